@@ -8,101 +8,161 @@
 
 #include "Globals.h"
 #include "Allocation.h"
+#include <unordered_map>
 
 
 
 
 
-Allocation::Allocation():
-	m_AllocationSize(0),
-	m_Type(atUnknown)
+/** Parents with fewer base children than this are matched by matchChildren() using a linear scan,
+rather than by building a map. */
+static const size_t MIN_MAPPED_CHILDREN = 16;
+
+
+
+
+
+Allocation Allocation::getParent() const
 {
+	auto parent = node().m_Parent;
+	if (parent == AllocationArena::NO_INDEX)
+	{
+		return Allocation();
+	}
+	return Allocation(m_Arena, parent);
 }
 
 
 
 
 
-Allocation::Allocation(AllocationWeakPtr a_Parent):
-	m_Parent(a_Parent),
-	m_AllocationSize(0),
-	m_Type(atUnknown)
+void Allocation::shareSubtree(const Allocation & a_Src) const
 {
+	setAllocationSize(a_Src.getAllocationSize());
+	setType(a_Src.getType());
+	m_Arena->linkChildren(m_Index, *a_Src.m_Arena, a_Src.m_Index);
 }
 
 
 
 
-AllocationPtr Allocation::addChild()
+
+Allocation::Children Allocation::getChildren() const
 {
-	auto res = std::make_shared<Allocation>(shared_from_this());
-	m_Children.push_back(res);
-	return res;
+	auto target = m_Arena->resolveLink(m_Index);
+	return Children(target.first, target.first->node(target.second).m_FirstChild);
 }
 
 
 
 
-AllocationPtr Allocation::getParent()
+
+size_t Allocation::getNumChildren() const
 {
-	return m_Parent.lock();
+	size_t res = 0;
+	auto target = m_Arena->resolveLink(m_Index);
+	auto arena = target.first;
+	for (auto ch = arena->node(target.second).m_FirstChild; ch != AllocationArena::NO_INDEX; ch = arena->node(ch).m_NextSibling)
+	{
+		res += 1;
+	}
+	return res;
 }
 
 
 
 
 
-void Allocation::sortBySize()
+std::vector<size_t> Allocation::matchChildren(const Allocation & a_Base, std::vector<Allocation> & a_BaseChildren) const
 {
-	// Sort the immediate children:
-	std::sort(m_Children.begin(), m_Children.end(), [](AllocationPtr & a_First, AllocationPtr & a_Second)
+	a_BaseChildren.clear();
+	if (a_Base.isValid())
+	{
+		for (const auto & ch: a_Base.getChildren())
 		{
-			return (a_First->m_AllocationSize > a_Second->m_AllocationSize);
+			a_BaseChildren.push_back(ch);
 		}
-	);
+	}
+	auto numBaseChildren = a_BaseChildren.size();
+	std::vector<size_t> res;
+	if (numBaseChildren < MIN_MAPPED_CHILDREN)
+	{
+		// Few base children, scan them for the first unused one with the same CodeLocation:
+		std::vector<bool> isBaseChildUsed(numBaseChildren, false);
+		for (const auto & ch: getChildren())
+		{
+			auto cl = ch.getCodeLocation().get();
+			auto match = numBaseChildren;
+			for (size_t i = 0; i < numBaseChildren; ++i)
+			{
+				if (!isBaseChildUsed[i] && (a_BaseChildren[i].getCodeLocation().get() == cl))
+				{
+					match = i;
+					isBaseChildUsed[i] = true;
+					break;
+				}
+			}
+			res.push_back(match);
+		}
+		return res;
+	}
 
-	// Recursively sort grandchildren:
-	for (auto & a: m_Children)
+	// Many base children, map them by their CodeLocation.
+	// Store the positions in reverse, so that the first unused position is always at the back:
+	std::unordered_map<const CodeLocation *, std::vector<size_t>> baseChildPositions;
+	for (auto i = numBaseChildren; i > 0;)
 	{
-		a->sortBySize();
+		--i;
+		baseChildPositions[a_BaseChildren[i].getCodeLocation().get()].push_back(i);
 	}
+	for (const auto & ch: getChildren())
+	{
+		auto match = numBaseChildren;
+		auto itr = baseChildPositions.find(ch.getCodeLocation().get());
+		if ((itr != baseChildPositions.end()) && !itr->second.empty())
+		{
+			match = itr->second.back();
+			itr->second.pop_back();
+		}
+		res.push_back(match);
+	}
+	return res;
 }
 
 
 
 
 
-AllocationPtr Allocation::findCodeLocationChild(CodeLocation * a_CodeLocation)
+Allocation Allocation::findCodeLocationChild(CodeLocation * a_CodeLocation) const
 {
-	for (const auto & ch: m_Children)
+	auto target = m_Arena->resolveLink(m_Index);
+	auto ch = target.first->findCodeLocationChild(target.second, a_CodeLocation);
+	if (ch == AllocationArena::NO_INDEX)
 	{
-		if (ch->getCodeLocation().get() == a_CodeLocation)
-		{
-			return ch;
-		}
+		return Allocation();
 	}
-	return nullptr;
+	return Allocation(target.first, ch);
 }
 
 
 
 
 
-AllocationPtr Allocation::recursiveFindCodeLocationChild(CodeLocation * a_CodeLocation)
+Allocation Allocation::recursiveFindCodeLocationChild(CodeLocation * a_CodeLocation) const
 {
-	if (m_CodeLocation.get() == a_CodeLocation)
+	if (getCodeLocation().get() == a_CodeLocation)
 	{
-		return shared_from_this();
+		return *this;
 	}
-	for (const auto & ch: m_Children)
+	for (const auto & ch: getChildren())
 	{
-		auto res = ch->recursiveFindCodeLocationChild(a_CodeLocation);
-		if (res != nullptr)
+		auto res = ch.recursiveFindCodeLocationChild(a_CodeLocation);
+		if (res.isValid())
 		{
 			return res;
 		}
 	}
-	return nullptr;
+	return Allocation();
 }
 
 
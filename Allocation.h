@@ -9,28 +9,22 @@
 
 
 
-#include <memory>
 #include <vector>
 #include <QString>
 #include "CodeLocation.h"
+#include "AllocationArena.h"
 
 
 
 
 
-// fwd:
-class Allocation;
-typedef std::shared_ptr<Allocation> AllocationPtr;
-typedef std::weak_ptr  <Allocation> AllocationWeakPtr;
-typedef std::vector<AllocationPtr> AllocationPtrs;
-
-
-
-
-
-/** Contains a single allocation point. */
-class Allocation:
-	public std::enable_shared_from_this<Allocation>
+/** A lightweight handle to a single allocation point, stored in a snapshot's AllocationArena.
+The handle is a plain value (arena pointer + node index), it is cheap to copy and doesn't keep the arena alive;
+it is only valid as long as the Snapshot owning the arena is alive.
+The descendants of a node sharing its subtree with another snapshot (AllocationArena::linkChildren()) are stored in
+the other snapshot's arena; the handles to them point there, and the snapshot's arena keeps that arena alive.
+A default-constructed handle is invalid, it represents "no allocation". */
+class Allocation
 {
 public:
 	enum Type
@@ -41,64 +35,124 @@ public:
 		atUnknown,         ///< Unknown entry, hasn't been filled yet (default type)
 	};
 
-	/** Creates a new instance that has no parent set. */
-	Allocation();
 
-	/** Creates a new instance that is attached to the specified parent. */
-	Allocation(AllocationWeakPtr a_Parent);
+	/** A range of the immediate children of an allocation, usable in the range-based for loop. */
+	class Children
+	{
+	public:
+		class iterator
+		{
+		public:
+			iterator(AllocationArena * a_Arena, quint32 a_Index): m_Arena(a_Arena), m_Index(a_Index) {}
+			Allocation operator *() const { return Allocation(m_Arena, m_Index); }
+			iterator & operator ++() { m_Index = m_Arena->node(m_Index).m_NextSibling; return *this; }
+			bool operator ==(const iterator & a_Other) const { return (m_Index == a_Other.m_Index); }
+			bool operator !=(const iterator & a_Other) const { return (m_Index != a_Other.m_Index); }
+
+		protected:
+			AllocationArena * m_Arena;
+			quint32 m_Index;
+		};
+
+		Children(AllocationArena * a_Arena, quint32 a_FirstChild): m_Arena(a_Arena), m_FirstChild(a_FirstChild) {}
+		iterator begin() const { return iterator(m_Arena, m_FirstChild); }
+		iterator end() const { return iterator(m_Arena, AllocationArena::NO_INDEX); }
+		bool empty() const { return (m_FirstChild == AllocationArena::NO_INDEX); }
+
+	protected:
+		AllocationArena * m_Arena;
+		quint32 m_FirstChild;
+	};
+
+
+	/** Creates an invalid handle, representing no allocation. */
+	Allocation(): m_Arena(nullptr), m_Index(AllocationArena::NO_INDEX) {}
+
+	/** Creates a handle to the specified node in the specified arena. */
+	Allocation(AllocationArena * a_Arena, quint32 a_Index): m_Arena(a_Arena), m_Index(a_Index) {}
 
-	/** Creates a new Allocation instance that is a child of this instance. */
-	AllocationPtr addChild();
+	/** Returns true if the handle points to an allocation. */
+	bool isValid() const { return (m_Arena != nullptr); }
 
-	/** Returns the parent Allocation of this instance.
-	Returns nullptr if this is the top-level instance. */
-	AllocationPtr getParent();
+	bool operator ==(const Allocation & a_Other) const { return ((m_Arena == a_Other.m_Arena) && (m_Index == a_Other.m_Index)); }
+	bool operator !=(const Allocation & a_Other) const { return !(*this == a_Other); }
 
-	void setAllocationSize(quint64 a_AllocationSize) { m_AllocationSize = a_AllocationSize; }
-	void setCodeLocation(CodeLocationPtr a_CodeLocation) { m_CodeLocation = a_CodeLocation; }
-	void setType(Type a_Type) { m_Type = a_Type; }
+	/** Returns the index of the node within its arena.
+	Unique only together with the arena, a snapshot's tree may span multiple arenas through the shared subtrees. */
+	quint32 getIndex() const { return m_Index; }
 
-	quint64         getAllocationSize() const { return m_AllocationSize; }
-	quint64         getAddress()        const { return m_CodeLocation->getAddress(); }
-	const QString & getFunctionName()   const { return m_CodeLocation->getFunctionName(); }
-	const QString & getFileName()       const { return m_CodeLocation->getFileName(); }
-	quint32         getFileLineNum()    const { return m_CodeLocation->getFileLineNum(); }
-	Type            getType()           const { return m_Type; }
-	CodeLocationPtr getCodeLocation()   const { return m_CodeLocation; }
+	/** Returns the arena in which the node is stored. */
+	AllocationArena * getArena() const { return m_Arena; }
+
+	/** Creates a new Allocation that is a child of this instance.
+	Children are kept in the order in which they are added. */
+	Allocation addChild() const { return Allocation(m_Arena, m_Arena->addChild(m_Index)); }
+
+	/** Returns the parent Allocation of this instance, within the same arena.
+	Returns an invalid handle if this is the top-level instance.
+	Meant for the tree being built, a node in a shared subtree only knows its parent in the arena it is stored in. */
+	Allocation getParent() const;
+
+	/** Makes this allocation the same as a_Src: copies the size and type, and shares all the descendants of a_Src
+	instead of copying them. The CodeLocation is expected to be set already.
+	a_Src needs to be in a finished arena, this allocation in an arena still being built, without any children. */
+	void shareSubtree(const Allocation & a_Src) const;
+
+	void setAllocationSize(quint64 a_AllocationSize) const { node().m_AllocationSize = a_AllocationSize; }
+	void setCodeLocation(const CodeLocationPtr & a_CodeLocation) const { node().m_CodeLocation = m_Arena->getCodeLocationIndex(a_CodeLocation); }
+	void setType(Type a_Type) const { node().m_Type = static_cast<quint8>(a_Type); }
+
+	quint64                 getAllocationSize() const { return node().m_AllocationSize; }
+	quint64                 getAddress()        const { return getCodeLocation()->getAddress(); }
+	const QString &         getFunctionName()   const { return getCodeLocation()->getFunctionName(); }
+	const QString &         getFileName()       const { return getCodeLocation()->getFileName(); }
+	quint32                 getFileLineNum()    const { return getCodeLocation()->getFileLineNum(); }
+	Type                    getType()           const { return static_cast<Type>(node().m_Type); }
+	const CodeLocationPtr & getCodeLocation()   const { return m_Arena->getCodeLocation(node().m_CodeLocation); }
+
+	/** Returns the hash of the whole subtree, see AllocationArena::Node::m_SubtreeHash.
+	Only valid once the arena is finished. */
+	quint64 getSubtreeHash() const { return node().m_SubtreeHash; }
 
 	/** Returns true if the allocation has any children. */
-	bool hasChildren() const { return m_Children.empty(); }
+	bool hasChildren() const { return (node().m_FirstChild != AllocationArena::NO_INDEX); }
+
+	/** Returns the immediate children, ordered by size after sortBySize(), otherwise in the order they were added. */
+	Children getChildren() const;
 
-	const AllocationPtrs & getChildren() const { return m_Children; }
+	/** Returns the number of immediate children. */
+	size_t getNumChildren() const;
+
+	/** Matches the immediate children of this allocation to the immediate children of a_Base by their CodeLocations.
+	Multiple children with the same CodeLocation are matched in their order: the n-th such child of this allocation
+	to the n-th such child of a_Base. a_Base may be invalid, then nothing is matched.
+	Fills a_BaseChildren with the children of a_Base. Returns, for each child of this allocation in its order,
+	the position of the matching child in a_BaseChildren, or a_BaseChildren.size() if there's no match. */
+	std::vector<size_t> matchChildren(const Allocation & a_Base, std::vector<Allocation> & a_BaseChildren) const;
 
 	/** Sorts the children (recursively) by their AllocationSize. */
-	void sortBySize();
+	void sortBySize() const { m_Arena->sortBySize(m_Index); }
 
 	/** Returns the immediate child that has the specified CodeLocation.
-	Returns nullptr if no such child. */
-	AllocationPtr findCodeLocationChild(CodeLocation * a_CodeLocation);
+	Uses the arena's child index, if built (AllocationArena::buildChildIndex()), otherwise scans the children.
+	Returns an invalid handle if no such child. */
+	Allocation findCodeLocationChild(CodeLocation * a_CodeLocation) const;
 
 	/** Returns the child (any depth descendant) that has the specified CodeLocation.
-	Returns nullptr if no such child. */
-	AllocationPtr recursiveFindCodeLocationChild(CodeLocation * a_CodeLocation);
+	Returns an invalid handle if no such child. */
+	Allocation recursiveFindCodeLocationChild(CodeLocation * a_CodeLocation) const;
 
 protected:
 
-	/** The parent allocation, if any. */
-	AllocationWeakPtr m_Parent;
-
-	/** Number of bytes of allocated memory. */
-	quint64 m_AllocationSize;
+	/** The arena in which the node is stored, nullptr for an invalid handle. */
+	AllocationArena * m_Arena;
 
-	/** Stack entry code location of where the allocation was created.
-	May be nullptr for unknown locations. */
-	CodeLocationPtr m_CodeLocation;
+	/** The index of the node in m_Arena. */
+	quint32 m_Index;
 
-	/** Type of the entry - root, regular, belowthreshold, unknown. */
-	Type m_Type;
 
-	/** Child allocations - where from has this location been called. */
-	AllocationPtrs m_Children;
+	/** Returns the node this handle points to. */
+	AllocationArena::Node & node() const { return m_Arena->node(m_Index); }
 };
 
 
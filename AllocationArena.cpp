@@ -0,0 +1,432 @@
+// AllocationArena.cpp
+
+// Implements the AllocationArena class representing the contiguous storage for a single snapshot's Allocation tree
+
+
+
+
+
+#include "Globals.h"
+#include "AllocationArena.h"
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <assert.h>
+#include "CodeLocation.h"
+#include "Allocation.h"
+
+
+
+
+
+const quint32 AllocationArena::NO_INDEX;
+
+/** Nodes with fewer children than this are not indexed by buildChildIndex(), the linear scan is fast enough for them. */
+static const size_t MIN_INDEXED_CHILDREN = 16;
+
+
+
+
+
+/** Mixes the bits of the value, so that the combined mixed values make a good hash (splitmix64 finalizer). */
+static quint64 mixHash(quint64 a_Value)
+{
+	a_Value ^= a_Value >> 30;
+	a_Value *= 0xbf58476d1ce4e5b9ull;
+	a_Value ^= a_Value >> 27;
+	a_Value *= 0x94d049bb133111ebull;
+	a_Value ^= a_Value >> 31;
+	return a_Value;
+}
+
+
+
+
+
+AllocationArena::AllocationArena():
+	m_IsFinished(false)
+{
+	Node root;
+	root.m_AllocationSize = 0;
+	root.m_SubtreeHash = 0;
+	root.m_Parent = NO_INDEX;
+	root.m_FirstChild = NO_INDEX;
+	root.m_NextSibling = NO_INDEX;
+	root.m_CodeLocation = NO_INDEX;
+	root.m_LinkedArena = NO_INDEX;
+	root.m_Type = static_cast<quint8>(Allocation::atUnknown);
+	m_Nodes.push_back(root);
+	m_LastChild.push_back(NO_INDEX);
+}
+
+
+
+
+
+quint32 AllocationArena::addChild(quint32 a_Parent)
+{
+	assert(!m_IsFinished);
+	assert(a_Parent < m_Nodes.size());
+	assert(!isLinked(a_Parent));  // The children of a linked node live in another arena
+
+	auto idx = static_cast<quint32>(m_Nodes.size());
+	Node child;
+	child.m_AllocationSize = 0;
+	child.m_SubtreeHash = 0;
+	child.m_Parent = a_Parent;
+	child.m_FirstChild = NO_INDEX;
+	child.m_NextSibling = NO_INDEX;
+	child.m_CodeLocation = NO_INDEX;
+	child.m_LinkedArena = NO_INDEX;
+	child.m_Type = static_cast<quint8>(Allocation::atUnknown);
+	m_Nodes.push_back(child);
+	m_LastChild.push_back(NO_INDEX);
+
+	// Link the new node at the end of the parent's children list:
+	auto lastSibling = m_LastChild[a_Parent];
+	if (lastSibling == NO_INDEX)
+	{
+		m_Nodes[a_Parent].m_FirstChild = idx;
+	}
+	else
+	{
+		m_Nodes[lastSibling].m_NextSibling = idx;
+	}
+	m_LastChild[a_Parent] = idx;
+	return idx;
+}
+
+
+
+
+
+const CodeLocationPtr & AllocationArena::getCodeLocation(quint32 a_CodeLocationIndex) const
+{
+	static const CodeLocationPtr noCodeLocation;
+	if (a_CodeLocationIndex == NO_INDEX)
+	{
+		return noCodeLocation;
+	}
+	return m_CodeLocations[a_CodeLocationIndex];
+}
+
+
+
+
+
+quint32 AllocationArena::getCodeLocationIndex(const CodeLocationPtr & a_CodeLocation)
+{
+	if (a_CodeLocation == nullptr)
+	{
+		return NO_INDEX;
+	}
+	assert(!m_IsFinished);
+	auto itr = m_CodeLocationIndices.find(a_CodeLocation.get());
+	if (itr != m_CodeLocationIndices.end())
+	{
+		return itr->second;
+	}
+	auto idx = static_cast<quint32>(m_CodeLocations.size());
+	m_CodeLocations.push_back(a_CodeLocation);
+	m_CodeLocationIndices[a_CodeLocation.get()] = idx;
+	return idx;
+}
+
+
+
+
+
+void AllocationArena::linkChildren(quint32 a_Index, AllocationArena & a_Target, quint32 a_TargetIndex)
+{
+	assert(!m_IsFinished);
+	assert(a_Target.m_IsFinished);
+	assert(m_Nodes[a_Index].m_FirstChild == NO_INDEX);
+
+	auto target = a_Target.resolveLink(a_TargetIndex);
+	if (target.first->m_Nodes[target.second].m_FirstChild == NO_INDEX)
+	{
+		// No children to share
+		return;
+	}
+
+	// Add the target arena to the table, unless already there:
+	quint32 linkedArena;
+	auto itr = m_LinkedArenaIndices.find(target.first);
+	if (itr != m_LinkedArenaIndices.end())
+	{
+		linkedArena = itr->second;
+	}
+	else
+	{
+		linkedArena = static_cast<quint32>(m_LinkedArenas.size());
+		m_LinkedArenas.push_back(target.first->shared_from_this());
+		m_LinkedArenaIndices[target.first] = linkedArena;
+	}
+
+	auto & n = m_Nodes[a_Index];
+	n.m_FirstChild = target.second;
+	n.m_LinkedArena = linkedArena;
+}
+
+
+
+
+
+std::pair<AllocationArena *, quint32> AllocationArena::resolveLink(quint32 a_Index)
+{
+	const auto & n = m_Nodes[a_Index];
+	if (n.m_LinkedArena == NO_INDEX)
+	{
+		return std::make_pair(this, a_Index);
+	}
+	return std::make_pair(m_LinkedArenas[n.m_LinkedArena].get(), n.m_FirstChild);
+}
+
+
+
+
+
+std::pair<const AllocationArena *, quint32> AllocationArena::resolveLink(quint32 a_Index) const
+{
+	const auto & n = m_Nodes[a_Index];
+	if (n.m_LinkedArena == NO_INDEX)
+	{
+		return std::make_pair(this, a_Index);
+	}
+	return std::make_pair(m_LinkedArenas[n.m_LinkedArena].get(), n.m_FirstChild);
+}
+
+
+
+
+
+void AllocationArena::sortBySize(quint32 a_Index)
+{
+	assert(!m_IsFinished);  // The subtree hashes depend on the children order
+
+	// Walk the subtree using an explicit stack, deep trees would overflow the call stack:
+	std::vector<quint32> toProcess;
+	std::vector<quint32> children;
+	toProcess.push_back(a_Index);
+	while (!toProcess.empty())
+	{
+		auto idx = toProcess.back();
+		toProcess.pop_back();
+		if (isLinked(idx))
+		{
+			// The shared children are already sorted in their own arena
+			continue;
+		}
+
+		// Collect the immediate children:
+		children.clear();
+		for (auto ch = m_Nodes[idx].m_FirstChild; ch != NO_INDEX; ch = m_Nodes[ch].m_NextSibling)
+		{
+			children.push_back(ch);
+		}
+		if (children.empty())
+		{
+			continue;
+		}
+
+		// Sort and relink them:
+		std::stable_sort(children.begin(), children.end(), [this](quint32 a_First, quint32 a_Second)
+			{
+				return (m_Nodes[a_First].m_AllocationSize > m_Nodes[a_Second].m_AllocationSize);
+			}
+		);
+		m_Nodes[idx].m_FirstChild = children.front();
+		auto numChildren = children.size();
+		for (size_t i = 1; i < numChildren; ++i)
+		{
+			m_Nodes[children[i - 1]].m_NextSibling = children[i];
+		}
+		m_Nodes[children.back()].m_NextSibling = NO_INDEX;
+		if (!m_LastChild.empty())
+		{
+			m_LastChild[idx] = children.back();
+		}
+
+		// Process the grandchildren later:
+		toProcess.insert(toProcess.end(), children.begin(), children.end());
+	}
+}
+
+
+
+
+
+void AllocationArena::finishBuilding()
+{
+	m_IsFinished = true;
+	std::vector<quint32>().swap(m_LastChild);
+	std::unordered_map<CodeLocation *, quint32>().swap(m_CodeLocationIndices);
+	std::unordered_map<const AllocationArena *, quint32>().swap(m_LinkedArenaIndices);
+	m_Nodes.shrink_to_fit();
+	m_CodeLocations.shrink_to_fit();
+	m_LinkedArenas.shrink_to_fit();
+
+	// Calculate the subtree hashes bottom-up. Children are always added after their parent, so walking the nodes
+	// from the back processes all children before their parent; the linked arenas are already finished:
+	for (auto idx = static_cast<quint32>(m_Nodes.size()); idx > 0;)
+	{
+		--idx;
+		auto & n = m_Nodes[idx];
+		auto codeLocation = reinterpret_cast<quintptr>(getCodeLocation(n.m_CodeLocation).get());
+		auto h = mixHash(static_cast<quint64>(codeLocation) ^ (static_cast<quint64>(n.m_Type) << 56));
+		h = mixHash(h + n.m_AllocationSize);
+		auto target = resolveLink(idx);
+		const auto & targetNodes = target.first->m_Nodes;
+		for (auto ch = targetNodes[target.second].m_FirstChild; ch != NO_INDEX; ch = targetNodes[ch].m_NextSibling)
+		{
+			h = mixHash(h + targetNodes[ch].m_SubtreeHash);
+		}
+		n.m_SubtreeHash = h;
+	}
+}
+
+
+
+
+
+void AllocationArena::buildChildIndex()
+{
+	m_ChildIndexEntries.clear();
+	m_ChildIndex.clear();
+	auto numNodes = static_cast<quint32>(m_Nodes.size());
+	for (quint32 idx = 0; idx < numNodes; ++idx)
+	{
+		auto firstChild = m_Nodes[idx].m_FirstChild;
+		if ((firstChild == NO_INDEX) || isLinked(idx))
+		{
+			continue;
+		}
+		auto start = m_ChildIndexEntries.size();
+		for (auto ch = firstChild; ch != NO_INDEX; ch = m_Nodes[ch].m_NextSibling)
+		{
+			ChildIndexEntry entry;
+			entry.m_CodeLocation = getCodeLocation(m_Nodes[ch].m_CodeLocation).get();
+			entry.m_Child = ch;
+			m_ChildIndexEntries.push_back(entry);
+		}
+		auto count = m_ChildIndexEntries.size() - start;
+		if (count < MIN_INDEXED_CHILDREN)
+		{
+			// Not worth indexing, remove the entries again:
+			m_ChildIndexEntries.resize(start);
+			continue;
+		}
+
+		// Stable sort keeps the sibling order among children with the same code location,
+		// so that the lookup returns the same child as the linear scan would:
+		std::stable_sort(m_ChildIndexEntries.begin() + start, m_ChildIndexEntries.end(),
+			[](const ChildIndexEntry & a_First, const ChildIndexEntry & a_Second)
+			{
+				return std::less<const CodeLocation *>()(a_First.m_CodeLocation, a_Second.m_CodeLocation);
+			}
+		);
+		m_ChildIndex[idx] = std::make_pair(static_cast<quint32>(start), static_cast<quint32>(count));
+	}
+	m_ChildIndexEntries.shrink_to_fit();
+}
+
+
+
+
+
+bool AllocationArena::isSameSubtree(quint32 a_Index, const AllocationArena & a_Other, quint32 a_OtherIndex) const
+{
+	assert(m_IsFinished);
+	assert(a_Other.m_IsFinished);
+
+	// Walk both subtrees in parallel using an explicit stack, deep trees would overflow the call stack.
+	// The subtrees may span multiple arenas through the linked nodes, so each entry carries its arenas:
+	typedef std::tuple<const AllocationArena *, quint32, const AllocationArena *, quint32> Entry;
+	std::vector<Entry> toCompare;
+	toCompare.emplace_back(this, a_Index, &a_Other, a_OtherIndex);
+	while (!toCompare.empty())
+	{
+		const AllocationArena * arena1;
+		const AllocationArena * arena2;
+		quint32 idx1, idx2;
+		std::tie(arena1, idx1, arena2, idx2) = toCompare.back();
+		toCompare.pop_back();
+		const auto & n1 = arena1->m_Nodes[idx1];
+		const auto & n2 = arena2->m_Nodes[idx2];
+		if (
+			(n1.m_SubtreeHash != n2.m_SubtreeHash) ||
+			(n1.m_AllocationSize != n2.m_AllocationSize) ||
+			(n1.m_Type != n2.m_Type) ||
+			(arena1->getCodeLocation(n1.m_CodeLocation) != arena2->getCodeLocation(n2.m_CodeLocation))
+		)
+		{
+			return false;
+		}
+
+		// Compare the children, unless both nodes share the very same ones:
+		auto target1 = arena1->resolveLink(idx1);
+		auto target2 = arena2->resolveLink(idx2);
+		if (target1 == target2)
+		{
+			continue;
+		}
+		const auto & nodes1 = target1.first->m_Nodes;
+		const auto & nodes2 = target2.first->m_Nodes;
+		auto ch1 = nodes1[target1.second].m_FirstChild;
+		auto ch2 = nodes2[target2.second].m_FirstChild;
+		while ((ch1 != NO_INDEX) && (ch2 != NO_INDEX))
+		{
+			toCompare.emplace_back(target1.first, ch1, target2.first, ch2);
+			ch1 = nodes1[ch1].m_NextSibling;
+			ch2 = nodes2[ch2].m_NextSibling;
+		}
+		if ((ch1 != NO_INDEX) || (ch2 != NO_INDEX))
+		{
+			// Different number of children
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+
+
+quint32 AllocationArena::findCodeLocationChild(quint32 a_Parent, const CodeLocation * a_CodeLocation) const
+{
+	assert(!isLinked(a_Parent));
+
+	// Use the index, if the node has one:
+	auto itr = m_ChildIndex.find(a_Parent);
+	if (itr != m_ChildIndex.end())
+	{
+		auto begin = m_ChildIndexEntries.begin() + itr->second.first;
+		auto end = begin + itr->second.second;
+		auto entry = std::lower_bound(begin, end, a_CodeLocation,
+			[](const ChildIndexEntry & a_Entry, const CodeLocation * a_Value)
+			{
+				return std::less<const CodeLocation *>()(a_Entry.m_CodeLocation, a_Value);
+			}
+		);
+		if ((entry == end) || (entry->m_CodeLocation != a_CodeLocation))
+		{
+			return NO_INDEX;
+		}
+		return entry->m_Child;
+	}
+
+	// No index, scan the children:
+	for (auto ch = m_Nodes[a_Parent].m_FirstChild; ch != NO_INDEX; ch = m_Nodes[ch].m_NextSibling)
+	{
+		if (getCodeLocation(m_Nodes[ch].m_CodeLocation).get() == a_CodeLocation)
+		{
+			return ch;
+		}
+	}
+	return NO_INDEX;
+}
+
+
+
+
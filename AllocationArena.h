@@ -0,0 +1,199 @@
+// AllocationArena.h
+
+// Declares the AllocationArena class representing the contiguous storage for a single snapshot's Allocation tree
+
+
+
+
+
+#ifndef ALLOCATIONARENA_H
+#define ALLOCATIONARENA_H
+
+
+
+
+
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <Qt>
+
+
+
+
+
+// fwd:
+class CodeLocation;
+typedef std::shared_ptr<CodeLocation> CodeLocationPtr;
+class AllocationArena;
+typedef std::shared_ptr<AllocationArena> AllocationArenaPtr;
+
+
+
+
+
+/** Stores all the Allocation nodes of a single snapshot's tree in one contiguous array.
+The nodes reference each other using 32-bit indices into the array, rather than pointers, and the code locations
+are stored as indices into a per-arena table, so that each node is small and there's no refcounting involved
+when walking the tree.
+The tree is built by the parser / loader by adding children in their final order, then finishBuilding() is called
+to release the helper structures needed only while building. Use the Allocation class as the handle to the nodes.
+A node may share its whole subtree with a node in another (finished) arena, instead of having its own children;
+such a "linked" node keeps its own size, code location and type, but its children are the other node's children,
+living in the other arena. This lets consecutive snapshots keep only a single copy of their unchanged subtrees.
+The arena keeps the arenas it links to alive. Arenas are expected to be created using std::make_shared. */
+class AllocationArena:
+	public std::enable_shared_from_this<AllocationArena>
+{
+public:
+
+	/** The index value representing "no node" / "no code location". */
+	static const quint32 NO_INDEX = 0xffffffffu;
+
+
+	/** A single node of the tree. */
+	struct Node
+	{
+		/** Number of bytes of allocated memory. */
+		quint64 m_AllocationSize;
+
+		/** The hash of the whole subtree (code locations, sizes and types of all its nodes, in the children order).
+		Calculated by finishBuilding(). */
+		quint64 m_SubtreeHash;
+
+		/** Index of the parent node, NO_INDEX for the root. */
+		quint32 m_Parent;
+
+		/** Index of the first child node, NO_INDEX if there are no children.
+		For a linked node, the index of the node in the linked arena whose children this node shares. */
+		quint32 m_FirstChild;
+
+		/** Index of the next sibling node, NO_INDEX if this is the last child of its parent. */
+		quint32 m_NextSibling;
+
+		/** Index of the code location in m_CodeLocations, NO_INDEX if unknown. */
+		quint32 m_CodeLocation;
+
+		/** Index of the arena in m_LinkedArenas holding the children of this node, NO_INDEX if they are in this arena. */
+		quint32 m_LinkedArena;
+
+		/** Type of the entry, the Allocation::Type value. */
+		quint8 m_Type;
+	};
+
+
+	/** Creates a new arena with a single root node in it. */
+	AllocationArena();
+
+	/** Returns the node at the specified index. */
+	Node & node(quint32 a_Index) { return m_Nodes[a_Index]; }
+	const Node & node(quint32 a_Index) const { return m_Nodes[a_Index]; }
+
+	/** Returns the number of nodes in the arena. */
+	size_t getNumNodes() const { return m_Nodes.size(); }
+
+	/** Adds a new node as the last child of the specified parent node.
+	Returns the index of the new node.
+	Can only be used before finishBuilding() is called. */
+	quint32 addChild(quint32 a_Parent);
+
+	/** Returns the code location stored at the specified index in the table.
+	Returns a nullptr CodeLocationPtr for NO_INDEX. */
+	const CodeLocationPtr & getCodeLocation(quint32 a_CodeLocationIndex) const;
+
+	/** Returns the index of the specified code location in the table, adding it if not present yet.
+	Returns NO_INDEX for a nullptr code location.
+	Can only be used before finishBuilding() is called. */
+	quint32 getCodeLocationIndex(const CodeLocationPtr & a_CodeLocation);
+
+	/** Makes the specified node share the children of the node a_TargetIndex in a_Target, instead of having its own.
+	The node must not have any children yet. The target arena must be finished, it is kept alive by this arena.
+	If the target node is linked itself, the link is followed, so that the children are always found in a single step.
+	Does nothing if the target node has no children.
+	Can only be used before finishBuilding() is called. */
+	void linkChildren(quint32 a_Index, AllocationArena & a_Target, quint32 a_TargetIndex);
+
+	/** Returns true if the specified node shares its children with a node in another arena. */
+	bool isLinked(quint32 a_Index) const { return (m_Nodes[a_Index].m_LinkedArena != NO_INDEX); }
+
+	/** Returns the arena and the index of the node whose children are the children of the specified node.
+	That is the node itself, unless it is linked to a node in another arena. */
+	std::pair<AllocationArena *, quint32> resolveLink(quint32 a_Index);
+	std::pair<const AllocationArena *, quint32> resolveLink(quint32 a_Index) const;
+
+	/** Sorts the children of the specified node and all its descendants by their allocation size, largest first.
+	Only relinks the sibling indices, the nodes stay in place, so the indices (and Allocation handles) remain valid.
+	The shared children of the linked nodes are left as they are.
+	Can only be used before finishBuilding() is called. */
+	void sortBySize(quint32 a_Index);
+
+	/** Releases the helper structures used only while building the tree, trims the storage and calculates
+	the subtree hashes. No more nodes or code locations can be added afterwards. */
+	void finishBuilding();
+
+	/** Builds the lookup index of children by their code location, for all nodes that have many children.
+	The linked nodes are not indexed here, their children are indexed in the arena they are linked to.
+	Optional, findCodeLocationChild() falls back to a linear scan for nodes that are not indexed. */
+	void buildChildIndex();
+
+	/** Returns the index of the first immediate child of the specified node that has the specified code location.
+	The node must not be linked, use resolveLink() first.
+	Returns NO_INDEX if there's no such child. */
+	quint32 findCodeLocationChild(quint32 a_Parent, const CodeLocation * a_CodeLocation) const;
+
+	/** Returns the hash of the subtree of the specified node, see Node::m_SubtreeHash.
+	Only valid once the arena is finished. */
+	quint64 getSubtreeHash(quint32 a_Index) const { return m_Nodes[a_Index].m_SubtreeHash; }
+
+	/** Returns true if the subtree at a_Index is the same as the subtree at a_OtherIndex in the other arena,
+	comparing the code locations, sizes and types of all the nodes, in the children order.
+	The subtree hashes are compared first, and the shared subtrees are recognized without walking them.
+	Both arenas need to be finished. */
+	bool isSameSubtree(quint32 a_Index, const AllocationArena & a_Other, quint32 a_OtherIndex) const;
+
+protected:
+
+	/** All the nodes of the tree. [0] is the root. */
+	std::vector<Node> m_Nodes;
+
+	/** The table of code locations referenced by the nodes' m_CodeLocation indices. */
+	std::vector<CodeLocationPtr> m_CodeLocations;
+
+	/** Map of CodeLocation -> index into m_CodeLocations, for de-duplicating the table while building. */
+	std::unordered_map<CodeLocation *, quint32> m_CodeLocationIndices;
+
+	/** The arenas holding the children of the linked nodes, referenced by the nodes' m_LinkedArena indices. */
+	std::vector<AllocationArenaPtr> m_LinkedArenas;
+
+	/** Map of AllocationArena -> index into m_LinkedArenas, for de-duplicating the table while building. */
+	std::unordered_map<const AllocationArena *, quint32> m_LinkedArenaIndices;
+
+	/** Index of the last child, for each node, so that children can be appended in O(1) while building.
+	Emptied by finishBuilding(). */
+	std::vector<quint32> m_LastChild;
+
+	/** A single entry in the child lookup index. */
+	struct ChildIndexEntry
+	{
+		const CodeLocation * m_CodeLocation;
+		quint32 m_Child;
+	};
+
+	/** The child lookup index entries of all indexed nodes, each node's entries sorted by m_CodeLocation.
+	Filled by buildChildIndex(). */
+	std::vector<ChildIndexEntry> m_ChildIndexEntries;
+
+	/** Map of node index -> (start, count) of the node's entries in m_ChildIndexEntries.
+	Only contains the nodes with enough children to be worth indexing. */
+	std::unordered_map<quint32, std::pair<quint32, quint32>> m_ChildIndex;
+
+	/** Set to true by finishBuilding(), used for checking that no more modifications are made. */
+	bool m_IsFinished;
+};
+
+
+
+
+
+#endif // ALLOCATIONARENA_H
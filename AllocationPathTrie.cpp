@@ -0,0 +1,196 @@
+// AllocationPathTrie.cpp
+
+// Implements the AllocationPathTrie class representing the merged allocation tree of all the project's snapshots
+
+
+
+
+
+#include "Globals.h"
+#include "AllocationPathTrie.h"
+#include "Snapshot.h"
+#include "Allocation.h"
+#include "AllocationPath.h"
+
+
+
+
+
+const quint32 AllocationPathTrie::NO_INDEX;
+
+
+
+
+
+AllocationPathTrie::AllocationPathTrie()
+{
+	Node root;
+	root.m_CodeLocation = nullptr;
+	root.m_LastSnapshotOrdinal = NO_INDEX;
+	m_Nodes.push_back(root);
+}
+
+
+
+
+
+void AllocationPathTrie::addSnapshot(const Snapshot & a_Snapshot)
+{
+	assert(m_SnapshotOrdinals.find(&a_Snapshot) == m_SnapshotOrdinals.end());  // Each snapshot can be added only once
+	auto ordinal = static_cast<quint32>(m_SnapshotOrdinals.size());
+	m_SnapshotOrdinals[&a_Snapshot] = ordinal;
+
+	// Hold the arena while walking the tree, it may be evicted from the snapshot meanwhile:
+	auto arena = a_Snapshot.getAllocationArena();
+	if (arena == nullptr)
+	{
+		return;
+	}
+	Allocation root(arena.get(), 0);
+
+	// Walk the snapshot's tree using an explicit stack, deep trees would overflow the call stack:
+	std::vector<std::pair<Allocation, quint32>> toProcess;
+	setSize(0, ordinal, root.getAllocationSize());
+	toProcess.emplace_back(root, 0);
+	while (!toProcess.empty())
+	{
+		auto allocation = toProcess.back().first;
+		auto trieNode = toProcess.back().second;
+		toProcess.pop_back();
+		for (const auto & ch: allocation.getChildren())
+		{
+			auto trieChild = getOrCreateChild(trieNode, ch.getCodeLocation().get());
+			if (setSize(trieChild, ordinal, ch.getAllocationSize()))
+			{
+				toProcess.emplace_back(ch, trieChild);
+			}
+		}
+	}
+}
+
+
+
+
+
+quint32 AllocationPathTrie::getSnapshotOrdinal(const Snapshot * a_Snapshot) const
+{
+	auto itr = m_SnapshotOrdinals.find(a_Snapshot);
+	if (itr == m_SnapshotOrdinals.end())
+	{
+		return NO_INDEX;
+	}
+	return itr->second;
+}
+
+
+
+
+
+quint32 AllocationPathTrie::findNode(const AllocationPath & a_Path) const
+{
+	quint32 res = getRoot();
+	for (const auto & seg: a_Path.getSegments())
+	{
+		res = findChild(res, seg);
+		if (res == NO_INDEX)
+		{
+			return NO_INDEX;
+		}
+	}
+	return res;
+}
+
+
+
+
+
+quint32 AllocationPathTrie::findChild(quint32 a_Parent, const CodeLocation * a_CodeLocation) const
+{
+	auto itr = m_ChildMap.find(std::make_pair(a_Parent, a_CodeLocation));
+	if (itr == m_ChildMap.end())
+	{
+		return NO_INDEX;
+	}
+	return itr->second;
+}
+
+
+
+
+
+quint64 AllocationPathTrie::getSize(quint32 a_Node, quint32 a_SnapshotOrdinal) const
+{
+	if ((a_Node == NO_INDEX) || (a_SnapshotOrdinal == NO_INDEX))
+	{
+		return 0;
+	}
+	const auto & sizes = m_Nodes[a_Node].m_Sizes;
+	if (a_SnapshotOrdinal >= sizes.size())
+	{
+		return 0;
+	}
+	return sizes[a_SnapshotOrdinal];
+}
+
+
+
+
+
+AllocationStats AllocationPathTrie::getStats(quint32 a_Node, const AllocationPath & a_Path) const
+{
+	AllocationStats stats(a_Path);
+	auto numSnapshots = static_cast<quint32>(m_SnapshotOrdinals.size());
+	for (quint32 ordinal = 0; ordinal < numSnapshots; ++ordinal)
+	{
+		stats.processNewValue(getSize(a_Node, ordinal));
+	}
+	stats.finishProcessing(numSnapshots);
+	return stats;
+}
+
+
+
+
+
+quint32 AllocationPathTrie::getOrCreateChild(quint32 a_Parent, CodeLocation * a_CodeLocation)
+{
+	auto key = std::make_pair(a_Parent, static_cast<const CodeLocation *>(a_CodeLocation));
+	auto itr = m_ChildMap.find(key);
+	if (itr != m_ChildMap.end())
+	{
+		return itr->second;
+	}
+	auto idx = static_cast<quint32>(m_Nodes.size());
+	Node child;
+	child.m_CodeLocation = a_CodeLocation;
+	child.m_LastSnapshotOrdinal = NO_INDEX;
+	m_Nodes.push_back(std::move(child));
+	m_Nodes[a_Parent].m_Children.push_back(idx);
+	m_ChildMap[key] = idx;
+	return idx;
+}
+
+
+
+
+
+bool AllocationPathTrie::setSize(quint32 a_Node, quint32 a_SnapshotOrdinal, quint64 a_Size)
+{
+	auto & node = m_Nodes[a_Node];
+	if (node.m_LastSnapshotOrdinal == a_SnapshotOrdinal)
+	{
+		// A sibling with the same CodeLocation has already been merged from this snapshot
+		return false;
+	}
+	node.m_LastSnapshotOrdinal = a_SnapshotOrdinal;
+	if (node.m_Sizes.size() <= a_SnapshotOrdinal)
+	{
+		node.m_Sizes.resize(a_SnapshotOrdinal + 1, 0);
+	}
+	node.m_Sizes[a_SnapshotOrdinal] = a_Size;
+	return true;
+}
+
+
+
+
@@ -0,0 +1,139 @@
+// AllocationPathTrie.h
+
+// Declares the AllocationPathTrie class representing the merged allocation tree of all the project's snapshots
+
+
+
+
+
+#ifndef ALLOCATIONPATHTRIE_H
+#define ALLOCATIONPATHTRIE_H
+
+
+
+
+
+#include <vector>
+#include <unordered_map>
+#include <Qt>
+#include "AllocationStats.h"
+
+
+
+
+
+// fwd:
+class CodeLocation;
+class Snapshot;
+class AllocationPath;
+
+
+
+
+
+/** The merged call tree of all the project's snapshots.
+Each AllocationPath present in any of the snapshots is a node in the trie. Each node keeps a column of its
+allocation sizes, indexed by the snapshot ordinal (the order in which the snapshots were added to the trie),
+so that the per-path queries across the whole project are direct array reads instead of a tree descent
+in each snapshot.
+The trie follows the Snapshot::findAllocation() semantics: if a node has multiple children with the same
+CodeLocation, only the first one is recorded. */
+class AllocationPathTrie
+{
+public:
+
+	/** The index value representing "no node". */
+	static const quint32 NO_INDEX = 0xffffffffu;
+
+
+	/** Creates a new trie containing only the root node and no snapshots. */
+	AllocationPathTrie();
+
+	/** Merges the allocation tree of the specified snapshot into the trie, under a new snapshot ordinal. */
+	void addSnapshot(const Snapshot & a_Snapshot);
+
+	/** Returns the number of snapshots added to the trie. */
+	size_t getNumSnapshots() const { return m_SnapshotOrdinals.size(); }
+
+	/** Returns the ordinal assigned to the specified snapshot, or NO_INDEX if the snapshot wasn't added. */
+	quint32 getSnapshotOrdinal(const Snapshot * a_Snapshot) const;
+
+	/** Returns the index of the root node. */
+	quint32 getRoot() const { return 0; }
+
+	/** Returns the index of the node representing the specified path, or NO_INDEX if no snapshot contains the path. */
+	quint32 findNode(const AllocationPath & a_Path) const;
+
+	/** Returns the index of the specified node's child with the specified CodeLocation, or NO_INDEX if there's none. */
+	quint32 findChild(quint32 a_Parent, const CodeLocation * a_CodeLocation) const;
+
+	/** Returns the indices of the immediate children of the specified node. */
+	const std::vector<quint32> & getChildren(quint32 a_Node) const { return m_Nodes[a_Node].m_Children; }
+
+	/** Returns the CodeLocation of the specified node (nullptr for the root). */
+	CodeLocation * getCodeLocation(quint32 a_Node) const { return m_Nodes[a_Node].m_CodeLocation; }
+
+	/** Returns the allocation size of the specified node in the snapshot with the specified ordinal.
+	Returns 0 if the snapshot doesn't contain the node's path. */
+	quint64 getSize(quint32 a_Node, quint32 a_SnapshotOrdinal) const;
+
+	/** Returns the stats of the specified node across all the snapshots in the trie. */
+	AllocationStats getStats(quint32 a_Node, const AllocationPath & a_Path) const;
+
+protected:
+
+	/** A single node of the trie. */
+	struct Node
+	{
+		/** The CodeLocation of the path's last segment, nullptr for the root. */
+		CodeLocation * m_CodeLocation;
+
+		/** Indices of the immediate children, in the order in which they were first seen. */
+		std::vector<quint32> m_Children;
+
+		/** The allocation sizes, indexed by the snapshot ordinal.
+		Only grown when written, the missing values at the end are zero. */
+		std::vector<quint64> m_Sizes;
+
+		/** The ordinal of the last snapshot that has written m_Sizes.
+		Used to skip the duplicate CodeLocation siblings while merging a snapshot. */
+		quint32 m_LastSnapshotOrdinal;
+	};
+
+	/** Hashes the (parent index, CodeLocation) key of m_ChildMap. */
+	struct ChildKeyHash
+	{
+		size_t operator ()(const std::pair<quint32, const CodeLocation *> & a_Key) const
+		{
+			return std::hash<const CodeLocation *>()(a_Key.second) ^ (static_cast<size_t>(a_Key.first) * 0x9e3779b97f4a7c15ull);
+		}
+	};
+
+
+	/** All the nodes of the trie, [0] is the root. */
+	std::vector<Node> m_Nodes;
+
+	/** Map of (parent index, CodeLocation) -> child index, for all the nodes. */
+	std::unordered_map<std::pair<quint32, const CodeLocation *>, quint32, ChildKeyHash> m_ChildMap;
+
+	/** Map of Snapshot -> its ordinal. */
+	std::unordered_map<const Snapshot *, quint32> m_SnapshotOrdinals;
+
+
+	/** Returns the index of the specified node's child with the specified CodeLocation, creating it if needed. */
+	quint32 getOrCreateChild(quint32 a_Parent, CodeLocation * a_CodeLocation);
+
+	/** Stores the size of the specified node in the specified snapshot.
+	Returns false (and doesn't store anything) if the node already has a size for this snapshot. */
+	bool setSize(quint32 a_Node, quint32 a_SnapshotOrdinal, quint64 a_Size);
+};
+
+
+
+
+
+#endif // ALLOCATIONPATHTRIE_H
+
+
+
+
@@ -24,7 +24,7 @@ AllocationsGraph::AllocationsGraph(QWidget * a_Parent):
 
 
 
-void AllocationsGraph::setAllocation(AllocationPtr a_Allocation)
+void AllocationsGraph::setAllocation(const Allocation & a_Allocation)
 {
 	m_Allocation = a_Allocation;
 	repaint();
@@ -37,7 +37,7 @@ void AllocationsGraph::setAllocation(AllocationPtr a_Allocation)
 void AllocationsGraph::paintEvent(QPaintEvent * a_Event)
 {
 	Super::paintEvent(a_Event);
-	if (m_Allocation == nullptr)
+	if (!m_Allocation.isValid())
 	{
 		return;
 	}
@@ -50,7 +50,7 @@ void AllocationsGraph::paintEvent(QPaintEvent * a_Event)
 
 
 
-void AllocationsGraph::drawChart(QPainter & a_Painter, QRect & a_Rect, AllocationPtr a_Allocation)
+void AllocationsGraph::drawChart(QPainter & a_Painter, QRect & a_Rect, const Allocation & a_Allocation)
 {
 	// Fit a square into the output rectangle:
 	auto size = std::min(a_Rect.width(), a_Rect.height()) - 1;
@@ -60,7 +60,7 @@ void AllocationsGraph::drawChart(QPainter & a_Painter, QRect & a_Rect, Allocatio
 
 	// Draw all children:
 	a_Painter.drawRect(rect);
-	auto parentSize = a_Allocation->getAllocationSize();
+	auto parentSize = a_Allocation.getAllocationSize();
 	if (parentSize == 0)
 	{
 		a_Painter.drawText(rect, Qt::AlignCenter, tr("Zero allocation size"));
@@ -77,17 +77,17 @@ void AllocationsGraph::drawChart(QPainter & a_Painter, QRect & a_Rect, Allocatio
 		{0xcf, 0x00, 0xff},
 	};
 	unsigned idx = 0;
-	for (const auto & a: a_Allocation->getChildren())
+	for (const auto & a: a_Allocation.getChildren())
 	{
 		int startAngle = static_cast<int>(16 * 360 * startSize / parentSize);
-		int endAngle = static_cast<int>(16 * 360 * (startSize + a->getAllocationSize()) / parentSize);
+		int endAngle = static_cast<int>(16 * 360 * (startSize + a.getAllocationSize()) / parentSize);
 		if (startAngle < endAngle)
 		{
 			a_Painter.setBrush(QBrush(colors[idx % ARRAYCOUNT(colors)]));
 			a_Painter.drawPie(rect, startAngle, endAngle - startAngle);
 			idx += 1;
 		}
-		startSize += a->getAllocationSize();
+		startSize += a.getAllocationSize();
 	}
 }
 
@@ -15,14 +15,7 @@
 
 #include <memory>
 #include <QWidget>
-
-
-
-
-
-// fwd:
-class Allocation;
-typedef std::shared_ptr<Allocation> AllocationPtr;
+#include "Allocation.h"
 
 
 
@@ -40,7 +33,7 @@ public:
 	explicit AllocationsGraph(QWidget * a_Parent = nullptr);
 
 	/** Sets the allocation whose children are visualised. */
-	void setAllocation(AllocationPtr a_Allocation);
+	void setAllocation(const Allocation & a_Allocation);
 
 signals:
 
@@ -48,14 +41,16 @@ public slots:
 
 protected:
 
-	AllocationPtr m_Allocation;
+	/** The allocation whose children are visualised.
+	The snapshot owning the allocation must be kept alive by the owner of this widget. */
+	Allocation m_Allocation;
 
 
 	// QWidget overrides:
 	virtual void paintEvent(QPaintEvent * a_Event) override;
 
 	/** Draws a single pie chart based on the specified Allocation's children. */
-	void drawChart(QPainter & a_Painter, QRect & a_Rect, AllocationPtr a_Allocation);
+	void drawChart(QPainter & a_Painter, QRect & a_Rect, const Allocation & a_Allocation);
 };
 
 
@@ -0,0 +1,113 @@
+// AsyncFileWriter.cpp
+
+// Implements the AsyncFileWriter class that writes data into a file on a background thread
+
+
+
+
+
+#include "Globals.h"
+#include "AsyncFileWriter.h"
+#include <QFile>
+
+
+
+
+
+AsyncFileWriter::AsyncFileWriter(const QString & a_FileName):
+	m_FileName(a_FileName),
+	m_IsFinishing(false),
+	m_HasFailed(false)
+{
+	start();
+}
+
+
+
+
+
+AsyncFileWriter::~AsyncFileWriter()
+{
+	finish();
+}
+
+
+
+
+
+void AsyncFileWriter::write(const QByteArray & a_Data)
+{
+	QMutexLocker lock(&m_Mtx);
+	if (m_HasFailed)
+	{
+		// No point in queueing more data, it wouldn't be written anyway
+		return;
+	}
+	m_Queue.push_back(a_Data);
+	m_HasWork.wakeOne();
+}
+
+
+
+
+
+bool AsyncFileWriter::finish()
+{
+	{
+		QMutexLocker lock(&m_Mtx);
+		m_IsFinishing = true;
+		m_HasWork.wakeOne();
+	}
+	wait();
+	QMutexLocker lock(&m_Mtx);
+	return !m_HasFailed;
+}
+
+
+
+
+
+void AsyncFileWriter::run()
+{
+	QFile f(m_FileName);
+	bool isOk = f.open(QIODevice::WriteOnly | QIODevice::Truncate);
+	std::list<QByteArray> toWrite;
+	while (true)
+	{
+		{
+			QMutexLocker lock(&m_Mtx);
+			if (!isOk)
+			{
+				m_HasFailed = true;
+				m_Queue.clear();
+			}
+			while (m_Queue.empty() && !m_IsFinishing)
+			{
+				m_HasWork.wait(&m_Mtx);
+			}
+			if (m_Queue.empty())
+			{
+				break;
+			}
+			// Take all the queued data at once, so that the producer isn't blocked while writing:
+			std::swap(toWrite, m_Queue);
+		}
+		for (const auto & data: toWrite)
+		{
+			if (isOk && (f.write(data) != data.size()))
+			{
+				isOk = false;
+			}
+		}
+		toWrite.clear();
+	}
+	if (isOk && !f.flush())
+	{
+		QMutexLocker lock(&m_Mtx);
+		m_HasFailed = true;
+	}
+}
+
+
+
+
@@ -0,0 +1,85 @@
+// AsyncFileWriter.h
+
+// Declares the AsyncFileWriter class that writes data into a file on a background thread
+
+
+
+
+
+#ifndef ASYNCFILEWRITER_H
+#define ASYNCFILEWRITER_H
+
+
+
+
+
+#include <list>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QByteArray>
+#include <QString>
+
+
+
+
+
+/** Writes data into a file on a background thread, so that the thread producing the data doesn't wait for the disk.
+The data is written in the order in which it is given to write(). The file is created (truncated) when the writer
+is constructed, and closed by finish(). */
+class AsyncFileWriter:
+	public QThread
+{
+	typedef QThread Super;
+
+public:
+
+	/** Creates the writer and starts its thread. The file is opened by the thread. */
+	AsyncFileWriter(const QString & a_FileName);
+
+	/** Finishes writing, if finish() hasn't been called yet. */
+	virtual ~AsyncFileWriter();
+
+	/** Queues the data to be written into the file. Returns immediately. */
+	void write(const QByteArray & a_Data);
+
+	/** Waits for all the queued data to be written and closes the file.
+	Returns true if the file has been opened and all the data has been written successfully. */
+	bool finish();
+
+	const QString & getFileName() const { return m_FileName; }
+
+protected:
+
+	/** The file into which the data is written. */
+	QString m_FileName;
+
+	/** Protects m_Queue, m_IsFinishing and m_HasFailed. */
+	QMutex m_Mtx;
+
+	/** Signalled when there's new data in m_Queue, or when finish() is called. */
+	QWaitCondition m_HasWork;
+
+	/** The data queued for writing. */
+	std::list<QByteArray> m_Queue;
+
+	/** Set to true by finish(), the thread terminates once the queue is empty. */
+	bool m_IsFinishing;
+
+	/** Set to true by the thread if the file cannot be opened or written to. */
+	bool m_HasFailed;
+
+
+	// QThread overrides:
+	virtual void run() override;
+};
+
+
+
+
+
+#endif // ASYNCFILEWRITER_H
+
+
+
+
@@ -0,0 +1,521 @@
+// AsyncLoader.cpp
+
+// Implements the AsyncLoader class that loads Massif files and projects on a background thread
+
+// Implements the AsyncLoaderWorker class that represents the background thread doing a single loading job
+
+
+
+
+
+#include "Globals.h"
+#include "AsyncLoader.h"
+#include <algorithm>
+#include <QFile>
+#include <QMetaType>
+#include "MassifParser.h"
+#include "Project.h"
+#include "ProjectLoader.h"
+#include "CodeLocationStats.h"
+
+
+
+
+
+/** The number of parsed snapshots after which they are reported to the UI thread. */
+static const size_t MAX_BATCH_SNAPSHOTS = 64;
+
+/** The time (in msec) after which the parsed snapshots are reported to the UI thread, even if there's only a few of them. */
+static const qint64 MAX_BATCH_MSEC = 200;
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// AsyncLoaderWorker:
+
+AsyncLoaderWorker::AsyncLoaderWorker(JobType a_JobType, const QString & a_FileName, ProjectPtr a_Project):
+	m_JobType(a_JobType),
+	m_FileName(a_FileName),
+	m_Project(a_Project),
+	m_IsAborted(false)
+{
+	if (m_JobType == jtMassifFile)
+	{
+		// The parser's signals carry pointers to its internal buffers, they must be handled directly in the worker thread:
+		m_Parser.reset(new MassifParser(m_Project));
+		connect(m_Parser.get(), SIGNAL(newSnapshotParsed(SnapshotPtr)),                  this, SLOT(onNewSnapshotParsed(SnapshotPtr)),                  Qt::DirectConnection);
+		connect(m_Parser.get(), SIGNAL(parsedCommand(const char *)),                     this, SLOT(onParsedCommand(const char *)),                     Qt::DirectConnection);
+		connect(m_Parser.get(), SIGNAL(parsedTimeUnit(const char *)),                    this, SLOT(onParsedTimeUnit(const char *)),                    Qt::DirectConnection);
+		connect(m_Parser.get(), SIGNAL(parseError(quint32, const char *, const char *)), this, SLOT(onParseError(quint32, const char *, const char *)), Qt::DirectConnection);
+		connect(m_Parser.get(), SIGNAL(parseProgress(quint64, quint64)),                 this, SLOT(onParseProgress(quint64, quint64)),                 Qt::DirectConnection);
+	}
+}
+
+
+
+
+
+AsyncLoaderWorker::~AsyncLoaderWorker()
+{
+	// The owner is expected to have waited for the thread to finish:
+	assert(!isRunning());
+}
+
+
+
+
+
+void AsyncLoaderWorker::abort()
+{
+	m_IsAborted = true;
+	if (m_Parser != nullptr)
+	{
+		m_Parser->abortParsing();
+	}
+}
+
+
+
+
+
+void AsyncLoaderWorker::run()
+{
+	switch (m_JobType)
+	{
+		case jtMassifFile: runMassifFile(); return;
+		case jtProject:    runProject();    return;
+	}
+}
+
+
+
+
+
+void AsyncLoaderWorker::runMassifFile()
+{
+	QFile file(m_FileName);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		emit failed(tr("Failed to open\n%1").arg(m_FileName));
+		return;
+	}
+	m_LastFlushTimer.start();
+	if (!m_IsAborted)
+	{
+		m_Parser->parse(file);
+	}
+	if (!m_IsAborted)
+	{
+		flushPendingSnapshots();
+	}
+}
+
+
+
+
+
+void AsyncLoaderWorker::runProject()
+{
+	QFile file(m_FileName);
+	if (!file.open(QIODevice::ReadOnly))
+	{
+		emit failed(tr("Failed to open project file\n%1").arg(m_FileName));
+		return;
+	}
+	ProjectPtr project;
+	try
+	{
+		project = ProjectLoader::loadProject(file, [this](qint64 a_Position, qint64 a_Size)
+			{
+				emit progress(static_cast<quint64>(a_Position), static_cast<quint64>(std::max<qint64>(a_Size, 0)));
+				return !m_IsAborted;
+			}
+		);
+	}
+	catch (const std::exception & exc)
+	{
+		if (!m_IsAborted)
+		{
+			emit failed(tr("Failed to load project from file\n%1\n\n%2").arg(m_FileName).arg(QString::fromUtf8(exc.what())));
+		}
+		return;
+	}
+	if (project == nullptr)
+	{
+		emit failed(tr("Failed to load project from file\n%1").arg(m_FileName));
+		return;
+	}
+	if (m_IsAborted)
+	{
+		return;
+	}
+
+	// The project has been created in this thread, hand it over to the receiver's thread:
+	project->moveToThread(thread());
+	project->getCodeLocationStats()->moveToThread(thread());
+	emit projectLoaded(project);
+}
+
+
+
+
+
+void AsyncLoaderWorker::flushPendingSnapshots()
+{
+	m_LastFlushTimer.restart();
+	if (m_PendingSnapshots.empty())
+	{
+		return;
+	}
+	SnapshotPtrs snapshots;
+	std::swap(snapshots, m_PendingSnapshots);
+	emit snapshotsParsed(snapshots);
+}
+
+
+
+
+
+void AsyncLoaderWorker::onNewSnapshotParsed(SnapshotPtr a_Snapshot)
+{
+	if (m_IsAborted)
+	{
+		return;
+	}
+	m_PendingSnapshots.push_back(a_Snapshot);
+	if (
+		(m_PendingSnapshots.size() >= MAX_BATCH_SNAPSHOTS) ||
+		(m_LastFlushTimer.elapsed() >= MAX_BATCH_MSEC)
+	)
+	{
+		flushPendingSnapshots();
+	}
+}
+
+
+
+
+
+void AsyncLoaderWorker::onParsedCommand(const char * a_Command)
+{
+	emit parsedCommand(QString::fromUtf8(a_Command));
+}
+
+
+
+
+
+void AsyncLoaderWorker::onParsedTimeUnit(const char * a_TimeUnit)
+{
+	emit parsedTimeUnit(QString::fromUtf8(a_TimeUnit));
+}
+
+
+
+
+
+void AsyncLoaderWorker::onParseError(quint32 a_LineNum, const char * a_Msg, const char * a_Line)
+{
+	// Report the snapshots parsed before the error first, to keep the order of the reports:
+	flushPendingSnapshots();
+	emit parseError(a_LineNum, QString::fromUtf8(a_Msg), QString::fromUtf8(a_Line));
+}
+
+
+
+
+
+void AsyncLoaderWorker::onParseProgress(quint64 a_NumBytesParsed, quint64 a_NumBytesTotal)
+{
+	emit progress(a_NumBytesParsed, a_NumBytesTotal);
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// AsyncLoader:
+
+AsyncLoader::AsyncLoader(QObject * a_Parent):
+	Super(a_Parent),
+	m_WorkerJobID(0),
+	m_NextJobID(0)
+{
+	// The types need registering for the queued connections across threads:
+	qRegisterMetaType<SnapshotPtrs>("SnapshotPtrs");
+	qRegisterMetaType<ProjectPtr>("ProjectPtr");
+}
+
+
+
+
+
+AsyncLoader::~AsyncLoader()
+{
+	m_Jobs.clear();
+	if (m_Worker != nullptr)
+	{
+		m_Worker->abort();
+		m_Worker->wait();
+		m_Worker.reset();
+	}
+}
+
+
+
+
+
+quint32 AsyncLoader::addMassifFile(ProjectPtr a_Project, const QString & a_FileName)
+{
+	Job job;
+	job.m_JobType = AsyncLoaderWorker::jtMassifFile;
+	job.m_FileName = a_FileName;
+	job.m_Project = a_Project;
+	job.m_ShouldUseLoadedProject = isLoadingProject();
+	return queueJob(std::move(job));
+}
+
+
+
+
+
+void AsyncLoader::loadProject(const QString & a_FileName)
+{
+	cancel();
+	Job job;
+	job.m_JobType = AsyncLoaderWorker::jtProject;
+	job.m_FileName = a_FileName;
+	job.m_ShouldUseLoadedProject = false;
+	queueJob(std::move(job));
+}
+
+
+
+
+
+void AsyncLoader::cancel()
+{
+	m_Jobs.clear();
+	if (m_Worker != nullptr)
+	{
+		// The worker will finish on its own and onWorkerFinished() will clean it up:
+		m_Worker->abort();
+	}
+}
+
+
+
+
+
+void AsyncLoader::abortJob(quint32 a_JobID)
+{
+	if ((m_Worker != nullptr) && (m_WorkerJobID == a_JobID))
+	{
+		// The worker will finish on its own and onWorkerFinished() will clean it up:
+		m_Worker->abort();
+		return;
+	}
+	m_Jobs.remove_if([a_JobID](const Job & a_Job)
+		{
+			return (a_Job.m_ID == a_JobID);
+		}
+	);
+}
+
+
+
+
+
+bool AsyncLoader::isLoadingProject() const
+{
+	if ((m_Worker != nullptr) && !m_Worker->isAborted() && (m_Worker->getJobType() == AsyncLoaderWorker::jtProject))
+	{
+		return true;
+	}
+	for (const auto & job: m_Jobs)
+	{
+		if (job.m_JobType == AsyncLoaderWorker::jtProject)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+
+
+
+quint32 AsyncLoader::queueJob(Job && a_Job)
+{
+	auto id = m_NextJobID++;
+	a_Job.m_ID = id;
+	m_Jobs.push_back(std::move(a_Job));
+	if (m_Worker == nullptr)
+	{
+		startNextJob();
+	}
+	return id;
+}
+
+
+
+
+
+void AsyncLoader::startNextJob()
+{
+	assert(m_Worker == nullptr);
+	if (m_Jobs.empty())
+	{
+		emit idle();
+		return;
+	}
+	auto job = m_Jobs.front();
+	m_Jobs.pop_front();
+
+	m_Worker.reset(new AsyncLoaderWorker(job.m_JobType, job.m_FileName, job.m_Project));
+	m_WorkerJobID = job.m_ID;
+	auto worker = m_Worker.get();
+	connect(worker, SIGNAL(snapshotsParsed(SnapshotPtrs)),                         this, SLOT(onWorkerSnapshotsParsed(SnapshotPtrs)));
+	connect(worker, SIGNAL(parsedCommand(const QString &)),                        this, SLOT(onWorkerParsedCommand(const QString &)));
+	connect(worker, SIGNAL(parsedTimeUnit(const QString &)),                       this, SLOT(onWorkerParsedTimeUnit(const QString &)));
+	connect(worker, SIGNAL(parseError(quint32, const QString &, const QString &)), this, SLOT(onWorkerParseError(quint32, const QString &, const QString &)));
+	connect(worker, SIGNAL(progress(quint64, quint64)),                            this, SLOT(onWorkerProgress(quint64, quint64)));
+	connect(worker, SIGNAL(projectLoaded(ProjectPtr)),                             this, SLOT(onWorkerProjectLoaded(ProjectPtr)));
+	connect(worker, SIGNAL(failed(const QString &)),                               this, SLOT(onWorkerFailed(const QString &)));
+	connect(worker, SIGNAL(finished()),                                            this, SLOT(onWorkerFinished()));
+	emit jobStarted(job.m_FileName);
+	worker->start();
+}
+
+
+
+
+
+bool AsyncLoader::isFromActiveWorker(QObject * a_Sender) const
+{
+	return (
+		(m_Worker != nullptr) &&
+		(a_Sender == m_Worker.get()) &&
+		!m_Worker->isAborted()
+	);
+}
+
+
+
+
+
+void AsyncLoader::onWorkerSnapshotsParsed(SnapshotPtrs a_Snapshots)
+{
+	if (isFromActiveWorker(sender()))
+	{
+		emit snapshotsParsed(a_Snapshots);
+	}
+}
+
+
+
+
+
+void AsyncLoader::onWorkerParsedCommand(const QString & a_Command)
+{
+	if (isFromActiveWorker(sender()))
+	{
+		emit parsedCommand(m_WorkerJobID, a_Command);
+	}
+}
+
+
+
+
+
+void AsyncLoader::onWorkerParsedTimeUnit(const QString & a_TimeUnit)
+{
+	if (isFromActiveWorker(sender()))
+	{
+		emit parsedTimeUnit(m_WorkerJobID, a_TimeUnit);
+	}
+}
+
+
+
+
+
+void AsyncLoader::onWorkerParseError(quint32 a_LineNum, const QString & a_Msg, const QString & a_Line)
+{
+	if (isFromActiveWorker(sender()))
+	{
+		emit parseError(a_LineNum, a_Msg, a_Line);
+	}
+}
+
+
+
+
+
+void AsyncLoader::onWorkerProgress(quint64 a_Current, quint64 a_Total)
+{
+	if (isFromActiveWorker(sender()))
+	{
+		emit progress(a_Current, a_Total);
+	}
+}
+
+
+
+
+
+void AsyncLoader::onWorkerProjectLoaded(ProjectPtr a_Project)
+{
+	if (!isFromActiveWorker(sender()))
+	{
+		return;
+	}
+
+	// The Massif files queued while the project was loading belong to the loaded project:
+	for (auto & job: m_Jobs)
+	{
+		if (job.m_ShouldUseLoadedProject)
+		{
+			job.m_Project = a_Project;
+			job.m_ShouldUseLoadedProject = false;
+		}
+	}
+	emit projectLoaded(a_Project, m_Worker->getFileName());
+}
+
+
+
+
+
+void AsyncLoader::onWorkerFailed(const QString & a_Reason)
+{
+	if (isFromActiveWorker(sender()))
+	{
+		emit loadFailed(m_Worker->getFileName(), a_Reason);
+	}
+}
+
+
+
+
+
+void AsyncLoader::onWorkerFinished()
+{
+	if ((m_Worker == nullptr) || (sender() != m_Worker.get()))
+	{
+		return;
+	}
+
+	// The finished() signal is queued, the thread may still be returning from run():
+	m_Worker->wait();
+	m_Worker.reset();
+	startNextJob();
+}
+
+
+
+
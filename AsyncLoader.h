@@ -0,0 +1,286 @@
+// AsyncLoader.h
+
+// Declares the AsyncLoader class that loads Massif files and projects on a background thread
+
+// Declares the AsyncLoaderWorker class that represents the background thread doing a single loading job
+
+
+
+
+
+#ifndef ASYNCLOADER_H
+#define ASYNCLOADER_H
+
+
+
+
+
+#include <memory>
+#include <list>
+#include <atomic>
+#include <QThread>
+#include <QString>
+#include <QElapsedTimer>
+
+
+
+
+
+// fwd:
+class Project;
+typedef std::shared_ptr<Project> ProjectPtr;
+class Snapshot;
+typedef std::shared_ptr<Snapshot> SnapshotPtr;
+typedef std::list<SnapshotPtr> SnapshotPtrs;
+class MassifParser;
+
+
+
+
+
+/** The background thread that does a single loading job for AsyncLoader - either parsing a Massif file,
+or loading an entire project.
+All signals are emitted from the worker thread, the receivers are expected to use queued connections. */
+class AsyncLoaderWorker:
+	public QThread
+{
+	typedef QThread Super;
+	Q_OBJECT
+
+public:
+
+	enum JobType
+	{
+		jtMassifFile,  ///< Parse a Massif output file into snapshots, reported in batches via snapshotsParsed()
+		jtProject,     ///< Load a saved project file, reported via projectLoaded()
+	};
+
+
+	/** Creates a new worker for the specified job.
+	a_Project is the project to whose CodeLocations the Massif file is bound, unused for jtProject jobs. */
+	AsyncLoaderWorker(JobType a_JobType, const QString & a_FileName, ProjectPtr a_Project);
+
+	virtual ~AsyncLoaderWorker();
+
+	/** Requests the job to be aborted as soon as possible.
+	Can be called from any thread. No more data signals will be emitted after the abort is noticed. */
+	void abort();
+
+	/** Returns true if abort() has been called. */
+	bool isAborted() const { return m_IsAborted; }
+
+	JobType getJobType() const { return m_JobType; }
+	const QString & getFileName() const { return m_FileName; }
+
+signals:
+
+	/** Emitted when a batch of snapshots has been parsed from the Massif file. */
+	void snapshotsParsed(SnapshotPtrs a_Snapshots);
+
+	/** Emitted when the command has been parsed from the Massif file. */
+	void parsedCommand(const QString & a_Command);
+
+	/** Emitted when the time unit has been parsed from the Massif file. */
+	void parsedTimeUnit(const QString & a_TimeUnit);
+
+	/** Emitted when the Massif file contains an error. */
+	void parseError(quint32 a_LineNum, const QString & a_Msg, const QString & a_Line);
+
+	/** Emitted periodically with the progress of the job.
+	a_Total is 0 if the total amount is not known. */
+	void progress(quint64 a_Current, quint64 a_Total);
+
+	/** Emitted when the project has been loaded successfully.
+	The project has already been moved into the thread in which this worker object lives. */
+	void projectLoaded(ProjectPtr a_Project);
+
+	/** Emitted when the job fails (file cannot be opened, project cannot be loaded). */
+	void failed(const QString & a_Reason);
+
+protected:
+
+	/** The type of the job to do. */
+	JobType m_JobType;
+
+	/** The file to load. */
+	QString m_FileName;
+
+	/** The project to which the parsed Massif file is bound. */
+	ProjectPtr m_Project;
+
+	/** The parser used for jtMassifFile jobs. */
+	std::unique_ptr<MassifParser> m_Parser;
+
+	/** Set to true by abort(). */
+	std::atomic<bool> m_IsAborted;
+
+	/** The snapshots parsed but not yet reported via snapshotsParsed(). */
+	SnapshotPtrs m_PendingSnapshots;
+
+	/** Measures the time since the last snapshotsParsed() emit, so that the batches are reported even for slow parses. */
+	QElapsedTimer m_LastFlushTimer;
+
+
+	// QThread overrides:
+	virtual void run() override;
+
+	/** Parses the Massif file (jtMassifFile job). */
+	void runMassifFile();
+
+	/** Loads the project (jtProject job). */
+	void runProject();
+
+	/** Emits snapshotsParsed() for all m_PendingSnapshots, if any, and clears them. */
+	void flushPendingSnapshots();
+
+protected slots:
+
+	// Relays for the MassifParser's signals, called directly in the worker thread:
+	void onNewSnapshotParsed(SnapshotPtr a_Snapshot);
+	void onParsedCommand(const char * a_Command);
+	void onParsedTimeUnit(const char * a_TimeUnit);
+	void onParseError(quint32 a_LineNum, const char * a_Msg, const char * a_Line);
+	void onParseProgress(quint64 a_NumBytesParsed, quint64 a_NumBytesTotal);
+};
+
+
+
+
+
+/** Loads Massif files and projects on a background thread, so that the UI stays responsive.
+The jobs are processed one at a time, in the order in which they were requested.
+All the signals are emitted in the thread in which the AsyncLoader lives (the UI thread). */
+class AsyncLoader:
+	public QObject
+{
+	typedef QObject Super;
+	Q_OBJECT
+
+public:
+
+	explicit AsyncLoader(QObject * a_Parent = nullptr);
+
+	/** Cancels all jobs and waits for the worker thread to finish. */
+	virtual ~AsyncLoader();
+
+	/** Queues the specified Massif file to be parsed into snapshots bound to the specified project.
+	If a project is being loaded, the file is bound to the loaded project instead, since that one replaces a_Project
+	by the time the file is parsed. a_Project is used only if the project fails to load.
+	Returns the ID of the new job, as used by abortJob() and reported by the parsing signals. */
+	quint32 addMassifFile(ProjectPtr a_Project, const QString & a_FileName);
+
+	/** Cancels all jobs and starts loading the project from the specified file. */
+	void loadProject(const QString & a_FileName);
+
+	/** Returns true if there is no job being processed or queued. */
+	bool isIdle() const { return (m_Worker == nullptr); }
+
+signals:
+
+	/** Emitted when a job starts to be processed. */
+	void jobStarted(const QString & a_FileName);
+
+	/** Emitted periodically with the progress of the current job. */
+	void progress(quint64 a_Current, quint64 a_Total);
+
+	/** Emitted when a batch of snapshots has been parsed from a Massif file. */
+	void snapshotsParsed(SnapshotPtrs a_Snapshots);
+
+	/** Emitted when the command has been parsed from a Massif file, a_JobID is the ID of the job parsing the file.
+	The receiver may call abortJob() if the command doesn't match the project. */
+	void parsedCommand(quint32 a_JobID, const QString & a_Command);
+
+	/** Emitted when the time unit has been parsed from a Massif file, a_JobID is the ID of the job parsing the file.
+	The receiver may call abortJob() if the time unit doesn't match the project. */
+	void parsedTimeUnit(quint32 a_JobID, const QString & a_TimeUnit);
+
+	/** Emitted when a Massif file contains an error. */
+	void parseError(quint32 a_LineNum, const QString & a_Msg, const QString & a_Line);
+
+	/** Emitted when a project has been loaded from the file. */
+	void projectLoaded(ProjectPtr a_Project, const QString & a_FileName);
+
+	/** Emitted when a job fails. */
+	void loadFailed(const QString & a_FileName, const QString & a_Reason);
+
+	/** Emitted when all the jobs have been finished or cancelled. */
+	void idle();
+
+public slots:
+
+	/** Cancels the current job and all the queued jobs. */
+	void cancel();
+
+	/** Aborts the job with the specified ID, whether it is being processed or still queued; the other jobs are kept.
+	Does nothing if the job has already finished. */
+	void abortJob(quint32 a_JobID);
+
+protected:
+
+	/** A single queued job. */
+	struct Job
+	{
+		/** The unique ID of the job, assigned when queued. */
+		quint32 m_ID;
+
+		AsyncLoaderWorker::JobType m_JobType;
+		QString m_FileName;
+		ProjectPtr m_Project;
+
+		/** If true, the job has been queued after a project loading job and is to be bound to the loaded project
+		once it is loaded. m_Project is used if the loading fails. */
+		bool m_ShouldUseLoadedProject;
+	};
+
+
+	/** The worker processing the current job, nullptr if idle. */
+	std::unique_ptr<AsyncLoaderWorker> m_Worker;
+
+	/** The ID of the job being processed by m_Worker. */
+	quint32 m_WorkerJobID;
+
+	/** The ID to be assigned to the next queued job. */
+	quint32 m_NextJobID;
+
+	/** The jobs waiting to be processed, after the current one. */
+	std::list<Job> m_Jobs;
+
+
+	/** Returns true if a project loading job is being processed or is queued. */
+	bool isLoadingProject() const;
+
+	/** Assigns an ID to the job, adds it to the queue and starts it, if there's no job being processed.
+	Returns the ID assigned to the job. */
+	quint32 queueJob(Job && a_Job);
+
+	/** Starts processing the next queued job, or emits idle() if there's none. */
+	void startNextJob();
+
+	/** Returns true if the signal comes from the current worker and it hasn't been aborted.
+	Signals from aborted workers may still be in the event queue, they need to be dropped. */
+	bool isFromActiveWorker(QObject * a_Sender) const;
+
+protected slots:
+
+	// Relays for the worker signals:
+	void onWorkerSnapshotsParsed(SnapshotPtrs a_Snapshots);
+	void onWorkerParsedCommand(const QString & a_Command);
+	void onWorkerParsedTimeUnit(const QString & a_TimeUnit);
+	void onWorkerParseError(quint32 a_LineNum, const QString & a_Msg, const QString & a_Line);
+	void onWorkerProgress(quint64 a_Current, quint64 a_Total);
+	void onWorkerProjectLoaded(ProjectPtr a_Project);
+	void onWorkerFailed(const QString & a_Reason);
+
+	/** Called when the worker thread finishes, starts the next job. */
+	void onWorkerFinished();
+};
+
+
+
+
+
+#endif // ASYNCLOADER_H
+
+
+
+
@@ -8,14 +8,74 @@
 
 #include "Globals.h"
 #include "BinaryIOStream.h"
+#include <cstring>
+
+
+
+
+
+/** Size of the write-combining and read-ahead buffers. */
+static const size_t BUFFER_SIZE = 64 * 1024;
 
 
 
 
 
 BinaryIOStream::BinaryIOStream(QIODevice & a_Device):
-	m_IODevice(a_Device)
+	m_IODevice(a_Device),
+	m_ReadPos(0),
+	m_ReadEnd(0)
+{
+}
+
+
+
+
+
+BinaryIOStream::~BinaryIOStream()
+{
+	try
+	{
+		flush();
+	}
+	catch (const BinaryIOStreamException &)
+	{
+		// Ignore, the explicit flush() is the way to detect write errors
+	}
+
+	// Give the unused read-ahead data back to the device:
+	if ((m_ReadPos < m_ReadEnd) && !m_IODevice.isSequential())
+	{
+		m_IODevice.seek(getPosition());
+	}
+}
+
+
+
+
+
+void BinaryIOStream::flush()
+{
+	if (m_WriteBuffer.empty())
+	{
+		return;
+	}
+	auto size = static_cast<qint64>(m_WriteBuffer.size());
+	auto bytesWritten = m_IODevice.write(m_WriteBuffer.data(), size);
+	m_WriteBuffer.clear();
+	if (bytesWritten != size)
+	{
+		throw BinaryIOStreamException("Failed to write buffered data");
+	}
+}
+
+
+
+
+
+qint64 BinaryIOStream::getPosition() const
 {
+	return m_IODevice.pos() - static_cast<qint64>(m_ReadEnd - m_ReadPos) + static_cast<qint64>(m_WriteBuffer.size());
 }
 
 
@@ -23,8 +83,8 @@ BinaryIOStream::BinaryIOStream(QIODevice & a_Device):
 
 void BinaryIOStream::writeBool(bool a_Value)
 {
-	unsigned char v =  a_Value ? 1 : 0;
-	m_IODevice.write(reinterpret_cast<const char *>(&v), 1);
+	char v =  a_Value ? 1 : 0;
+	writeBytes(&v, 1);
 }
 
 
@@ -58,10 +118,7 @@ void BinaryIOStream::writeUInt32(quint32 a_Value)
 		static_cast<unsigned char>((a_Value >> 8)  & 0xff),
 		static_cast<unsigned char>(a_Value         & 0xff),
 	};
-	if (m_IODevice.write(reinterpret_cast<const char *>(v), 4) != 4)
-	{
-		throw BinaryIOStreamException("Failed to write UInt32");
-	}
+	writeBytes(reinterpret_cast<const char *>(v), 4);
 }
 
 
@@ -70,21 +127,7 @@ void BinaryIOStream::writeUInt32(quint32 a_Value)
 
 void BinaryIOStream::writeUInt64(quint64 a_Value)
 {
-	unsigned char v[8] =
-	{
-		static_cast<unsigned char>((a_Value >> 56) & 0xff),
-		static_cast<unsigned char>((a_Value >> 48) & 0xff),
-		static_cast<unsigned char>((a_Value >> 40) & 0xff),
-		static_cast<unsigned char>((a_Value >> 32) & 0xff),
-		static_cast<unsigned char>((a_Value >> 24) & 0xff),
-		static_cast<unsigned char>((a_Value >> 16) & 0xff),
-		static_cast<unsigned char>((a_Value >> 8)  & 0xff),
-		static_cast<unsigned char>(a_Value         & 0xff),
-	};
-	if (m_IODevice.write(reinterpret_cast<const char *>(v), 8) != 8)
-	{
-		throw BinaryIOStreamException("Failed to write UInt64");
-	}
+	writeUInt64Array(&a_Value, 1);
 }
 
 
@@ -103,11 +146,7 @@ void BinaryIOStream::writeString(const char * a_Value)
 void BinaryIOStream::writeString(const char * a_Value, size_t a_Length)
 {
 	writeUInt64(a_Length);
-	auto bytesWritten = m_IODevice.write(a_Value, a_Length);
-	if (bytesWritten != static_cast<decltype(bytesWritten)>(a_Length))
-	{
-		throw BinaryIOStreamException("Failed to write string payload");
-	}
+	writeBytes(a_Value, a_Length);
 }
 
 
@@ -126,26 +165,132 @@ void BinaryIOStream::writeString(const std::string & a_Value)
 void BinaryIOStream::writeString(const QString & a_Value)
 {
 	auto value = a_Value.toUtf8();
-	writeUInt64(value.size());
-	if (m_IODevice.write(value) != value.size())
+	writeString(value.constData(), static_cast<size_t>(value.size()));
+}
+
+
+
+
+
+void BinaryIOStream::writeVarUInt(quint64 a_Value)
+{
+	char v[10];
+	size_t len = 0;
+	do
 	{
-		throw BinaryIOStreamException("Failed to write QString payload");
+		unsigned char b = static_cast<unsigned char>(a_Value & 0x7f);
+		a_Value >>= 7;
+		if (a_Value != 0)
+		{
+			b |= 0x80;
+		}
+		v[len++] = static_cast<char>(b);
+	} while (a_Value != 0);
+	writeBytes(v, len);
+}
+
+
+
+
+
+void BinaryIOStream::writeVarString(const char * a_Value, size_t a_Length)
+{
+	writeVarUInt(a_Length);
+	writeBytes(a_Value, a_Length);
+}
+
+
+
+
+
+void BinaryIOStream::writeVarString(const std::string & a_Value)
+{
+	writeVarString(a_Value.data(), a_Value.size());
+}
+
+
+
+
+
+void BinaryIOStream::writeVarString(const QString & a_Value)
+{
+	auto value = a_Value.toUtf8();
+	writeVarString(value.constData(), static_cast<size_t>(value.size()));
+}
+
+
+
+
+
+void BinaryIOStream::writeBytes(const char * a_Data, size_t a_Length)
+{
+	if (a_Length == 0)
+	{
+		return;
 	}
+
+	// Large blocks go directly to the device, there's no point in copying them:
+	if (a_Length >= BUFFER_SIZE)
+	{
+		flush();
+		auto bytesWritten = m_IODevice.write(a_Data, static_cast<qint64>(a_Length));
+		if (bytesWritten != static_cast<qint64>(a_Length))
+		{
+			throw BinaryIOStreamException("Failed to write raw data");
+		}
+		return;
+	}
+
+	if (m_WriteBuffer.size() + a_Length > BUFFER_SIZE)
+	{
+		flush();
+	}
+	if (m_WriteBuffer.capacity() < BUFFER_SIZE)
+	{
+		m_WriteBuffer.reserve(BUFFER_SIZE);
+	}
+	m_WriteBuffer.insert(m_WriteBuffer.end(), a_Data, a_Data + a_Length);
 }
 
 
 
 
 
-bool BinaryIOStream::readBool()
+void BinaryIOStream::writeUInt64Array(const quint64 * a_Values, size_t a_Count)
 {
-	char v;
-	auto numBytesRead = m_IODevice.read(&v, 1);
-	if (numBytesRead != 1)
+	// Encode in chunks on the stack, then hand each chunk over to the buffer at once:
+	static const size_t CHUNK_VALUES = 512;
+	unsigned char chunk[CHUNK_VALUES * 8];
+	while (a_Count > 0)
 	{
-		throw BinaryIOStreamException("Failed to read bool");
+		auto num = std::min(a_Count, CHUNK_VALUES);
+		auto dst = chunk;
+		for (size_t i = 0; i < num; ++i)
+		{
+			auto value = a_Values[i];
+			dst[0] = static_cast<unsigned char>((value >> 56) & 0xff);
+			dst[1] = static_cast<unsigned char>((value >> 48) & 0xff);
+			dst[2] = static_cast<unsigned char>((value >> 40) & 0xff);
+			dst[3] = static_cast<unsigned char>((value >> 32) & 0xff);
+			dst[4] = static_cast<unsigned char>((value >> 24) & 0xff);
+			dst[5] = static_cast<unsigned char>((value >> 16) & 0xff);
+			dst[6] = static_cast<unsigned char>((value >> 8)  & 0xff);
+			dst[7] = static_cast<unsigned char>(value         & 0xff);
+			dst += 8;
+		}
+		writeBytes(reinterpret_cast<const char *>(chunk), num * 8);
+		a_Values += num;
+		a_Count -= num;
 	}
-	return (v != 0);
+}
+
+
+
+
+
+bool BinaryIOStream::readBool()
+{
+	return (readByte() != 0);
 }
 
 
@@ -172,12 +317,13 @@ qint64 BinaryIOStream::readInt64()
 quint32 BinaryIOStream::readUInt32()
 {
 	unsigned char v[4];
-	auto numBytesRead = m_IODevice.read(reinterpret_cast<char *>(v), 4);
-	if (numBytesRead != 4)
-	{
-		throw BinaryIOStreamException("Failed to read UInt32");
-	}
-	return ((v[0] << 24) | (v[1] << 16) | (v[2] << 8) | v[3]);
+	readBytes(reinterpret_cast<char *>(v), 4);
+	return (
+		(static_cast<quint32>(v[0]) << 24) |
+		(static_cast<quint32>(v[1]) << 16) |
+		(static_cast<quint32>(v[2]) << 8) |
+		static_cast<quint32>(v[3])
+	);
 }
 
 
@@ -186,9 +332,9 @@ quint32 BinaryIOStream::readUInt32()
 
 quint64 BinaryIOStream::readUInt64()
 {
-	quint64 upper = readUInt32();
-	quint64 lower = readUInt32();
-	return (upper << 32) | lower;
+	quint64 res;
+	readUInt64Array(&res, 1);
+	return res;
 }
 
 
@@ -198,24 +344,125 @@ quint64 BinaryIOStream::readUInt64()
 std::string BinaryIOStream::readString()
 {
 	auto len = readUInt64();
-	if (len > std::numeric_limits<size_t>::max() - 1)
+	auto data = readBytes(len);
+	return std::string(data.constData(), static_cast<size_t>(data.size()));
+}
+
+
+
+
+
+QString BinaryIOStream::readQString()
+{
+	auto utf8 = readString();
+	return QString::fromUtf8(utf8.c_str(), static_cast<int>(utf8.size()));
+}
+
+
+
+
+
+quint64 BinaryIOStream::readVarUInt()
+{
+	quint64 res = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7)
+	{
+		auto b = readByte();
+		res |= static_cast<quint64>(b & 0x7f) << shift;
+		if ((b & 0x80) == 0)
+		{
+			return res;
+		}
+	}
+	throw BinaryIOStreamException("VarUInt is too long");
+}
+
+
+
+
+
+std::string BinaryIOStream::readVarString()
+{
+	auto len = readVarUInt();
+	auto data = readBytes(len);
+	return std::string(data.constData(), static_cast<size_t>(data.size()));
+}
+
+
+
+
+
+QString BinaryIOStream::readVarQString()
+{
+	auto len = readVarUInt();
+	auto data = readBytes(len);
+	return QString::fromUtf8(data.constData(), data.size());
+}
+
+
+
+
+
+void BinaryIOStream::readBytes(char * a_Dest, size_t a_Length)
+{
+	// Use up the read-ahead data first:
+	auto numBuffered = std::min(a_Length, m_ReadEnd - m_ReadPos);
+	if (numBuffered > 0)
 	{
-		throw BinaryIOStreamException("String sanity check failed");
+		std::memcpy(a_Dest, m_ReadBuffer.data() + m_ReadPos, numBuffered);
+		m_ReadPos += numBuffered;
+		a_Dest += numBuffered;
+		a_Length -= numBuffered;
 	}
-	std::string res;
-	res.reserve(len);
-	static const size_t BUF_SIZE = 4096;
-	while (len > 0)
+	if (a_Length == 0)
 	{
-		char buf[BUF_SIZE];
-		size_t toRead = std::min<size_t>(len, sizeof(buf));
-		if (m_IODevice.read(buf, toRead) != static_cast<qint64>(toRead))
+		return;
+	}
+
+	// Large blocks are read directly into the destination:
+	if (a_Length >= BUFFER_SIZE)
+	{
+		if (m_IODevice.read(a_Dest, static_cast<qint64>(a_Length)) != static_cast<qint64>(a_Length))
 		{
-			throw BinaryIOStreamException("Failed to read part of string");
+			throw BinaryIOStreamException("Failed to read raw data");
 		}
-		res.append(buf, toRead);
-		len -= toRead;
+		return;
+	}
+
+	// Small remainder, refill the read-ahead buffer and copy from it:
+	while (a_Length > 0)
+	{
+		fillReadBuffer();
+		auto num = std::min(a_Length, m_ReadEnd);
+		std::memcpy(a_Dest, m_ReadBuffer.data(), num);
+		m_ReadPos = num;
+		a_Dest += num;
+		a_Length -= num;
 	}
+}
+
+
+
+
+
+QByteArray BinaryIOStream::readBytes(size_t a_Length)
+{
+	if (a_Length > static_cast<size_t>(std::numeric_limits<int>::max()))
+	{
+		throw BinaryIOStreamException("Raw data sanity check failed");
+	}
+	if (a_Length == 0)
+	{
+		return QByteArray();
+	}
+	if (!m_IODevice.isSequential() && (static_cast<qint64>(a_Length) > m_IODevice.size() - getPosition()))
+	{
+		// Don't allocate huge buffers for corrupted lengths
+		throw BinaryIOStreamException("Raw data is larger than the rest of the device");
+	}
+	QByteArray res;
+	res.resize(static_cast<int>(a_Length));
+	readBytes(res.data(), a_Length);
 	return res;
 }
 
@@ -223,10 +470,49 @@ std::string BinaryIOStream::readString()
 
 
 
-QString BinaryIOStream::readQString()
+void BinaryIOStream::readUInt64Array(quint64 * a_Values, size_t a_Count)
 {
-	auto utf8 = readString();
-	return QString::fromUtf8(utf8.c_str(), static_cast<int>(utf8.size()));
+	static const size_t CHUNK_VALUES = 512;
+	unsigned char chunk[CHUNK_VALUES * 8];
+	while (a_Count > 0)
+	{
+		auto num = std::min(a_Count, CHUNK_VALUES);
+		readBytes(reinterpret_cast<char *>(chunk), num * 8);
+		auto src = chunk;
+		for (size_t i = 0; i < num; ++i)
+		{
+			a_Values[i] =
+				(static_cast<quint64>(src[0]) << 56) |
+				(static_cast<quint64>(src[1]) << 48) |
+				(static_cast<quint64>(src[2]) << 40) |
+				(static_cast<quint64>(src[3]) << 32) |
+				(static_cast<quint64>(src[4]) << 24) |
+				(static_cast<quint64>(src[5]) << 16) |
+				(static_cast<quint64>(src[6]) << 8) |
+				static_cast<quint64>(src[7]);
+			src += 8;
+		}
+		a_Values += num;
+		a_Count -= num;
+	}
+}
+
+
+
+
+
+void BinaryIOStream::fillReadBuffer()
+{
+	assert(m_ReadPos >= m_ReadEnd);  // Only refill when all the data has been consumed
+	m_ReadBuffer.resize(BUFFER_SIZE);
+	auto numRead = m_IODevice.read(m_ReadBuffer.data(), static_cast<qint64>(BUFFER_SIZE));
+	m_ReadPos = 0;
+	m_ReadEnd = 0;
+	if (numRead <= 0)
+	{
+		throw BinaryIOStreamException("Failed to read data");
+	}
+	m_ReadEnd = static_cast<size_t>(numRead);
 }
 
 
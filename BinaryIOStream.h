@@ -14,6 +14,7 @@
 
 
 #include <stdexcept>
+#include <vector>
 #include <QIODevice>
 
 
@@ -36,11 +37,28 @@ public:
 
 
 
+/** Reads and writes binary data from / to a QIODevice.
+Both directions are buffered, so that the individual fields don't each cost a QIODevice call:
+- the written data is combined in a buffer and sent to the device when the buffer is full, or on flush()
+- the data is read ahead from the device in large blocks
+A single instance should be used for either reading or writing, not both. */
 class BinaryIOStream
 {
 public:
 	BinaryIOStream(QIODevice & a_Device);
 
+	/** Flushes any buffered written data (ignoring errors, call flush() explicitly to detect them).
+	If there's unused read-ahead data and the device is seekable, seeks the device back to the logical position,
+	so that the device can be used for further reading. */
+	~BinaryIOStream();
+
+	/** Sends all the buffered written data to the device.
+	Throws a BinaryIOStreamException on an error. */
+	void flush();
+
+	/** Returns the logical position in the device - the position of the next byte to be read / written by this stream. */
+	qint64 getPosition() const;
+
 	// The write functions throw a BinaryIOStreamException on an error
 	void writeBool(bool a_Value);
 	void writeInt32(qint32 a_Value);
@@ -52,16 +70,27 @@ public:
 	void writeString(const std::string & a_Value);
 	void writeString(const QString & a_Value);
 
+	/** Writes the value as an unsigned LEB128 varint: 7 bits per byte, least significant group first,
+	the high bit set on all bytes but the last. Small values take only a single byte. */
+	void writeVarUInt(quint64 a_Value);
+
+	/** Writes the string as a varint length followed by the raw data. */
+	void writeVarString(const char * a_Value, size_t a_Length);
+	void writeVarString(const std::string & a_Value);
+	void writeVarString(const QString & a_Value);
+
+	/** Writes the raw data, without any length prefix.
+	Large blocks bypass the buffer and are written to the device directly. */
+	void writeBytes(const char * a_Data, size_t a_Length);
+
+	/** Writes the array of values in the same encoding as writeUInt64(), in a single bulk operation. */
+	void writeUInt64Array(const quint64 * a_Values, size_t a_Count);
+
 	/** Writes a static constant block of data, represented as a char array.
 	Throws BinaryIOStreamException on an error. */
 	template <qint64 N> void writeConst(const char (&a_Value)[N])
 	{
-		auto bytesWritten = m_IODevice.write(&a_Value[0], N);
-		if (bytesWritten == N)
-		{
-			return;
-		}
-		throw BinaryIOStreamException("Failed to write const");
+		writeBytes(&a_Value[0], N);
 	}
 
 
@@ -73,13 +102,54 @@ public:
 	quint64     readUInt64();
 	std::string readString();
 	QString     readQString();
+	quint64     readVarUInt();
+	std::string readVarString();
+	QString     readVarQString();
+
+	/** Reads exactly the specified number of bytes of raw data into the destination buffer.
+	Large blocks bypass the read-ahead buffer and are read from the device directly. */
+	void readBytes(char * a_Dest, size_t a_Length);
+
+	/** Reads exactly the specified number of bytes of raw data. */
+	QByteArray readBytes(size_t a_Length);
+
+	/** Reads the array of values written by writeUInt64Array(), in a single bulk operation. */
+	void readUInt64Array(quint64 * a_Values, size_t a_Count);
 
 protected:
 
 	/** The QIODevice instance that provides the underlying IO operations. */
 	QIODevice & m_IODevice;
 
+	/** The written data not yet sent to the device. */
+	std::vector<char> m_WriteBuffer;
+
+	/** The data read ahead from the device.
+	Only the bytes in [m_ReadPos, m_ReadEnd) haven't been consumed yet. */
+	std::vector<char> m_ReadBuffer;
+
+	/** Position of the next unconsumed byte in m_ReadBuffer. */
+	size_t m_ReadPos;
+
+	/** Position after the last valid byte in m_ReadBuffer. */
+	size_t m_ReadEnd;
+
+
 	BinaryIOStream(const BinaryIOStream &) = delete;
+
+	/** Reads the next single byte, refilling the read-ahead buffer if needed. */
+	inline unsigned char readByte()
+	{
+		if (m_ReadPos >= m_ReadEnd)
+		{
+			fillReadBuffer();
+		}
+		return static_cast<unsigned char>(m_ReadBuffer[m_ReadPos++]);
+	}
+
+	/** Reads the next block of data from the device into the (empty) read-ahead buffer.
+	Throws a BinaryIOStreamException if no data can be read. */
+	void fillReadBuffer();
 };
 
 #endif // BINARYIOSTREAM_H
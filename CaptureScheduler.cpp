@@ -0,0 +1,719 @@
+// CaptureScheduler.cpp
+
+// Implements the CaptureScheduler class that periodically captures snapshots of multiple valgrind instances
+
+// Implements the CaptureWorker class that represents the background thread doing a single capture
+
+
+
+
+
+#include "Globals.h"
+#include "CaptureScheduler.h"
+#include <algorithm>
+#include <cstdlib>
+#include <QDir>
+#include <QFile>
+#include <QCoreApplication>
+#include <QMetaType>
+#include "VgdbComm.h"
+#include "MassifParser.h"
+#include "Project.h"
+#include "Snapshot.h"
+#include "AsyncFileWriter.h"
+
+
+
+
+
+/** The interval (in msec) in which the scheduler checks for the due captures. */
+static const int TIMER_INTERVAL_MSEC = 250;
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// CaptureWorker:
+
+CaptureWorker::CaptureWorker(qint64 a_Pid, bool a_IsSummary, ProjectPtr a_Project, const QString & a_SnapshotFileName):
+	m_Pid(a_Pid),
+	m_IsSummary(a_IsSummary),
+	m_Project(a_Project),
+	m_SnapshotFileName(a_SnapshotFileName),
+	m_ExpectedCommand(a_Project->getCommand()),
+	m_ExpectedTimeUnit(a_Project->getTimeUnit()),
+	m_Parser(new MassifParser(a_Project)),
+	m_IsAborted(false)
+{
+	// The parser's signals carry pointers to its internal buffers, they must be handled directly in the worker thread:
+	connect(m_Parser.get(), SIGNAL(newSnapshotParsed(SnapshotPtr)),                  this, SLOT(onNewSnapshotParsed(SnapshotPtr)),                  Qt::DirectConnection);
+	connect(m_Parser.get(), SIGNAL(parsedCommand(const char *)),                     this, SLOT(onParsedCommand(const char *)),                     Qt::DirectConnection);
+	connect(m_Parser.get(), SIGNAL(parsedTimeUnit(const char *)),                    this, SLOT(onParsedTimeUnit(const char *)),                    Qt::DirectConnection);
+	connect(m_Parser.get(), SIGNAL(parseError(quint32, const char *, const char *)), this, SLOT(onParseError(quint32, const char *, const char *)), Qt::DirectConnection);
+}
+
+
+
+
+
+CaptureWorker::~CaptureWorker()
+{
+	// The owner is expected to have waited for the thread to finish:
+	assert(!isRunning());
+}
+
+
+
+
+
+void CaptureWorker::abort()
+{
+	m_IsAborted = true;
+	m_Parser->abortParsing();
+}
+
+
+
+
+
+void CaptureWorker::run()
+{
+	QByteArray stdOut, stdErr;
+	auto res = VgdbComm::canStreamSnapshots() ? captureStreamed(stdOut, stdErr) : captureViaFile(stdOut, stdErr);
+	if (m_IsAborted)
+	{
+		return;
+	}
+	if (!stdOut.isEmpty())
+	{
+		emit logEvent(tr("pid %1 stdout: %2").arg(m_Pid).arg(QString::fromUtf8(stdOut)));
+	}
+	if (!stdErr.isEmpty())
+	{
+		emit logEvent(tr("pid %1 stderr: %2").arg(m_Pid).arg(QString::fromUtf8(stdErr)));
+	}
+	if (!m_FatalError.isEmpty())
+	{
+		emit captureFailed(m_Pid, m_FatalError, true);
+		return;
+	}
+	if (!res)
+	{
+		emit captureFailed(m_Pid, tr("Failed to capture the snapshot"), false);
+		return;
+	}
+	if (m_Snapshots.empty())
+	{
+		emit captureFailed(m_Pid, tr("The captured data contains no snapshot"), false);
+		return;
+	}
+	if (m_IsSummary)
+	{
+		const auto & snapshot = m_Snapshots.back();
+		emit summaryCaptured(m_Pid, snapshot->getHeapSize() + snapshot->getHeapExtraSize());
+		return;
+	}
+	auto fileName = m_SnapshotFileName.isEmpty() ? tr("<pid %1 stream>").arg(m_Pid) : m_SnapshotFileName;
+	for (const auto & snapshot: m_Snapshots)
+	{
+		emit snapshotCaptured(m_Pid, snapshot, fileName);
+	}
+}
+
+
+
+
+
+bool CaptureWorker::captureStreamed(QByteArray & a_StdOut, QByteArray & a_StdErr)
+{
+	// If saving the snapshot, tee the data into the file, without holding up the parser:
+	std::unique_ptr<AsyncFileWriter> tee;
+	if (!m_SnapshotFileName.isEmpty())
+	{
+		tee.reset(new AsyncFileWriter(m_SnapshotFileName));
+	}
+
+	// Perform the capture, parsing the data as it arrives:
+	auto & parser = *m_Parser;
+	auto res = VgdbComm::captureSnapshotStreamed(static_cast<quint64>(m_Pid), !m_IsSummary,
+		[&tee, &parser](const char * a_Data, size_t a_Size)
+		{
+			if (tee != nullptr)
+			{
+				tee->write(QByteArray(a_Data, static_cast<int>(a_Size)));
+			}
+			parser.feed(a_Data, a_Size);
+		},
+		a_StdOut, a_StdErr, &m_IsAborted
+	);
+	if ((tee != nullptr) && !tee->finish())
+	{
+		emit logEvent(tr("Failed to save the snapshot into file %1").arg(m_SnapshotFileName));
+	}
+	if (!res)
+	{
+		// The parser is not finished, so that the possibly incomplete snapshot is dropped
+		if (tee != nullptr)
+		{
+			QFile::remove(m_SnapshotFileName);
+		}
+		return false;
+	}
+
+	// The snapshot is only complete once the whole data has been read:
+	m_Parser->finish();
+	return true;
+}
+
+
+
+
+
+bool CaptureWorker::captureViaFile(QByteArray & a_StdOut, QByteArray & a_StdErr)
+{
+	// Choose a filename for the snapshot:
+	auto fileName = m_SnapshotFileName;
+	if (fileName.isEmpty())
+	{
+		static std::atomic<int> counter(0);
+		fileName = QString("%1/VisualMassifDiff-%2-capture-pid-%3-%4.tmp")
+			.arg(QDir::tempPath())
+			.arg(QCoreApplication::applicationPid())
+			.arg(m_Pid)
+			.arg(++counter);
+	}
+
+	// Perform the capture:
+	if (!VgdbComm::captureSnapshot(static_cast<quint64>(m_Pid), fileName, a_StdOut, a_StdErr, !m_IsSummary, &m_IsAborted))
+	{
+		return false;
+	}
+	if (m_IsAborted)
+	{
+		if (m_SnapshotFileName.isEmpty())
+		{
+			QFile::remove(fileName);
+		}
+		return false;
+	}
+
+	// Parse the file:
+	bool res = false;
+	{
+		QFile f(fileName);
+		if (f.open(QFile::ReadOnly))
+		{
+			m_Parser->parse(f);
+			res = true;
+		}
+		else
+		{
+			emit logEvent(tr("Cannot open snapshot file %1 for reading").arg(fileName));
+		}
+	}
+
+	// If not saving the snapshots, remove the temp file:
+	if (m_SnapshotFileName.isEmpty())
+	{
+		QFile::remove(fileName);
+	}
+	return res;
+}
+
+
+
+
+
+void CaptureWorker::onNewSnapshotParsed(SnapshotPtr a_Snapshot)
+{
+	if (m_IsAborted || !m_FatalError.isEmpty())
+	{
+		return;
+	}
+	m_Snapshots.push_back(a_Snapshot);
+}
+
+
+
+
+
+void CaptureWorker::onParsedCommand(const char * a_Command)
+{
+	if (m_ExpectedCommand.empty() || (m_ExpectedCommand.compare(a_Command) == 0))
+	{
+		// The command used to launch the process is the same, continue processing
+		return;
+	}
+
+	// The command is different, abort parsing and report an error:
+	m_Parser->abortParsing();
+	m_FatalError = tr(
+		"Cannot use snapshots from this capture, the valgrind instance has a different commandline."
+		"Expected \"%1\", got \"%2\".")
+		.arg(QString::fromStdString(m_ExpectedCommand))
+		.arg(QString::fromUtf8(a_Command));
+}
+
+
+
+
+
+void CaptureWorker::onParsedTimeUnit(const char * a_TimeUnit)
+{
+	if (m_ExpectedTimeUnit.empty() || (m_ExpectedTimeUnit.compare(a_TimeUnit) == 0))
+	{
+		// The time units are the same, continue processing
+		return;
+	}
+
+	// The time units are different, abort parsing and report an error:
+	m_Parser->abortParsing();
+	m_FatalError = tr(
+		"Cannot use snapshots from this capture, the valgrind instance has a different time unit."
+		"Expected \"%1\", got \"%2\".")
+		.arg(QString::fromStdString(m_ExpectedTimeUnit))
+		.arg(QString::fromUtf8(a_TimeUnit));
+}
+
+
+
+
+
+void CaptureWorker::onParseError(quint32 a_LineNum, const char * a_Msg, const char * a_Line)
+{
+	emit logEvent(tr(
+		"Parser error on line %1 of pid %2 snapshot: %3\nOffending line:\n%4\n"
+		"Continuing the capture, but this snapshot will not be included.")
+		.arg(a_LineNum)
+		.arg(m_Pid)
+		.arg(QString::fromUtf8(a_Msg))
+		.arg(QString::fromUtf8(a_Line))
+	);
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// CaptureScheduler:
+
+CaptureScheduler::CaptureScheduler(ProjectPtr a_Project, QObject * a_Parent):
+	Super(a_Parent),
+	m_Project(a_Project),
+	m_Random(std::random_device()()),
+	m_MaxConcurrentCaptures(static_cast<size_t>(std::max(QThread::idealThreadCount(), 1)))
+{
+	qRegisterMetaType<SnapshotPtr>("SnapshotPtr");
+	m_Clock.start();
+	connect(&m_Timer, SIGNAL(timeout()), this, SLOT(onTimer()));
+}
+
+
+
+
+
+CaptureScheduler::~CaptureScheduler()
+{
+	for (auto worker: m_Workers)
+	{
+		disconnect(worker, nullptr, this, nullptr);
+		worker->abort();
+	}
+	for (auto worker: m_Workers)
+	{
+		worker->wait();
+		delete worker;
+	}
+}
+
+
+
+
+
+void CaptureScheduler::addTarget(qint64 a_Pid, const TargetSchedule & a_Schedule, bool a_ShouldCaptureNow)
+{
+	if (findTarget(a_Pid) != nullptr)
+	{
+		return;
+	}
+	Target target;
+	target.m_Pid = a_Pid;
+	target.m_Schedule = a_Schedule;
+	target.m_NextCaptureMsec = m_Clock.elapsed();
+	target.m_Worker = nullptr;
+	target.m_LastDetailedMsec = -1;
+	target.m_LastDetailedHeapSize = -1;
+	target.m_LastSummaryMsec = -1;
+	target.m_LastSummaryHeapSize = -1;
+	target.m_ShouldCaptureDetailed = false;
+	if (!a_ShouldCaptureNow)
+	{
+		scheduleNextCapture(target);
+	}
+	m_Targets.push_back(target);
+	if (!m_Timer.isActive())
+	{
+		m_Timer.start(TIMER_INTERVAL_MSEC);
+	}
+	if (a_ShouldCaptureNow)
+	{
+		onTimer();
+	}
+}
+
+
+
+
+
+void CaptureScheduler::removeTarget(qint64 a_Pid)
+{
+	auto itr = std::find_if(m_Targets.begin(), m_Targets.end(),
+		[a_Pid](const Target & a_Target)
+		{
+			return (a_Target.m_Pid == a_Pid);
+		}
+	);
+	if (itr == m_Targets.end())
+	{
+		return;
+	}
+	if (itr->m_Worker != nullptr)
+	{
+		// The worker is deleted once it finishes, in onWorkerFinished()
+		itr->m_Worker->abort();
+	}
+	m_Targets.erase(itr);
+}
+
+
+
+
+
+bool CaptureScheduler::hasTarget(qint64 a_Pid) const
+{
+	for (const auto & target: m_Targets)
+	{
+		if (target.m_Pid == a_Pid)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+
+
+
+std::vector<qint64> CaptureScheduler::getTargetPids() const
+{
+	std::vector<qint64> res;
+	res.reserve(m_Targets.size());
+	for (const auto & target: m_Targets)
+	{
+		res.push_back(target.m_Pid);
+	}
+	return res;
+}
+
+
+
+
+
+void CaptureScheduler::stop()
+{
+	m_Timer.stop();
+	for (auto worker: m_Workers)
+	{
+		worker->abort();
+	}
+	m_Targets.clear();
+}
+
+
+
+
+
+int CaptureScheduler::getSecondsTillNextCapture() const
+{
+	auto now = m_Clock.elapsed();
+	qint64 res = -1;
+	for (const auto & target: m_Targets)
+	{
+		if (target.m_Worker != nullptr)
+		{
+			continue;
+		}
+		auto msecLeft = std::max<qint64>(target.m_NextCaptureMsec - now, 0);
+		if ((res < 0) || (msecLeft < res))
+		{
+			res = msecLeft;
+		}
+	}
+	if (res < 0)
+	{
+		return -1;
+	}
+	return static_cast<int>((res + 999) / 1000);
+}
+
+
+
+
+
+CaptureScheduler::Target * CaptureScheduler::findTarget(qint64 a_Pid)
+{
+	for (auto & target: m_Targets)
+	{
+		if (target.m_Pid == a_Pid)
+		{
+			return &target;
+		}
+	}
+	return nullptr;
+}
+
+
+
+
+
+void CaptureScheduler::scheduleNextCapture(Target & a_Target)
+{
+	if (a_Target.m_ShouldCaptureDetailed)
+	{
+		// A summary sample has crossed a threshold, capture the details right away:
+		a_Target.m_NextCaptureMsec = m_Clock.elapsed();
+		return;
+	}
+	const auto & schedule = a_Target.m_Schedule;
+	qint64 delayMsec = static_cast<qint64>(schedule.m_IntervalSec) * 1000;
+	if (schedule.m_JitterSec > 0)
+	{
+		std::uniform_int_distribution<int> jitter(-schedule.m_JitterSec * 1000, schedule.m_JitterSec * 1000);
+		delayMsec += jitter(m_Random);
+	}
+	a_Target.m_NextCaptureMsec = m_Clock.elapsed() + std::max<qint64>(delayMsec, 0);
+}
+
+
+
+
+
+void CaptureScheduler::startCapture(Target & a_Target)
+{
+	assert(a_Target.m_Worker == nullptr);  // Only one capture per target at a time
+
+	auto isDetailed = shouldCaptureDetailed(a_Target);
+	QString fileName;
+	if (isDetailed)
+	{
+		a_Target.m_ShouldCaptureDetailed = false;
+		a_Target.m_LastDetailedMsec = m_Clock.elapsed();
+		if (m_SnapshotFileNameProvider)
+		{
+			fileName = m_SnapshotFileNameProvider(a_Target.m_Pid);
+		}
+	}
+	auto worker = new CaptureWorker(a_Target.m_Pid, !isDetailed, m_Project, fileName);
+	connect(worker, SIGNAL(snapshotCaptured(qint64, SnapshotPtr, const QString &)), this, SLOT(onWorkerSnapshotCaptured(qint64, SnapshotPtr, const QString &)));
+	connect(worker, SIGNAL(summaryCaptured(qint64, quint64)),                       this, SLOT(onWorkerSummaryCaptured(qint64, quint64)));
+	connect(worker, SIGNAL(captureFailed(qint64, const QString &, bool)),          this, SLOT(onWorkerCaptureFailed(qint64, const QString &, bool)));
+	connect(worker, SIGNAL(logEvent(const QString &)),                              this, SLOT(onWorkerLogEvent(const QString &)));
+	connect(worker, SIGNAL(finished()),                                             this, SLOT(onWorkerFinished()));
+	a_Target.m_Worker = worker;
+	m_Workers.insert(worker);
+	worker->start();
+	if (isDetailed)
+	{
+		emit captureStarted(a_Target.m_Pid);
+	}
+}
+
+
+
+
+
+bool CaptureScheduler::shouldCaptureDetailed(const Target & a_Target) const
+{
+	const auto & schedule = a_Target.m_Schedule;
+	if (!schedule.m_IsAdaptive || a_Target.m_ShouldCaptureDetailed || (a_Target.m_LastDetailedMsec < 0))
+	{
+		return true;
+	}
+	return (m_Clock.elapsed() - a_Target.m_LastDetailedMsec >= static_cast<qint64>(schedule.m_MaxIntervalSec) * 1000);
+}
+
+
+
+
+
+size_t CaptureScheduler::getNumActiveWorkers() const
+{
+	size_t res = 0;
+	for (const auto worker: m_Workers)
+	{
+		if (!worker->isAborted())
+		{
+			res += 1;
+		}
+	}
+	return res;
+}
+
+
+
+
+
+void CaptureScheduler::onTimer()
+{
+	// Collect the due targets first, the signal handlers may modify m_Targets:
+	auto now = m_Clock.elapsed();
+	std::vector<qint64> duePids;
+	for (const auto & target: m_Targets)
+	{
+		if ((target.m_Worker == nullptr) && (target.m_NextCaptureMsec <= now))
+		{
+			duePids.push_back(target.m_Pid);
+		}
+	}
+
+	auto numActive = getNumActiveWorkers();
+	for (auto pid: duePids)
+	{
+		if (numActive >= m_MaxConcurrentCaptures)
+		{
+			// The rest of the due captures will start once some of the running ones finish
+			return;
+		}
+		auto target = findTarget(pid);
+		if ((target == nullptr) || (target->m_Worker != nullptr))
+		{
+			continue;
+		}
+		startCapture(*target);
+		numActive += 1;
+	}
+}
+
+
+
+
+
+void CaptureScheduler::onWorkerSnapshotCaptured(qint64 a_Pid, SnapshotPtr a_Snapshot, const QString & a_FileName)
+{
+	auto worker = qobject_cast<CaptureWorker *>(sender());
+	if ((worker == nullptr) || worker->isAborted())
+	{
+		// The target has been removed meanwhile
+		return;
+	}
+	auto target = findTarget(a_Pid);
+	if (target != nullptr)
+	{
+		target->m_LastDetailedHeapSize = static_cast<qint64>(a_Snapshot->getHeapSize() + a_Snapshot->getHeapExtraSize());
+	}
+	emit snapshotCaptured(a_Pid, a_Snapshot, a_FileName);
+}
+
+
+
+
+
+void CaptureScheduler::onWorkerSummaryCaptured(qint64 a_Pid, quint64 a_HeapSize)
+{
+	auto worker = qobject_cast<CaptureWorker *>(sender());
+	auto target = findTarget(a_Pid);
+	if ((worker == nullptr) || worker->isAborted() || (target == nullptr))
+	{
+		// The target has been removed meanwhile
+		return;
+	}
+	const auto & schedule = target->m_Schedule;
+	auto now = m_Clock.elapsed();
+	auto heapSize = static_cast<qint64>(a_HeapSize);
+
+	// Check the change since the last detailed snapshot:
+	if ((schedule.m_HeapChangeThreshold > 0) && (target->m_LastDetailedHeapSize >= 0))
+	{
+		auto change = static_cast<quint64>(std::abs(heapSize - target->m_LastDetailedHeapSize));
+		if (change >= schedule.m_HeapChangeThreshold)
+		{
+			emit logEvent(tr("pid %1: the heap has changed by %2 bytes, capturing the details").arg(a_Pid).arg(change));
+			target->m_ShouldCaptureDetailed = true;
+		}
+	}
+
+	// Check the growth rate since the last summary sample:
+	if (
+		!target->m_ShouldCaptureDetailed &&
+		(schedule.m_GrowthRateThreshold > 0) &&
+		(target->m_LastSummaryMsec >= 0) &&
+		(now > target->m_LastSummaryMsec)
+	)
+	{
+		auto change = static_cast<quint64>(std::abs(heapSize - target->m_LastSummaryHeapSize));
+		auto rate = change * 1000 / static_cast<quint64>(now - target->m_LastSummaryMsec);
+		if (rate >= schedule.m_GrowthRateThreshold)
+		{
+			emit logEvent(tr("pid %1: the heap is changing by %2 bytes per second, capturing the details").arg(a_Pid).arg(rate));
+			target->m_ShouldCaptureDetailed = true;
+		}
+	}
+
+	target->m_LastSummaryMsec = now;
+	target->m_LastSummaryHeapSize = heapSize;
+}
+
+
+
+
+
+void CaptureScheduler::onWorkerCaptureFailed(qint64 a_Pid, const QString & a_Reason, bool a_IsFatal)
+{
+	auto worker = qobject_cast<CaptureWorker *>(sender());
+	if ((worker == nullptr) || worker->isAborted())
+	{
+		// The target has been removed meanwhile
+		return;
+	}
+	emit captureFailed(a_Pid, a_Reason, a_IsFatal);
+}
+
+
+
+
+
+void CaptureScheduler::onWorkerLogEvent(const QString & a_Message)
+{
+	emit logEvent(a_Message);
+}
+
+
+
+
+
+void CaptureScheduler::onWorkerFinished()
+{
+	auto worker = qobject_cast<CaptureWorker *>(sender());
+	if (worker == nullptr)
+	{
+		return;
+	}
+	m_Workers.erase(worker);
+	auto target = findTarget(worker->getPid());
+	if ((target != nullptr) && (target->m_Worker == worker))
+	{
+		target->m_Worker = nullptr;
+		scheduleNextCapture(*target);
+	}
+	worker->deleteLater();
+
+	// A worker slot is free now, start any capture that is waiting for it:
+	onTimer();
+}
+
+
+
+
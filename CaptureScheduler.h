@@ -0,0 +1,341 @@
+// CaptureScheduler.h
+
+// Declares the CaptureScheduler class that periodically captures snapshots of multiple valgrind instances
+
+// Declares the CaptureWorker class that represents the background thread doing a single capture
+
+
+
+
+
+#ifndef CAPTURESCHEDULER_H
+#define CAPTURESCHEDULER_H
+
+
+
+
+
+#include <memory>
+#include <list>
+#include <set>
+#include <vector>
+#include <atomic>
+#include <random>
+#include <functional>
+#include <QThread>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QString>
+
+
+
+
+
+// fwd:
+class Project;
+typedef std::shared_ptr<Project> ProjectPtr;
+class Snapshot;
+typedef std::shared_ptr<Snapshot> SnapshotPtr;
+typedef std::list<SnapshotPtr> SnapshotPtrs;
+class MassifParser;
+
+
+
+
+
+/** The background thread that captures a single snapshot of a single valgrind instance, and parses it.
+The snapshot is bound to the project's CodeLocations, but not added to the project.
+All signals are emitted from the worker thread, the receivers are expected to use queued connections. */
+class CaptureWorker:
+	public QThread
+{
+	typedef QThread Super;
+	Q_OBJECT
+
+public:
+
+	/** Creates a new worker for capturing the specified instance.
+	If a_IsSummary is true, only the heap totals are captured (summaryCaptured() is emitted instead of snapshotCaptured()).
+	If a_SnapshotFileName is not empty, the raw snapshot data is saved into that file as well.
+	The snapshot is rejected if its command or time unit doesn't match the (non-empty) ones of the project. */
+	CaptureWorker(qint64 a_Pid, bool a_IsSummary, ProjectPtr a_Project, const QString & a_SnapshotFileName);
+
+	virtual ~CaptureWorker();
+
+	/** Requests the capture to be aborted as soon as possible.
+	Can be called from any thread. No more signals will be emitted after the abort is noticed. */
+	void abort();
+
+	/** Returns true if abort() has been called. */
+	bool isAborted() const { return m_IsAborted; }
+
+	qint64 getPid() const { return m_Pid; }
+	bool isSummary() const { return m_IsSummary; }
+
+signals:
+
+	/** Emitted when the snapshot has been captured and parsed.
+	a_FileName is the file into which the snapshot was saved, or a description of the source if it wasn't saved. */
+	void snapshotCaptured(qint64 a_Pid, SnapshotPtr a_Snapshot, const QString & a_FileName);
+
+	/** Emitted when the heap totals have been captured, for summary captures. a_HeapSize includes the extra heap size. */
+	void summaryCaptured(qint64 a_Pid, quint64 a_HeapSize);
+
+	/** Emitted when the capture fails.
+	a_IsFatal is true if the instance cannot be captured into the project at all (different command or time unit). */
+	void captureFailed(qint64 a_Pid, const QString & a_Reason, bool a_IsFatal);
+
+	/** Emitted when a message should be appended to the log. */
+	void logEvent(const QString & a_Message);
+
+protected:
+
+	/** PID of the instance to capture. */
+	qint64 m_Pid;
+
+	/** If true, only the heap totals are captured. */
+	bool m_IsSummary;
+
+	/** The project to whose CodeLocations the snapshot is bound. */
+	ProjectPtr m_Project;
+
+	/** The file into which the snapshot is saved, empty if not saving. */
+	QString m_SnapshotFileName;
+
+	/** The command and time unit of the project when the capture was scheduled, empty if not known yet. */
+	std::string m_ExpectedCommand;
+	std::string m_ExpectedTimeUnit;
+
+	/** The parser used for the captured data. */
+	std::unique_ptr<MassifParser> m_Parser;
+
+	/** Set to true by abort(). */
+	std::atomic<bool> m_IsAborted;
+
+	/** The snapshots parsed from the captured data. */
+	SnapshotPtrs m_Snapshots;
+
+	/** The reason why the instance cannot be captured into the project, empty if there's no such problem. */
+	QString m_FatalError;
+
+
+	// QThread overrides:
+	virtual void run() override;
+
+	/** Captures the snapshot by streaming it from vgdb directly into the parser.
+	Returns true on success. */
+	bool captureStreamed(QByteArray & a_StdOut, QByteArray & a_StdErr);
+
+	/** Captures the snapshot by letting vgdb write it into a file, then parsing the file.
+	Used where the snapshots cannot be streamed. Returns true on success. */
+	bool captureViaFile(QByteArray & a_StdOut, QByteArray & a_StdErr);
+
+protected slots:
+
+	// Handlers for the MassifParser's signals, called directly in the worker thread:
+	void onNewSnapshotParsed(SnapshotPtr a_Snapshot);
+	void onParsedCommand(const char * a_Command);
+	void onParsedTimeUnit(const char * a_TimeUnit);
+	void onParseError(quint32 a_LineNum, const char * a_Msg, const char * a_Line);
+};
+
+
+
+
+
+/** Periodically captures snapshots of multiple valgrind instances (targets), each with its own interval.
+The captures run on background threads, so the thread in which the scheduler lives (the UI thread) is never
+blocked by vgdb or by the parsing. Each target has at most one capture running at a time; its next capture is
+scheduled once the previous one completes, after the target's interval randomly adjusted by up to its jitter.
+All the signals are emitted in the thread in which the CaptureScheduler lives. */
+class CaptureScheduler:
+	public QObject
+{
+	typedef QObject Super;
+	Q_OBJECT
+
+public:
+
+	/** The schedule of a single target. */
+	struct TargetSchedule
+	{
+		/** The interval between the captures. In the adaptive mode, the interval between the summary samples. */
+		int m_IntervalSec;
+
+		/** The maximum random deviation of each capture from the interval. */
+		int m_JitterSec;
+
+		/** If true, a cheap summary (heap totals only) is sampled each interval, and the detailed snapshot is captured
+		only when the heap changes by at least m_HeapChangeThreshold since the last detailed snapshot, or the heap grows
+		or shrinks at least at m_GrowthRateThreshold, or after m_MaxIntervalSec without a detailed snapshot. */
+		bool m_IsAdaptive;
+
+		/** The maximum interval between the detailed snapshots, in the adaptive mode. */
+		int m_MaxIntervalSec;
+
+		/** The heap size change (in bytes) that triggers a detailed snapshot, in the adaptive mode. 0 to disable. */
+		quint64 m_HeapChangeThreshold;
+
+		/** The heap growth rate (in bytes per second) that triggers a detailed snapshot, in the adaptive mode. 0 to disable. */
+		quint64 m_GrowthRateThreshold;
+
+		TargetSchedule():
+			m_IntervalSec(30),
+			m_JitterSec(0),
+			m_IsAdaptive(false),
+			m_MaxIntervalSec(300),
+			m_HeapChangeThreshold(0),
+			m_GrowthRateThreshold(0)
+		{
+		}
+	};
+
+
+	/** Function that returns the name of the file into which the next snapshot of the specified instance is to be
+	saved, or an empty string if the snapshot shouldn't be saved. */
+	typedef std::function<QString(qint64 a_Pid)> SnapshotFileNameProvider;
+
+
+	/** Creates a new scheduler that binds the captured snapshots to the specified project's CodeLocations.
+	The captures start once the targets are added. */
+	explicit CaptureScheduler(ProjectPtr a_Project, QObject * a_Parent = nullptr);
+
+	/** Aborts all running captures and waits for them to finish. */
+	virtual ~CaptureScheduler();
+
+	/** Adds the instance as a new target to be captured.
+	If a_ShouldCaptureNow is true, the first capture starts right away, otherwise after the interval.
+	Does nothing if the instance is already a target. */
+	void addTarget(qint64 a_Pid, const TargetSchedule & a_Schedule, bool a_ShouldCaptureNow);
+
+	/** Removes the target, aborting its capture, if running. */
+	void removeTarget(qint64 a_Pid);
+
+	/** Returns true if the specified instance is a target. */
+	bool hasTarget(qint64 a_Pid) const;
+
+	/** Returns the PIDs of all the targets. */
+	std::vector<qint64> getTargetPids() const;
+
+	/** Removes all the targets, aborting all the running captures. */
+	void stop();
+
+	/** Sets the function that provides the file names for saving the snapshots.
+	If not set, the snapshots are not saved. */
+	void setSnapshotFileNameProvider(SnapshotFileNameProvider a_Provider) { m_SnapshotFileNameProvider = a_Provider; }
+
+	/** Sets the maximum number of captures running at the same time, the other due captures wait for them. */
+	void setMaxConcurrentCaptures(size_t a_MaxConcurrentCaptures) { m_MaxConcurrentCaptures = a_MaxConcurrentCaptures; }
+
+	/** Returns the number of seconds till the earliest scheduled capture, or -1 if there's none scheduled. */
+	int getSecondsTillNextCapture() const;
+
+signals:
+
+	/** Emitted when a (detailed) capture of the instance starts. The summary captures are not reported. */
+	void captureStarted(qint64 a_Pid);
+
+	/** Emitted when a snapshot of the instance has been captured and parsed.
+	The snapshot is not added to the project, that is up to the receiver. */
+	void snapshotCaptured(qint64 a_Pid, SnapshotPtr a_Snapshot, const QString & a_FileName);
+
+	/** Emitted when a capture fails. The target stays scheduled, it is up to the receiver to remove it. */
+	void captureFailed(qint64 a_Pid, const QString & a_Reason, bool a_IsFatal);
+
+	/** Emitted when a message should be appended to the log. */
+	void logEvent(const QString & a_Message);
+
+protected:
+
+	/** A single instance being captured. */
+	struct Target
+	{
+		qint64 m_Pid;
+		TargetSchedule m_Schedule;
+
+		/** The time (in m_Clock msec) of the next capture. */
+		qint64 m_NextCaptureMsec;
+
+		/** The worker doing the current capture, nullptr if not capturing. */
+		CaptureWorker * m_Worker;
+
+		// Adaptive mode state:
+
+		/** The time (in m_Clock msec) when the last detailed capture started, -1 if there was none yet. */
+		qint64 m_LastDetailedMsec;
+
+		/** The heap size in the last detailed snapshot, -1 if there was none yet. */
+		qint64 m_LastDetailedHeapSize;
+
+		/** The time (in m_Clock msec) and heap size of the last summary sample, -1 if there was none yet. */
+		qint64 m_LastSummaryMsec;
+		qint64 m_LastSummaryHeapSize;
+
+		/** Set when a summary sample crosses a threshold, the next capture is then a detailed one, started right away. */
+		bool m_ShouldCaptureDetailed;
+	};
+
+
+	/** The project to whose CodeLocations the snapshots are bound. */
+	ProjectPtr m_Project;
+
+	/** All the targets. */
+	std::vector<Target> m_Targets;
+
+	/** All the running workers, including the aborted ones for removed targets. */
+	std::set<CaptureWorker *> m_Workers;
+
+	/** The timer that checks for the due captures. */
+	QTimer m_Timer;
+
+	/** The time base for scheduling the captures. */
+	QElapsedTimer m_Clock;
+
+	/** The random generator for the jitter. */
+	std::minstd_rand m_Random;
+
+	/** The maximum number of non-aborted workers running at the same time. */
+	size_t m_MaxConcurrentCaptures;
+
+	/** Provides the file names for saving the snapshots. */
+	SnapshotFileNameProvider m_SnapshotFileNameProvider;
+
+
+	/** Returns the target for the specified instance, or nullptr if there's no such target. */
+	Target * findTarget(qint64 a_Pid);
+
+	/** Sets the time of the target's next capture to its interval (adjusted by the jitter) from now. */
+	void scheduleNextCapture(Target & a_Target);
+
+	/** Starts capturing the target on a new worker.
+	In the adaptive mode, decides between a summary and a detailed capture. */
+	void startCapture(Target & a_Target);
+
+	/** Returns true if the next capture of the target should be a detailed one. */
+	bool shouldCaptureDetailed(const Target & a_Target) const;
+
+	/** Returns the number of workers that haven't been aborted. */
+	size_t getNumActiveWorkers() const;
+
+protected slots:
+
+	/** Starts the captures that are due. */
+	void onTimer();
+
+	// Handlers for the CaptureWorker's signals:
+	void onWorkerSnapshotCaptured(qint64 a_Pid, SnapshotPtr a_Snapshot, const QString & a_FileName);
+	void onWorkerSummaryCaptured(qint64 a_Pid, quint64 a_HeapSize);
+	void onWorkerCaptureFailed(qint64 a_Pid, const QString & a_Reason, bool a_IsFatal);
+	void onWorkerLogEvent(const QString & a_Message);
+	void onWorkerFinished();
+};
+
+
+
+
+
+#endif // CAPTURESCHEDULER_H
+
+
+
+
@@ -8,6 +8,7 @@
 
 #include "Globals.h"
 #include "CodeLocationFactory.h"
+#include <algorithm>
 #include "CodeLocation.h"
 
 
@@ -24,14 +25,16 @@ CodeLocationFactory::CodeLocationFactory()
 
 CodeLocationPtr CodeLocationFactory::getCodeLocation(quint64 a_Address, bool & a_IsNew)
 {
-	auto itr = m_CodeLocations.find(a_Address);
-	if (itr != m_CodeLocations.end())
+	auto & shard = m_Shards[shardIndex(a_Address)];
+	QMutexLocker lock(&shard.m_Mutex);
+	auto itr = shard.m_CodeLocations.find(a_Address);
+	if (itr != shard.m_CodeLocations.end())
 	{
 		a_IsNew = false;
 		return itr->second;
 	}
 	auto loc = std::make_shared<CodeLocation>(a_Address);
-	m_CodeLocations.insert(itr, std::make_pair(a_Address, loc));
+	shard.m_CodeLocations.insert(std::make_pair(a_Address, loc));
 	a_IsNew = true;
 	return loc;
 }
@@ -39,3 +42,62 @@ CodeLocationPtr CodeLocationFactory::getCodeLocation(quint64 a_Address, bool & a
 
 
 
+
+CodeLocationPtr CodeLocationFactory::getCodeLocation(quint64 a_Address, const std::function<void(CodeLocation &)> & a_Initialize)
+{
+	auto & shard = m_Shards[shardIndex(a_Address)];
+	{
+		QMutexLocker lock(&shard.m_Mutex);
+		auto itr = shard.m_CodeLocations.find(a_Address);
+		if (itr != shard.m_CodeLocations.end())
+		{
+			return itr->second;
+		}
+	}
+
+	// Fill in the new instance before it gets into the map, the shard lock then publishes it fully initialized:
+	auto loc = std::make_shared<CodeLocation>(a_Address);
+	a_Initialize(*loc);
+
+	// Another thread may have published the same address meanwhile, keep its instance in that case:
+	QMutexLocker lock(&shard.m_Mutex);
+	return shard.m_CodeLocations.insert(std::make_pair(a_Address, loc)).first->second;
+}
+
+
+
+
+
+std::vector<CodeLocationPtr> CodeLocationFactory::getAllCodeLocations() const
+{
+	std::vector<CodeLocationPtr> res;
+	for (const auto & shard: m_Shards)
+	{
+		QMutexLocker lock(&shard.m_Mutex);
+		for (const auto & cl: shard.m_CodeLocations)
+		{
+			res.push_back(cl.second);
+		}
+	}
+	std::sort(res.begin(), res.end(), [](const CodeLocationPtr & a_First, const CodeLocationPtr & a_Second)
+		{
+			return (a_First->getAddress() < a_Second->getAddress());
+		}
+	);
+	return res;
+}
+
+
+
+
+
+size_t CodeLocationFactory::shardIndex(quint64 a_Address)
+{
+	// Code addresses are mostly aligned and clustered, mix the higher bits into the lower ones:
+	auto mixed = a_Address ^ (a_Address >> 7) ^ (a_Address >> 17);
+	return static_cast<size_t>(mixed % NUM_SHARDS);
+}
+
+
+
+
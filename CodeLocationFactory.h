@@ -13,9 +13,11 @@
 
 
 
-#include <map>
+#include <functional>
+#include <unordered_map>
+#include <vector>
 #include <memory>
-#include <Qt>
+#include <QMutex>
 
 
 
@@ -31,27 +33,56 @@ typedef std::shared_ptr<CodeLocation> CodeLocationPtr;
 
 /** An instance of this class manages all the CodeLocation instances for a single project. The point is to
 share the same CodeLocationPtr in all Snapshots that reference the same address, thus making it simple
-to query a history of allocations for a given CodeLocation. */
+to query a history of allocations for a given CodeLocation.
+The factory is thread-safe, so that multiple parsers can use it concurrently. The CodeLocations are split
+into shards by their address, each shard has its own lock, so that the parsers rarely contend. */
 class CodeLocationFactory
 {
 public:
-	/** The type used for storing the CodeLocation instances with a fast address lookup. */
-	typedef std::map<quint64, CodeLocationPtr> CodeLocationsMap;
-
 
 	CodeLocationFactory();
 
 	/** Returns a CodeLocation instance corresponding to the specified address.
 	If the address hasn't been seen yet, a new CodeLocation instance is created and a_IsNew is set to true;
-	otherwise a cached CodeLocation is used instead and a_IsNew is set to false. */
+	otherwise a cached CodeLocation is used instead and a_IsNew is set to false.
+	If multiple threads ask for the same new address at the same time, only one of them gets a_IsNew set to true,
+	that one is then responsible for filling in the location details.
+	The new instance is visible to other threads before its details are filled in, so this is only suitable while
+	the factory is not shared yet (such as when loading a project); use the overload with an initializer otherwise. */
 	CodeLocationPtr getCodeLocation(quint64 a_Address, bool & a_IsNew);
 
-	const CodeLocationsMap & getAllCodeLocations() const { return m_CodeLocations; }
+	/** Returns a CodeLocation instance corresponding to the specified address.
+	If the address hasn't been seen yet, a new CodeLocation instance is created and a_Initialize is called to fill in
+	its details before the instance is published, so that other threads never see a partially filled location.
+	a_Initialize is called without holding any lock; if another thread publishes the same address meanwhile,
+	that thread's instance is returned and the one initialized here is dropped. */
+	CodeLocationPtr getCodeLocation(quint64 a_Address, const std::function<void(CodeLocation &)> & a_Initialize);
+
+	/** Returns all the CodeLocation instances, sorted by their address. */
+	std::vector<CodeLocationPtr> getAllCodeLocations() const;
 
 protected:
 
-	/** The map of already-known CodeLocation instances. */
-	CodeLocationsMap m_CodeLocations;
+	/** The number of shards into which the CodeLocations are split. */
+	static const size_t NUM_SHARDS = 64;
+
+	/** A single part of the CodeLocations map, with its own lock. */
+	struct Shard
+	{
+		/** The lock protecting m_CodeLocations. */
+		mutable QMutex m_Mutex;
+
+		/** The map of already-known CodeLocation instances in this shard. */
+		std::unordered_map<quint64, CodeLocationPtr> m_CodeLocations;
+	};
+
+
+	/** The shards into which the CodeLocations are split, based on shardIndex(). */
+	Shard m_Shards[NUM_SHARDS];
+
+
+	/** Returns the index of the shard that holds the specified address. */
+	static size_t shardIndex(quint64 a_Address);
 };
 
 
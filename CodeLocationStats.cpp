@@ -40,7 +40,8 @@ CodeLocationStats::Stats::Stats():
 CodeLocationStats::CodeLocationStats(Project * a_Project):
 	m_Project(a_Project)
 {
-	connect(m_Project, SIGNAL(addingSnapshot(SnapshotPtr)), this, SLOT(onProjectAddingSnapshot(SnapshotPtr)));
+	// The stats need to be updated before the snapshot is inserted, even if the project lives in another thread:
+	connect(m_Project, SIGNAL(addingSnapshot(SnapshotPtr)), this, SLOT(onProjectAddingSnapshot(SnapshotPtr)), Qt::DirectConnection);
 }
 
 
@@ -101,19 +102,19 @@ std::vector<CodeLocationStats::Stats> CodeLocationStats::getAllStats()
 
 
 
-void CodeLocationStats::updateStatsByAllocation(Allocation * a_Allocation)
+void CodeLocationStats::updateStatsByAllocation(const Allocation & a_Allocation)
 {
 	auto numSnapshots = m_Project->getNumSnapshots();
-	for (const auto ch: a_Allocation->getChildren())
+	for (const auto ch: a_Allocation.getChildren())
 	{
-		auto loc = ch->getCodeLocation().get();
+		auto loc = ch.getCodeLocation().get();
 		auto & stats = m_Stats[loc];
 		if (stats.m_CodeLocation != nullptr)
 		{
 			stats.m_CodeLocation = loc + 1;
 		}
 		stats.m_CodeLocation = loc;  // If the location wasn't present yet - a new one was created
-		auto s = ch->getAllocationSize();
+		auto s = ch.getAllocationSize();
 		if (stats.m_MaxAllocationSize < s)
 		{
 			stats.m_MaxAllocationSize = s;
@@ -123,7 +124,7 @@ void CodeLocationStats::updateStatsByAllocation(Allocation * a_Allocation)
 			stats.m_MinAllocationSize = s;
 		}
 		stats.m_AvgAllocationSize = (stats.m_AvgAllocationSize * numSnapshots + s) / (numSnapshots + 1);
-		updateStatsByAllocation(ch.get());
+		updateStatsByAllocation(ch);
 	}
 }
 
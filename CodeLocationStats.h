@@ -83,7 +83,7 @@ protected:
 	/** Recursively updates the stats when adding a snapshot to the project.
 	The specified allocation and all its (recursive) children are updated.
 	The snapshot is not yet added to the project. */
-	void updateStatsByAllocation(Allocation * a_Allocation);
+	void updateStatsByAllocation(const Allocation & a_Allocation);
 };
 
 
@@ -22,16 +22,16 @@ CodeLocationStatsModel::CodeLocationStatsModel(ProjectPtr a_Project):
 	m_Project(a_Project)
 {
 	rebuildModel();
-	connect(a_Project.get(), SIGNAL(addedSnapshot(SnapshotPtr)), this, SLOT(addedSnapshot(SnapshotPtr)));
+	connect(a_Project.get(), SIGNAL(addedSnapshots(SnapshotPtrs)), this, SLOT(addedSnapshots(SnapshotPtrs)));
 }
 
 
 
 
 
-void CodeLocationStatsModel::addedSnapshot(SnapshotPtr a_Snapshot)
+void CodeLocationStatsModel::addedSnapshots(SnapshotPtrs a_Snapshots)
 {
-	Q_UNUSED(a_Snapshot);
+	Q_UNUSED(a_Snapshots);
 	rebuildModel();
 }
 
@@ -14,6 +14,7 @@
 
 
 #include <memory>
+#include <list>
 #include <QAbstractTableModel>
 #include "CodeLocationStats.h"
 
@@ -24,6 +25,9 @@
 // fwd:
 class Project;
 typedef std::shared_ptr<Project> ProjectPtr;
+class Snapshot;
+typedef std::shared_ptr<Snapshot> SnapshotPtr;
+typedef std::list<SnapshotPtr> SnapshotPtrs;
 
 
 
@@ -51,9 +55,9 @@ signals:
 
 public slots:
 
-	/** Called after a new snapshot has been added to the project.
+	/** Called after a batch of new snapshots has been added to the project.
 	Resets and rebuilds the model. */
-	void addedSnapshot(SnapshotPtr a_Snapshot);
+	void addedSnapshots(SnapshotPtrs a_Snapshots);
 
 protected:
 
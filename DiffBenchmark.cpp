@@ -0,0 +1,298 @@
+// DiffBenchmark.cpp
+
+// Implements the micro-benchmark comparing the SnapshotDiff child matching with the per-child lookup it replaced
+// Built only with the BUILD_BENCHMARKS CMake option, it is not a part of the application
+
+// Usage: DiffBenchmark [<NumNodes> [<Seed>]]
+
+
+
+
+
+#include "Globals.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_set>
+#include "Allocation.h"
+#include "CodeLocation.h"
+#include "Snapshot.h"
+#include "SnapshotDiff.h"
+
+
+
+
+
+/** The default number of nodes in the generated tree. */
+static const size_t DEFAULT_NUM_NODES = 200000;
+
+/** The number of distinct CodeLocations used by the generated tree. */
+static const quint32 NUM_CODE_LOCATIONS = 20000;
+
+/** How many times each matching is run; the best time is reported. */
+static const int NUM_REPEATS = 5;
+
+
+
+
+
+/** A node of the generated tree, before it is converted into Allocations. */
+struct GenNode
+{
+	/** Index of the node's CodeLocation. */
+	quint32 m_CodeLocation;
+
+	/** The node's allocation size. */
+	quint64 m_Size;
+
+	/** Indices of the node's children in the generated tree. */
+	std::vector<quint32> m_Children;
+};
+
+typedef std::vector<GenNode> GenTree;
+
+
+
+
+
+/** Appends a new node with the specified CodeLocation as the last child of a_Parent, returns its index. */
+static quint32 addGenNode(GenTree & a_Tree, quint32 a_Parent, quint32 a_CodeLocation, quint64 a_Size)
+{
+	auto idx = static_cast<quint32>(a_Tree.size());
+	GenNode node;
+	node.m_CodeLocation = a_CodeLocation;
+	node.m_Size = a_Size;
+	a_Tree.push_back(node);
+	a_Tree[a_Parent].m_Children.push_back(idx);
+	return idx;
+}
+
+
+
+
+
+/** Generates a random tree of about a_NumNodes nodes, breadth-first.
+Most nodes have a few children, but some are wide, similar to the allocation functions called from many places.
+The siblings have distinct CodeLocations. */
+static GenTree generateTree(size_t a_NumNodes, std::mt19937 & a_Rng)
+{
+	GenTree tree(1);
+	tree[0].m_CodeLocation = 0;
+	tree[0].m_Size = 0;
+	for (size_t idx = 0; (idx < tree.size()) && (tree.size() < a_NumNodes); ++idx)
+	{
+		size_t numChildren;
+		if ((idx == 0) || (a_Rng() % 200 == 0))
+		{
+			numChildren = 500 + a_Rng() % 4500;
+		}
+		else
+		{
+			numChildren = a_Rng() % 5;
+		}
+		numChildren = std::min(numChildren, a_NumNodes - tree.size());
+		std::unordered_set<quint32> usedCodeLocations;
+		while (usedCodeLocations.size() < numChildren)
+		{
+			auto cl = 1 + a_Rng() % NUM_CODE_LOCATIONS;
+			if (usedCodeLocations.insert(cl).second)
+			{
+				addGenNode(tree, static_cast<quint32>(idx), cl, 1 + a_Rng() % 100000);
+			}
+		}
+	}
+	return tree;
+}
+
+
+
+
+
+/** Returns a copy of the tree with some of the sizes changed, and some of the children removed or added,
+the way a later snapshot of the same program usually differs. */
+static GenTree mutateTree(const GenTree & a_Tree, std::mt19937 & a_Rng)
+{
+	auto res = a_Tree;
+	auto numNodes = res.size();
+	for (size_t idx = 0; idx < numNodes; ++idx)
+	{
+		auto r = a_Rng() % 1000;
+		if (r < 20)
+		{
+			res[idx].m_Size = 1 + a_Rng() % 100000;
+		}
+		else if ((r < 25) && !res[idx].m_Children.empty())
+		{
+			res[idx].m_Children.erase(res[idx].m_Children.begin() + a_Rng() % res[idx].m_Children.size());
+		}
+		else if (r < 30)
+		{
+			// The new CodeLocations are outside of the generated range, so that the siblings stay distinct:
+			addGenNode(res, static_cast<quint32>(idx), NUM_CODE_LOCATIONS + 1 + static_cast<quint32>(idx), 1 + a_Rng() % 100000);
+		}
+	}
+	return res;
+}
+
+
+
+
+
+/** Creates a snapshot containing the generated tree, finished the same way as the MassifParser finishes its snapshots.
+If a_ShouldIndex is false, the child index is not built, so findCodeLocationChild() scans the children linearly. */
+static SnapshotPtr createSnapshot(const GenTree & a_Tree, const std::vector<CodeLocationPtr> & a_CodeLocations, bool a_ShouldIndex)
+{
+	auto res = std::make_shared<Snapshot>();
+	std::vector<std::pair<quint32, Allocation>> toBuild;
+	toBuild.emplace_back(0, res->createRootAllocation());
+	while (!toBuild.empty())
+	{
+		auto node = toBuild.back().first;
+		auto allocation = toBuild.back().second;
+		toBuild.pop_back();
+		const auto & genNode = a_Tree[node];
+		allocation.setAllocationSize(genNode.m_Size);
+		allocation.setType((node == 0) ? Allocation::atRoot : Allocation::atRegular);
+		if (node != 0)
+		{
+			allocation.setCodeLocation(a_CodeLocations[genNode.m_CodeLocation]);
+		}
+		for (auto ch: genNode.m_Children)
+		{
+			toBuild.emplace_back(ch, allocation.addChild());
+		}
+	}
+	res->getRootAllocation().sortBySize();
+	res->finishAllocations();
+	if (a_ShouldIndex)
+	{
+		res->buildChildIndex();
+	}
+	return res;
+}
+
+
+
+
+
+/** Matches the whole trees the way SnapshotDiff did before matching the CodeLocation-sorted child lists:
+each child of a_First is looked up by a_Second.findCodeLocationChild(), and the matched children are remembered
+in a set, so that the unmatched children of a_Second can be found. Returns the number of the diff items. */
+static size_t matchByLookup(const Allocation & a_First, const Allocation & a_Second)
+{
+	size_t res = 0;
+	std::unordered_set<quint32> processed;
+	for (const auto & ch: a_First.getChildren())
+	{
+		if (ch.getCodeLocation() == nullptr)
+		{
+			continue;
+		}
+		res += 1;
+		auto match = a_Second.findCodeLocationChild(ch.getCodeLocation().get());
+		if (match.isValid())
+		{
+			res += matchByLookup(ch, match);
+			processed.insert(match.getIndex());
+		}
+	}
+	for (const auto & ch: a_Second.getChildren())
+	{
+		if ((ch.getCodeLocation() != nullptr) && (processed.find(ch.getIndex()) == processed.end()))
+		{
+			res += 1;
+		}
+	}
+	return res;
+}
+
+
+
+
+
+/** Matches the whole trees by SnapshotDiff::matchChildren(). Returns the number of the diff items. */
+static size_t matchByMerge(const SnapshotDiff & a_Diff, const Allocation & a_First, const Allocation & a_Second)
+{
+	size_t res = 0;
+	for (const auto & match: a_Diff.matchChildren(a_First, a_Second))
+	{
+		res += 1;
+		if (match.first.isValid() && match.second.isValid())
+		{
+			res += matchByMerge(a_Diff, match.first, match.second);
+		}
+	}
+	return res;
+}
+
+
+
+
+
+/** Runs the function NUM_REPEATS times, returns the best time in milliseconds.
+a_NumItems receives the function's result, so that the work cannot be optimized away and the results can be compared. */
+template <typename Function>
+static double measureBestMsec(Function a_Function, size_t & a_NumItems)
+{
+	double res = 0;
+	for (int i = 0; i < NUM_REPEATS; ++i)
+	{
+		auto start = std::chrono::steady_clock::now();
+		a_NumItems = a_Function();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if ((i == 0) || (elapsed.count() < res))
+		{
+			res = elapsed.count();
+		}
+	}
+	return res;
+}
+
+
+
+
+
+int main(int argc, char * argv[])
+{
+	auto numNodes = (argc > 1) ? static_cast<size_t>(std::strtoull(argv[1], nullptr, 10)) : DEFAULT_NUM_NODES;
+	auto seed = (argc > 2) ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 1u;
+	std::mt19937 rng(seed);
+
+	// Generate the trees:
+	std::vector<CodeLocationPtr> codeLocations;
+	for (quint32 i = 0; i <= NUM_CODE_LOCATIONS; ++i)
+	{
+		codeLocations.push_back(std::make_shared<CodeLocation>(0x1000 + 16 * i));
+	}
+	auto firstTree = generateTree(numNodes, rng);
+	auto secondTree = mutateTree(firstTree, rng);
+	for (auto i = codeLocations.size(); i <= NUM_CODE_LOCATIONS + secondTree.size(); ++i)
+	{
+		codeLocations.push_back(std::make_shared<CodeLocation>(0x1000 + 16 * i));
+	}
+	std::printf("Trees: %zu and %zu nodes, %d runs each, best time reported\n", firstTree.size(), secondTree.size(), NUM_REPEATS);
+
+	// Time both matchings, with and without the child index:
+	for (int shouldIndex = 1; shouldIndex >= 0; --shouldIndex)
+	{
+		auto first = createSnapshot(firstTree, codeLocations, (shouldIndex != 0));
+		auto second = createSnapshot(secondTree, codeLocations, (shouldIndex != 0));
+		SnapshotDiff diff(first, second);
+		auto firstRoot = first->getRootAllocation();
+		auto secondRoot = second->getRootAllocation();
+		size_t numLookupItems = 0, numMergeItems = 0;
+		auto lookupMsec = measureBestMsec([&]() { return matchByLookup(firstRoot, secondRoot); }, numLookupItems);
+		auto mergeMsec = measureBestMsec([&]() { return matchByMerge(diff, firstRoot, secondRoot); }, numMergeItems);
+		std::printf("%s child index:\n", shouldIndex ? "With" : "Without");
+		std::printf("  findCodeLocationChild() lookup: %10.2f msec, %zu diff items\n", lookupMsec, numLookupItems);
+		std::printf("  sorted lists merge:             %10.2f msec, %zu diff items\n", mergeMsec, numMergeItems);
+		if (numLookupItems != numMergeItems)
+		{
+			std::printf("  The matchings differ!\n");
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -25,6 +25,7 @@ DlgLiveCaptureSettings::DlgLiveCaptureSettings(QWidget * a_Parent):
 	connect(m_UI->bNewProcessExecutableBrowse,  SIGNAL(clicked()), this, SLOT(bNewProcessExecutableBrowseClicked()));
 	connect(m_UI->bNewProcessStartFolderBrowse, SIGNAL(clicked()), this, SLOT(bNewProcessStartFolderBrowseClicked()));
 	connect(m_UI->bSnapshotFolderBrowse,        SIGNAL(clicked()), this, SLOT(bSnapshotFolderBrowseClicked()));
+	connect(m_UI->bFollowFileBrowse,            SIGNAL(clicked()), this, SLOT(bFollowFileBrowseClicked()));
 }
 
 
@@ -38,12 +39,21 @@ bool DlgLiveCaptureSettings::show(
 {
 	// Copy the settings into the UI:
 	m_Settings = &a_Settings;
-	m_UI->rbCreateProcess->setChecked(a_Settings.m_ShouldCreateNewProcess);
+	auto isCapturingSingle = !a_Settings.m_ShouldFollowFile && !a_Settings.m_ShouldCaptureAllInstances;
+	m_UI->rbCreateProcess->setChecked(a_Settings.m_ShouldCreateNewProcess && isCapturingSingle);
 	m_UI->eNewProcessExecutable->setText(a_Settings.m_NewProcessExecutable);
 	m_UI->eNewProcessParams->setText(a_Settings.m_NewProcessParams);
 	m_UI->eNewProcessStartFolder->setText(a_Settings.m_NewProcessStartFolder);
-	m_UI->rbExistingProcess->setChecked(!a_Settings.m_ShouldCreateNewProcess);
+	m_UI->rbExistingProcess->setChecked(!a_Settings.m_ShouldCreateNewProcess && isCapturingSingle);
+	m_UI->rbAllInstances->setChecked(a_Settings.m_ShouldCaptureAllInstances && !a_Settings.m_ShouldFollowFile);
+	m_UI->rbFollowFile->setChecked(a_Settings.m_ShouldFollowFile);
+	m_UI->eFollowFileName->setText(a_Settings.m_FollowFileName);
 	m_UI->sbCaptureInterval->setValue(a_Settings.m_CaptureIntervalSec);
+	m_UI->sbCaptureJitter->setValue(a_Settings.m_CaptureJitterSec);
+	m_UI->chbAdaptive->setChecked(a_Settings.m_IsAdaptive);
+	m_UI->sbAdaptiveHeapChange->setValue(a_Settings.m_AdaptiveHeapChangeKiB);
+	m_UI->sbAdaptiveGrowthRate->setValue(a_Settings.m_AdaptiveGrowthRateKiBPerSec);
+	m_UI->sbAdaptiveMaxInterval->setValue(a_Settings.m_AdaptiveMaxIntervalSec);
 	m_UI->chbSaveProject->setChecked(a_Settings.m_ShouldSaveProject);
 	m_UI->chbSaveSnapshots->setChecked(a_Settings.m_ShouldSaveSnapshots);
 	m_UI->eSnapshotFolder->setText(a_Settings.m_SnapshotFolder);
@@ -77,7 +87,15 @@ bool DlgLiveCaptureSettings::show(
 	a_Settings.m_NewProcessParams       = m_UI->eNewProcessParams->text();
 	a_Settings.m_NewProcessStartFolder  = m_UI->eNewProcessStartFolder->text();
 	a_Settings.m_ExistingProcessID      = m_UI->cbExistingProcess->itemData(m_UI->cbExistingProcess->currentIndex()).toInt();
+	a_Settings.m_ShouldFollowFile       = m_UI->rbFollowFile->isChecked();
+	a_Settings.m_ShouldCaptureAllInstances = m_UI->rbAllInstances->isChecked();
+	a_Settings.m_FollowFileName         = m_UI->eFollowFileName->text();
 	a_Settings.m_CaptureIntervalSec     = m_UI->sbCaptureInterval->value();
+	a_Settings.m_CaptureJitterSec       = m_UI->sbCaptureJitter->value();
+	a_Settings.m_IsAdaptive             = m_UI->chbAdaptive->isChecked();
+	a_Settings.m_AdaptiveHeapChangeKiB  = m_UI->sbAdaptiveHeapChange->value();
+	a_Settings.m_AdaptiveGrowthRateKiBPerSec = m_UI->sbAdaptiveGrowthRate->value();
+	a_Settings.m_AdaptiveMaxIntervalSec = m_UI->sbAdaptiveMaxInterval->value();
 	a_Settings.m_ShouldSaveProject      = m_UI->chbSaveProject->isChecked();
 	a_Settings.m_ShouldSaveSnapshots    = m_UI->chbSaveSnapshots->isChecked();
 	a_Settings.m_SnapshotFolder         = m_UI->eSnapshotFolder->text();
@@ -128,6 +146,24 @@ void DlgLiveCaptureSettings::bSnapshotFolderBrowseClicked()
 
 
 
+void DlgLiveCaptureSettings::bFollowFileBrowseClicked()
+{
+	auto fileName = QFileDialog::getOpenFileName(
+		this,                                                     // Parent
+		tr("Select Massif output file"),                          // Title
+		QString(),                                                // Start folder
+		tr("Massif output files (massif.out.*);;All files (*)")  // Filter
+	);
+	if (!fileName.isEmpty())
+	{
+		m_UI->eFollowFileName->setText(fileName);
+	}
+}
+
+
+
+
+
 void DlgLiveCaptureSettings::browseForFolder(QLineEdit * a_DstLineEdit)
 {
 	auto folder = QFileDialog::getExistingDirectory(
@@ -67,6 +67,7 @@ private slots:
 	void bNewProcessExecutableBrowseClicked();
 	void bNewProcessStartFolderBrowseClicked();
 	void bSnapshotFolderBrowseClicked();
+	void bFollowFileBrowseClicked();
 
 private:
 	std::shared_ptr<Ui::DlgLiveCaptureSettings> m_UI;
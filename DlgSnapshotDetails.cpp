@@ -17,13 +17,6 @@
 
 
 
-/** Role used as a storage for the allocation data in the tree widget. */
-static const int TW_ITEM_DATAROLE_ALLOCATIONPTR = 10035;
-
-
-
-
-
 DlgSnapshotDetails::DlgSnapshotDetails(QWidget * a_Parent):
 	Super(a_Parent),
 	m_UI(new Ui::DlgSnapshotDetails)
@@ -40,6 +33,7 @@ DlgSnapshotDetails::DlgSnapshotDetails(QWidget * a_Parent):
 void DlgSnapshotDetails::show(SnapshotPtr a_Snapshot)
 {
 	m_Snapshot = a_Snapshot;
+	m_Allocations = a_Snapshot->getAllocationArena();
 	m_UI->txtTimestamp->setText(formatBigNumber(a_Snapshot->getTimestamp()));
 	m_UI->txtHeapSize->setText(formatMemorySize(a_Snapshot->getHeapSize()));
 	m_UI->txtHeapExtraSize->setText(formatMemorySize(a_Snapshot->getHeapExtraSize()));
@@ -64,7 +58,12 @@ void DlgSnapshotDetails::onTreeItemExpanded(QTreeWidgetItem * a_TreeItem)
 void DlgSnapshotDetails::updateAllocationsTree()
 {
 	m_UI->twAllocations->clear();
-	insertChildAllocations(m_UI->twAllocations->invisibleRootItem(), m_Snapshot->getRootAllocation().get());
+	m_ItemAllocations.clear();
+	auto rootAllocation = m_Snapshot->getRootAllocation();
+	if (rootAllocation.isValid())
+	{
+		insertChildAllocations(m_UI->twAllocations->invisibleRootItem(), rootAllocation);
+	}
 	ensureCorrectChildIndicatorsForChildren(m_UI->twAllocations->invisibleRootItem());
 }
 
@@ -72,28 +71,28 @@ void DlgSnapshotDetails::updateAllocationsTree()
 
 
 
-void DlgSnapshotDetails::insertChildAllocations(QTreeWidgetItem * a_TreeItem, Allocation * a_Allocation)
+void DlgSnapshotDetails::insertChildAllocations(QTreeWidgetItem * a_TreeItem, const Allocation & a_Allocation)
 {
-	for (const auto & ch: a_Allocation->getChildren())
+	for (const auto & ch: a_Allocation.getChildren())
 	{
 		QStringList columns;
-		const auto codeLoc = ch->getCodeLocation();
+		const auto & codeLoc = ch.getCodeLocation();
 		if (codeLoc == nullptr)
 		{
 			columns << tr("?");
-			columns << formatMemorySize(ch->getAllocationSize());
+			columns << formatMemorySize(ch.getAllocationSize());
 			columns << QString();
 			columns << QString();
 		}
 		else
 		{
-			columns << ch->getFunctionName();
-			columns << formatMemorySize(ch->getAllocationSize());
-			columns << ch->getFileName();
-			columns << tr("%1").arg(ch->getFileLineNum());
+			columns << ch.getFunctionName();
+			columns << formatMemorySize(ch.getAllocationSize());
+			columns << ch.getFileName();
+			columns << tr("%1").arg(ch.getFileLineNum());
 		}
 		auto twi = new QTreeWidgetItem(columns);
-		twi->setData(0, TW_ITEM_DATAROLE_ALLOCATIONPTR, reinterpret_cast<qulonglong>(ch.get()));
+		m_ItemAllocations[twi] = ch;
 		twi->setTextAlignment(0, Qt::AlignRight | Qt::AlignVCenter);
 		twi->setTextAlignment(1, Qt::AlignRight | Qt::AlignVCenter);
 		twi->setTextAlignment(2, Qt::AlignRight | Qt::AlignVCenter);
@@ -116,8 +115,9 @@ void DlgSnapshotDetails::ensureCorrectChildIndicatorsForChildren(QTreeWidgetItem
 			continue;
 		}
 		// Insert any children, if appropriate:
-		auto allocation = reinterpret_cast<Allocation *>(child->data(0, TW_ITEM_DATAROLE_ALLOCATIONPTR).toULongLong());
-		insertChildAllocations(child, allocation);
+		auto itr = m_ItemAllocations.find(child);
+		assert(itr != m_ItemAllocations.end());  // All the items are inserted by insertChildAllocations()
+		insertChildAllocations(child, itr->second);
 	}  // for i - a_TreeItem->children[]
 }
 
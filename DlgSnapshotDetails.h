@@ -14,8 +14,10 @@
 
 
 #include <memory>
+#include <unordered_map>
 #include <QMainWindow>
 #include <QTreeWidgetItem>
+#include "Allocation.h"
 
 
 
@@ -24,8 +26,8 @@
 // fwd:
 class Snapshot;
 typedef std::shared_ptr<Snapshot> SnapshotPtr;
-class Allocation;
-typedef std::shared_ptr<Allocation> AllocationPtr;
+class AllocationArena;
+typedef std::shared_ptr<AllocationArena> AllocationArenaPtr;
 
 
 
@@ -66,12 +68,19 @@ private:
 	/** The snapshot being displayed. */
 	SnapshotPtr m_Snapshot;
 
+	/** The snapshot's allocation tree, held so that it isn't evicted while the dialog displays it. */
+	AllocationArenaPtr m_Allocations;
+
+	/** The allocation displayed by each tree item, for inserting the item's children on demand.
+	The allocations of a shared subtree live in another snapshot's arena, so the node index alone isn't enough. */
+	std::unordered_map<const QTreeWidgetItem *, Allocation> m_ItemAllocations;
+
 
 	/** Updates all the items in the allocations tree widget. */
 	void updateAllocationsTree();
 
 	/** Inserts immediate children of the specified allocation into the specified tree item. */
-	void insertChildAllocations(QTreeWidgetItem * a_TreeItem, Allocation * a_Allocation);
+	void insertChildAllocations(QTreeWidgetItem * a_TreeItem, const Allocation & a_Allocation);
 
 	/** For each child of the specified tree item, makes sure any applicable grandchildren are added.
 	This makes the child indicators correct for all children of a_TreeItem. */
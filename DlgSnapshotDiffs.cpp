@@ -13,12 +13,18 @@
 #include "Snapshot.h"
 #include "Allocation.h"
 #include "SnapshotDiffModel.h"
+#include "MultiSnapshotDiff.h"
+#include "MultiSnapshotDiffModel.h"
+#include "FormatNumber.h"
 
 
 
 
 
-static const int TW_DATA_ROLE_DIFFPTR = 1037;
+static const int TW_DATA_ROLE_DIFFIDX = 1037;
+
+/** The TW_DATA_ROLE_DIFFIDX value of the item representing the diff across the whole range of snapshots. */
+static const int DIFFIDX_RANGE = -1;
 
 
 
@@ -26,7 +32,8 @@ static const int TW_DATA_ROLE_DIFFPTR = 1037;
 
 DlgSnapshotDiffs::DlgSnapshotDiffs(QWidget * a_Parent):
 	Super(a_Parent),
-	m_UI(new Ui::DlgSnapshotDiffs)
+	m_UI(new Ui::DlgSnapshotDiffs),
+	m_RangeItem(nullptr)
 {
 	m_UI->setupUi(this);
 
@@ -43,25 +50,55 @@ DlgSnapshotDiffs::DlgSnapshotDiffs(QWidget * a_Parent):
 
 
 
-void DlgSnapshotDiffs::show(SnapshotDiffPtrs && a_Diffs)
+void DlgSnapshotDiffs::show(const SnapshotPairs & a_Pairs)
 {
-	// Store the diffs internally:
-	std::swap(a_Diffs, m_Diffs);
-	for (auto d: m_Diffs)
+	m_Diffs.assign(a_Pairs.size(), nullptr);
+
+	// Add a placeholder item for the diff across the whole range, it gets enabled once the diff is built:
+	auto root = m_UI->twDiffs->invisibleRootItem();
+	std::vector<SnapshotPtr> rangeSnapshots;
+	if (a_Pairs.size() > 1)
 	{
-		m_Models[d.get()] = nullptr;
+		rangeSnapshots.reserve(a_Pairs.size() + 1);
+		for (const auto & p: a_Pairs)
+		{
+			rangeSnapshots.push_back(p.first);
+		}
+		rangeSnapshots.push_back(a_Pairs.back().second);
+		QStringList columns;
+		columns << tr("%1").arg(rangeSnapshots.front()->getTimestamp());
+		columns << tr("%1").arg(rangeSnapshots.back()->getTimestamp());
+		columns << tr("(whole range) Calculating...");
+		m_RangeItem = new QTreeWidgetItem(columns);
+		m_RangeItem->setData(0, TW_DATA_ROLE_DIFFIDX, DIFFIDX_RANGE);
+		m_RangeItem->setDisabled(true);
+		root->addChild(m_RangeItem);
 	}
 
-	// Create an item for each diff:
-	auto root = m_UI->twDiffs->invisibleRootItem();
-	for (auto d: m_Diffs)
+	// Create a placeholder item for each diff, it gets enabled once the diff is built:
+	int idx = 0;
+	for (const auto & p: a_Pairs)
 	{
 		QStringList columns;
-		columns << tr("%1").arg(d->getFirstSnapshot()->getTimestamp());
-		columns << tr("%1").arg(d->getSecondSnapshot()->getTimestamp());
+		columns << tr("%1").arg(p.first->getTimestamp());
+		columns << tr("%1").arg(p.second->getTimestamp());
+		columns << tr("Calculating...");
 		auto item = new QTreeWidgetItem(columns);
-		item->setData(0, TW_DATA_ROLE_DIFFPTR, reinterpret_cast<quint64>(d.get()));
+		item->setData(0, TW_DATA_ROLE_DIFFIDX, idx);
+		item->setDisabled(true);
 		root->addChild(item);
+		m_Items.push_back(item);
+		idx += 1;
+	}
+
+	// Build the diffs in the background:
+	m_Builder.reset(new SnapshotDiffBuilder);
+	connect(m_Builder.get(), SIGNAL(diffBuilt(int, SnapshotDiffPtr)), this, SLOT(onDiffBuilt(int, SnapshotDiffPtr)));
+	connect(m_Builder.get(), SIGNAL(rangeDiffBuilt(MultiSnapshotDiffPtr)), this, SLOT(onRangeDiffBuilt(MultiSnapshotDiffPtr)));
+	m_Builder->start(a_Pairs);
+	if (!rangeSnapshots.empty())
+	{
+		m_Builder->startRange(rangeSnapshots);
 	}
 
 	Super::showMaximized();
@@ -74,21 +111,24 @@ void DlgSnapshotDiffs::show(SnapshotDiffPtrs && a_Diffs)
 void DlgSnapshotDiffs::onCurrentDiffChanged()
 {
 	// Get the SnapshotDiffPtr representing the diff:
-	auto diff = reinterpret_cast<SnapshotDiff *>(m_UI->twDiffs->currentItem()->data(0, TW_DATA_ROLE_DIFFPTR).toULongLong());
-	SnapshotDiffPtr diffPtr;
-	for (auto d: m_Diffs)
+	auto item = m_UI->twDiffs->currentItem();
+	if (item == nullptr)
 	{
-		if (d.get() == diff)
-		{
-			diffPtr = d;
-			break;
-		}
+		return;
+	}
+	auto idx = item->data(0, TW_DATA_ROLE_DIFFIDX).toInt();
+	if (idx == DIFFIDX_RANGE)
+	{
+		showRangeDiff();
+		return;
 	}
-	if (diffPtr == nullptr)
+	if ((idx < 0) || (static_cast<size_t>(idx) >= m_Diffs.size()) || (m_Diffs[static_cast<size_t>(idx)] == nullptr))
 	{
-		assert(!"Cannot find SnapshotDiffPtr for current item");
+		// The diff is still being built
+		m_SortingModel->setSourceModel(nullptr);
 		return;
 	}
+	const auto & diffPtr = m_Diffs[static_cast<size_t>(idx)];
 
 	// Get the model, create it if it doesn't exist yet
 	auto model = m_Models[diffPtr.get()];
@@ -104,3 +144,51 @@ void DlgSnapshotDiffs::onCurrentDiffChanged()
 
 
 
+void DlgSnapshotDiffs::onDiffBuilt(int a_Index, SnapshotDiffPtr a_Diff)
+{
+	if ((a_Index < 0) || (static_cast<size_t>(a_Index) >= m_Diffs.size()))
+	{
+		assert(!"Diff index out of range");
+		return;
+	}
+	m_Diffs[static_cast<size_t>(a_Index)] = a_Diff;
+	auto item = m_Items[static_cast<size_t>(a_Index)];
+	item->setText(2, formatSignedMemorySize(a_Diff->getRootDiffItem()->getHeapSizeDiff()));
+	item->setDisabled(false);
+}
+
+
+
+
+
+void DlgSnapshotDiffs::onRangeDiffBuilt(MultiSnapshotDiffPtr a_Diff)
+{
+	if (m_RangeItem == nullptr)
+	{
+		assert(!"Range diff built without a range item");
+		return;
+	}
+	m_RangeDiff = a_Diff;
+	m_RangeModel = std::make_shared<MultiSnapshotDiffModel>(m_RangeDiff);
+	m_RangeItem->setText(2, tr("(whole range) %1").arg(formatSignedMemorySize(m_RangeDiff->getRootItem()->getFirstToLastDiff())));
+	m_RangeItem->setDisabled(false);
+}
+
+
+
+
+
+void DlgSnapshotDiffs::showRangeDiff()
+{
+	if (m_RangeModel == nullptr)
+	{
+		// The diff is still being built
+		m_SortingModel->setSourceModel(nullptr);
+		return;
+	}
+	m_SortingModel->setSourceModel(m_RangeModel.get());
+}
+
+
+
+
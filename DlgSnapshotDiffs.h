@@ -13,10 +13,12 @@
 
 
 
+#include <map>
 #include <memory>
 #include <vector>
 #include <QMainWindow>
 #include <QSortFilterProxyModel>
+#include "SnapshotDiffBuilder.h"
 
 
 
@@ -28,6 +30,10 @@ typedef std::shared_ptr<SnapshotDiff> SnapshotDiffPtr;
 typedef std::vector<SnapshotDiffPtr> SnapshotDiffPtrs;
 class SnapshotDiffModel;
 typedef std::shared_ptr<SnapshotDiffModel> SnapshotDiffModelPtr;
+class MultiSnapshotDiff;
+typedef std::shared_ptr<MultiSnapshotDiff> MultiSnapshotDiffPtr;
+class MultiSnapshotDiffModel;
+class QTreeWidgetItem;
 
 namespace Ui
 {
@@ -48,27 +54,55 @@ class DlgSnapshotDiffs:
 public:
 	explicit DlgSnapshotDiffs(QWidget * a_Parent = nullptr);
 
-	/** Shows the dialog with the specified diffs filled in. */
-	void show(SnapshotDiffPtrs && a_Diffs);
+	/** Shows the dialog with a placeholder for the diff of each of the specified snapshot pairs.
+	The diffs are built in the background and each one becomes available as soon as it is finished.
+	If there is more than one pair, an item for the diff across the whole range of the snapshots is added as well. */
+	void show(const SnapshotPairs & a_Pairs);
 
 private slots:
 
 	void onCurrentDiffChanged();
 
+	/** Stores the finished diff and enables its item. */
+	void onDiffBuilt(int a_Index, SnapshotDiffPtr a_Diff);
+
+	/** Stores the finished diff across the whole range, creates its model and enables its item. */
+	void onRangeDiffBuilt(MultiSnapshotDiffPtr a_Diff);
+
 private:
 
 	/** QtCreator-managed UI. */
 	std::shared_ptr<Ui::DlgSnapshotDiffs> m_UI;
 
-	/** The diffs that are being shown. */
+	/** The diffs that are being shown, in the order of the pairs given to show().
+	nullptr for the diffs that are still being built. */
 	SnapshotDiffPtrs m_Diffs;
 
+	/** The twDiffs items representing the diffs, in the same order as m_Diffs. */
+	std::vector<QTreeWidgetItem *> m_Items;
+
+	/** The twDiffs item representing the diff across the whole range, nullptr if there's none. */
+	QTreeWidgetItem * m_RangeItem;
+
+	/** The diff across the whole range. nullptr while it is still being built, or if there's a single pair. */
+	MultiSnapshotDiffPtr m_RangeDiff;
+
+	/** The model for m_RangeDiff, nullptr while the diff is still being built. */
+	std::shared_ptr<MultiSnapshotDiffModel> m_RangeModel;
+
+	/** Builds the diffs in the background. */
+	std::unique_ptr<SnapshotDiffBuilder> m_Builder;
+
 	/** The models for the diffs being show.
 	The models are lazily created and cached. */
 	std::map<SnapshotDiff *, SnapshotDiffModelPtr> m_Models;
 
 	/** The sorting proxy model for the diff model. */
 	std::shared_ptr<QSortFilterProxyModel> m_SortingModel;
+
+
+	/** Displays the diff across the whole range, or nothing if it is still being built. */
+	void showRangeDiff();
 };
 
 #endif // DLGSNAPSHOTDIFFS_H
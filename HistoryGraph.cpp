@@ -144,7 +144,16 @@ void HistoryGraph::paintGraph(QPainter & a_Painter)
 	auto numGraphedItems = graphedItems.size();
 	prevY.resize(numGraphedItems);
 	y.resize(numGraphedItems);
-	projectCodeLocationsY(snapshots.front().get(), prevY);
+
+	// Resolve the graphed paths into the project's allocation path trie, so that each snapshot's sizes are direct reads:
+	const auto & trie = m_Project->getAllocationPathTrie();
+	std::vector<quint32> graphedNodes;
+	graphedNodes.reserve(numGraphedItems);
+	for (const auto & gi: graphedItems)
+	{
+		graphedNodes.push_back(trie.findNode(gi->m_AllocationPath));
+	}
+	projectCodeLocationsY(snapshots.front().get(), graphedNodes, prevY);
 	std::vector<bool> isSelected;
 	isSelected.resize(numGraphedItems);
 	for (const auto & s: m_Selection->selectedIndexes())
@@ -154,7 +163,7 @@ void HistoryGraph::paintGraph(QPainter & a_Painter)
 	for (const auto & s: snapshots)
 	{
 		int x = projectionX(s->getTimestamp());
-		projectCodeLocationsY(s.get(), y);
+		projectCodeLocationsY(s.get(), graphedNodes, y);
 		assert(y.size() == numGraphedItems);
 		int yH = projectionY(s->getHeapSize());
 		int yT = projectionY(s->getTotalSize());
@@ -209,19 +218,16 @@ int HistoryGraph::projectionY(quint64 a_ValueY)
 
 
 
-void HistoryGraph::projectCodeLocationsY(Snapshot * a_Snapshot, std::vector<int> & a_OutCoords)
+void HistoryGraph::projectCodeLocationsY(Snapshot * a_Snapshot, const std::vector<quint32> & a_GraphedNodes, std::vector<int> & a_OutCoords)
 {
 	quint64 acc = 0;
-	const auto & graphedPaths = m_Model->getGraphedAllocationPaths();
-	auto numGraphedPaths = graphedPaths.size();
+	const auto & trie = m_Project->getAllocationPathTrie();
+	auto ordinal = trie.getSnapshotOrdinal(a_Snapshot);
+	auto numGraphedPaths = a_GraphedNodes.size();
 	for (size_t idx = 0; idx < numGraphedPaths; idx++)
 	{
-		auto allocation = a_Snapshot->findAllocation(graphedPaths[idx]->m_AllocationPath);
-		if (allocation != nullptr)
-		{
-			acc += allocation->getAllocationSize();
-			assert(acc <= a_Snapshot->getHeapSize());
-		}
+		acc += trie.getSize(a_GraphedNodes[idx], ordinal);
+		assert(acc <= a_Snapshot->getHeapSize());
 		a_OutCoords[idx] = projectionY(acc);
 	}
 	// Not valid for snapshots of low-memory programs, with allocations below Massif's threshold:
@@ -14,6 +14,7 @@
 
 
 #include <memory>
+#include <vector>
 #include <QWidget>
 
 
@@ -111,10 +112,11 @@ protected:
 	/** Projects the specified value into the graph Y coordinate. */
 	int projectionY(quint64 a_ValueY);
 
-	/** Projects the m_GraphedCodeLocations[] values into graph Y coordinates.
+	/** Projects the graphed paths' sizes in the specified snapshot into graph Y coordinates.
+	a_GraphedNodes are the graphed paths' nodes in the project's AllocationPathTrie.
 	a_OutCoords is an array that receives the Y coords.
 	The code locations' sizes are accumulated on top of each other. */
-	void projectCodeLocationsY(Snapshot * a_Snapshot, std::vector<int> & a_OutCoords);
+	void projectCodeLocationsY(Snapshot * a_Snapshot, const std::vector<quint32> & a_GraphedNodes, std::vector<int> & a_OutCoords);
 };
 
 
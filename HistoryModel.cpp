@@ -77,7 +77,8 @@ HistoryModel::GraphedAllocationPath::GraphedAllocationPath(
 HistoryModel::HistoryModel(ProjectPtr a_Project):
 	m_Project(a_Project)
 {
-	connect(m_Project.get(), SIGNAL(addedSnapshot(SnapshotPtr)), this, SLOT(resetModel()));
+	connect(m_Project.get(), SIGNAL(addedSnapshots(SnapshotPtrs)), this, SLOT(projectSnapshotsAdded()));
+	connect(m_Project.get(), SIGNAL(allocationPathTrieUpdated()),  this, SLOT(resetModel()));
 	resetModel();
 }
 
@@ -96,20 +97,45 @@ bool HistoryModel::canItemExpand(const QModelIndex & a_Index) const
 	{
 		return false;
 	}
-	auto path = gap->m_AllocationPath;
-	for(;;)
+	const auto & trie = m_Project->getAllocationPathTrie();
+	auto node = trie.findNode(gap->m_AllocationPath);
+	if (node == AllocationPathTrie::NO_INDEX)
 	{
-		const auto & children = m_Project->getAllAllocationPathsImmediateChildren(path);
-		if (children.empty())
+		return false;
+	}
+	auto itr = m_CanExpandCache.find(node);
+	if (itr != m_CanExpandCache.end())
+	{
+		return itr->second;
+	}
+
+	// Walk down the single-child chain until a leaf or a branching point is found:
+	std::vector<quint32> chain;
+	bool res;
+	for (;;)
+	{
+		chain.push_back(node);
+		const auto & children = trie.getChildren(node);
+		if (children.size() != 1)
 		{
-			return false;
+			res = !children.empty();
+			break;
 		}
-		if (children.size() > 1)
+		node = children[0];
+		itr = m_CanExpandCache.find(node);
+		if (itr != m_CanExpandCache.end())
 		{
-			return true;
+			res = itr->second;
+			break;
 		}
-		path = children[0];
 	}
+
+	// All the nodes in the chain share the result:
+	for (const auto & n: chain)
+	{
+		m_CanExpandCache[n] = res;
+	}
+	return res;
 }
 
 
@@ -159,6 +185,7 @@ void HistoryModel::resetModel()
 
 	// Insert the root path, to be then expanded:
 	m_GraphedAllocationPaths.clear();
+	m_CanExpandCache.clear();
 	if (m_Project->getNumSnapshots() > 0)
 	{
 		m_GraphedAllocationPaths.push_back(std::make_shared<GraphedAllocationPath>(AllocationPath(), AllocationStats()));
@@ -177,6 +204,20 @@ void HistoryModel::resetModel()
 
 
 
+void HistoryModel::projectSnapshotsAdded()
+{
+	// Once the model shows something, the project is already merging the added snapshots into its trie,
+	// the model is reset when that finishes. Otherwise show the root placeholder and start the merge:
+	if (m_GraphedAllocationPaths.empty())
+	{
+		resetModel();
+	}
+}
+
+
+
+
+
 void HistoryModel::expandItem(const QModelIndex & a_Item)
 {
 	expandItem(a_Item.row());
@@ -347,6 +388,11 @@ QVariant HistoryModel::data(const QModelIndex & a_Index, int a_Role) const
 					auto lcl = gap->m_AllocationPath.getLeafSegment();
 					if (lcl == nullptr)
 					{
+						if (gap->m_AllocationPath.getSegments().empty() && !m_Project->isAllocationPathTrieComplete())
+						{
+							// The root is shown alone until the project merges the snapshots into its trie:
+							return tr("<loading the allocations...>");
+						}
 						return "<unknown location>";
 					}
 					return lcl->getFunctionName();
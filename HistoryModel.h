@@ -14,6 +14,7 @@
 
 
 #include <memory>
+#include <unordered_map>
 #include <QAbstractTableModel>
 #include <QSortFilterProxyModel>
 #include <QColor>
@@ -88,7 +89,8 @@ public:
 	/** Returns all the allocation paths that are to be graphed. */
 	const std::vector<GraphedAllocationPathPtr> & getGraphedAllocationPaths() const { return m_GraphedAllocationPaths; }
 
-	/** Returns true iff the path at the specified index can expand (has at least two children somewhere down its hierarchy). */
+	/** Returns true iff the path at the specified index can expand (has at least two children somewhere down its hierarchy).
+	The result is cached per path until the project's trie is updated, so that it is cheap to call while painting. */
 	bool canItemExpand(const QModelIndex & a_Index) const;
 
 	/** Returns true iff the path at the specified index can collapse (has a grandparent). */
@@ -116,6 +118,12 @@ public slots:
 
 	void expandItem(int a_Index);
 
+protected slots:
+
+	/** Called when snapshots are added to the project.
+	Resets the model only if it is empty, otherwise the reset comes with the project's allocationPathTrieUpdated(). */
+	void projectSnapshotsAdded();
+
 protected:
 
 	/** The project for which the history is being modelled. */
@@ -124,6 +132,10 @@ protected:
 	/** The allocation paths that are to be graphed, together with their color and stats. */
 	std::vector<GraphedAllocationPathPtr> m_GraphedAllocationPaths;
 
+	/** Cache for canItemExpand(): map of the path's node in the project's AllocationPathTrie -> can expand.
+	Cleared in resetModel(), which is called whenever the project's trie is updated. */
+	mutable std::unordered_map<quint32, bool> m_CanExpandCache;
+
 
 	// QAbstractItemModel overrides:
 	virtual int rowCount(const QModelIndex & a_Parent = QModelIndex()) const override;
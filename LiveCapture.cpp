@@ -8,12 +8,14 @@
 
 #include "Globals.h"
 #include "LiveCapture.h"
-#include <QDir>
-#include <QCoreApplication>
+#include <algorithm>
+#include <QSaveFile>
 #include "VgdbComm.h"
 #include "MassifParser.h"
 #include "Project.h"
 #include "ProjectSaver.h"
+#include "ProjectJournal.h"
+#include "CaptureScheduler.h"
 
 
 
@@ -22,9 +24,24 @@
 LiveCapture::LiveCapture(ProjectPtr a_Project, const LiveCaptureSettings & a_Settings):
 	Super(nullptr),
 	m_Project(a_Project),
-	m_Settings(a_Settings)
+	m_Settings(a_Settings),
+	m_SecondsTillRescan(0),
+	m_FollowOffset(0),
+	m_IsReadingFollowedFile(false),
+	m_NumFollowedSnapshots(0),
+	m_NumSnapshotsToSkip(0)
 {
-	connect(&m_Timer, SIGNAL(timeout()), this, SLOT(onTimer()));
+	connect(&m_Timer,       SIGNAL(timeout()),            this, SLOT(onTimer()));
+	connect(&m_FileWatcher, SIGNAL(fileChanged(QString)), this, SLOT(onFollowedFileChanged()));
+}
+
+
+
+
+
+LiveCapture::~LiveCapture()
+{
+	// Needed here so that the compiler sees the full ProjectJournal, MassifParser and CaptureScheduler declarations when destroying the members
 }
 
 
@@ -33,6 +50,37 @@ LiveCapture::LiveCapture(ProjectPtr a_Project, const LiveCaptureSettings & a_Set
 
 void LiveCapture::start()
 {
+	if (m_Settings.m_ShouldFollowFile)
+	{
+		startFollowingFile();
+		return;
+	}
+
+	// The captures run in the background, on the scheduler's threads:
+	m_Scheduler.reset(new CaptureScheduler(m_Project));
+	if (m_Settings.m_ShouldSaveSnapshots)
+	{
+		m_Scheduler->setSnapshotFileNameProvider([this](qint64 a_Pid)
+			{
+				Q_UNUSED(a_Pid);
+				return createSnapshotFileName();
+			}
+		);
+	}
+	connect(m_Scheduler.get(), SIGNAL(captureStarted(qint64)),                                this, SLOT(onCaptureStarted(qint64)));
+	connect(m_Scheduler.get(), SIGNAL(snapshotCaptured(qint64, SnapshotPtr, const QString &)), this, SLOT(onSnapshotCaptured(qint64, SnapshotPtr, const QString &)));
+	connect(m_Scheduler.get(), SIGNAL(captureFailed(qint64, const QString &, bool)),          this, SLOT(onCaptureFailed(qint64, const QString &, bool)));
+	connect(m_Scheduler.get(), SIGNAL(logEvent(const QString &)),                              this, SIGNAL(logEvent(const QString &)));
+
+	if (m_Settings.m_ShouldCaptureAllInstances)
+	{
+		m_Pid = 0;
+		updateRunningInstances();
+		m_SecondsTillRescan = m_Settings.m_CaptureIntervalSec;
+		m_Timer.start(1000);
+		return;
+	}
+
 	// Start the new process, if requested:
 	if (m_Settings.m_ShouldCreateNewProcess)
 	{
@@ -53,13 +101,9 @@ void LiveCapture::start()
 	}
 
 	// If this was an existing process, capture immediately:
-	if (!m_Settings.m_ShouldCreateNewProcess)
-	{
-		doCapture();
-	}
+	m_Scheduler->addTarget(m_Pid, createTargetSchedule(), !m_Settings.m_ShouldCreateNewProcess);
 
-	// Start a timer:
-	m_SecondsTillCapture = m_Settings.m_CaptureIntervalSec;
+	// Start a timer for reporting the time till the next capture:
 	m_Timer.start(1000);
 }
 
@@ -71,6 +115,41 @@ void LiveCapture::stop()
 {
 	m_Timer.stop();
 	m_Pid = 0;
+
+	// Abort the running captures; the scheduler is not deleted here, this may be called from its signal handler:
+	if (m_Scheduler != nullptr)
+	{
+		m_Scheduler->stop();
+	}
+
+	// The process is not expected to write into the followed file anymore, parse its last snapshot:
+	if (m_FollowParser != nullptr)
+	{
+		if (m_IsReadingFollowedFile)
+		{
+			// Called from a parser's signal handler, the parser is still on the call stack:
+			m_FollowParser->abortParsing();
+		}
+		else
+		{
+			readFollowedFile(true);
+		}
+		m_FollowParser.release()->deleteLater();
+		if (!m_FileWatcher.files().isEmpty())
+		{
+			m_FileWatcher.removePaths(m_FileWatcher.files());
+		}
+	}
+
+	// The journal grows with each capture, rewrite it in the compact format:
+	if (m_Journal != nullptr)
+	{
+		m_Journal.reset();
+		if (saveProject())
+		{
+			emit logEvent(tr("The project has been compacted"));
+		}
+	}
 }
 
 
@@ -79,15 +158,33 @@ void LiveCapture::stop()
 
 void LiveCapture::onTimer()
 {
-	// Update the timer:
-	m_SecondsTillCapture -= 1;
-	emit timerTick(m_SecondsTillCapture);
+	// When following a file, poll it, in case the file watcher misses a change (network filesystems etc.):
+	if (m_FollowParser != nullptr)
+	{
+		if (!m_FileWatcher.files().contains(m_Settings.m_FollowFileName) && QFile::exists(m_Settings.m_FollowFileName))
+		{
+			// The file has been created or replaced since the last tick, watch the new one:
+			m_FileWatcher.addPath(m_Settings.m_FollowFileName);
+		}
+		readFollowedFile(false);
+		return;
+	}
 
-	// If it's time, run a capture:
-	if (m_SecondsTillCapture == 0)
+	if (m_Scheduler == nullptr)
 	{
-		m_SecondsTillCapture = m_Settings.m_CaptureIntervalSec;
-		doCapture();  // May call stop() in a handler
+		return;
+	}
+	emit timerTick(std::max(m_Scheduler->getSecondsTillNextCapture(), 0));
+
+	// Pick up the instances started since the last check, drop the terminated ones:
+	if (m_Settings.m_ShouldCaptureAllInstances)
+	{
+		m_SecondsTillRescan -= 1;
+		if (m_SecondsTillRescan <= 0)
+		{
+			m_SecondsTillRescan = m_Settings.m_CaptureIntervalSec;
+			updateRunningInstances();
+		}
 	}
 }
 
@@ -95,16 +192,31 @@ void LiveCapture::onTimer()
 
 
 
-void LiveCapture::onParserNewSnapshot(SnapshotPtr a_Snapshot)
+void LiveCapture::onFollowedFileChanged()
 {
-	emit snapshotParsed(m_SnapshotFileName, a_Snapshot);
-	m_Project->addSnapshot(a_Snapshot);
-	emit snapshotAdded(m_SnapshotFileName, a_Snapshot);
+	if (m_FollowParser != nullptr)
+	{
+		readFollowedFile(false);
+	}
+}
 
-	if (m_Settings.m_ShouldSaveProject)
+
+
+
+
+void LiveCapture::onParserNewSnapshot(SnapshotPtr a_Snapshot)
+{
+	if (m_NumSnapshotsToSkip > 0)
 	{
-		saveProject();
+		// The snapshot has already been parsed before the followed file was rewritten
+		m_NumSnapshotsToSkip -= 1;
+		return;
+	}
+	if (m_FollowParser != nullptr)
+	{
+		m_NumFollowedSnapshots += 1;
 	}
+	addParsedSnapshot(m_SnapshotFileName, a_Snapshot);
 }
 
 
@@ -172,44 +284,96 @@ void LiveCapture::onParserError(quint32 a_LineNum, const char * a_ErrorMessage,
 
 
 
-void LiveCapture::doCapture()
+void LiveCapture::onCaptureStarted(qint64 a_Pid)
 {
-	emit logEvent(tr("Capturing a new snapshot..."));
+	emit logEvent(tr("Capturing a new snapshot of pid %1...").arg(a_Pid));
+}
+
+
+
+
+
+void LiveCapture::onSnapshotCaptured(qint64 a_Pid, SnapshotPtr a_Snapshot, const QString & a_FileName)
+{
+	Q_UNUSED(a_Pid);
 
-	// Choose a filename for the snapshot:
 	if (m_Settings.m_ShouldSaveSnapshots)
 	{
-		m_SnapshotFileName = createSnapshotFileName();
+		emit snapshotRecorded(a_FileName);
 	}
-	else
+	addParsedSnapshot(a_FileName, a_Snapshot);
+}
+
+
+
+
+
+void LiveCapture::onCaptureFailed(qint64 a_Pid, const QString & a_Reason, bool a_IsFatal)
+{
+	emit logEvent(tr("pid %1: %2").arg(a_Pid).arg(a_Reason));
+	if (!a_IsFatal)
 	{
-		static int counter = 0;
-		m_SnapshotFileName = QString("%1/VisualMassifDiff-%2-capture-pid-%3-%4.tmp")
-			.arg(QDir::tempPath())
-			.arg(QCoreApplication::applicationPid())
-			.arg(m_Pid)
-			.arg(++counter);
+		return;
 	}
-
-	// Perform the capture:
-	QByteArray stdOut, stdErr;
-	auto res = VgdbComm::captureSnapshot(m_Pid, m_SnapshotFileName, stdOut, stdErr);
-	emit logEvent(tr("stdout: %1").arg(QString::fromUtf8(stdOut)));
-	emit logEvent(tr("stderr: %1").arg(QString::fromUtf8(stdErr)));
-	if (!res)
+	if (m_Settings.m_ShouldCaptureAllInstances)
 	{
-		emit logEvent(tr("Failed to capture the snapshot"));
+		// The other instances can still be captured, only skip this one from now on:
+		m_IgnoredPids.insert(a_Pid);
+		m_Scheduler->removeTarget(a_Pid);
 		return;
 	}
-	emit snapshotRecorded(m_SnapshotFileName);
+	emit error(a_Reason);
+}
+
+
+
+
+
+void LiveCapture::addParsedSnapshot(const QString & a_FileName, SnapshotPtr a_Snapshot)
+{
+	emit snapshotParsed(a_FileName, a_Snapshot);
+	m_Project->addSnapshot(a_Snapshot);
+	emit snapshotAdded(a_FileName, a_Snapshot);
+
+	if (m_Settings.m_ShouldSaveProject)
+	{
+		appendToJournal(a_Snapshot);
+	}
+}
+
+
+
+
+
+void LiveCapture::updateRunningInstances()
+{
+	auto instances = VgdbComm::listRunningInstances();
 
-	// Process the snapshot:
-	processSnapshotFile();
+	// Remove the targets whose instances have terminated:
+	for (auto pid: m_Scheduler->getTargetPids())
+	{
+		auto isRunning = std::any_of(instances.begin(), instances.end(),
+			[pid](const VgdbComm::InstanceDesc & a_Instance)
+			{
+				return (a_Instance.first == pid);
+			}
+		);
+		if (!isRunning)
+		{
+			emit logEvent(tr("Instance %1 has terminated").arg(pid));
+			m_Scheduler->removeTarget(pid);
+		}
+	}
 
-	// If not saving the snapshots, remove the temp file:
-	if (!m_Settings.m_ShouldSaveSnapshots)
+	// Add the new instances, capturing them right away:
+	for (const auto & inst: instances)
 	{
-		QFile::remove(m_SnapshotFileName);
+		if (m_Scheduler->hasTarget(inst.first) || (m_IgnoredPids.find(inst.first) != m_IgnoredPids.end()))
+		{
+			continue;
+		}
+		emit logEvent(tr("Capturing instance %1: %2").arg(inst.first).arg(inst.second));
+		m_Scheduler->addTarget(inst.first, createTargetSchedule(), true);
 	}
 }
 
@@ -217,23 +381,96 @@ void LiveCapture::doCapture()
 
 
 
-void LiveCapture::processSnapshotFile()
+CaptureScheduler::TargetSchedule LiveCapture::createTargetSchedule() const
+{
+	CaptureScheduler::TargetSchedule res;
+	res.m_IntervalSec = m_Settings.m_CaptureIntervalSec;
+	res.m_JitterSec = m_Settings.m_CaptureJitterSec;
+	res.m_IsAdaptive = m_Settings.m_IsAdaptive;
+	res.m_HeapChangeThreshold = static_cast<quint64>(std::max(m_Settings.m_AdaptiveHeapChangeKiB, 0)) * 1024;
+	res.m_GrowthRateThreshold = static_cast<quint64>(std::max(m_Settings.m_AdaptiveGrowthRateKiBPerSec, 0)) * 1024;
+	res.m_MaxIntervalSec = std::max(m_Settings.m_AdaptiveMaxIntervalSec, 1);  // Zero would capture detailed each time
+	return res;
+}
+
+
+
+
+
+void LiveCapture::startFollowingFile()
 {
-	// Open the file:
-	QFile f(m_SnapshotFileName);
+	emit logEvent(tr("Following file %1...").arg(m_Settings.m_FollowFileName));
+	m_SnapshotFileName = m_Settings.m_FollowFileName;
+	m_FollowOffset = 0;
+	m_NumFollowedSnapshots = 0;
+	m_NumSnapshotsToSkip = 0;
+	m_FollowParser.reset(new MassifParser(m_Project));
+	connectParser(*m_FollowParser);
+
+	// Watch the file for changes; if it doesn't exist yet, the timer will pick it up once it is created:
+	if (QFile::exists(m_Settings.m_FollowFileName))
+	{
+		m_FileWatcher.addPath(m_Settings.m_FollowFileName);
+	}
+	readFollowedFile(false);
+	m_Timer.start(1000);
+}
+
+
+
+
+
+void LiveCapture::readFollowedFile(bool a_IsFinal)
+{
+	QFile f(m_Settings.m_FollowFileName);
 	if (!f.open(QFile::ReadOnly))
 	{
-		emit error(QString::fromUtf8("Cannot open snapshot file %1 for reading").arg(m_SnapshotFileName));
+		// The file may not have been created yet
+		return;
+	}
+	auto size = f.size();
+	if (size < m_FollowOffset)
+	{
+		// The file has been rewritten from scratch, parse it again, but skip the snapshots already added:
+		emit logEvent(tr("File %1 has been rewritten, parsing it again").arg(m_Settings.m_FollowFileName));
+		m_NumSnapshotsToSkip = m_NumFollowedSnapshots;
+		m_NumFollowedSnapshots = 0;
+		m_FollowOffset = 0;
+		m_FollowParser.reset(new MassifParser(m_Project));
+		connectParser(*m_FollowParser);
+	}
+	if ((size == m_FollowOffset) || !f.seek(m_FollowOffset))
+	{
 		return;
 	}
 
-	// Parse the file:
-	MassifParser parser(m_Project);
-	connect(&parser, SIGNAL(newSnapshotParsed(SnapshotPtr)),                  this, SLOT(onParserNewSnapshot(SnapshotPtr)));
-	connect(&parser, SIGNAL(parsedTimeUnit(const char *)),                    this, SLOT(onParserTimeUnit(const char *)));
-	connect(&parser, SIGNAL(parsedCommand(const char *)),                     this, SLOT(onParserCommand(const char *)));
-	connect(&parser, SIGNAL(parseError(quint32, const char *, const char *)), this, SLOT(onParserError(quint32, const char *, const char *)));
-	parser.parse(f);
+	// Read only the data after the last complete snapshot and parse it.
+	// The parser's signal handlers may stop the capture, which releases m_FollowParser, so use a local pointer:
+	auto data = f.read(size - m_FollowOffset);
+	auto parser = m_FollowParser.get();
+	m_IsReadingFollowedFile = true;
+	if (a_IsFinal)
+	{
+		parser->finishAppendedData(data.constData(), static_cast<size_t>(data.size()));
+		m_FollowOffset += data.size();
+	}
+	else
+	{
+		m_FollowOffset += static_cast<qint64>(parser->parseAppendedData(data.constData(), static_cast<size_t>(data.size())));
+	}
+	m_IsReadingFollowedFile = false;
+}
+
+
+
+
+
+void LiveCapture::connectParser(MassifParser & a_Parser)
+{
+	connect(&a_Parser, SIGNAL(newSnapshotParsed(SnapshotPtr)),                  this, SLOT(onParserNewSnapshot(SnapshotPtr)));
+	connect(&a_Parser, SIGNAL(parsedTimeUnit(const char *)),                    this, SLOT(onParserTimeUnit(const char *)));
+	connect(&a_Parser, SIGNAL(parsedCommand(const char *)),                     this, SLOT(onParserCommand(const char *)));
+	connect(&a_Parser, SIGNAL(parseError(quint32, const char *, const char *)), this, SLOT(onParserError(quint32, const char *, const char *)));
 }
 
 
@@ -251,20 +488,64 @@ QString LiveCapture::createSnapshotFileName()
 
 
 
-bool LiveCapture::saveProject()
+bool LiveCapture::appendToJournal(SnapshotPtr a_Snapshot)
 {
 	const auto & fileName = m_Project->getFileName();
-	QFile f(fileName);
-	if (!f.open(QFile::WriteOnly))
+	try
 	{
-		emit logEvent(tr("Failed to save project: cannot write to file %1").arg(fileName));
+		if (m_Journal == nullptr)
+		{
+			// The snapshots may still be loading their allocations lazily from the file, load them before it is overwritten:
+			m_Project->detachFromFile(fileName);
+
+			// Write the whole project, including the new snapshot:
+			std::unique_ptr<ProjectJournal> journal(new ProjectJournal(fileName));
+			journal->start(*m_Project);
+			m_Journal = std::move(journal);
+		}
+		else
+		{
+			m_Journal->appendSnapshot(*m_Project, *a_Snapshot);
+		}
+		m_Project->setSaved(fileName);
+	}
+	catch (const std::exception & exc)
+	{
+		// The journal may be inconsistent now, the next capture will start a new one:
+		m_Journal.reset();
+		emit logEvent(tr("Failed to save project to file %1: %2").arg(fileName).arg(exc.what()));
 		return false;
 	}
+	return true;
+}
+
+
+
 
-	// Save the project:
+
+bool LiveCapture::saveProject()
+{
+	const auto & fileName = m_Project->getFileName();
 	try
 	{
+		// The snapshots may still be loading their allocations lazily from the file, load them before it is overwritten:
+		m_Project->detachFromFile(fileName);
+
+		// Write into a temporary file that replaces the project file only when complete, so that the journal survives a failure:
+		QSaveFile f(fileName);
+		if (!f.open(QFile::WriteOnly))
+		{
+			emit logEvent(tr("Failed to save project: cannot write to file %1").arg(fileName));
+			return false;
+		}
+
+		// Save the project:
 		ProjectSaver::saveProject(*m_Project, f);
+		if (!f.commit())
+		{
+			emit logEvent(tr("Failed to save project: cannot write to file %1").arg(fileName));
+			return false;
+		}
 		m_Project->setSaved(fileName);
 	}
 	catch (const std::exception & exc)
@@ -14,9 +14,12 @@
 
 
 #include <memory>
+#include <set>
 #include <QObject>
 #include <QTimer>
+#include <QFileSystemWatcher>
 #include "LiveCaptureSettings.h"
+#include "CaptureScheduler.h"
 
 
 
@@ -25,6 +28,8 @@
 // fwd:
 class Project;
 class Snapshot;
+class ProjectJournal;
+class MassifParser;
 typedef std::shared_ptr<Project> ProjectPtr;
 typedef std::shared_ptr<Snapshot> SnapshotPtr;
 
@@ -42,10 +47,13 @@ class LiveCapture:
 public:
 	explicit LiveCapture(ProjectPtr a_Project, const LiveCaptureSettings & a_Settings);
 
+	virtual ~LiveCapture();
+
 	/** Starts the capture. */
 	void start();
 
-	/** Stops the capture. */
+	/** Stops the capture.
+	If the project has been saved incrementally during the capture, it is rewritten into the compact format. */
 	void stop();
 
 signals:
@@ -72,9 +80,22 @@ signals:
 
 private slots:
 
-	/** Handles the m_Timer's ticks. Schedules the captures. */
+	/** Handles the m_Timer's ticks. Schedules the captures, or polls the followed file. */
 	void onTimer();
 
+	/** Called by m_FileWatcher when the followed file changes. */
+	void onFollowedFileChanged();
+
+	/** Called by m_Scheduler when a capture of the instance starts. */
+	void onCaptureStarted(qint64 a_Pid);
+
+	/** Called by m_Scheduler when a snapshot of the instance has been captured and parsed. */
+	void onSnapshotCaptured(qint64 a_Pid, SnapshotPtr a_Snapshot, const QString & a_FileName);
+
+	/** Called by m_Scheduler when a capture fails.
+	A fatal failure stops the whole capture, unless capturing all instances, then only the instance is dropped. */
+	void onCaptureFailed(qint64 a_Pid, const QString & a_Reason, bool a_IsFatal);
+
 	/** Called when the parser has finished parsing a new snapshot. */
 	void onParserNewSnapshot(SnapshotPtr a_Snapshot);
 
@@ -97,34 +118,83 @@ protected:
 	/** The settings for the LiveCapture session. */
 	LiveCaptureSettings m_Settings;
 
-	/** Number of seconds left until the next capture.
-	Updated using a timer, and when it reaches zero, the actual capture is performed. */
-	int m_SecondsTillCapture;
+	/** Number of seconds left until the next check for the started and terminated instances.
+	Used only if capturing all instances. */
+	int m_SecondsTillRescan;
 
-	/** Filename for the snapshot currently being processed. */
+	/** Filename for the snapshot currently being processed from the followed file. */
 	QString m_SnapshotFileName;
 
-	/** PID of the process to capture. */
+	/** PID of the process to capture, 0 if capturing all instances. */
 	qint64 m_Pid;
 
-	/** The timer used for scheduling the capture. */
+	/** The timer used for reporting the time till the next capture, and for polling the followed file. */
 	QTimer m_Timer;
 
+	/** Runs the captures of the process(es) in the background. nullptr if following a file. */
+	std::unique_ptr<CaptureScheduler> m_Scheduler;
+
+	/** The instances that cannot be captured into the project (different command or time unit).
+	Used only if capturing all instances, so that they aren't added again. */
+	std::set<qint64> m_IgnoredPids;
+
 	/** Holds the number of snapshot files created so far; used for creating a new snapshot filename.
 	Used only if the settings indicate that snapshots should be saved. */
 	int m_CurrentSnapshotIndex;
 
+	/** Watches the followed file for changes (uses inotify on Linux), if following a file. */
+	QFileSystemWatcher m_FileWatcher;
+
+	/** The parser used for the followed file, keeps the line numbering across the appended data.
+	nullptr if not following a file. */
+	std::unique_ptr<MassifParser> m_FollowParser;
+
+	/** The offset in the followed file of the first byte not parsed yet - the start of the last, incomplete, snapshot. */
+	qint64 m_FollowOffset;
+
+	/** True while readFollowedFile() is parsing, the parser's signal handlers may call stop() meanwhile. */
+	bool m_IsReadingFollowedFile;
 
-	/** Performs the capture. */
-	void doCapture();
+	/** The number of snapshots parsed from the followed file. */
+	int m_NumFollowedSnapshots;
 
-	/** Parses the snapshot data from file m_FileName, adds the snapshot to the project. */
-	void processSnapshotFile();
+	/** The number of the next parsed snapshots to be ignored, because they have already been parsed.
+	Used when the followed file is rewritten from scratch. */
+	int m_NumSnapshotsToSkip;
+
+	/** The journal into which the captured snapshots are appended, if the project is to be saved.
+	Created on the first capture, reset when the capture stops (and the project is compacted). */
+	std::unique_ptr<ProjectJournal> m_Journal;
+
+
+	/** Adds the parsed snapshot to the project, and to the journal, if saving the project. */
+	void addParsedSnapshot(const QString & a_FileName, SnapshotPtr a_Snapshot);
+
+	/** Adds the newly started valgrind instances to m_Scheduler, and removes the terminated ones. */
+	void updateRunningInstances();
+
+	/** Returns the schedule for the captured instances, based on m_Settings. */
+	CaptureScheduler::TargetSchedule createTargetSchedule() const;
+
+	/** Starts following the file specified in the settings. */
+	void startFollowingFile();
+
+	/** Parses the data appended to the followed file since the last call.
+	If a_IsFinal is true, the last snapshot is parsed as well, otherwise it is left until another snapshot follows it. */
+	void readFollowedFile(bool a_IsFinal);
+
+	/** Connects the parser's signals to this object's handlers. */
+	void connectParser(MassifParser & a_Parser);
 
 	/** Returns a filename to be used for saving the next snapshot. */
 	QString createSnapshotFileName();
 
-	/** Saves m_Project into its file.
+	/** Saves the new snapshot into the project file, by appending it to m_Journal.
+	The first call (or the first one after a failure) writes the whole project into a new journal.
+	Returns true if the snapshot was saved properly, false on failure. */
+	bool appendToJournal(SnapshotPtr a_Snapshot);
+
+	/** Saves m_Project into its file, in the compact format.
 	Returns true if the project was saved properly, false on failure. */
 	bool saveProject();
 };
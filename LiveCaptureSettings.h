@@ -19,7 +19,14 @@ public:
 	LiveCaptureSettings():
 		m_ShouldCreateNewProcess(true),
 		m_ExistingProcessID(0),
+		m_ShouldFollowFile(false),
+		m_ShouldCaptureAllInstances(false),
 		m_CaptureIntervalSec(30),
+		m_CaptureJitterSec(0),
+		m_IsAdaptive(false),
+		m_AdaptiveHeapChangeKiB(1024),
+		m_AdaptiveGrowthRateKiBPerSec(256),
+		m_AdaptiveMaxIntervalSec(300),
 		m_ShouldSaveProject(true),
 		m_ShouldSaveSnapshots(true)
 	{
@@ -32,8 +39,29 @@ public:
 	QString m_NewProcessStartFolder;
 	qint64 m_ExistingProcessID;
 
+	/** If true, no process is captured, instead the Massif output file m_FollowFileName is followed as it grows
+	(valgrind --tool=massif --massif-out-file=...), parsing each snapshot as soon as it is complete. */
+	bool m_ShouldFollowFile;
+	QString m_FollowFileName;
+
+	/** If true, all the running valgrind massif instances are captured, each on its own schedule.
+	The instances started during the capture are picked up as well. */
+	bool m_ShouldCaptureAllInstances;
+
 	// Capture settings:
 	int m_CaptureIntervalSec;
+
+	/** The maximum random deviation of each capture from the interval, so that multiple instances aren't
+	all captured at the same time. */
+	int m_CaptureJitterSec;
+
+	/** If true, only the heap totals are sampled each interval, and a detailed snapshot is captured only when the heap
+	changes by m_AdaptiveHeapChangeKiB since the last detailed snapshot, or changes at m_AdaptiveGrowthRateKiBPerSec,
+	or after m_AdaptiveMaxIntervalSec. A zero threshold is disabled; the max interval is at least 1 second. */
+	bool m_IsAdaptive;
+	int m_AdaptiveHeapChangeKiB;
+	int m_AdaptiveGrowthRateKiBPerSec;
+	int m_AdaptiveMaxIntervalSec;
 	bool m_ShouldSaveProject;
 	bool m_ShouldSaveSnapshots;
 	QString m_SnapshotFolder;
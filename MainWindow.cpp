@@ -8,14 +8,15 @@
 
 #include "Globals.h"
 #include "MainWindow.h"
+#include <algorithm>
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QFile>
 #include <QTreeWidget>
 #include <QTreeWidgetItem>
 #include <QString>
+#include <QProgressDialog>
 #include "ui_MainWindow.h"
-#include "MassifParser.h"
 #include "Project.h"
 #include "Snapshot.h"
 #include "DlgSnapshotDetails.h"
@@ -33,6 +34,7 @@
 #include "LiveCapture.h"
 #include "DlgLiveCapture.h"
 #include "SnapshotModel.h"
+#include "AsyncLoader.h"
 
 
 
@@ -40,10 +42,29 @@
 
 MainWindow::MainWindow(QWidget * a_Parent):
 	Super(a_Parent),
-	m_UI(new Ui::MainWindow)
+	m_UI(new Ui::MainWindow),
+	m_Loader(new AsyncLoader(this)),
+	m_LoaderProgress(new QProgressDialog(this)),
+	m_HasReportedAllocationsLoadFailure(false)
 {
 	m_UI->setupUi(this);
 
+	// Set up the background loader:
+	m_LoaderProgress->setWindowTitle(tr("Loading"));
+	m_LoaderProgress->setRange(0, 1000);
+	m_LoaderProgress->setMinimumDuration(500);
+	m_LoaderProgress->reset();
+	connect(m_LoaderProgress, SIGNAL(canceled()),                                             m_Loader, SLOT(cancel()));
+	connect(m_Loader,         SIGNAL(jobStarted(const QString &)),                            this, SLOT(loaderJobStarted(const QString &)));
+	connect(m_Loader,         SIGNAL(progress(quint64, quint64)),                             this, SLOT(loaderProgress(quint64, quint64)));
+	connect(m_Loader,         SIGNAL(idle()),                                                 this, SLOT(loaderIdle()));
+	connect(m_Loader,         SIGNAL(snapshotsParsed(SnapshotPtrs)),                          this, SLOT(snapshotsParsed(SnapshotPtrs)));
+	connect(m_Loader,         SIGNAL(parsedCommand(quint32, const QString &)),                this, SLOT(parsedCommand(quint32, const QString &)));
+	connect(m_Loader,         SIGNAL(parsedTimeUnit(quint32, const QString &)),               this, SLOT(parsedTimeUnit(quint32, const QString &)));
+	connect(m_Loader,         SIGNAL(parseError(quint32, const QString &, const QString &)),  this, SLOT(parseError(quint32, const QString &, const QString &)));
+	connect(m_Loader,         SIGNAL(projectLoaded(ProjectPtr, const QString &)),             this, SLOT(loaderProjectLoaded(ProjectPtr, const QString &)));
+	connect(m_Loader,         SIGNAL(loadFailed(const QString &, const QString &)),           this, SLOT(loaderFailed(const QString &, const QString &)));
+
 	// Add a context menu to twSnapshots:
 	m_UI->tvSnapshots->addAction(m_UI->actCtxDiffSelected);
 	m_UI->tvSnapshots->addAction(m_UI->actCtxDiffAll);
@@ -74,6 +95,9 @@ MainWindow::MainWindow(QWidget * a_Parent):
 
 MainWindow::~MainWindow()
 {
+	// Stop the background loading before the project and models go away:
+	delete m_Loader;
+	m_Loader = nullptr;
 	delete m_UI;
 }
 
@@ -97,7 +121,7 @@ void MainWindow::addSnapshotsFromFile(void)
 
 void MainWindow::addSnapshotsFromFile(const QString & a_FileName)
 {
-	// Open the file:
+	// Check that the file can be opened at all:
 	QFile file(a_FileName);
 	if (!file.open(QIODevice::ReadOnly))
 	{
@@ -107,15 +131,10 @@ void MainWindow::addSnapshotsFromFile(const QString & a_FileName)
 		);
 		return;
 	}
+	file.close();
 
-	// Parse the file:
-	// TODO: Move this to a background thread (?)
-	MassifParser parser(m_Project);
-	connect(&parser, SIGNAL(parseError(quint32, const char *, const char *)), this, SLOT(parseError(quint32, const char *, const char *)));
-	connect(&parser, SIGNAL(newSnapshotParsed(SnapshotPtr)),                  this, SLOT(newSnapshotParsed(SnapshotPtr)));
-	connect(&parser, SIGNAL(parsedCommand(const char *)),                     this, SLOT(parsedCommand(const char *)));
-	connect(&parser, SIGNAL(parsedTimeUnit(const char *)),                    this, SLOT(parsedTimeUnit(const char *)));
-	parser.parse(file);
+	// Parse the file in the background, the snapshots will be added as they are parsed:
+	m_Loader->addMassifFile(m_Project, a_FileName);
 }
 
 
@@ -170,7 +189,7 @@ void MainWindow::snapshotsLiveCapture()
 
 
 
-void MainWindow::parseError(quint32 a_LineNum, const char * a_Msg, const char * a_Line)
+void MainWindow::parseError(quint32 a_LineNum, const QString & a_Msg, const QString & a_Line)
 {
 	QMessageBox::warning(this,
 		tr("Parse error"),
@@ -185,18 +204,22 @@ void MainWindow::parseError(quint32 a_LineNum, const char * a_Msg, const char *
 
 
 
-void MainWindow::newSnapshotParsed(SnapshotPtr a_Snapshot)
+void MainWindow::snapshotsParsed(SnapshotPtrs a_Snapshots)
 {
 	assert(m_Project != nullptr);
 
-	// If the project already contains a snapshot with this timestamp, skip:
-	if (m_Project->hasSnapshotForTimestamp(a_Snapshot->getTimestamp()))
+	// Skip the snapshots whose timestamp the project already contains:
+	SnapshotPtrs newSnapshots;
+	for (const auto & snapshot: a_Snapshots)
 	{
-		return;
+		if (!m_Project->hasSnapshotForTimestamp(snapshot->getTimestamp()))
+		{
+			newSnapshots.push_back(snapshot);
+		}
 	}
 
-	// Add snapshot to project:
-	m_Project->addSnapshot(a_Snapshot);
+	// Add the snapshots to project:
+	m_Project->addSnapshots(newSnapshots);
 }
 
 
@@ -204,12 +227,13 @@ void MainWindow::newSnapshotParsed(SnapshotPtr a_Snapshot)
 
 
 
-void MainWindow::parsedCommand(const char * a_Command)
+void MainWindow::parsedCommand(quint32 a_JobID, const QString & a_Command)
 {
 	assert(m_Project != nullptr);
-	if (!m_Project->checkAndSetCommand(a_Command))
+	if (!m_Project->checkAndSetCommand(a_Command.toUtf8().constData()))
 	{
-		reinterpret_cast<MassifParser *>(QObject::sender())->abortParsing();
+		// Drop only this file, the other queued files may still match:
+		m_Loader->abortJob(a_JobID);
 		QMessageBox::warning(this,
 			tr("Bad commandline"),
 			tr("The commandline in the specified file is different, it is likely not created from the same Massif run.\n\n" \
@@ -224,12 +248,13 @@ void MainWindow::parsedCommand(const char * a_Command)
 
 
 
-void MainWindow::parsedTimeUnit(const char * a_TimeUnit)
+void MainWindow::parsedTimeUnit(quint32 a_JobID, const QString & a_TimeUnit)
 {
 	assert(m_Project != nullptr);
-	if (!m_Project->checkAndSetTimeUnit(a_TimeUnit))
+	if (!m_Project->checkAndSetTimeUnit(a_TimeUnit.toUtf8().constData()))
 	{
-		reinterpret_cast<MassifParser *>(QObject::sender())->abortParsing();
+		// Drop only this file, the other queued files may still match:
+		m_Loader->abortJob(a_JobID);
 		QMessageBox::warning(this,
 			tr("Bad time unit"),
 			tr("The time unit in the specified file is different, it is likely not created from the same Massif run.\n\n" \
@@ -314,6 +339,9 @@ void MainWindow::newProject()
 		return;
 	}
 
+	// Any Massif files still being parsed belong to the old project, drop them:
+	m_Loader->cancel();
+
 	// Create and set a new project:
 	setProject(std::make_shared<Project>());
 }
@@ -349,7 +377,7 @@ void MainWindow::loadProject(const QString & a_FileName)
 		return;
 	}
 
-	// Load the project from the file:
+	// Check that the file can be opened at all:
 	QFile f(a_FileName);
 	if (!f.open(QFile::ReadOnly))
 	{
@@ -359,33 +387,10 @@ void MainWindow::loadProject(const QString & a_FileName)
 		);
 		return;
 	}
-	ProjectPtr project;
-	try
-	{
-		project = ProjectLoader::loadProject(f);
-	}
-	catch (const std::exception & exc)
-	{
-		QMessageBox::warning(this,
-			tr("File error"),
-			tr("Failed to load project from file\n%1\n\n%2").arg(a_FileName).arg(QString::fromUtf8(exc.what()))
-		);
-		return;
-	}
-	if (project == nullptr)
-	{
-		QMessageBox::warning(this,
-			tr("File error"),
-			tr("Failed to load project from file\n%1").arg(a_FileName)
-		);
-		return;
-	}
-
-	// Mark the project as non-dirty:
-	project->setSaved(a_FileName);
+	f.close();
 
-	// Replace the currently loaded project:
-	setProject(project);
+	// Load the project in the background, it replaces the current one once loaded (loaderProjectLoaded()):
+	m_Loader->loadProject(a_FileName);
 }
 
 
@@ -407,6 +412,22 @@ bool MainWindow::saveProject()
 
 bool MainWindow::saveProject(const QString & a_FileName)
 {
+	// The snapshots may still be loading their allocations lazily from the file, load them before it is overwritten.
+	// If any of them cannot be loaded, bail out before the file is truncated:
+	try
+	{
+		m_Project->detachFromFile(a_FileName);
+	}
+	catch (const std::exception & exc)
+	{
+		QMessageBox::warning(
+			this,
+			tr("VisualMassifDiff: Failed to save project"),
+			tr("Failed to save project to file %1: %2").arg(a_FileName).arg(exc.what())
+		);
+		return false;
+	}
+
 	// Open the file for writing:
 	QFile f(a_FileName);
 	if (!f.open(QFile::WriteOnly))
@@ -443,16 +464,21 @@ bool MainWindow::saveProject(const QString & a_FileName)
 
 bool MainWindow::saveProjectAs()
 {
+	auto plainFilter = tr("VisualMassifDiff project file, uncompressed (*.vmdp)");
+	auto compressedFilter = tr("VisualMassifDiff project file, compressed (*.vmdp)");
+	auto selectedFilter = m_Project->isCompressed() ? compressedFilter : plainFilter;
 	auto fileName = QFileDialog::getSaveFileName(
-		nullptr,                                      // Parent widget
-		tr("Save the project file"),                  // Title
-		QString(),                                    // Initial folder
-		tr("VisualMassifDiff project file (*.vmdp)")  // Filter
+		nullptr,                                // Parent widget
+		tr("Save the project file"),            // Title
+		QString(),                              // Initial folder
+		plainFilter + ";;" + compressedFilter,  // Filter
+		&selectedFilter                         // Selected filter
 	);
 	if (fileName.isEmpty())
 	{
 		return false;
 	}
+	m_Project->setCompressed(selectedFilter == compressedFilter);
 	return saveProject(fileName);
 }
 
@@ -487,6 +513,86 @@ bool MainWindow::openUnknownFile(const QString & a_FileName)
 
 
 
+void MainWindow::loaderJobStarted(const QString & a_FileName)
+{
+	m_LoaderProgress->setLabelText(tr("Loading %1").arg(a_FileName));
+	m_LoaderProgress->setValue(0);
+}
+
+
+
+
+
+void MainWindow::loaderProgress(quint64 a_Current, quint64 a_Total)
+{
+	if (a_Total == 0)
+	{
+		// Unknown total size, show a "busy" indicator:
+		m_LoaderProgress->setMaximum(0);
+		return;
+	}
+	m_LoaderProgress->setMaximum(1000);
+	m_LoaderProgress->setValue(static_cast<int>(std::min<quint64>(a_Current, a_Total) * 1000 / a_Total));
+}
+
+
+
+
+
+void MainWindow::loaderIdle()
+{
+	m_LoaderProgress->reset();
+}
+
+
+
+
+
+void MainWindow::loaderProjectLoaded(ProjectPtr a_Project, const QString & a_FileName)
+{
+	// Mark the project as non-dirty:
+	a_Project->setSaved(a_FileName);
+
+	// Replace the currently loaded project:
+	setProject(a_Project);
+}
+
+
+
+
+
+void MainWindow::loaderFailed(const QString & a_FileName, const QString & a_Reason)
+{
+	Q_UNUSED(a_FileName);
+
+	QMessageBox::warning(this,
+		tr("File error"),
+		a_Reason
+	);
+}
+
+
+
+
+
+void MainWindow::allocationsLoadFailed(const QString & a_FileName, const QString & a_Reason)
+{
+	if (m_HasReportedAllocationsLoadFailure)
+	{
+		return;
+	}
+	m_HasReportedAllocationsLoadFailure = true;
+	QMessageBox::warning(this,
+		tr("File error"),
+		tr("Failed to load the allocations from the project file %1: %2\n\nThe affected snapshots show no allocations, and the project cannot be saved until it is reloaded.")
+			.arg(a_FileName).arg(a_Reason)
+	);
+}
+
+
+
+
+
 void MainWindow::showDiffsForSnapshots(const SnapshotPtrs & a_Snapshots)
 {
 	// Sort the snapshots by their timestamp:
@@ -499,22 +605,21 @@ void MainWindow::showDiffsForSnapshots(const SnapshotPtrs & a_Snapshots)
 		}
 	);
 
-	// Create the diffs:
-	SnapshotDiffPtrs diffs;
+	// Pair up the consecutive snapshots:
+	SnapshotPairs pairs;
 	SnapshotPtr prevSnapshot;
 	for (auto s: snapshots)
 	{
 		if (prevSnapshot != nullptr)
 		{
-			auto diff = std::make_shared<SnapshotDiff>(prevSnapshot, s);
-			diffs.push_back(diff);
+			pairs.emplace_back(prevSnapshot, s);
 		}
 		prevSnapshot = s;
 	}
 
-	// Show the diffs:
+	// Show the diffs, the dialog builds them in the background:
 	auto dlg = new DlgSnapshotDiffs(this);
-	dlg->show(std::move(diffs));
+	dlg->show(pairs);
 }
 
 
@@ -592,6 +697,13 @@ void MainWindow::setProject(ProjectPtr a_Project)
 	);
 	m_HistoryModel = historyModel;
 
+	// Report the failures to load the allocations lazily from the project file:
+	connect(
+		a_Project.get(), SIGNAL(allocationsLoadFailed(const QString &, const QString &)),
+		this,            SLOT(allocationsLoadFailed(const QString &, const QString &))
+	);
+	m_HasReportedAllocationsLoadFailure = false;
+
 	// Replace the current project (and free the old one):
 	m_Project = a_Project;
 }
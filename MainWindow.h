@@ -25,6 +25,7 @@
 class QSortFilterProxyModel;
 class QAbstractItemModel;
 class QItemSelection;
+class QProgressDialog;
 class Project;
 typedef std::shared_ptr<Project> ProjectPtr;
 class Snapshot;
@@ -32,6 +33,7 @@ typedef std::shared_ptr<Snapshot>SnapshotPtr;
 typedef std::list<SnapshotPtr> SnapshotPtrs;
 class CodeLocationStatsModel;
 class SnapshotModel;
+class AsyncLoader;
 
 
 
@@ -73,18 +75,19 @@ public slots:
 	void snapshotsLiveCapture();
 
 	/** Displays an error message containing the error. */
-	void parseError(quint32 a_LineNum, const char * a_Msg, const char * a_Line);
+	void parseError(quint32 a_LineNum, const QString & a_Msg, const QString & a_Line);
 
-	/** Adds the specified new snapshot to current project. */
-	void newSnapshotParsed(SnapshotPtr a_Snapshot);
+	/** Adds the specified batch of new snapshots to current project.
+	Snapshots whose timestamp is already present in the project are skipped. */
+	void snapshotsParsed(SnapshotPtrs a_Snapshots);
 
 	/** The command used for creating the Massif file has been parsed.
-	Checks with the project if it is the same, aborts parse if not. */
-	void parsedCommand(const char * a_Command);
+	Checks with the project if it is the same, aborts the job parsing the file if not. */
+	void parsedCommand(quint32 a_JobID, const QString & a_Command);
 
 	/** The time unit used for creating the Massif file has been parsed.
-	Checks with the project if it is the same, aborts parse if not. */
-	void parsedTimeUnit(const char * a_TimeUnit);
+	Checks with the project if it is the same, aborts the job parsing the file if not. */
+	void parsedTimeUnit(quint32 a_JobID, const QString & a_TimeUnit);
 
 	/** Triggered when a snapshot is double-clicked in the treeview. */
 	void tvItemDblClicked(const QModelIndex & a_Item);
@@ -128,6 +131,27 @@ public slots:
 	Returns true if the file is processed, false otherwise. */
 	bool openUnknownFile(const QString & a_FileName);
 
+protected slots:
+
+	/** The background loader has started loading the specified file, shows the progress dialog. */
+	void loaderJobStarted(const QString & a_FileName);
+
+	/** Updates the progress dialog with the background loader's progress. */
+	void loaderProgress(quint64 a_Current, quint64 a_Total);
+
+	/** The background loader has finished all its jobs, hides the progress dialog. */
+	void loaderIdle();
+
+	/** The background loader has loaded a project, replaces the current project with it. */
+	void loaderProjectLoaded(ProjectPtr a_Project, const QString & a_FileName);
+
+	/** The background loader has failed to load a file, displays the error. */
+	void loaderFailed(const QString & a_FileName, const QString & a_Reason);
+
+	/** A snapshot's allocations failed to load lazily from the project file, displays the error.
+	Only the first failure for the current project is displayed, the rest are most likely the same. */
+	void allocationsLoadFailed(const QString & a_FileName, const QString & a_Reason);
+
 
 private:
 
@@ -149,6 +173,15 @@ private:
 	/** The model used for the allocation history views. */
 	std::shared_ptr<QAbstractItemModel> m_HistoryModel;
 
+	/** The loader that parses Massif files and loads projects on a background thread. */
+	AsyncLoader * m_Loader;
+
+	/** The dialog showing the progress of m_Loader, with the option to cancel the loading. */
+	QProgressDialog * m_LoaderProgress;
+
+	/** Set to true once a lazy load failure has been displayed for the current project. */
+	bool m_HasReportedAllocationsLoadFailure;
+
 
 	/** Displays a new DlgSnapshotDiffs for diffs created between the specified snapshots. */
 	void showDiffsForSnapshots(const SnapshotPtrs & a_Snapshots);
@@ -159,7 +192,8 @@ private:
 	bool prepareCurrentProjectForUnload();
 
 	/** Sets the specified project as the current project.
-	Updates all views and models based on the new project. */
+	Updates all views and models based on the new project.
+	Doesn't touch the loader's jobs, the callers replacing the project by a different one need to cancel them. */
 	void setProject(ProjectPtr a_Project);
 };
 
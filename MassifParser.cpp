@@ -8,7 +8,12 @@
 
 #include "Globals.h"
 #include "MassifParser.h"
+#include <cstring>
+#include <future>
 #include <QIODevice>
+#include <QFileDevice>
+#include <QThreadPool>
+#include <QRunnable>
 #include "ParseInteger.h"
 #include "Snapshot.h"
 #include "Allocation.h"
@@ -58,7 +63,8 @@ static bool isHexDigit(char a_Character)
 
 
 
-/** */
+/** Returns the numerical value of the specified hex digit.
+Must be synchronized with isHexDigit(). */
 static quint64 hexDigitToValue(char a_HexDigit)
 {
 	switch (a_HexDigit)
@@ -94,13 +100,180 @@ static quint64 hexDigitToValue(char a_HexDigit)
 
 
 
+/** Returns true if the line, specified by its start and length, starts with the specified text constant.
+The line needn't be NUL-terminated, it may be a view into a larger buffer. */
+template <size_t N> static bool lineStartsWith(const char * a_Line, size_t a_LineLen, const char (&a_Prefix)[N])
+{
+	return (
+		(a_LineLen >= N - 1) &&
+		(std::memcmp(a_Line, a_Prefix, N - 1) == 0)
+	);
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MassifParser::SectionTask:
+
+/** Parses a single Section of the data, on a thread pool's worker thread.
+The results are stored within the task, the main parser then reports them in the file order.
+The task can be claimed for execution either by the thread pool, or by the main parser, whoever comes first. */
+class MassifParser::SectionTask
+{
+public:
+
+	/** Description of a single parse error encountered in the section, to be reported by the main parser. */
+	struct ParseError
+	{
+		quint32 m_LineNum;
+		const char * m_ErrorMessage;
+		std::string m_Line;
+	};
+
+
+	/** The snapshots parsed from the section, in the file order. */
+	std::vector<SnapshotPtr> m_Snapshots;
+
+	/** The parse errors encountered in the section, in the file order. */
+	std::vector<ParseError> m_Errors;
+
+
+	SectionTask(const char * a_Data, const Section & a_Section, CodeLocationFactoryPtr a_CodeLocationFactory):
+		m_Data(a_Data),
+		m_Section(a_Section),
+		m_Parser(a_CodeLocationFactory, this),
+		m_IsClaimed(false),
+		m_Finished(m_FinishedPromise.get_future())
+	{
+	}
+
+	/** Claims the task for execution.
+	Returns true if the caller should execute the task, false if it has already been claimed by someone else. */
+	bool claim()
+	{
+		bool expected = false;
+		return m_IsClaimed.compare_exchange_strong(expected, true);
+	}
+
+	/** Parses the section. Only to be called after a successful claim(). */
+	void execute()
+	{
+		m_Parser.m_CurrentLine = m_Section.m_FirstLineNum;
+		m_Parser.parseLines(m_Data + m_Section.m_Start, m_Section.m_End - m_Section.m_Start);
+		m_FinishedPromise.set_value();
+	}
+
+	/** Aborts the task, whether it is queued or already being executed. */
+	void abort()
+	{
+		if (claim())
+		{
+			// Nobody has started the task yet, mark it finished without parsing anything:
+			m_FinishedPromise.set_value();
+		}
+		else
+		{
+			m_Parser.abortParsing();
+		}
+	}
+
+	/** Waits for the task to finish, after being executed or aborted. */
+	void wait()
+	{
+		m_Finished.wait();
+	}
+
+	/** Returns the section of the data that this task parses. */
+	const Section & getSection() const { return m_Section; }
+
+protected:
+
+	/** The entire data being parsed. */
+	const char * m_Data;
+
+	/** The section of m_Data that this task parses. */
+	Section m_Section;
+
+	/** The parser used for this section, in the "section worker" mode. */
+	MassifParser m_Parser;
+
+	/** Set to true once the task has been claimed for execution. */
+	std::atomic<bool> m_IsClaimed;
+
+	/** Signals the end of the task execution, or abortion. */
+	std::promise<void> m_FinishedPromise;
+	std::future<void> m_Finished;
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MassifParser::SectionTaskRunnable:
+
+/** The QRunnable wrapper that executes a SectionTask in the thread pool.
+The task is shared, so that it stays alive even if the main parser finishes before the thread pool gets to the runnable. */
+class MassifParser::SectionTaskRunnable:
+	public QRunnable
+{
+public:
+	SectionTaskRunnable(std::shared_ptr<SectionTask> a_Task):
+		m_Task(a_Task)
+	{
+	}
+
+	virtual void run() override
+	{
+		if (m_Task->claim())
+		{
+			m_Task->execute();
+		}
+	}
+
+protected:
+	std::shared_ptr<SectionTask> m_Task;
+};
+
+
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // MassifParser:
 
 MassifParser::MassifParser(ProjectPtr a_Project):
 	Super(nullptr),
 	m_CodeLocationFactory(a_Project->getCodeLocationFactory()),
-	m_LastAllocationDepth(0)
+	m_SectionTask(nullptr),
+	m_LastAllocationDepth(0),
+	m_CurrentLine(1),
+	m_NumBytesTotal(0),
+	m_IsFeeding(false),
+	m_ShouldContinueParsing(true)
+{
+	const auto & snapshots = a_Project->getSnapshots();
+	if (!snapshots.empty())
+	{
+		m_PreviousSnapshot = snapshots.back();
+	}
+}
+
+
+
+
+
+MassifParser::MassifParser(CodeLocationFactoryPtr a_CodeLocationFactory, SectionTask * a_SectionTask):
+	Super(nullptr),
+	m_CodeLocationFactory(a_CodeLocationFactory),
+	m_SectionTask(a_SectionTask),
+	m_LastAllocationDepth(0),
+	m_CurrentLine(1),
+	m_NumBytesTotal(0),
+	m_IsFeeding(false),
+	m_ShouldContinueParsing(true)
 {
 }
 
@@ -110,19 +283,103 @@ MassifParser::MassifParser(ProjectPtr a_Project):
 
 void MassifParser::parse(QIODevice & a_Device)
 {
-	m_CurrentLine = 1;
-	m_ShouldContinueParsing = true;
-	while (m_ShouldContinueParsing)
+	// If the device is a regular file, map it into memory and parse the lines directly from the mapping:
+	auto fileDevice = qobject_cast<QFileDevice *>(&a_Device);
+	if ((fileDevice != nullptr) && !fileDevice->isSequential())
 	{
-		char buf[3000];
-		auto lineLen = a_Device.readLine(buf, sizeof(buf));
-		if (lineLen < 0)
+		auto start = fileDevice->pos();
+		auto size = fileDevice->size() - start;
+		auto data = (size > 0) ? fileDevice->map(start, size) : nullptr;
+		if (data != nullptr)
+		{
+			parseBuffer(reinterpret_cast<const char *>(data), static_cast<size_t>(size));
+			fileDevice->unmap(data);
+			return;
+		}
+		// Mapping failed (not enough address space etc.), fall back to reading in chunks
+	}
+
+	// Read the device in large chunks and feed them to the parser:
+	auto numBytesTotal = a_Device.isSequential() ? 0 : static_cast<quint64>(std::max<qint64>(a_Device.size() - a_Device.pos(), 0));
+	static const size_t CHUNK_SIZE = 1024 * 1024;
+	std::vector<char> buf(CHUNK_SIZE);
+	quint64 numBytesParsed = 0;
+	do
+	{
+		auto numBytesRead = a_Device.read(buf.data(), static_cast<qint64>(buf.size()));
+		if (numBytesRead <= 0)
 		{
 			break;
 		}
-		processLine(buf, static_cast<int>(lineLen));
-		m_CurrentLine += 1;
+		feed(buf.data(), static_cast<size_t>(numBytesRead));
+		numBytesParsed += static_cast<quint64>(numBytesRead);
+		emit parseProgress(numBytesParsed, numBytesTotal);
+	} while (m_ShouldContinueParsing);
+	finish();
+}
+
+
+
+
+
+void MassifParser::feed(const char * a_Data, size_t a_Size)
+{
+	if (!m_IsFeeding)
+	{
+		// Start a new output:
+		m_IsFeeding = true;
+		m_CurrentLine = 1;
+		m_FeedLine.clear();
 	}
+	if (!m_ShouldContinueParsing || (a_Size == 0))
+	{
+		return;
+	}
+
+	// Complete the line left over from the previous call, if any:
+	if (!m_FeedLine.empty())
+	{
+		auto lineEnd = static_cast<const char *>(std::memchr(a_Data, '\n', a_Size));
+		if (lineEnd == nullptr)
+		{
+			// Still no line end, keep collecting:
+			m_FeedLine.insert(m_FeedLine.end(), a_Data, a_Data + a_Size);
+			return;
+		}
+		auto numLineBytes = static_cast<size_t>(lineEnd - a_Data) + 1;
+		m_FeedLine.insert(m_FeedLine.end(), a_Data, a_Data + numLineBytes);
+		processLines(m_FeedLine.data(), m_FeedLine.size());
+		m_FeedLine.clear();
+		a_Data += numLineBytes;
+		a_Size -= numLineBytes;
+	}
+
+	// Process the complete lines directly from the data, keep the incomplete last line for the next call:
+	auto numConsumed = processLines(a_Data, a_Size);
+	if (m_ShouldContinueParsing)
+	{
+		m_FeedLine.assign(a_Data + numConsumed, a_Data + a_Size);
+	}
+}
+
+
+
+
+
+void MassifParser::finish()
+{
+	if (!m_IsFeeding)
+	{
+		return;
+	}
+	m_IsFeeding = false;
+
+	// Process the last line, if it wasn't terminated by a newline:
+	if (m_ShouldContinueParsing && !m_FeedLine.empty())
+	{
+		processLine(m_FeedLine.data(), m_FeedLine.size());
+	}
+	m_FeedLine.clear();
 
 	// End any snapshot that was parsed up until now, without a terminating line:
 	endCurrentSnapshot();
@@ -132,6 +389,86 @@ void MassifParser::parse(QIODevice & a_Device)
 
 
 
+void MassifParser::parseBuffer(const char * a_Data, size_t a_Size)
+{
+	m_CurrentLine = 1;
+	parseData(a_Data, a_Size);
+}
+
+
+
+
+
+size_t MassifParser::parseAppendedData(const char * a_Data, size_t a_Size)
+{
+	static const char strSnapshot[] = "snapshot=";
+
+	// Find the start of the last snapshot, counting the lines before it.
+	// The data starts at a snapshot start (or the file start), so only the later starts count:
+	size_t lastSnapshotStart = 0;
+	quint32 numLinesBefore = 0;
+	quint32 numLines = 0;
+	size_t lineStart = 0;
+	while (lineStart < a_Size)
+	{
+		if ((lineStart > 0) && lineStartsWith(a_Data + lineStart, a_Size - lineStart, strSnapshot))
+		{
+			lastSnapshotStart = lineStart;
+			numLinesBefore = numLines;
+		}
+		auto lineEnd = static_cast<const char *>(std::memchr(a_Data + lineStart, '\n', a_Size - lineStart));
+		if (lineEnd == nullptr)
+		{
+			break;
+		}
+		lineStart = static_cast<size_t>(lineEnd - a_Data) + 1;
+		numLines += 1;
+	}
+	if (lastSnapshotStart == 0)
+	{
+		// No complete snapshot yet
+		return 0;
+	}
+
+	// Parse everything up to the last snapshot's start:
+	auto firstLineNum = m_CurrentLine;
+	parseData(a_Data, lastSnapshotStart);
+	m_CurrentLine = firstLineNum + numLinesBefore;
+	return lastSnapshotStart;
+}
+
+
+
+
+
+void MassifParser::finishAppendedData(const char * a_Data, size_t a_Size)
+{
+	parseData(a_Data, a_Size);
+}
+
+
+
+
+
+void MassifParser::parseData(const char * a_Data, size_t a_Size)
+{
+	m_NumBytesTotal = a_Size;
+
+	// If there are enough snapshots in the data, parse them in parallel:
+	auto sections = findSnapshotSections(a_Data, a_Size, m_CurrentLine);
+	if (sections.size() > 1)
+	{
+		parseSectionsInParallel(a_Data, sections);
+		return;
+	}
+
+	parseLines(a_Data, a_Size);
+}
+
+
+
+
+
 void MassifParser::abortParsing(void)
 {
 	m_ShouldContinueParsing = false;
@@ -141,7 +478,165 @@ void MassifParser::abortParsing(void)
 
 
 
-void MassifParser::processLine(char * a_Line, int a_LineLen)
+std::vector<MassifParser::Section> MassifParser::findSnapshotSections(const char * a_Data, size_t a_Size, quint32 a_FirstLineNum)
+{
+	// Sections smaller than this are merged with their neighbors, so that the per-task overhead doesn't dominate:
+	static const size_t MIN_SECTION_SIZE = 256 * 1024;
+	static const char strSnapshot[] = "snapshot=";
+
+	// Walk the lines, a new section starts at each "snapshot=" line:
+	std::vector<Section> res;
+	size_t lineStart = 0;
+	quint32 lineNum = a_FirstLineNum;
+	while (lineStart < a_Size)
+	{
+		if (lineStartsWith(a_Data + lineStart, a_Size - lineStart, strSnapshot))
+		{
+			if (res.empty() || (lineStart - res.back().m_Start >= MIN_SECTION_SIZE))
+			{
+				if (!res.empty())
+				{
+					res.back().m_End = lineStart;
+				}
+				res.push_back({lineStart, a_Size, lineNum});
+			}
+		}
+		auto lineEnd = static_cast<const char *>(std::memchr(a_Data + lineStart, '\n', a_Size - lineStart));
+		if (lineEnd == nullptr)
+		{
+			break;
+		}
+		lineStart = static_cast<size_t>(lineEnd - a_Data) + 1;
+		lineNum += 1;
+	}
+	return res;
+}
+
+
+
+
+
+void MassifParser::parseSectionsInParallel(const char * a_Data, const std::vector<Section> & a_Sections)
+{
+	// Parse the header on this thread, the handlers may abort the parsing based on its contents:
+	parseLines(a_Data, a_Sections.front().m_Start);
+	if (!m_ShouldContinueParsing)
+	{
+		return;
+	}
+
+	// Queue all the sections for parsing in the thread pool:
+	std::vector<std::shared_ptr<SectionTask>> tasks;
+	tasks.reserve(a_Sections.size());
+	auto threadPool = QThreadPool::globalInstance();
+	for (const auto & section: a_Sections)
+	{
+		auto task = std::make_shared<SectionTask>(a_Data, section, m_CodeLocationFactory);
+		tasks.push_back(task);
+		threadPool->start(new SectionTaskRunnable(task));
+	}
+
+	// Report the results in the file order. If a task hasn't been started yet, execute it on this thread:
+	for (const auto & task: tasks)
+	{
+		if (!m_ShouldContinueParsing)
+		{
+			// Parsing has been aborted, abort the remaining tasks, but still wait for them to finish
+			// (they access the data, which is about to go away):
+			task->abort();
+			task->wait();
+			continue;
+		}
+		if (task->claim())
+		{
+			task->execute();
+		}
+		task->wait();
+		for (const auto & err: task->m_Errors)
+		{
+			emit parseError(err.m_LineNum, err.m_ErrorMessage, err.m_Line.c_str());
+		}
+		for (const auto & snapshot: task->m_Snapshots)
+		{
+			if (!m_ShouldContinueParsing)
+			{
+				break;
+			}
+			reportSnapshot(snapshot);
+		}
+		emit parseProgress(task->getSection().m_End, m_NumBytesTotal);
+	}
+}
+
+
+
+
+
+void MassifParser::parseLines(const char * a_Data, size_t a_Size)
+{
+	// The main parser processes the data in steps, so that it can report the progress in between:
+	static const size_t PROGRESS_STEP = 4 * 1024 * 1024;
+	auto stepSize = (m_SectionTask == nullptr) ? PROGRESS_STEP : a_Size;
+	size_t numConsumed = 0;
+	while (m_ShouldContinueParsing && (numConsumed < a_Size))
+	{
+		auto numStepConsumed = processLines(a_Data + numConsumed, std::min(stepSize, a_Size - numConsumed));
+		if (numStepConsumed == 0)
+		{
+			// There's no line end within the step, process everything up to the last line end:
+			numStepConsumed = processLines(a_Data + numConsumed, a_Size - numConsumed);
+			if (numStepConsumed == 0)
+			{
+				// Only the last unterminated line remains
+				break;
+			}
+		}
+		numConsumed += numStepConsumed;
+		if (m_SectionTask == nullptr)
+		{
+			emit parseProgress(numConsumed, m_NumBytesTotal);
+		}
+	}
+
+	// Process the last line, if it wasn't terminated by a newline:
+	if (m_ShouldContinueParsing && (numConsumed < a_Size))
+	{
+		processLine(a_Data + numConsumed, a_Size - numConsumed);
+	}
+
+	// End any snapshot that was parsed up until now, without a terminating line:
+	endCurrentSnapshot();
+}
+
+
+
+
+
+size_t MassifParser::processLines(const char * a_Data, size_t a_Size)
+{
+	// Use memchr() for finding the line ends, the C runtime provides a vectorized implementation:
+	size_t lineStart = 0;
+	while (m_ShouldContinueParsing && (lineStart < a_Size))
+	{
+		auto lineEnd = static_cast<const char *>(std::memchr(a_Data + lineStart, '\n', a_Size - lineStart));
+		if (lineEnd == nullptr)
+		{
+			// Incomplete line, leave it for the caller
+			break;
+		}
+		auto lineLen = static_cast<size_t>(lineEnd - a_Data) - lineStart;
+		processLine(a_Data + lineStart, lineLen);
+		m_CurrentLine += 1;
+		lineStart += lineLen + 1;
+	}
+	return lineStart;
+}
+
+
+
+
+
+void MassifParser::processLine(const char * a_Line, size_t a_LineLen)
 {
 	// Text constants used for comparisons:
 	static const char strMemHeapB[] = "mem_heap_B=";
@@ -150,14 +645,17 @@ void MassifParser::processLine(char * a_Line, int a_LineLen)
 	static const char strTimeUnit[] = "time_unit: ";
 	static const char strCmd[] = "cmd: ";
 
-	// If the line is too short, bail out early:
-	if (a_LineLen < 2)
+	// Drop the CR of CRLF line endings:
+	if ((a_LineLen > 0) && (a_Line[a_LineLen - 1] == '\r'))
 	{
-		return;
+		a_LineLen -= 1;
 	}
 
-	// Terminate the line before the '\n':
-	a_Line[a_LineLen - 1] = 0;
+	// If the line is empty, bail out early:
+	if (a_LineLen < 1)
+	{
+		return;
+	}
 
 	// Process the line; take the first guess based on the start letter:
 	switch (a_Line[0])
@@ -171,24 +669,24 @@ void MassifParser::processLine(char * a_Line, int a_LineLen)
 
 		case 'm':
 		{
-			if (strncmp(a_Line, strMemHeapB, sizeof(strMemHeapB) - 1) == 0)
+			if (lineStartsWith(a_Line, a_LineLen, strMemHeapB))
 			{
 				createNewSnapshotIfNeeded();
 				quint64 heapSize;
-				if (!parseInteger(a_Line + sizeof(strMemHeapB) - 1, heapSize))
+				if (!parseInteger(a_Line + sizeof(strMemHeapB) - 1, heapSize, a_LineLen - sizeof(strMemHeapB) + 1))
 				{
-					emit parseError(m_CurrentLine, "Bad number as heap size", a_Line);
+					reportParseError("Bad number as heap size", a_Line, a_LineLen);
 					break;
 				}
 				m_CurrentSnapshot->setHeapSize(heapSize);
 			}
-			else if (strncmp(a_Line, strMemHeapExtraB, sizeof(strMemHeapExtraB) - 1) == 0)
+			else if (lineStartsWith(a_Line, a_LineLen, strMemHeapExtraB))
 			{
 				createNewSnapshotIfNeeded();
 				quint64 heapExtraSize;
-				if (!parseInteger(a_Line + sizeof(strMemHeapExtraB) - 1, heapExtraSize))
+				if (!parseInteger(a_Line + sizeof(strMemHeapExtraB) - 1, heapExtraSize, a_LineLen - sizeof(strMemHeapExtraB) + 1))
 				{
-					emit parseError(m_CurrentLine, "Bad number as heap extra size", a_Line);
+					reportParseError("Bad number as heap extra size", a_Line, a_LineLen);
 					break;
 				}
 				m_CurrentSnapshot->setHeapExtraSize(heapExtraSize);
@@ -198,19 +696,20 @@ void MassifParser::processLine(char * a_Line, int a_LineLen)
 
 		case 't':
 		{
-			if (strncmp(a_Line, strTimeUnit, sizeof(strTimeUnit) - 1) == 0)
+			if (lineStartsWith(a_Line, a_LineLen, strTimeUnit))
 			{
 				// Report the time units up, abort parsing if they don't agree:
-				emit parsedTimeUnit(a_Line + sizeof(strTimeUnit) - 1);
+				std::string timeUnit(a_Line + sizeof(strTimeUnit) - 1, a_LineLen - sizeof(strTimeUnit) + 1);
+				emit parsedTimeUnit(timeUnit.c_str());
 				break;
 			}
-			if (strncmp(a_Line, strTime, sizeof(strTime) - 1) == 0)
+			if (lineStartsWith(a_Line, a_LineLen, strTime))
 			{
 				createNewSnapshotIfNeeded();
 				quint64 timestamp;
-				if (!parseInteger(a_Line + sizeof(strTime) - 1, timestamp))
+				if (!parseInteger(a_Line + sizeof(strTime) - 1, timestamp, a_LineLen - sizeof(strTime) + 1))
 				{
-					emit parseError(m_CurrentLine, "Bad number as snapshot time", a_Line);
+					reportParseError("Bad number as snapshot time", a_Line, a_LineLen);
 					break;
 				}
 				m_CurrentSnapshot->setTimestamp(timestamp);
@@ -221,34 +720,35 @@ void MassifParser::processLine(char * a_Line, int a_LineLen)
 
 		case 'c':
 		{
-			if (strncmp(a_Line, strCmd, sizeof(strCmd) - 1) == 0)
+			if (lineStartsWith(a_Line, a_LineLen, strCmd))
 			{
 				// Report the command used for generating the report:
-				emit parsedCommand(a_Line + sizeof(strCmd));
+				auto cmdStart = std::min(sizeof(strCmd), a_LineLen);
+				std::string cmd(a_Line + cmdStart, a_LineLen - cmdStart);
+				emit parsedCommand(cmd.c_str());
 			}
 			break;
 		}  // case 'c'
 
 		case 'n':
 		{
-			if ((a_Line[1] < '0') || (a_Line[1] > '9'))
+			if ((a_LineLen < 2) || (a_Line[1] < '0') || (a_Line[1] > '9'))
 			{
 				break;
 			}
 			// The first Allocation line. Create the root Allocation and reset allocation stack:
 			createNewSnapshotIfNeeded();
 			m_LastAllocationDepth = 0;
-			m_LastAllocation = std::make_shared<Allocation>();
+			m_LastAllocation = m_CurrentSnapshot->createRootAllocation();
 			parseAllocationDetails(a_Line, a_LineLen);
-			m_LastAllocation->setType(Allocation::atRoot);
-			m_CurrentSnapshot->setRootAllocation(m_LastAllocation);
+			m_LastAllocation.setType(Allocation::atRoot);
 			break;
 		}
 		case ' ':
 		{
 			if (m_CurrentSnapshot == nullptr)
 			{
-				parseError(m_CurrentLine, "Data line found without a header in front of it", a_Line);
+				reportParseError("Data line found without a header in front of it", a_Line, a_LineLen);
 				break;
 			}
 			createAllocationFromLine(a_Line, a_LineLen);
@@ -261,6 +761,24 @@ void MassifParser::processLine(char * a_Line, int a_LineLen)
 
 
 
+void MassifParser::reportParseError(const char * a_ErrorMessage, const char * a_Line, size_t a_LineLen)
+{
+	// The line is a view into the parsed buffer, make a NUL-terminated copy for the signal:
+	std::string line(a_Line, a_LineLen);
+
+	// Section workers only store the error, it is reported later by the main parser, on its thread:
+	if (m_SectionTask != nullptr)
+	{
+		m_SectionTask->m_Errors.push_back({m_CurrentLine, a_ErrorMessage, std::move(line)});
+		return;
+	}
+	emit parseError(m_CurrentLine, a_ErrorMessage, line.c_str());
+}
+
+
+
+
+
 void MassifParser::createNewSnapshotIfNeeded(void)
 {
 	if (m_CurrentSnapshot == nullptr)
@@ -277,20 +795,28 @@ void MassifParser::endCurrentSnapshot(void)
 {
 	if (m_CurrentSnapshot != nullptr)
 	{
-		// Sort the allocations:
+		// Sort the allocations and index the wide nodes for the CodeLocation lookups:
 		auto allocation = m_CurrentSnapshot->getRootAllocation();
-		if (allocation != nullptr)
+		if (allocation.isValid())
 		{
-			allocation->sortBySize();
+			allocation.sortBySize();
 		}
-		m_CurrentSnapshot->updateFlatSums();
+		m_CurrentSnapshot->finishAllocations();
+		m_CurrentSnapshot->buildChildIndex();
 
-		// Notify about the new snapshot:
-		emit newSnapshotParsed(m_CurrentSnapshot);
+		// Notify about the new snapshot (section workers store it for the main parser to report later):
+		if (m_SectionTask != nullptr)
+		{
+			m_SectionTask->m_Snapshots.push_back(m_CurrentSnapshot);
+		}
+		else
+		{
+			reportSnapshot(m_CurrentSnapshot);
+		}
 
 		// Reset everything:
 		m_CurrentSnapshot.reset();
-		m_LastAllocation.reset();
+		m_LastAllocation = Allocation();
 		m_LastAllocationDepth = 0;
 	}
 }
@@ -299,18 +825,34 @@ void MassifParser::endCurrentSnapshot(void)
 
 
 
-void MassifParser::createAllocationFromLine(const char * a_Line, int a_LineLen)
+void MassifParser::reportSnapshot(SnapshotPtr a_Snapshot)
+{
+	// Consecutive snapshots usually differ only in a few subtrees, keep only a single copy of the unchanged ones.
+	// The tree is rebuilt here, in the parsing thread, while no one else can access the new snapshot yet:
+	if (m_PreviousSnapshot != nullptr)
+	{
+		a_Snapshot->shareAllocationsWith(*m_PreviousSnapshot);
+	}
+	m_PreviousSnapshot = a_Snapshot;
+	emit newSnapshotParsed(a_Snapshot);
+}
+
+
+
+
+
+void MassifParser::createAllocationFromLine(const char * a_Line, size_t a_LineLen)
 {
 	// Check that we already have an allocation present:
-	if (m_LastAllocation == nullptr)
+	if (!m_LastAllocation.isValid())
 	{
-		emit parseError(m_CurrentLine, "Child data line without a parent line", a_Line);
+		reportParseError("Child data line without a parent line", a_Line, a_LineLen);
 		return;
 	}
 
 	// Calculate the depth of the new Allocation, by enumerating all the spaces at line start:
 	unsigned depth = 0;
-	for (int i = 0; i < a_LineLen; i++)
+	for (size_t i = 0; i < a_LineLen; i++)
 	{
 		if (a_Line[i] != ' ')
 		{
@@ -325,11 +867,11 @@ void MassifParser::createAllocationFromLine(const char * a_Line, int a_LineLen)
 	{
 		for (unsigned i = m_LastAllocationDepth; i >= depth; i--)
 		{
-			m_LastAllocation = m_LastAllocation->getParent();
-			assert(m_LastAllocation != nullptr);
+			m_LastAllocation = m_LastAllocation.getParent();
+			assert(m_LastAllocation.isValid());
 		}
 	}
-	m_LastAllocation = m_LastAllocation->addChild();
+	m_LastAllocation = m_LastAllocation.addChild();
 	m_LastAllocationDepth = depth;
 
 	// Parse the information on the rest of the line into the Allocation's details:
@@ -340,7 +882,7 @@ void MassifParser::createAllocationFromLine(const char * a_Line, int a_LineLen)
 
 
 
-void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
+void MassifParser::parseAllocationDetails(const char * a_Line, size_t a_LineLen)
 {
 	/* Line examples:
 	"n77: 76933037 (heap allocation functions) malloc/new/new[], --alloc-fns, etc."
@@ -350,7 +892,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 	*/
 
 	// Skip any initial whitespaces:
-	int idx = 0;
+	size_t idx = 0;
 	while ((idx < a_LineLen) && (a_Line[idx] <= ' '))
 	{
 		idx += 1;
@@ -370,7 +912,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 	{
 		idx += 1;
 	}
-	if (idx + 1 >= a_LineLen)
+	if (idx >= a_LineLen)
 	{
 		return;
 	}
@@ -383,7 +925,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 	{
 		idx += 1;
 	}
-	if (idx + 1 >= a_LineLen)
+	if (idx >= a_LineLen)
 	{
 		return;
 	}
@@ -395,7 +937,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 		allocationSize = allocationSize * 10 + (a_Line[idx] - '0');
 		idx += 1;
 	}
-	m_LastAllocation->setAllocationSize(allocationSize);
+	m_LastAllocation.setAllocationSize(allocationSize);
 	if (idx >= a_LineLen)
 	{
 		return;
@@ -417,7 +959,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 	)
 	{
 		// No more data to be parsed for this entry
-		m_LastAllocation->setType(Allocation::atBelowThreshold);
+		m_LastAllocation.setType(Allocation::atBelowThreshold);
 		return;
 	}
 
@@ -427,7 +969,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 		(a_Line[idx] == '(')
 	)
 	{
-		m_LastAllocation->setType(Allocation::atRoot);
+		m_LastAllocation.setType(Allocation::atRoot);
 		return;
 	}
 
@@ -445,13 +987,15 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 			address = address * 16 + hexDigitToValue(a_Line[idx]);
 			idx += 1;
 		}
-		bool isNew;
-		auto codeLocation = m_CodeLocationFactory->getCodeLocation(address, isNew);
-		m_LastAllocation->setCodeLocation(codeLocation);
-		if (isNew)
-		{
-			parseCodeLocation(codeLocation, a_Line + idx, a_LineLen - idx);
-		}
+		// The details are parsed before the location is published, other sections' parsers may use it right away:
+		auto details = a_Line + idx;
+		auto detailsLength = a_LineLen - idx;
+		auto codeLocation = m_CodeLocationFactory->getCodeLocation(address, [details, detailsLength](CodeLocation & a_NewLocation)
+			{
+				parseCodeLocation(a_NewLocation, details, detailsLength);
+			}
+		);
+		m_LastAllocation.setCodeLocation(codeLocation);
 		return;
 	}
 
@@ -463,7 +1007,7 @@ void MassifParser::parseAllocationDetails(const char * a_Line, int a_LineLen)
 
 
 
-void MassifParser::parseCodeLocation(CodeLocationPtr a_Location, const char * a_Line, int a_LineLength)
+void MassifParser::parseCodeLocation(CodeLocation & a_Location, const char * a_Line, size_t a_LineLength)
 {
 	/* Example location values:
 	": ??? (in /usr/lib/x86_64-linux-gnu/libstdc++.so.6.0.21)"
@@ -471,40 +1015,45 @@ void MassifParser::parseCodeLocation(CodeLocationPtr a_Location, const char * a_
 	": cListAllocationPool<cChunkData::sChunkSection, 1600ul>::Allocate() (AllocationPool.h:81)"
 	*/
 
-	if (a_LineLength < 3)
+	if (a_LineLength < 2)
 	{
 		return;
 	}
-	a_Location->setHasTriedParsing();
+	a_Location.setHasTriedParsing();
 
 	// Skip the colon and space, both are optional:
-	int idx = 0;
+	// (signed indices are used, because the parsing walks backwards from the end)
+	auto lineLength = static_cast<qint64>(a_LineLength);
+	qint64 idx = 0;
 	if (a_Line[0] == ':')
 	{
 		idx += 1;
 	}
-	while ((idx < a_LineLength) && (a_Line[idx] == ' '))
+	while ((idx < lineLength) && (a_Line[idx] == ' '))
 	{
 		idx += 1;
 	}
-	if (idx >= a_LineLength)
+	if (idx >= lineLength)
 	{
 		return;
 	}
 
-	// If the data starts with "??? (in ", consider this an unknown location:
-	if (strncmp(a_Line + idx, "??? (in ", a_LineLength - idx) == 0)
+	// If the data starts with "??? (in ", consider this an unknown location.
+	// The line is a view into the mapped file, it is not NUL-terminated, so check the length first:
+	static const char unknownPrefix[] = "??? (in ";
+	static const qint64 unknownPrefixLength = sizeof(unknownPrefix) - 1;
+	if ((lineLength - idx >= unknownPrefixLength) && (std::memcmp(a_Line + idx, unknownPrefix, unknownPrefixLength) == 0))
 	{
-		a_Location->setFunctionName("???");
-		a_Location->setFileName(QString::fromUtf8(a_Line + idx + 8, a_LineLength - idx - 8));
+		a_Location.setFunctionName("???");
+		a_Location.setFileName(QString::fromUtf8(a_Line + idx + unknownPrefixLength, static_cast<int>(lineLength - idx - unknownPrefixLength)));
 		return;
 	}
 
 	// If there's no filename / linenumber information at the end, consider everything a function name:
-	int end = a_LineLength - 2;
+	auto end = lineLength - 1;
 	if (a_Line[end] != ')')
 	{
-		a_Location->setFunctionName(QString::fromUtf8(a_Line + idx, a_LineLength - idx));
+		a_Location.setFunctionName(QString::fromUtf8(a_Line + idx, static_cast<int>(lineLength - idx)));
 	}
 
 	// Parse from the end, try to cut off the filename and line number:
@@ -517,7 +1066,7 @@ void MassifParser::parseCodeLocation(CodeLocationPtr a_Location, const char * a_
 		order = order * 10;
 		end -= 1;
 	}
-	a_Location->setFileLineNum(lineNum);
+	a_Location.setFileLineNum(lineNum);
 	if (end - 1 <= idx)
 	{
 		return;
@@ -526,12 +1075,12 @@ void MassifParser::parseCodeLocation(CodeLocationPtr a_Location, const char * a_
 	{
 		end -= 1;
 	}
-	int fileNameEnd = end;
+	auto fileNameEnd = end;
 	while ((end >= idx) && (a_Line[end] != '('))
 	{
 		end -= 1;
 	}
-	a_Location->setFileName(QString::fromUtf8(a_Line + end + 1, fileNameEnd - end));
+	a_Location.setFileName(QString::fromUtf8(a_Line + end + 1, static_cast<int>(fileNameEnd - end)));
 	if (end - 1 <= idx)
 	{
 		return;
@@ -543,7 +1092,7 @@ void MassifParser::parseCodeLocation(CodeLocationPtr a_Location, const char * a_
 	}
 	if (end > idx)
 	{
-		a_Location->setFunctionName(QString::fromUtf8(a_Line + idx, end - idx + 1));
+		a_Location.setFunctionName(QString::fromUtf8(a_Line + idx, static_cast<int>(end - idx + 1)));
 	}
 	return;
 }
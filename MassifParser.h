@@ -14,7 +14,10 @@
 
 
 #include <memory>
+#include <atomic>
+#include <vector>
 #include <QObject>
+#include "Allocation.h"
 
 
 
@@ -22,8 +25,6 @@
 
 // fwd:
 class QIODevice;
-class Allocation;
-typedef std::shared_ptr<Allocation> AllocationPtr;
 class Snapshot;
 typedef std::shared_ptr<Snapshot> SnapshotPtr;
 class Project;
@@ -47,12 +48,44 @@ class MassifParser:
 public:
 
 	/** Creates a new parser bound to the specified project.
-	The parser doesn't insert the Snapshots to the project, but needs to bind to existing CodeLocations. */
+	The parser doesn't insert the Snapshots to the project, but needs to bind to existing CodeLocations.
+	The first parsed snapshot shares its unchanged subtrees with the project's latest snapshot, so the parser needs
+	to be created in the project's thread. */
 	explicit MassifParser(ProjectPtr a_Project);
 
-	/** Parses the data coming from the IODevice into snapshots, those are then reported via signals. */
+	/** Parses the data coming from the IODevice into snapshots, those are then reported via signals.
+	Regular files are memory-mapped and parsed directly from the mapping, other devices are read in large chunks. */
 	void parse(QIODevice & a_Device);
 
+	/** Parses the data in the specified memory buffer into snapshots, those are then reported via signals.
+	The buffer is expected to contain the entire Massif output.
+	If the data contains enough snapshots, they are parsed in parallel on the global thread pool
+	and then reported in the file order, from the calling thread. */
+	void parseBuffer(const char * a_Data, size_t a_Size);
+
+	/** Parses the next piece of a Massif output arriving in pieces (from a pipe, socket, process output etc.).
+	The pieces may split the data anywhere, even in the middle of a line; the incomplete line and snapshot
+	are kept until the next call. The complete snapshots are reported via signals as soon as they are parsed.
+	The first call after construction or finish() starts a new output, line numbering from 1.
+	Not thread-safe, but the calls may come from different threads, as long as they don't overlap,
+	so that reading the data and parsing it can run in parallel. */
+	void feed(const char * a_Data, size_t a_Size);
+
+	/** Finishes parsing the output given to feed(), including its last line and snapshot.
+	The parser is then ready to parse a new output. */
+	void finish();
+
+	/** Parses the complete snapshots from the data appended to a growing Massif file.
+	a_Data is the file's data starting where the previous call has stopped (the file start for the first call).
+	Only the snapshots that are followed by the start of another snapshot are parsed, the last one may still be
+	being written. Returns the number of bytes consumed, the next call needs to start with the data at that offset.
+	The line numbers continue across the calls. */
+	size_t parseAppendedData(const char * a_Data, size_t a_Size);
+
+	/** Parses all the remaining data of a followed file (see parseAppendedData()), including the last snapshot.
+	Used when the file is not expected to grow anymore. */
+	void finishAppendedData(const char * a_Data, size_t a_Size);
+
 signals:
 
 	/** Emitted when a complete new snapshot has been parsed. */
@@ -70,40 +103,112 @@ signals:
 	The handler may call abortParsing() to abort the current parsing operation. */
 	void parseError(quint32 a_LineNum, const char * a_ErrorMessage, const char * a_Line);
 
+	/** Emitted periodically while parsing, with the number of bytes parsed so far.
+	a_NumBytesTotal is 0 if the total size of the data is not known (sequential devices). */
+	void parseProgress(quint64 a_NumBytesParsed, quint64 a_NumBytesTotal);
+
 public slots:
 
 	/** Aborts current parse operation (in parse() function call).
-	Sets the m_ShouldContinueParsing flag to false, the parser will abort upon parsing next line. */
+	Sets the m_ShouldContinueParsing flag to false, the parser will abort upon parsing next line.
+	The abort is permanent, any later parse operation returns without parsing anything, even if the abort comes before
+	the parsing starts. Use a new parser instance for parsing more data. */
 	void abortParsing(void);
 
 protected:
 
+	/** Describes a part of the parsed data that contains one or more whole snapshots.
+	Used for parsing the snapshots in parallel. */
+	struct Section
+	{
+		/** Offset of the section's first byte in the data. */
+		size_t m_Start;
+
+		/** Offset of the first byte after the section. */
+		size_t m_End;
+
+		/** Line number of the section's first line, 1-based. */
+		quint32 m_FirstLineNum;
+	};
+
+	// fwd:
+	class SectionTask;
+	class SectionTaskRunnable;
+
+
 	/** The factory that manages CodeLocationPtr instances. */
 	CodeLocationFactoryPtr m_CodeLocationFactory;
 
+	/** The task for which this parser is parsing a single section, as a section worker.
+	If set, the parsed snapshots and errors are stored in the task, instead of being emitted.
+	nullptr for the main parser. */
+	SectionTask * m_SectionTask;
+
 	/** The snapshot that is currently being parsed. */
 	SnapshotPtr m_CurrentSnapshot;
 
-	/** The last Allocation instance created from a data line in the file. */
-	AllocationPtr m_LastAllocation;
+	/** The last snapshot reported by this parser (or the project's latest one, before the first report).
+	Each newly parsed snapshot shares its unchanged subtrees with this one, see reportSnapshot(). nullptr if none. */
+	SnapshotPtr m_PreviousSnapshot;
+
+	/** The last Allocation created from a data line in the file, in m_CurrentSnapshot's arena. */
+	Allocation m_LastAllocation;
 
 	/** The nesting depth of m_LastAllocation.
 	Used to find the correct parent for the next Allocation instance, by walking from m_LastAllocation up, if needed. */
 	unsigned m_LastAllocationDepth;
 
-	/** Current line being parsed (in parse() method), 1-based. */
+	/** Current line being parsed (in parse() / parseBuffer() method), 1-based. */
 	quint32 m_CurrentLine;
 
+	/** The total size of the data being parsed, reported in the parseProgress signal. */
+	quint64 m_NumBytesTotal;
+
+	/** True if feed() has been called and finish() hasn't been called yet. */
+	bool m_IsFeeding;
+
+	/** The incomplete last line of the data given to feed(), to be completed by the next feed(). */
+	std::vector<char> m_FeedLine;
+
 	/** If set to false, the parser will abort at the next line.
-	Used by abortParsing() to signal that the parsing should be aborted. */
-	bool m_ShouldContinueParsing;
+	Used by abortParsing() to signal that the parsing should be aborted.
+	Atomic, because the section workers are aborted from the main parser's thread. */
+	std::atomic<bool> m_ShouldContinueParsing;
+
+
+	/** Creates a new section worker parser, bound to the specified (shared) CodeLocationFactory.
+	The parsed snapshots and errors are stored into the specified task, rather than emitted. */
+	MassifParser(CodeLocationFactoryPtr a_CodeLocationFactory, SectionTask * a_SectionTask);
+
+	/** Splits the data into sections, each starting with a "snapshot=" line, for parallel parsing.
+	Small neighboring sections are merged together.
+	The data before the first section is the header. */
+	static std::vector<Section> findSnapshotSections(const char * a_Data, size_t a_Size, quint32 a_FirstLineNum);
 
+	/** Parses the data into snapshots, continuing the line numbering from m_CurrentLine.
+	Uses parallel parsing, if there are enough snapshots in the data. */
+	void parseData(const char * a_Data, size_t a_Size);
 
-	/** Processes a single input line. */
-	void processLine(char * a_Line, int a_LineLen);
+	/** Parses the header on the calling thread, then all the sections in the global thread pool.
+	Reports the results in the file order. */
+	void parseSectionsInParallel(const char * a_Data, const std::vector<Section> & a_Sections);
 
-	/** Processes a single input line that describes an Allocation ("<spaces>n<number>: " lines). */
-	void processAllocationLine(const char * a_Line, int a_LineLen);
+	/** Parses all the lines in the specified buffer, including the last unterminated one.
+	Ends the current snapshot after the last line.
+	The main parser reports the progress in between, a_Data is expected to be the start of the whole data in such a case. */
+	void parseLines(const char * a_Data, size_t a_Size);
+
+
+	/** Processes all the complete lines in the specified buffer.
+	Returns the number of bytes consumed; the rest of the buffer is an incomplete line, not processed yet. */
+	size_t processLines(const char * a_Data, size_t a_Size);
+
+	/** Processes a single input line.
+	The line is a view into the parsed data, it doesn't include the line terminator and isn't NUL-terminated. */
+	void processLine(const char * a_Line, size_t a_LineLen);
+
+	/** Emits the parseError signal for the specified line, on m_CurrentLine. */
+	void reportParseError(const char * a_ErrorMessage, const char * a_Line, size_t a_LineLen);
 
 	/** If m_CurrentSnapshot is empty, creates a new snapshot and assigns it to m_CurrentSnapshot. */
 	void createNewSnapshotIfNeeded(void);
@@ -111,18 +216,23 @@ protected:
 	/** If m_CurrentSnapshot is valid, signalizes that it has been parsed and resets it to empty. */
 	void endCurrentSnapshot(void);
 
+	/** Shares the unchanged subtrees of the specified finished snapshot with m_PreviousSnapshot, then emits
+	newSnapshotParsed() for it. Used by the main parser only, in the order of the snapshots in the data. */
+	void reportSnapshot(SnapshotPtr a_Snapshot);
+
 	/** Creates a new Allocation instance from the specified line, and assigns it into m_LastAllocation.
 	Uses m_LastAllocationDepth to find the correct parent for the new Allocation. */
-	void createAllocationFromLine(const char * a_Line, int a_LineLen);
+	void createAllocationFromLine(const char * a_Line, size_t a_LineLen);
 
 	/** Parses the line contents into m_LastAllocation's details.
 	Receives the entire Allocation line, including the spaces and "n<int>: " header. */
-	void parseAllocationDetails(const char * a_Line, int a_LineLen);
+	void parseAllocationDetails(const char * a_Line, size_t a_LineLen);
 
 	/** Parses the code location details from the given string.
 	The string contains all the Massif's data after the hex address, starting with the colon:
-	": cChunk::SetAllData(cSetChunkData&) (Chunk.cpp:313)" */
-	void parseCodeLocation(CodeLocationPtr a_Location, const char * a_Line, int a_LineLength);
+	": cChunk::SetAllData(cSetChunkData&) (Chunk.cpp:313)"
+	Static, so that it can run as the CodeLocationFactory initializer without touching the parser's state. */
+	static void parseCodeLocation(CodeLocation & a_Location, const char * a_Line, size_t a_LineLength);
 };
 
 
@@ -0,0 +1,318 @@
+// MultiSnapshotDiff.cpp
+
+// Implements the MultiSnapshotDiff class representing a diff across a range of snapshots
+
+// Implements the MultiDiffItem class representing a single item of the MultiSnapshotDiff tree
+
+
+
+
+
+#include "Globals.h"
+#include "MultiSnapshotDiff.h"
+#include <algorithm>
+#include <functional>
+#include "Allocation.h"
+#include "AllocationArena.h"
+#include "Snapshot.h"
+#include "SnapshotDiff.h"
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MultiDiffItem:
+
+MultiDiffItem::MultiDiffItem(const MultiSnapshotDiff & a_Diff, MultiDiffItem * a_Parent, int a_Row, std::vector<Allocation> && a_Allocations):
+	m_Diff(a_Diff),
+	m_Parent(a_Parent),
+	m_Row(a_Row),
+	m_Allocations(std::move(a_Allocations)),
+	m_AreChildrenCreated(false)
+{
+	m_Sizes.reserve(m_Allocations.size());
+	for (const auto & a: m_Allocations)
+	{
+		m_Sizes.push_back(a.isValid() ? a.getAllocationSize() : 0);
+	}
+}
+
+
+
+
+
+const MultiDiffItemPtrs & MultiDiffItem::getChildren() const
+{
+	createChildren();
+	return m_Children;
+}
+
+
+
+
+
+MultiDiffItem * MultiDiffItem::child(int a_Index) const
+{
+	createChildren();
+	if ((a_Index < 0) || (static_cast<size_t>(a_Index) >= m_Children.size()))
+	{
+		return nullptr;
+	}
+	return m_Children[static_cast<size_t>(a_Index)].get();
+}
+
+
+
+
+
+CodeLocationPtr MultiDiffItem::getCodeLocation() const
+{
+	for (const auto & a: m_Allocations)
+	{
+		if (a.isValid())
+		{
+			return a.getCodeLocation();
+		}
+	}
+	assert(!"MultiDiffItem without any valid allocation");
+	return nullptr;
+}
+
+
+
+
+
+qint64 MultiDiffItem::getFirstToLastDiff() const
+{
+	if (m_Sizes.empty())
+	{
+		return 0;
+	}
+	return static_cast<qint64>(m_Sizes.back()) - static_cast<qint64>(m_Sizes.front());
+}
+
+
+
+
+
+qint64 MultiDiffItem::getMaxGrowth() const
+{
+	// Single pass, keeping the minimum of the sizes seen so far:
+	qint64 res = 0;
+	if (m_Sizes.empty())
+	{
+		return res;
+	}
+	auto minSoFar = static_cast<qint64>(m_Sizes.front());
+	for (auto s: m_Sizes)
+	{
+		auto size = static_cast<qint64>(s);
+		res = std::max(res, size - minSoFar);
+		minSoFar = std::min(minSoFar, size);
+	}
+	return res;
+}
+
+
+
+
+
+bool MultiDiffItem::isMonotonicGrowth() const
+{
+	for (size_t i = 1; i < m_Sizes.size(); ++i)
+	{
+		if (m_Sizes[i] < m_Sizes[i - 1])
+		{
+			return false;
+		}
+	}
+	return (getFirstToLastDiff() > 0);
+}
+
+
+
+
+
+void MultiDiffItem::createChildren() const
+{
+	if (m_AreChildrenCreated)
+	{
+		return;
+	}
+	m_AreChildrenCreated = true;
+
+	// Skip the children that are the same in all the snapshots, they would show only a flat line:
+	auto self = const_cast<MultiDiffItem *>(this);
+	for (auto & match: m_Diff.matchChildren(m_Allocations))
+	{
+		if (m_Diff.hasAnyDiff(match))
+		{
+			auto row = static_cast<int>(m_Children.size());
+			m_Children.push_back(std::make_shared<MultiDiffItem>(m_Diff, self, row, std::move(match)));
+		}
+	}
+}
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// MultiSnapshotDiff:
+
+MultiSnapshotDiff::MultiSnapshotDiff(const std::vector<SnapshotPtr> & a_Snapshots):
+	m_Snapshots(a_Snapshots)
+{
+	std::vector<Allocation> roots;
+	m_Allocations.reserve(m_Snapshots.size());
+	roots.reserve(m_Snapshots.size());
+	for (const auto & s: m_Snapshots)
+	{
+		auto arena = s->getAllocationArena();
+		roots.push_back((arena == nullptr) ? Allocation() : Allocation(arena.get(), 0));
+		m_Allocations.push_back(std::move(arena));
+	}
+	m_Root = std::make_shared<MultiDiffItem>(*this, nullptr, 0, std::move(roots));
+}
+
+
+
+
+
+std::vector<std::vector<Allocation>> MultiSnapshotDiff::matchChildren(const std::vector<Allocation> & a_Allocations) const
+{
+	// Collect each snapshot's children that have a CodeLocation, and order them by the CodeLocation:
+	auto numSnapshots = a_Allocations.size();
+	std::vector<std::vector<Allocation>> children(numSnapshots);
+	std::vector<std::vector<size_t>> orders(numSnapshots);
+	for (size_t k = 0; k < numSnapshots; ++k)
+	{
+		SnapshotDiff::collectMatchableChildren(a_Allocations[k], children[k]);
+		orders[k] = SnapshotDiff::sortByCodeLocation(children[k]);
+	}
+	auto codeLocationAt = [&children, &orders](size_t a_Snapshot, size_t a_Pos)
+	{
+		return children[a_Snapshot][orders[a_Snapshot][a_Pos]].getCodeLocation().get();
+	};
+
+	// Merge all the sorted lists at once, each step takes the smallest CodeLocation of all the lists' heads:
+	std::vector<std::vector<Allocation>> res;
+	std::vector<size_t> heads(numSnapshots, 0);
+	std::vector<size_t> runEnds(numSnapshots, 0);
+	for (;;)
+	{
+		const CodeLocation * cl = nullptr;
+		bool hasAny = false;
+		for (size_t k = 0; k < numSnapshots; ++k)
+		{
+			if (heads[k] >= children[k].size())
+			{
+				continue;
+			}
+			auto headCL = codeLocationAt(k, heads[k]);
+			if (!hasAny || std::less<const CodeLocation *>()(headCL, cl))
+			{
+				cl = headCL;
+				hasAny = true;
+			}
+		}
+		if (!hasAny)
+		{
+			break;
+		}
+
+		// Find the run of the children with this CodeLocation in each list, match the runs' members in their order:
+		size_t maxRunLength = 0;
+		for (size_t k = 0; k < numSnapshots; ++k)
+		{
+			auto end = heads[k];
+			while ((end < children[k].size()) && (codeLocationAt(k, end) == cl))
+			{
+				++end;
+			}
+			runEnds[k] = end;
+			maxRunLength = std::max(maxRunLength, end - heads[k]);
+		}
+		for (size_t i = 0; i < maxRunLength; ++i)
+		{
+			std::vector<Allocation> match(numSnapshots);
+			for (size_t k = 0; k < numSnapshots; ++k)
+			{
+				if (heads[k] + i < runEnds[k])
+				{
+					match[k] = children[k][orders[k][heads[k] + i]];
+				}
+			}
+			res.push_back(std::move(match));
+		}
+		heads.swap(runEnds);
+	}
+	return res;
+}
+
+
+
+
+
+bool MultiSnapshotDiff::hasAnyDiff(const std::vector<Allocation> & a_Allocations) const
+{
+	// The allocation appearing or disappearing, or changing its size, is a difference:
+	auto numSnapshots = a_Allocations.size();
+	if (numSnapshots < 2)
+	{
+		return false;
+	}
+	bool areAllValid = true;
+	for (size_t k = 0; k < numSnapshots; ++k)
+	{
+		if (a_Allocations[k].isValid() != a_Allocations[0].isValid())
+		{
+			return true;
+		}
+		if (!a_Allocations[k].isValid())
+		{
+			areAllValid = false;
+			continue;
+		}
+		if (a_Allocations[k].getAllocationSize() != a_Allocations[0].getAllocationSize())
+		{
+			return true;
+		}
+	}
+	if (!areAllValid)
+	{
+		// Not present in any snapshot
+		return false;
+	}
+
+	// Subtrees identical in all the snapshots have no difference anywhere:
+	auto hash = a_Allocations[0].getSubtreeHash();
+	bool areAllSame = true;
+	for (size_t k = 1; k < numSnapshots; ++k)
+	{
+		if (a_Allocations[k].getSubtreeHash() != hash)
+		{
+			areAllSame = false;
+			break;
+		}
+	}
+	if (areAllSame)
+	{
+		return false;
+	}
+
+	// The subtrees differ, but the changes may still cancel out in this node, check the descendants:
+	for (const auto & match: matchChildren(a_Allocations))
+	{
+		if (hasAnyDiff(match))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+
+
+
@@ -0,0 +1,161 @@
+// MultiSnapshotDiff.h
+
+// Declares the MultiSnapshotDiff class representing a diff across a range of snapshots
+
+// Declares the MultiDiffItem class representing a single item of the MultiSnapshotDiff tree
+
+
+
+
+
+#ifndef MULTISNAPSHOTDIFF_H
+#define MULTISNAPSHOTDIFF_H
+
+
+
+
+
+#include <memory>
+#include <vector>
+#include <Qt>
+#include "Allocation.h"
+
+
+
+
+
+// fwd:
+class MultiSnapshotDiff;
+class Snapshot;
+typedef std::shared_ptr<Snapshot> SnapshotPtr;
+class MultiDiffItem;
+typedef std::shared_ptr<MultiDiffItem> MultiDiffItemPtr;
+typedef std::vector<MultiDiffItemPtr> MultiDiffItemPtrs;
+class CodeLocation;
+typedef std::shared_ptr<CodeLocation> CodeLocationPtr;
+
+
+
+
+
+/** Represents the corresponding allocations across all the snapshots of a MultiSnapshotDiff.
+Is arranged into a tree structure with a single MultiDiffItem as the root; the tree corresponds to the merged trees
+of all the snapshots' Allocations, without the subtrees that are the same in all the snapshots.
+Each item holds the allocation sizes in all the snapshots; the aggregates over the sizes are calculated on the fly.
+The children are created lazily, on first access. The items are valid only while the MultiSnapshotDiff exists. */
+class MultiDiffItem
+{
+public:
+	/** Creates a new instance for the specified allocations, one per snapshot (invalid where not present).
+	a_Row is the index of the new item within its parent's children (0 for the root). */
+	MultiDiffItem(const MultiSnapshotDiff & a_Diff, MultiDiffItem * a_Parent, int a_Row, std::vector<Allocation> && a_Allocations);
+
+	MultiDiffItem * getParent() const { return m_Parent; }
+
+	/** Returns the index of this item within its parent's children, 0 for the root. */
+	int getRow() const { return m_Row; }
+
+	/** Returns the allocations in all the snapshots, in the snapshots' order. Invalid where not present. */
+	const std::vector<Allocation> & getAllocations() const { return m_Allocations; }
+
+	/** Returns the allocation sizes in all the snapshots, in the snapshots' order. 0 where not present. */
+	const std::vector<quint64> & getSizes() const { return m_Sizes; }
+
+	/** Returns all the children, creating them first if not created yet. */
+	const MultiDiffItemPtrs & getChildren() const;
+
+	/** Returns the child at the specified index, or nullptr if index out of bounds. */
+	MultiDiffItem * child(int a_Index) const;
+
+	/** Returns the code location representing this item, taken from the first snapshot where the allocation is present. */
+	CodeLocationPtr getCodeLocation() const;
+
+	/** Returns the difference in size between the last and the first snapshot. */
+	qint64 getFirstToLastDiff() const;
+
+	/** Returns the largest growth of the size between any snapshot and any later snapshot, 0 if the size never grows. */
+	qint64 getMaxGrowth() const;
+
+	/** Returns true if the size never decreases between the consecutive snapshots, and grows overall. */
+	bool isMonotonicGrowth() const;
+
+protected:
+
+	/** The diff that created this item, provides the matching of the children. */
+	const MultiSnapshotDiff & m_Diff;
+
+	/** The parent item of this instance, or nullptr if this is the root. */
+	MultiDiffItem * m_Parent;
+
+	/** The index of this item within m_Parent's m_Children, 0 for the root. */
+	int m_Row;
+
+	/** The allocations in all the snapshots, invalid where the allocation is not present. */
+	std::vector<Allocation> m_Allocations;
+
+	/** The sizes of m_Allocations, 0 for the invalid ones. */
+	std::vector<quint64> m_Sizes;
+
+	/** All the children of this instance, valid only once m_AreChildrenCreated is true. */
+	mutable MultiDiffItemPtrs m_Children;
+
+	/** Set to true once m_Children have been created. */
+	mutable bool m_AreChildrenCreated;
+
+
+	/** Creates the children, if not created yet.
+	Only the children that differ between the snapshots in themselves or in any of their descendants are created. */
+	void createChildren() const;
+};
+
+
+
+
+
+/** A diff across any number of snapshots, merging all their allocation trees at once.
+Used to see how the call paths evolve over a range of snapshots, instead of opening a pairwise diff for each
+consecutive pair. */
+class MultiSnapshotDiff
+{
+public:
+	/** Creates a diff across the specified snapshots, in the specified order (expected to be by their timestamp).
+	Only the root item is created, its descendants are created on first access. */
+	explicit MultiSnapshotDiff(const std::vector<SnapshotPtr> & a_Snapshots);
+
+	const std::vector<SnapshotPtr> & getSnapshots() const { return m_Snapshots; }
+	size_t getNumSnapshots() const { return m_Snapshots.size(); }
+	MultiDiffItemPtr getRootItem() const { return m_Root; }
+
+	/** Matches the children of the allocations (one per snapshot) by their CodeLocations.
+	All the snapshots' children lists are merged in a single pass, in O(N * K) after sorting, where N is the total
+	number of children and K the number of snapshots. Multiple children with the same CodeLocation are matched in
+	their order, the n-th one in each snapshot together, the same as SnapshotDiff::matchChildren() does. Returns the matched children, one vector with an allocation per snapshot (invalid where there's no
+	match) for each matched child. Children without a CodeLocation are not matched nor returned. */
+	std::vector<std::vector<Allocation>> matchChildren(const std::vector<Allocation> & a_Allocations) const;
+
+	/** Returns true if the allocations (one per snapshot), or any of their descendants, differ between the snapshots.
+	The subtrees that are the same in all the snapshots are recognized by their subtree hashes, without walking them. */
+	bool hasAnyDiff(const std::vector<Allocation> & a_Allocations) const;
+
+protected:
+
+	/** The snapshots being diff-ed. */
+	std::vector<SnapshotPtr> m_Snapshots;
+
+	/** The allocation trees of m_Snapshots, nullptr for the snapshots without any.
+	Held so that the items' Allocation handles stay valid even if the snapshots evict their lazily loaded trees. */
+	std::vector<AllocationArenaPtr> m_Allocations;
+
+	/** The root of the diff tree. */
+	MultiDiffItemPtr m_Root;
+};
+
+
+
+
+
+#endif // MULTISNAPSHOTDIFF_H
+
+
+
+
@@ -0,0 +1,197 @@
+// MultiSnapshotDiffModel.cpp
+
+// Implements the MultiSnapshotDiffModel class representing a Qt model for visualising the diff across a range of snapshots
+
+
+
+
+
+#include "Globals.h"
+#include "MultiSnapshotDiffModel.h"
+#include "MultiSnapshotDiff.h"
+#include "Snapshot.h"
+#include "CodeLocation.h"
+#include "FormatNumber.h"
+
+
+
+
+
+MultiSnapshotDiffModel::MultiSnapshotDiffModel(MultiSnapshotDiffPtr a_Diff):
+	Super(nullptr),
+	m_Diff(a_Diff)
+{
+}
+
+
+
+
+
+MultiDiffItem * MultiSnapshotDiffModel::itemFromIndex(const QModelIndex & a_Index) const
+{
+	if (!a_Index.isValid())
+	{
+		return m_Diff->getRootItem().get();
+	}
+	return static_cast<MultiDiffItem *>(a_Index.internalPointer());
+}
+
+
+
+
+
+QVariant MultiSnapshotDiffModel::data(const QModelIndex & a_Index, int a_Role) const
+{
+	if (!a_Index.isValid())
+	{
+		return QVariant();
+	}
+	auto di = static_cast<MultiDiffItem *>(a_Index.internalPointer());
+	auto col = a_Index.column();
+	switch (a_Role)
+	{
+		case Qt::DisplayRole:
+		{
+			switch (col)
+			{
+				case colFirstToLastDiff: return formatBigSignedNumber(di->getFirstToLastDiff());
+				case colMaxGrowth:       return formatBigSignedNumber(di->getMaxGrowth());
+				case colMonotonicGrowth: return di->isMonotonicGrowth() ? tr("Yes") : QString();
+				case colFunction:        return di->getCodeLocation()->getFunctionName();
+				case colFile:            return di->getCodeLocation()->getFileName();
+				case colLine:            return di->getCodeLocation()->getFileLineNum();
+			}
+			if ((col >= colFirstSnapshotSize) && (static_cast<size_t>(col - colFirstSnapshotSize) < di->getSizes().size()))
+			{
+				return formatBigNumber(di->getSizes()[static_cast<size_t>(col - colFirstSnapshotSize)]);
+			}
+			break;
+		}
+		case dataRoleSort:
+		{
+			switch (col)
+			{
+				case colFirstToLastDiff: return di->getFirstToLastDiff();
+				case colMaxGrowth:       return di->getMaxGrowth();
+				case colMonotonicGrowth: return di->isMonotonicGrowth();
+				case colFunction:        return di->getCodeLocation()->getFunctionName();
+				case colFile:            return di->getCodeLocation()->getFileName();
+				case colLine:            return di->getCodeLocation()->getFileLineNum();
+			}
+			if ((col >= colFirstSnapshotSize) && (static_cast<size_t>(col - colFirstSnapshotSize) < di->getSizes().size()))
+			{
+				return di->getSizes()[static_cast<size_t>(col - colFirstSnapshotSize)];
+			}
+			break;
+		}
+	}
+	return QVariant();
+}
+
+
+
+
+
+Qt::ItemFlags MultiSnapshotDiffModel::flags(const QModelIndex & a_Index) const
+{
+	if (!a_Index.isValid())
+	{
+		return {};
+	}
+
+	return Super::flags(a_Index);
+}
+
+
+
+
+
+QVariant MultiSnapshotDiffModel::headerData(int a_Section, Qt::Orientation a_Orientation, int a_Role) const
+{
+	if ((a_Orientation != Qt::Horizontal) || (a_Role != Qt::DisplayRole))
+	{
+		return QVariant();
+	}
+	switch (a_Section)
+	{
+		case colFirstToLastDiff: return tr("First to last (B)");
+		case colMaxGrowth:       return tr("Max growth (B)");
+		case colMonotonicGrowth: return tr("Monotonic growth");
+		case colFunction:        return tr("Function");
+		case colFile:            return tr("File");
+		case colLine:            return tr("Line");
+	}
+	const auto & snapshots = m_Diff->getSnapshots();
+	if ((a_Section >= colFirstSnapshotSize) && (static_cast<size_t>(a_Section - colFirstSnapshotSize) < snapshots.size()))
+	{
+		return tr("Size @ %1").arg(snapshots[static_cast<size_t>(a_Section - colFirstSnapshotSize)]->getTimestamp());
+	}
+	return QVariant();
+}
+
+
+
+
+
+QModelIndex MultiSnapshotDiffModel::index(int a_Row, int a_Column, const QModelIndex & a_Parent) const
+{
+	if (!hasIndex(a_Row, a_Column, a_Parent))
+	{
+		return QModelIndex();
+	}
+
+	auto childItem = itemFromIndex(a_Parent)->child(a_Row);
+	if (childItem == nullptr)
+	{
+		return QModelIndex();
+	}
+	return createIndex(a_Row, a_Column, childItem);
+}
+
+
+
+
+
+QModelIndex MultiSnapshotDiffModel::parent(const QModelIndex & a_Index) const
+{
+	if (!a_Index.isValid())
+	{
+		return QModelIndex();
+	}
+
+	auto childItem = static_cast<MultiDiffItem *>(a_Index.internalPointer());
+	auto parentItem = childItem->getParent();
+	if (parentItem == m_Diff->getRootItem().get())
+	{
+		return QModelIndex();
+	}
+
+	return createIndex(parentItem->getRow(), 0, parentItem);
+}
+
+
+
+
+
+int MultiSnapshotDiffModel::rowCount(const QModelIndex & a_Parent) const
+{
+	if (a_Parent.column() > 0)
+	{
+		return 0;
+	}
+
+	return static_cast<int>(itemFromIndex(a_Parent)->getChildren().size());
+}
+
+
+
+
+
+int MultiSnapshotDiffModel::columnCount(const QModelIndex &) const
+{
+	return colFirstSnapshotSize + static_cast<int>(m_Diff->getNumSnapshots());
+}
+
+
+
+
@@ -0,0 +1,89 @@
+// MultiSnapshotDiffModel.h
+
+// Declares the MultiSnapshotDiffModel class representing a Qt model for visualising the diff across a range of snapshots
+
+
+
+
+
+#ifndef MULTISNAPSHOTDIFFMODEL_H
+#define MULTISNAPSHOTDIFFMODEL_H
+
+
+
+
+
+#include <memory>
+#include <QAbstractItemModel>
+
+
+
+
+
+// fwd:
+class MultiSnapshotDiff;
+typedef std::shared_ptr<MultiSnapshotDiff> MultiSnapshotDiffPtr;
+class MultiDiffItem;
+
+
+
+
+
+/** Shows the MultiSnapshotDiff as a tree, with the aggregates over the range (first-to-last diff, maximum growth,
+monotonic growth) in the first columns, then the code location, then the allocation size in each snapshot. */
+class MultiSnapshotDiffModel:
+	public QAbstractItemModel
+{
+	typedef QAbstractItemModel Super;
+
+	Q_OBJECT
+
+public:
+
+	enum
+	{
+		dataRoleSort = 1038,  // Same as SnapshotDiffModel::dataRoleSort, so that the same sorting proxy can be used
+	};
+
+	/** The columns of the model. The per-snapshot size columns follow colFirstSnapshotSize, one for each snapshot. */
+	enum
+	{
+		colFirstToLastDiff = 0,
+		colMaxGrowth,
+		colMonotonicGrowth,
+		colFunction,
+		colFile,
+		colLine,
+		colFirstSnapshotSize,
+	};
+
+	explicit MultiSnapshotDiffModel(MultiSnapshotDiffPtr a_Diff);
+
+protected:
+
+	/** The diff represented by this model. */
+	MultiSnapshotDiffPtr m_Diff;
+
+
+	/** Returns the item represented by the specified index, the root item for the invalid index. */
+	MultiDiffItem * itemFromIndex(const QModelIndex & a_Index) const;
+
+	// QAbstractItemModel overrides:
+	virtual QVariant data(const QModelIndex & a_Index, int a_Role) const override;
+	virtual Qt::ItemFlags flags(const QModelIndex & a_Index) const override;
+	QVariant headerData(
+		int a_Section,
+		Qt::Orientation a_Orientation,
+		int a_Role = Qt::DisplayRole
+	) const override;
+	QModelIndex index(
+		int a_Row,
+		int a_Column,
+		const QModelIndex & a_Parent = QModelIndex()
+	) const override;
+	QModelIndex parent(const QModelIndex & a_Index) const override;
+	int rowCount(const QModelIndex & a_Parent = QModelIndex()) const override;
+	int columnCount(const QModelIndex & a_Parent = QModelIndex()) const override;
+};
+
+#endif // MULTISNAPSHOTDIFFMODEL_H
@@ -8,9 +8,13 @@
 
 #include "Globals.h"
 #include "Project.h"
-#include <unordered_set>
+#include <stdexcept>
 #include <QIODevice>
 #include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
 #include "Snapshot.h"
 #include "CodeLocationFactory.h"
 #include "CodeLocationStats.h"
@@ -21,11 +25,120 @@
 
 
 
+////////////////////////////////////////////////////////////////////////////////
+// Project::TrieBuildState:
+
+struct Project::TrieBuildState
+{
+	/** Protects m_Project and m_BuiltTrie. */
+	QMutex m_Mtx;
+
+	/** The project to report the built trie to, nullptr once the project has been destroyed. */
+	Project * m_Project;
+
+	/** The trie built by the last finished build, not yet taken by the project. */
+	std::shared_ptr<const AllocationPathTrie> m_BuiltTrie;
+
+
+	TrieBuildState(Project * a_Project):
+		m_Project(a_Project)
+	{
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Project::TrieBuildTask:
+
+class Project::TrieBuildTask:
+	public QRunnable
+{
+public:
+	TrieBuildTask(
+		std::shared_ptr<TrieBuildState> a_State,
+		std::shared_ptr<const AllocationPathTrie> a_Trie,
+		const SnapshotPtrs & a_Snapshots
+	):
+		m_State(a_State),
+		m_Trie(a_Trie),
+		m_Snapshots(a_Snapshots)
+	{
+	}
+
+	virtual void run() override
+	{
+		auto trie = std::make_shared<AllocationPathTrie>(*m_Trie);
+		for (const auto & s: m_Snapshots)
+		{
+			// Stop loading the trees if no one is interested in the trie anymore:
+			if (isAbandoned())
+			{
+				return;
+			}
+
+			// Lazily loaded trees are only needed for the merge, don't keep them all in memory:
+			bool wasLoaded = s->areAllocationsLoaded();
+			trie->addSnapshot(*s);
+			if (!wasLoaded)
+			{
+				s->evictAllocations();
+			}
+		}
+
+		// Report the trie while holding the lock, so that the project cannot be destroyed meanwhile:
+		QMutexLocker lock(&m_State->m_Mtx);
+		if (m_State->m_Project != nullptr)
+		{
+			m_State->m_BuiltTrie = std::move(trie);
+			emit m_State->m_Project->trieBuildFinished();
+		}
+	}
+
+protected:
+	std::shared_ptr<TrieBuildState> m_State;
+	std::shared_ptr<const AllocationPathTrie> m_Trie;
+	SnapshotPtrs m_Snapshots;
+
+
+	/** Returns true if the project has been destroyed. */
+	bool isAbandoned()
+	{
+		QMutexLocker lock(&m_State->m_Mtx);
+		return (m_State->m_Project == nullptr);
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Project:
+
 Project::Project():
 	m_CodeLocationFactory(std::make_shared<CodeLocationFactory>()),
 	m_CodeLocationStats(std::make_shared<CodeLocationStats>(this)),
-	m_HasChangedSinceSave(false)
+	m_AllocationPathTrie(std::make_shared<AllocationPathTrie>()),
+	m_IsBuildingTrie(false),
+	m_IsTrieUsed(false),
+	m_TrieBuildState(std::make_shared<TrieBuildState>(this)),
+	m_HasChangedSinceSave(false),
+	m_IsCompressed(false)
 {
+	connect(this, SIGNAL(trieBuildFinished()), this, SLOT(onTrieBuildFinished()), Qt::QueuedConnection);
+}
+
+
+
+
+
+Project::~Project()
+{
+	QMutexLocker lock(&m_TrieBuildState->m_Mtx);
+	m_TrieBuildState->m_Project = nullptr;
 }
 
 
@@ -34,25 +147,45 @@ Project::Project():
 
 void Project::addSnapshot(SnapshotPtr a_Snapshot)
 {
-	// Emit the signal about the change to all listeners:
-	emit addingSnapshot(a_Snapshot);
+	addSnapshots({a_Snapshot});
+}
 
-	// Insert the snapshot into the internal collection, so that it is sorted:
-	auto timestamp = a_Snapshot->getTimestamp();
-	for (auto itr = m_Snapshots.begin(), end = m_Snapshots.end(); itr != end; ++itr)
+
+
+
+
+void Project::addSnapshots(const SnapshotPtrs & a_Snapshots)
+{
+	if (a_Snapshots.empty())
+	{
+		return;
+	}
+
+	for (const auto & snapshot: a_Snapshots)
 	{
-		if ((*itr)->getTimestamp() > timestamp)
+		// Emit the signal about the change to all listeners:
+		emit addingSnapshot(snapshot);
+		m_TriePendingSnapshots.push_back(snapshot);
+
+		// Insert the snapshot into the internal collection, so that it is sorted.
+		// Search from the back, the snapshots are usually added in the timestamp order:
+		auto timestamp = snapshot->getTimestamp();
+		auto itr = m_Snapshots.end();
+		while ((itr != m_Snapshots.begin()) && ((*std::prev(itr))->getTimestamp() > timestamp))
 		{
-			m_Snapshots.insert(itr, a_Snapshot);
-			m_HasChangedSinceSave = true;
-			emit addedSnapshot(a_Snapshot);
-			return;
+			--itr;
 		}
+		// The parser has already shared the snapshot's unchanged subtrees with its predecessor in the data, see
+		// MassifParser::reportSnapshot(). The sharing only saves memory, each tree stays complete on its own, so
+		// inserting a snapshot out of order doesn't invalidate its neighbors' trees and they need no re-sharing:
+		m_Snapshots.insert(itr, snapshot);
 	}
-	// Timestamp is larger than anything in the collection, append to back:
-	m_Snapshots.push_back(a_Snapshot);
 	m_HasChangedSinceSave = true;
-	emit addedSnapshot(a_Snapshot);
+	if (m_IsTrieUsed)
+	{
+		startTrieBuild();
+	}
+	emit addedSnapshots(a_Snapshots);
 }
 
 
@@ -164,15 +297,8 @@ void Project::setTimeUnit(const std::string & a_TimeUnit)
 
 AllocationStats Project::getStatsForAllocationPath(const AllocationPath & a_AllocationPath)
 {
-	AllocationStats stats(a_AllocationPath);
-	for (const auto & s: m_Snapshots)
-	{
-		const auto alloc = s->findAllocation(a_AllocationPath);
-		auto size = (alloc == nullptr) ? 0 : alloc->getAllocationSize();
-		stats.processNewValue(size);
-	}
-	stats.finishProcessing(m_Snapshots.size());
-	return stats;
+	const auto & trie = getAllocationPathTrie();
+	return trie.getStats(trie.findNode(a_AllocationPath), a_AllocationPath);
 }
 
 
@@ -181,26 +307,21 @@ AllocationStats Project::getStatsForAllocationPath(const AllocationPath & a_Allo
 
 std::vector<AllocationPath> Project::getAllAllocationPathsImmediateChildren(const AllocationPath & a_Path)
 {
-	// Collect all children's CodeLocations:
-	std::unordered_set<CodeLocation *> childrenCodeLocations;
-	for (const auto & s: m_Snapshots)
+	// The trie already has the children merged across all snapshots:
+	std::vector<AllocationPath> paths;
+	const auto & trie = getAllocationPathTrie();
+	auto node = trie.findNode(a_Path);
+	if (node == AllocationPathTrie::NO_INDEX)
 	{
-		const auto allocation = s->findAllocation(a_Path);
-		if (allocation == nullptr)
-		{
-			continue;
-		}
-		for (const auto & a: allocation->getChildren())
-		{
-			childrenCodeLocations.insert(a->getCodeLocation().get());
-		}
+		return paths;
 	}
 
 	// Make the output by appending each child's CodeLocation to a_Path:
-	std::vector<AllocationPath> paths;
-	for (const auto & cl: childrenCodeLocations)
+	const auto & children = trie.getChildren(node);
+	paths.reserve(children.size());
+	for (const auto & ch: children)
 	{
-		paths.emplace_back(a_Path.makeChild(cl));
+		paths.emplace_back(a_Path.makeChild(trie.getCodeLocation(ch)));
 	}
 
 	return paths;
@@ -210,6 +331,56 @@ std::vector<AllocationPath> Project::getAllAllocationPathsImmediateChildren(cons
 
 
 
+const AllocationPathTrie & Project::getAllocationPathTrie() const
+{
+	m_IsTrieUsed = true;
+	startTrieBuild();
+	return *m_AllocationPathTrie;
+}
+
+
+
+
+
+bool Project::isAllocationPathTrieComplete() const
+{
+	return (!m_IsBuildingTrie && m_TriePendingSnapshots.empty());
+}
+
+
+
+
+
+void Project::detachFromFile(const QString & a_FileName)
+{
+	auto canonicalName = QFileInfo(a_FileName).canonicalFilePath();
+	if (canonicalName.isEmpty())
+	{
+		// The file doesn't exist, nothing can be loaded from it
+		return;
+	}
+	for (const auto & s: m_Snapshots)
+	{
+		auto source = s->getAllocationsSource();
+		if (
+			(source != nullptr) &&
+			(QFileInfo(source->getFileName()).canonicalFilePath() == canonicalName) &&
+			!s->detachAllocationsSource()
+		)
+		{
+			throw std::runtime_error(tr("Cannot load the allocations of snapshot %1 from the file: %2")
+				.arg(s->getTimestamp())
+				.arg(s->getAllocationsLoadError())
+				.toStdString()
+			);
+		}
+	}
+}
+
+
+
+
+
 void Project::setSaved(const QString & a_FileName)
 {
 	m_FileName = a_FileName;
@@ -219,3 +390,40 @@ void Project::setSaved(const QString & a_FileName)
 
 
 
+
+void Project::startTrieBuild() const
+{
+	if (m_IsBuildingTrie || m_TriePendingSnapshots.empty())
+	{
+		return;
+	}
+	m_IsBuildingTrie = true;
+	SnapshotPtrs snapshots;
+	std::swap(snapshots, m_TriePendingSnapshots);
+	QThreadPool::globalInstance()->start(new TrieBuildTask(m_TrieBuildState, m_AllocationPathTrie, snapshots));
+}
+
+
+
+
+
+void Project::onTrieBuildFinished()
+{
+	{
+		QMutexLocker lock(&m_TrieBuildState->m_Mtx);
+		if (m_TrieBuildState->m_BuiltTrie == nullptr)
+		{
+			return;
+		}
+		m_AllocationPathTrie = std::move(m_TrieBuildState->m_BuiltTrie);
+	}
+	m_IsBuildingTrie = false;
+
+	// Merge the snapshots added while building:
+	startTrieBuild();
+	emit allocationPathTrieUpdated();
+}
+
+
+
+
@@ -17,6 +17,7 @@
 #include <list>
 #include <QObject>
 #include "AllocationStats.h"
+#include "AllocationPathTrie.h"
 
 
 
@@ -45,9 +46,16 @@ class Project:
 public:
 	Project();
 
+	/** Abandons the background trie build, if any. Doesn't wait for it to finish. */
+	virtual ~Project();
+
 	/** Adds the specified snapshot to the project. */
 	void addSnapshot(SnapshotPtr a_Snapshot);
 
+	/** Adds the specified snapshots to the project in a single batch.
+	The addingSnapshot signal is emitted for each snapshot, but addedSnapshots only once for the whole batch. */
+	void addSnapshots(const SnapshotPtrs & a_Snapshots);
+
 	/** Returns the number of snapshots contained in the project. */
 	size_t getNumSnapshots(void) const;
 
@@ -88,6 +96,22 @@ public:
 	/** Returns all paths across all snapshots that are immediate children to the specified path. */
 	std::vector<AllocationPath> getAllAllocationPathsImmediateChildren(const AllocationPath & a_Path);
 
+	/** Returns the merged allocation tree of the project's snapshots.
+	The snapshots are merged into the trie in the background, on the global thread pool; the first call starts the merge,
+	from then on the snapshots are merged as soon as they are added. Until the merge finishes, the returned trie lacks
+	the newest snapshots (right after opening a project, it is empty); allocationPathTrieUpdated() is emitted once
+	the trie contains them. Lazily loaded snapshot trees that are loaded only for the merge are evicted again.
+	The returned reference is valid only until the next allocationPathTrieUpdated() signal. */
+	const AllocationPathTrie & getAllocationPathTrie() const;
+
+	/** Returns true if all the project's snapshots are merged in the trie returned by getAllocationPathTrie(). */
+	bool isAllocationPathTrieComplete() const;
+
+	/** Prepares the project for overwriting the specified file.
+	All snapshots whose allocations are lazily loaded from that file get their allocations loaded into memory.
+	Throws a std::runtime_error if any of the trees fails to load, the file must not be overwritten then. */
+	void detachFromFile(const QString & a_FileName);
+
 	/** Marks the project as saved into the specified file name.
 	Sets the m_FileName and resets the m_HasChangedSinceSave. */
 	void setSaved(const QString & a_FileName);
@@ -101,16 +125,41 @@ public:
 	so that a newly created project doesn't prompt for saving. */
 	bool hasChangedSinceSave() const { return m_HasChangedSinceSave; }
 
+	/** Returns true if the project is saved in the compressed variant of the file format. */
+	bool isCompressed() const { return m_IsCompressed; }
+
+	/** Sets whether the project is saved in the compressed variant of the file format.
+	Set by the loader for the compressed project files, so that they are saved again the same way. */
+	void setCompressed(bool a_IsCompressed) { m_IsCompressed = a_IsCompressed; }
+
 signals:
 
 	/** Emitted just before a snapshot is added to the project. */
 	void addingSnapshot(SnapshotPtr a_Snapshot);
 
-	/** Emitted just after a snapshot is added to the project. */
-	void addedSnapshot(SnapshotPtr a_Snapshot);
+	/** Emitted just after a batch of snapshots is added to the project. */
+	void addedSnapshots(SnapshotPtrs a_Snapshots);
+
+	/** Emitted when a snapshot's allocation tree fails to load lazily from the project file.
+	The snapshot then shows no tree until the project is reloaded. Emitted from the thread that accessed the tree. */
+	void allocationsLoadFailed(const QString & a_FileName, const QString & a_Reason);
+
+	/** Emitted when the trie returned by getAllocationPathTrie() has been replaced with one containing more snapshots. */
+	void allocationPathTrieUpdated();
+
+	/** Emitted by the background trie build, from the thread pool, once its trie is ready in m_TrieBuildState.
+	Internal, handled by onTrieBuildFinished() in the project's thread. */
+	void trieBuildFinished();
 
 protected:
 
+	/** The state shared between the project and its background trie build, so that the build can outlive the project. */
+	struct TrieBuildState;
+
+	/** The QRunnable that merges snapshots into a copy of the trie. */
+	class TrieBuildTask;
+
+
 	/** The snapshots contained within the project. */
 	SnapshotPtrs m_Snapshots;
 
@@ -129,11 +178,43 @@ protected:
 	Keeps track of min, max and avg allocation sizes of each code location. */
 	CodeLocationStatsPtr m_CodeLocationStats;
 
+	/** The merged allocation tree of the snapshots, with per-snapshot sizes in each node.
+	Never modified, so that the background build can read it while the UI does; the build merges the snapshots
+	into a copy, which then replaces this one in onTrieBuildFinished(). */
+	std::shared_ptr<const AllocationPathTrie> m_AllocationPathTrie;
+
+	/** The snapshots that have been added to the project, but are neither merged into m_AllocationPathTrie
+	nor being merged by the running build, in the order of adding. */
+	mutable SnapshotPtrs m_TriePendingSnapshots;
+
+	/** True if the background trie build is running. At most one build runs at a time, so that the snapshot
+	ordinals in the trie keep the order of adding. */
+	mutable bool m_IsBuildingTrie;
+
+	/** True once getAllocationPathTrie() has been called; the added snapshots are merged right away from then on. */
+	mutable bool m_IsTrieUsed;
+
+	/** The state shared with the background trie build. */
+	std::shared_ptr<TrieBuildState> m_TrieBuildState;
+
 	/** The filename used to load / save the project last. */
 	QString m_FileName;
 
 	/** True iff the project has changed since it was last saved. */
 	bool m_HasChangedSinceSave;
+
+	/** True if the project is saved in the compressed variant of the file format. */
+	bool m_IsCompressed;
+
+
+	/** Starts merging m_TriePendingSnapshots into a copy of the trie on the thread pool,
+	unless there are none or a build is already running. */
+	void startTrieBuild() const;
+
+protected slots:
+
+	/** Replaces the trie with the one built in the background and starts merging the snapshots added meanwhile. */
+	void onTrieBuildFinished();
 };
 
 
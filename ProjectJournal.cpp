@@ -0,0 +1,277 @@
+// ProjectJournal.cpp
+
+// Implements the ProjectJournal class that saves a project incrementally, by appending records to its file
+
+
+
+
+
+#include "Globals.h"
+#include "ProjectJournal.h"
+#include <QBuffer>
+#include <QFile>
+#include "Project.h"
+#include "Snapshot.h"
+#include "Allocation.h"
+#include "CodeLocation.h"
+#include "BinaryIOStream.h"
+
+#ifdef _WIN32
+	#include <io.h>
+#else
+	#include <unistd.h>
+#endif
+
+
+
+
+
+const quint32 ProjectJournal::FILE_VERSION;
+
+
+
+
+
+/** Flushes the file's buffers and makes the OS write the file's data to the disk.
+Returns true on success. */
+static bool syncFile(QFile & a_File)
+{
+	if (!a_File.flush())
+	{
+		return false;
+	}
+	#ifdef _WIN32
+		return (_commit(a_File.handle()) == 0);
+	#else
+		return (fsync(a_File.handle()) == 0);
+	#endif
+}
+
+
+
+
+
+ProjectJournal::ProjectJournal(const QString & a_FileName):
+	m_FileName(a_FileName)
+{
+}
+
+
+
+
+
+void ProjectJournal::start(const Project & a_Project)
+{
+	m_Command.clear();
+	m_TimeUnit.clear();
+	m_StringIndices.clear();
+	m_CodeLocationIndices.clear();
+
+	QByteArray data;
+	{
+		QBuffer buf(&data);
+		buf.open(QIODevice::WriteOnly);
+		BinaryIOStream ios(buf);
+		ios.writeConst(g_ProjectFileMagic);
+		ios.writeUInt32(FILE_VERSION);
+		writeSettingsIfChanged(ios, a_Project);
+		for (const auto & s: a_Project.getSnapshots())
+		{
+			writeSnapshotRecords(ios, *s);
+		}
+		ios.flush();
+	}
+	writeAndSync(data, true);
+}
+
+
+
+
+
+void ProjectJournal::appendSnapshot(const Project & a_Project, Snapshot & a_Snapshot)
+{
+	QByteArray data;
+	{
+		QBuffer buf(&data);
+		buf.open(QIODevice::WriteOnly);
+		BinaryIOStream ios(buf);
+		writeSettingsIfChanged(ios, a_Project);
+		writeSnapshotRecords(ios, a_Snapshot);
+		ios.flush();
+	}
+	writeAndSync(data, false);
+}
+
+
+
+
+
+void ProjectJournal::writeSettingsIfChanged(BinaryIOStream & a_IOS, const Project & a_Project)
+{
+	// The live capture may learn the settings only after parsing the first snapshot, hence the check on each append
+	if ((a_Project.getCommand() == m_Command) && (a_Project.getTimeUnit() == m_TimeUnit))
+	{
+		return;
+	}
+	QByteArray payload;
+	{
+		QBuffer buf(&payload);
+		buf.open(QIODevice::WriteOnly);
+		BinaryIOStream ios(buf);
+		ios.writeVarString(a_Project.getCommand());
+		ios.writeVarString(a_Project.getTimeUnit());
+		ios.flush();
+	}
+	writeRecord(a_IOS, rtSettings, payload);
+	m_Command = a_Project.getCommand();
+	m_TimeUnit = a_Project.getTimeUnit();
+}
+
+
+
+
+
+void ProjectJournal::writeSnapshotRecords(BinaryIOStream & a_IOS, Snapshot & a_Snapshot)
+{
+	// Collect the CodeLocations not yet in the journal. Each CodeLocation used in the tree has a flat sum:
+	std::vector<const CodeLocation *> newCodeLocations;
+	for (const auto & fs: a_Snapshot.getFlatSums())
+	{
+		if (m_CodeLocationIndices.find(fs.first) == m_CodeLocationIndices.end())
+		{
+			auto idx = static_cast<quint64>(m_CodeLocationIndices.size()) + 1;
+			m_CodeLocationIndices[fs.first] = idx;
+			newCodeLocations.push_back(fs.first);
+		}
+	}
+
+	// Write the new strings and CodeLocations:
+	if (!newCodeLocations.empty())
+	{
+		std::vector<QString> newStrings;
+		std::vector<std::pair<quint64, quint64>> clStrings;
+		clStrings.reserve(newCodeLocations.size());
+		for (const auto & cl: newCodeLocations)
+		{
+			clStrings.emplace_back(
+				getStringIndex(cl->getFunctionName(), newStrings),
+				getStringIndex(cl->getFileName(),     newStrings)
+			);
+		}
+
+		if (!newStrings.empty())
+		{
+			QByteArray payload;
+			{
+				QBuffer buf(&payload);
+				buf.open(QIODevice::WriteOnly);
+				BinaryIOStream ios(buf);
+				ios.writeVarUInt(newStrings.size());
+				for (const auto & str: newStrings)
+				{
+					ios.writeVarString(str);
+				}
+				ios.flush();
+			}
+			writeRecord(a_IOS, rtStrings, payload);
+		}
+
+		QByteArray payload;
+		{
+			QBuffer buf(&payload);
+			buf.open(QIODevice::WriteOnly);
+			BinaryIOStream ios(buf);
+			ios.writeVarUInt(newCodeLocations.size());
+			auto numCLs = newCodeLocations.size();
+			for (size_t i = 0; i < numCLs; ++i)
+			{
+				const auto & cl = newCodeLocations[i];
+				ios.writeVarUInt(cl->getAddress());
+				ios.writeVarUInt(clStrings[i].first);
+				ios.writeVarUInt(clStrings[i].second);
+				ios.writeVarUInt(cl->getFileLineNum());
+			}
+			ios.flush();
+		}
+		writeRecord(a_IOS, rtCodeLocations, payload);
+	}
+
+	// Write the snapshot itself:
+	QByteArray payload;
+	bool wasLoaded = a_Snapshot.areAllocationsLoaded();
+	{
+		auto arena = a_Snapshot.getAllocationArena();
+		QBuffer buf(&payload);
+		buf.open(QIODevice::WriteOnly);
+		BinaryIOStream ios(buf);
+		ios.writeVarUInt(a_Snapshot.getTimestamp());
+		ios.writeVarUInt(a_Snapshot.getHeapSize());
+		ios.writeVarUInt(a_Snapshot.getHeapExtraSize());
+		ios.writeBool(arena != nullptr);
+		if (arena != nullptr)
+		{
+			ProjectSaver::saveAllocation(ios, Allocation(arena.get(), 0), m_CodeLocationIndices);
+		}
+		ios.flush();
+	}
+	if (!wasLoaded)
+	{
+		// The tree has been loaded only for writing, don't keep it in memory:
+		a_Snapshot.evictAllocations();
+	}
+	writeRecord(a_IOS, rtSnapshot, payload);
+}
+
+
+
+
+
+quint64 ProjectJournal::getStringIndex(const QString & a_String, std::vector<QString> & a_NewStrings)
+{
+	auto itr = m_StringIndices.constFind(a_String);
+	if (itr != m_StringIndices.constEnd())
+	{
+		return itr.value();
+	}
+	auto idx = static_cast<quint64>(m_StringIndices.size());
+	m_StringIndices[a_String] = idx;
+	a_NewStrings.push_back(a_String);
+	return idx;
+}
+
+
+
+
+
+void ProjectJournal::writeRecord(BinaryIOStream & a_IOS, RecordType a_RecordType, const QByteArray & a_Payload)
+{
+	a_IOS.writeVarUInt(static_cast<quint64>(a_RecordType));
+	a_IOS.writeVarUInt(static_cast<quint64>(a_Payload.size()));
+	a_IOS.writeBytes(a_Payload.constData(), static_cast<size_t>(a_Payload.size()));
+}
+
+
+
+
+
+void ProjectJournal::writeAndSync(const QByteArray & a_Data, bool a_ShouldTruncate)
+{
+	QFile f(m_FileName);
+	auto mode = a_ShouldTruncate ? (QIODevice::WriteOnly | QIODevice::Truncate) : (QIODevice::WriteOnly | QIODevice::Append);
+	if (!f.open(mode))
+	{
+		throw ProjectJournalException("Cannot open the project file for writing");
+	}
+	if (f.write(a_Data) != a_Data.size())
+	{
+		throw ProjectJournalException("Failed to write to the project file");
+	}
+	if (!syncFile(f))
+	{
+		throw ProjectJournalException("Failed to sync the project file to the disk");
+	}
+}
+
+
+
+
@@ -0,0 +1,135 @@
+// ProjectJournal.h
+
+// Declares the ProjectJournal class that saves a project incrementally, by appending records to its file
+
+
+
+
+
+#ifndef PROJECTJOURNAL_H
+#define PROJECTJOURNAL_H
+
+
+
+
+
+#include <string>
+#include <stdexcept>
+#include <vector>
+#include <QString>
+#include <QHash>
+#include <QByteArray>
+#include "ProjectSaver.h"
+
+
+
+
+
+// fwd:
+class Project;
+class Snapshot;
+
+
+
+
+
+class ProjectJournalException:
+	public std::runtime_error
+{
+	typedef std::runtime_error Super;
+
+public:
+	ProjectJournalException(const char * a_Reason):
+		Super(a_Reason)
+	{
+	}
+};
+
+
+
+
+
+/** Saves a project into a file in the append-only journal format (file format version 3), used while live-capturing.
+The file consists of the usual header followed by a sequence of records, each prefixed by its type and size.
+start() writes the entire project once, then each appendSnapshot() appends only the records for the new snapshot
+and the CodeLocations and strings that haven't been written before, and syncs the file to the disk. The cost of
+each capture is thus proportional to the size of the snapshot, not the size of the whole project.
+If the writing is interrupted, the loader ignores the incomplete record at the end of the file.
+The journal is not compact, the project should be saved using ProjectSaver (which rewrites the file in the latest
+indexed format) once the capture is done. */
+class ProjectJournal
+{
+public:
+
+	/** The file format version of the journal. */
+	static const quint32 FILE_VERSION = 3;
+
+	/** The types of the records in the journal. */
+	enum RecordType
+	{
+		rtSettings = 1,       ///< The project's command and time unit, replacing any previous settings
+		rtStrings = 2,        ///< Strings appended to the string table, in the same format as the version 1 string table
+		rtCodeLocations = 3,  ///< CodeLocations appended to the CodeLocation table, in the same format as in version 1
+		rtSnapshot = 4,       ///< A single snapshot, in the same format as the version 1 snapshot block
+	};
+
+
+	/** Creates a journal for the specified file. Nothing is written until start() is called. */
+	ProjectJournal(const QString & a_FileName);
+
+	/** Rewrites the file with the entire project, in the journal format.
+	Throws an exception on error. */
+	void start(const Project & a_Project);
+
+	/** Appends the snapshot to the file, together with the project settings, if they changed, and any CodeLocations
+	that the snapshot uses and that haven't been written yet. The snapshot must belong to the project.
+	Throws an exception on error; the journal then needs to be restarted using start(). */
+	void appendSnapshot(const Project & a_Project, Snapshot & a_Snapshot);
+
+	const QString & getFileName() const { return m_FileName; }
+
+protected:
+
+	/** The name of the file into which the journal is written. */
+	QString m_FileName;
+
+	/** The last command and time unit written into the journal. */
+	std::string m_Command;
+	std::string m_TimeUnit;
+
+	/** Map of string -> its index in the journal's string table. */
+	QHash<QString, quint64> m_StringIndices;
+
+	/** Map of CodeLocation -> its (1-based) index in the journal's CodeLocation table. */
+	ProjectSaver::CodeLocationIndices m_CodeLocationIndices;
+
+
+	/** Writes the settings record, if the project's settings differ from the last written ones. */
+	void writeSettingsIfChanged(BinaryIOStream & a_IOS, const Project & a_Project);
+
+	/** Writes the records needed for the snapshot (new strings, new CodeLocations, the snapshot itself).
+	The new strings and CodeLocations are added to the index maps. */
+	void writeSnapshotRecords(BinaryIOStream & a_IOS, Snapshot & a_Snapshot);
+
+	/** Returns the index of the string in the journal's string table.
+	If the string is not in the table yet, it is added to the table and to a_NewStrings. */
+	quint64 getStringIndex(const QString & a_String, std::vector<QString> & a_NewStrings);
+
+	/** Writes a single record, with the type and size prefix. */
+	static void writeRecord(BinaryIOStream & a_IOS, RecordType a_RecordType, const QByteArray & a_Payload);
+
+	/** Writes the data to the file and syncs the file to the disk.
+	If a_ShouldTruncate is true, the file is rewritten, otherwise the data is appended to it.
+	Throws a ProjectJournalException on failure. */
+	void writeAndSync(const QByteArray & a_Data, bool a_ShouldTruncate);
+};
+
+
+
+
+
+#endif // PROJECTJOURNAL_H
+
+
+
+
@@ -10,13 +10,19 @@
 #include "Globals.h"
 #include "ProjectLoader.h"
 #include <cstring>
+#include <vector>
+#include <unordered_map>
 #include <QIODevice>
+#include <QBuffer>
+#include <QFile>
+#include <QMutex>
 #include "Project.h"
 #include "BinaryIOStream.h"
 #include "CodeLocationFactory.h"
 #include "CodeLocation.h"
 #include "Snapshot.h"
 #include "Allocation.h"
+#include "ProjectJournal.h"
 
 
 
@@ -41,14 +47,13 @@ a previous format class).
 class ProjectLoaderV0
 {
 public:
-	static ProjectPtr loadProject(QIODevice & a_IODevice)
+	static ProjectPtr loadProject(BinaryIOStream & a_IOS, QIODevice & a_IODevice, ProjectLoader::ProgressCallback a_Progress)
 	{
-		BinaryIOStream s(a_IODevice);
 		auto res = std::make_shared<Project>();
-		res->setCommand(s.readString());
-		res->setTimeUnit(s.readString());
-		readCodeLocations(s, *(res->getCodeLocationFactory()));
-		readSnapshots(s, *res);
+		res->setCommand(a_IOS.readString());
+		res->setTimeUnit(a_IOS.readString());
+		readCodeLocations(a_IOS, *(res->getCodeLocationFactory()));
+		readSnapshots(a_IOS, *res, a_IODevice, a_Progress);
 		return res;
 	}
 
@@ -72,9 +77,15 @@ protected:
 	}
 
 
-	static void readSnapshots(BinaryIOStream & a_IOS, Project & a_Project)
+	static void readSnapshots(
+		BinaryIOStream & a_IOS,
+		Project & a_Project,
+		QIODevice & a_IODevice,
+		ProjectLoader::ProgressCallback & a_Progress
+	)
 	{
 		auto numSnapshots = a_IOS.readUInt64();
+		SnapshotPtrs snapshots;
 		for (auto i = numSnapshots; i > 0; --i)
 		{
 			auto snapshot = std::make_shared<Snapshot>();
@@ -84,19 +95,23 @@ protected:
 			if (a_IOS.readBool())
 			{
 				// Allocations are present in the file, read them:
-				auto rootAllocation = std::make_shared<Allocation>();
-				readAllocation(a_IOS, *rootAllocation, *(a_Project.getCodeLocationFactory()));
-				snapshot->setRootAllocation(rootAllocation);
+				readAllocation(a_IOS, snapshot->createRootAllocation(), *(a_Project.getCodeLocationFactory()));
+			}
+			snapshot->finishAllocations();
+			snapshot->buildChildIndex();
+			snapshots.push_back(snapshot);
+			if (a_Progress && !a_Progress(a_IOS.getPosition(), a_IODevice.size()))
+			{
+				throw ProjectLoadException("Loading has been aborted");
 			}
-			snapshot->updateFlatSums();
-			a_Project.addSnapshot(snapshot);
 		}
+		a_Project.addSnapshots(snapshots);
 	}
 
 
 	static void readAllocation(
 		BinaryIOStream & a_IOS,
-		Allocation & a_Allocation,
+		const Allocation & a_Allocation,
 		CodeLocationFactory & a_CodeLocationFactory
 	)
 	{
@@ -120,9 +135,838 @@ protected:
 		auto childrenCount = a_IOS.readUInt64();
 		for (auto i = childrenCount; i > 0; --i)
 		{
-			auto child = a_Allocation.addChild();
-			readAllocation(a_IOS, *child, a_CodeLocationFactory);
+			readAllocation(a_IOS, a_Allocation.addChild(), a_CodeLocationFactory);
+		}
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProjectLoaderV1:
+
+/** Loads the version 1 of the project format.
+Numbers are stored as LEB128 varints, the function and file names are in a string table, allocations refer to
+the CodeLocations by their (1-based) index in the file and each snapshot is stored as a size-prefixed block. */
+class ProjectLoaderV1
+{
+public:
+	static ProjectPtr loadProject(BinaryIOStream & a_IOS, QIODevice & a_IODevice, ProjectLoader::ProgressCallback a_Progress)
+	{
+		auto res = std::make_shared<Project>();
+		res->setCommand(a_IOS.readVarString());
+		res->setTimeUnit(a_IOS.readVarString());
+		auto codeLocations = readCodeLocations(a_IOS, *(res->getCodeLocationFactory()));
+		readSnapshots(a_IOS, *res, codeLocations, a_IODevice, a_Progress);
+		return res;
+	}
+
+protected:
+
+	/** Reads the string table and the CodeLocations, returns the CodeLocations in the file order. */
+	static std::vector<CodeLocationPtr> readCodeLocations(BinaryIOStream & a_IOS, CodeLocationFactory & a_CodeLocations)
+	{
+		std::vector<QString> strings;
+		readStrings(a_IOS, strings);
+		std::vector<CodeLocationPtr> res;
+		readCodeLocationEntries(a_IOS, a_CodeLocations, strings, res);
+		return res;
+	}
+
+
+	/** Reads a count-prefixed list of strings, appends them to a_Strings. */
+	static void readStrings(BinaryIOStream & a_IOS, std::vector<QString> & a_Strings)
+	{
+		auto numStrings = a_IOS.readVarUInt();
+		if (numStrings >= std::numeric_limits<quint32>::max())
+		{
+			throw ProjectLoadException("Failed sanity check on string table size");
+		}
+		a_Strings.reserve(a_Strings.size() + static_cast<size_t>(numStrings));
+		for (auto i = numStrings; i > 0; --i)
+		{
+			a_Strings.push_back(a_IOS.readVarQString());
+		}
+	}
+
+
+	/** Reads a count-prefixed list of CodeLocations, whose names refer to a_Strings, appends them to a_Res. */
+	static void readCodeLocationEntries(
+		BinaryIOStream & a_IOS,
+		CodeLocationFactory & a_CodeLocations,
+		const std::vector<QString> & a_Strings,
+		std::vector<CodeLocationPtr> & a_Res
+	)
+	{
+		auto numCLs = a_IOS.readVarUInt();
+		if (numCLs >= std::numeric_limits<quint32>::max())
+		{
+			throw ProjectLoadException("Failed sanity check on CodeLocation count");
+		}
+		a_Res.reserve(a_Res.size() + static_cast<size_t>(numCLs));
+		for (auto i = numCLs; i > 0; --i)
+		{
+			bool unused;
+			auto cl = a_CodeLocations.getCodeLocation(a_IOS.readVarUInt(), unused);
+			auto functionNameIdx = a_IOS.readVarUInt();
+			auto fileNameIdx = a_IOS.readVarUInt();
+			if ((functionNameIdx >= a_Strings.size()) || (fileNameIdx >= a_Strings.size()))
+			{
+				throw ProjectLoadException("Failed sanity check on CodeLocation string index");
+			}
+			cl->setFunctionName(a_Strings[static_cast<size_t>(functionNameIdx)]);
+			cl->setFileName(a_Strings[static_cast<size_t>(fileNameIdx)]);
+			cl->setFileLineNum(static_cast<quint32>(a_IOS.readVarUInt()));
+			a_Res.push_back(cl);
+		}
+	}
+
+
+	static void readSnapshots(
+		BinaryIOStream & a_IOS,
+		Project & a_Project,
+		const std::vector<CodeLocationPtr> & a_CodeLocations,
+		QIODevice & a_IODevice,
+		ProjectLoader::ProgressCallback & a_Progress
+	)
+	{
+		auto numSnapshots = a_IOS.readVarUInt();
+		SnapshotPtrs snapshots;
+		for (auto i = numSnapshots; i > 0; --i)
+		{
+			// Read the whole snapshot block at once and parse it from memory:
+			auto blockSize = a_IOS.readVarUInt();
+			auto block = a_IOS.readBytes(static_cast<size_t>(blockSize));
+			snapshots.push_back(readSnapshotBlock(block, a_CodeLocations));
+			if (a_Progress && !a_Progress(a_IOS.getPosition(), a_IODevice.size()))
+			{
+				throw ProjectLoadException("Loading has been aborted");
+			}
+		}
+		a_Project.addSnapshots(snapshots);
+	}
+
+
+	/** Parses a single snapshot, with its allocation tree, from the in-memory block. */
+	static SnapshotPtr readSnapshotBlock(QByteArray & a_Block, const std::vector<CodeLocationPtr> & a_CodeLocations)
+	{
+		QBuffer buf(&a_Block);
+		buf.open(QIODevice::ReadOnly);
+		BinaryIOStream ios(buf);
+
+		auto snapshot = std::make_shared<Snapshot>();
+		snapshot->setTimestamp(ios.readVarUInt());
+		snapshot->setHeapSize(ios.readVarUInt());
+		snapshot->setHeapExtraSize(ios.readVarUInt());
+		if (ios.readBool())
+		{
+			// Allocations are present in the file, read them:
+			readAllocation(ios, snapshot->createRootAllocation(), a_CodeLocations);
+		}
+		snapshot->finishAllocations();
+		snapshot->buildChildIndex();
+		return snapshot;
+	}
+
+
+	/** Reads the allocation type, stored as its file value. Unknown values are read as atUnknown. */
+	static Allocation::Type readAllocationType(BinaryIOStream & a_IOS)
+	{
+		switch (a_IOS.readVarUInt())
+		{
+			case 1: return Allocation::atBelowThreshold;
+			case 2: return Allocation::atRegular;
+			case 3: return Allocation::atRoot;
+		}
+		return Allocation::atUnknown;
+	}
+
+
+	static void readAllocation(
+		BinaryIOStream & a_IOS,
+		const Allocation & a_Allocation,
+		const std::vector<CodeLocationPtr> & a_CodeLocations
+	)
+	{
+		a_Allocation.setAllocationSize(a_IOS.readVarUInt());
+		auto clIndex = a_IOS.readVarUInt();
+		if (clIndex != 0)
+		{
+			if (clIndex > a_CodeLocations.size())
+			{
+				throw ProjectLoadException("Failed sanity check on allocation's CodeLocation index");
+			}
+			a_Allocation.setCodeLocation(a_CodeLocations[static_cast<size_t>(clIndex - 1)]);
+		}
+		a_Allocation.setType(readAllocationType(a_IOS));
+
+		auto childrenCount = a_IOS.readVarUInt();
+		for (auto i = childrenCount; i > 0; --i)
+		{
+			readAllocation(a_IOS, a_Allocation.addChild(), a_CodeLocations);
+		}
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProjectLoaderV2:
+
+/** Loads the version 2 of the project format.
+The settings and CodeLocations are the same as in version 1. They are followed by the snapshots' allocation
+tree blocks, then by the snapshot index (the summaries, flat sums and block positions) and finally by a fixed
+8-byte offset of the index. Only the index is read when loading; if the device is a file, the trees are
+loaded lazily from it, on first access.
+Also provides the loading for version 4, which adds the delta-encoded blocks, see ProjectLoaderV4. */
+class ProjectLoaderV2:
+	public ProjectLoaderV1
+{
+public:
+	static ProjectPtr loadProject(BinaryIOStream & a_IOS, QIODevice & a_IODevice, ProjectLoader::ProgressCallback a_Progress)
+	{
+		if (a_IODevice.isSequential())
+		{
+			throw ProjectLoadException("Project file version 2 needs a seekable device");
+		}
+		auto res = std::make_shared<Project>();
+		res->setCommand(a_IOS.readVarString());
+		res->setTimeUnit(a_IOS.readVarString());
+		auto codeLocations = readCodeLocations(a_IOS, *(res->getCodeLocationFactory()));
+		auto headerEnd = a_IOS.getPosition();
+		readSnapshotIndex(res, codeLocations, headerEnd, a_IODevice, false, false, a_Progress);
+		return res;
+	}
+
+protected:
+
+	/** The value of BlockPosition::m_Base for the blocks that contain the full tree. */
+	static const size_t NO_BASE = std::numeric_limits<size_t>::max();
+
+
+	/** The position of a single snapshot's allocation block within the file. */
+	struct BlockPosition
+	{
+		quint64 m_Offset;
+		quint64 m_Size;
+
+		/** The index of the snapshot whose tree the block is a delta against, NO_BASE if the block is the full tree. */
+		size_t m_Base;
+	};
+
+
+	/** Returns the decompressed contents of a block of the compressed variant of the format (version 5).
+	Throws a ProjectLoadException if the block is corrupted. */
+	static QByteArray uncompressBlock(const QByteArray & a_Block)
+	{
+		auto res = qUncompress(a_Block);
+		if (res.isEmpty())
+		{
+			throw ProjectLoadException("Failed to decompress a block of the project file");
+		}
+		return res;
+	}
+
+
+	/** Reads the allocation tree from the block into a new finished arena.
+	If a_Base is not nullptr, the block is a delta against the tree in a_Base. */
+	static AllocationArenaPtr readTreeBlock(
+		BinaryIOStream & a_IOS,
+		const AllocationArenaPtr & a_Base,
+		const std::vector<CodeLocationPtr> & a_CodeLocations
+	)
+	{
+		auto arena = std::make_shared<AllocationArena>();
+		if (a_Base == nullptr)
+		{
+			readAllocation(a_IOS, Allocation(arena.get(), 0), a_CodeLocations);
+		}
+		else
+		{
+			readAllocationDelta(a_IOS, Allocation(a_Base.get(), 0), Allocation(arena.get(), 0), a_CodeLocations);
+		}
+		arena->finishBuilding();
+		return arena;
+	}
+
+
+	/** Reads the allocation stored as a delta against a_Base (see ProjectSaver::saveAllocationDelta()) into a_Allocation. */
+	static void readAllocationDelta(
+		BinaryIOStream & a_IOS,
+		const Allocation & a_Base,
+		const Allocation & a_Allocation,
+		const std::vector<CodeLocationPtr> & a_CodeLocations
+	)
+	{
+		a_Allocation.setCodeLocation(a_Base.getCodeLocation());
+		switch (a_IOS.readVarUInt())
+		{
+			case 0:
+			{
+				// The subtree is the same as in the base, share it instead of copying:
+				a_Allocation.shareSubtree(a_Base);
+				return;
+			}
+			case 1:
+			{
+				break;
+			}
+			default:
+			{
+				throw ProjectLoadException("Unknown allocation delta kind");
+			}
+		}
+
+		// Decode the ZigZag-encoded size difference:
+		auto sizeDiff = a_IOS.readVarUInt();
+		a_Allocation.setAllocationSize(a_Base.getAllocationSize() + ((sizeDiff >> 1) ^ (~(sizeDiff & 1) + 1)));
+		a_Allocation.setType(readAllocationType(a_IOS));
+
+		// Read the children, each either references a base child and is a delta against it, or is a full subtree:
+		std::vector<Allocation> baseChildren;
+		for (const auto & ch: a_Base.getChildren())
+		{
+			baseChildren.push_back(ch);
+		}
+		auto childrenCount = a_IOS.readVarUInt();
+		for (auto i = childrenCount; i > 0; --i)
+		{
+			auto baseChild = a_IOS.readVarUInt();
+			if (baseChild == 0)
+			{
+				readAllocation(a_IOS, a_Allocation.addChild(), a_CodeLocations);
+			}
+			else if (baseChild <= baseChildren.size())
+			{
+				readAllocationDelta(a_IOS, baseChildren[static_cast<size_t>(baseChild - 1)], a_Allocation.addChild(), a_CodeLocations);
+			}
+			else
+			{
+				throw ProjectLoadException("Failed sanity check on allocation delta's base child");
+			}
+		}
+	}
+
+
+	/** Loads the snapshots' allocation trees from the project file on demand.
+	Uses its own QFile instance, so that it is independent of the device used for loading the project. */
+	class FileAllocationsSource:
+		public SnapshotAllocationsSource
+	{
+	public:
+		FileAllocationsSource(
+			const QString & a_FileName,
+			const std::vector<CodeLocationPtr> & a_CodeLocations,
+			const std::vector<BlockPosition> & a_Blocks,
+			bool a_IsCompressed,
+			const ProjectPtr & a_Project
+		):
+			m_FileName(a_FileName),
+			m_CodeLocations(a_CodeLocations),
+			m_Blocks(a_Blocks),
+			m_IsCompressed(a_IsCompressed),
+			m_Project(a_Project)
+		{
 		}
+
+
+		// SnapshotAllocationsSource overrides:
+		virtual AllocationArenaPtr loadAllocations(quint64 a_Key) override
+		{
+			try
+			{
+				return loadTree(a_Key);
+			}
+			catch (const std::exception & exc)
+			{
+				// Let the UI know, the snapshot will show no tree until the project is reloaded:
+				auto project = m_Project.lock();
+				if (project != nullptr)
+				{
+					emit project->allocationsLoadFailed(m_FileName, QString::fromUtf8(exc.what()));
+				}
+				throw;
+			}
+		}
+
+
+		virtual QString getFileName() const override
+		{
+			return m_FileName;
+		}
+
+	protected:
+
+		/** The name of the project file. */
+		QString m_FileName;
+
+		/** The CodeLocations in the file order, for resolving the indices in the allocations. */
+		std::vector<CodeLocationPtr> m_CodeLocations;
+
+		/** The position of each snapshot's block in the file, indexed by the key. */
+		std::vector<BlockPosition> m_Blocks;
+
+		/** If true, each block is compressed (version 5). */
+		bool m_IsCompressed;
+
+		/** The project to which the load failures are reported. */
+		std::weak_ptr<Project> m_Project;
+
+		/** The file from which the blocks are read, opened on first use. */
+		QFile m_File;
+
+
+		/** Loads the tree of the snapshot with the specified key, applying the chain of the deltas.
+		Throws a ProjectLoadException on error. */
+		AllocationArenaPtr loadTree(quint64 a_Key)
+		{
+			if (a_Key >= m_Blocks.size())
+			{
+				throw ProjectLoadException("Invalid snapshot block key");
+			}
+
+			// Collect the chain of the delta blocks down to a keyframe or to a tree that is already loaded:
+			std::vector<size_t> chain;
+			AllocationArenaPtr arena;
+			auto idx = static_cast<size_t>(a_Key);
+			while (true)
+			{
+				arena = findLoadedArena(idx);
+				if (arena != nullptr)
+				{
+					break;
+				}
+				chain.push_back(idx);
+				idx = m_Blocks[idx].m_Base;
+				if (idx == NO_BASE)
+				{
+					break;
+				}
+			}
+			if (chain.empty())
+			{
+				return arena;
+			}
+
+			// Apply the blocks from the oldest one. The trees in between are needed as the bases, and they stay in memory
+			// as long as the requested tree shares their unchanged subtrees, so they are indexed too:
+			for (auto itr = chain.rbegin(), end = chain.rend(); itr != end; ++itr)
+			{
+				auto block = readBlock(m_Blocks[*itr]);
+				if (m_IsCompressed)
+				{
+					// Decompress without holding the lock, so that multiple trees can be loaded in parallel:
+					block = uncompressBlock(block);
+				}
+				QBuffer buf(&block);
+				buf.open(QIODevice::ReadOnly);
+				BinaryIOStream ios(buf);
+				arena = readTreeBlock(ios, arena, m_CodeLocations);
+				arena->buildChildIndex();
+			}
+			{
+				QMutexLocker lock(&m_Mutex);
+				m_LoadedArenas[static_cast<size_t>(a_Key)] = arena;
+			}
+			return arena;
+		}
+
+
+		/** Returns the tree of the snapshot with the specified index, if it is still in memory, nullptr otherwise. */
+		AllocationArenaPtr findLoadedArena(size_t a_Index)
+		{
+			// A loaded tree can serve as the base for loading the later snapshots' deltas:
+			QMutexLocker lock(&m_Mutex);
+			auto itr = m_LoadedArenas.find(a_Index);
+			if (itr == m_LoadedArenas.end())
+			{
+				return nullptr;
+			}
+			auto arena = itr->second.lock();
+			if (arena == nullptr)
+			{
+				m_LoadedArenas.erase(itr);
+			}
+			return arena;
+		}
+
+
+		/** Reads the whole block from the file. The block is then parsed without holding the lock. */
+		QByteArray readBlock(const BlockPosition & a_Pos)
+		{
+			QMutexLocker lock(&m_Mutex);
+			if (!m_File.isOpen())
+			{
+				m_File.setFileName(m_FileName);
+				if (!m_File.open(QIODevice::ReadOnly))
+				{
+					throw ProjectLoadException("Cannot open the project file to load the allocations");
+				}
+			}
+			if (!m_File.seek(static_cast<qint64>(a_Pos.m_Offset)))
+			{
+				throw ProjectLoadException("Cannot seek to the snapshot's allocations");
+			}
+			BinaryIOStream ios(m_File);
+			return ios.readBytes(static_cast<size_t>(a_Pos.m_Size));
+		}
+
+
+		/** The trees loaded from the file, by their snapshot index, so that loading a later snapshot can start from
+		an already loaded base. Keyed by the snapshot rather than by the block, because multiple snapshots may refer
+		to the same block with different bases. Entries for the trees that have been freed are removed on the next access. */
+		std::unordered_map<size_t, std::weak_ptr<AllocationArena>> m_LoadedArenas;
+
+		/** Protects m_File and m_LoadedArenas against concurrent loads. */
+		QMutex m_Mutex;
+	};
+
+
+	/** Reads the snapshot index from the end of the device and adds the snapshots to the project.
+	The allocation trees are set to be loaded lazily from the file, or loaded right away if the device is not a file.
+	If a_HasDeltas is true, the index entries contain the base of the delta-encoded blocks (version 4).
+	If a_IsCompressed is true, the index and the tree blocks are compressed (version 5). */
+	static void readSnapshotIndex(
+		const ProjectPtr & a_Project,
+		const std::vector<CodeLocationPtr> & a_CodeLocations,
+		qint64 a_HeaderEnd,
+		QIODevice & a_IODevice,
+		bool a_HasDeltas,
+		bool a_IsCompressed,
+		ProjectLoader::ProgressCallback & a_Progress
+	)
+	{
+		// Read the index offset from the footer:
+		auto deviceSize = a_IODevice.size();
+		if ((deviceSize < a_HeaderEnd + 8) || !a_IODevice.seek(deviceSize - 8))
+		{
+			throw ProjectLoadException("Project file is truncated");
+		}
+		quint64 indexOffset;
+		{
+			BinaryIOStream ios(a_IODevice);
+			indexOffset = ios.readUInt64();
+		}
+		if ((indexOffset < static_cast<quint64>(a_HeaderEnd)) || (indexOffset > static_cast<quint64>(deviceSize - 8)))
+		{
+			throw ProjectLoadException("Failed sanity check on snapshot index offset");
+		}
+		if (!a_IODevice.seek(static_cast<qint64>(indexOffset)))
+		{
+			throw ProjectLoadException("Cannot seek to the snapshot index");
+		}
+
+		// Read the whole index into memory and parse it from there:
+		QByteArray index;
+		{
+			BinaryIOStream ios(a_IODevice);
+			index = ios.readBytes(static_cast<size_t>(static_cast<quint64>(deviceSize - 8) - indexOffset));
+		}
+		if (a_IsCompressed)
+		{
+			index = uncompressBlock(index);
+		}
+		QBuffer indexBuf(&index);
+		indexBuf.open(QIODevice::ReadOnly);
+		BinaryIOStream ios(indexBuf);
+		auto numSnapshots = ios.readVarUInt();
+		if (numSnapshots >= std::numeric_limits<quint32>::max())
+		{
+			throw ProjectLoadException("Failed sanity check on snapshot count");
+		}
+		std::vector<BlockPosition> blocks;
+		std::vector<std::pair<SnapshotPtr, Snapshot::FlatSums>> snapshots;
+		blocks.reserve(static_cast<size_t>(numSnapshots));
+		snapshots.reserve(static_cast<size_t>(numSnapshots));
+		for (auto i = numSnapshots; i > 0; --i)
+		{
+			BlockPosition pos;
+			pos.m_Offset = ios.readVarUInt();
+			pos.m_Size = ios.readVarUInt();
+			pos.m_Base = NO_BASE;
+			if ((pos.m_Offset < static_cast<quint64>(a_HeaderEnd)) || (pos.m_Offset + pos.m_Size > indexOffset))
+			{
+				throw ProjectLoadException("Failed sanity check on snapshot block position");
+			}
+			if (a_HasDeltas)
+			{
+				// The base must be an earlier snapshot with a tree, so that the chains always end in a keyframe:
+				auto baseDistance = ios.readVarUInt();
+				if (baseDistance > 0)
+				{
+					if ((baseDistance > blocks.size()) || (blocks[blocks.size() - static_cast<size_t>(baseDistance)].m_Size == 0))
+					{
+						throw ProjectLoadException("Failed sanity check on snapshot block's base");
+					}
+					pos.m_Base = blocks.size() - static_cast<size_t>(baseDistance);
+				}
+			}
+			auto snapshot = std::make_shared<Snapshot>();
+			snapshot->setTimestamp(ios.readVarUInt());
+			snapshot->setHeapSize(ios.readVarUInt());
+			snapshot->setHeapExtraSize(ios.readVarUInt());
+			if (!ios.readBool())
+			{
+				pos.m_Size = 0;
+				pos.m_Base = NO_BASE;
+			}
+			Snapshot::FlatSums flatSums;
+			auto numFlatSums = ios.readVarUInt();
+			if (numFlatSums > a_CodeLocations.size())
+			{
+				throw ProjectLoadException("Failed sanity check on flat sums count");
+			}
+			for (auto j = numFlatSums; j > 0; --j)
+			{
+				auto clIndex = ios.readVarUInt();
+				if ((clIndex == 0) || (clIndex > a_CodeLocations.size()))
+				{
+					throw ProjectLoadException("Failed sanity check on flat sum's CodeLocation index");
+				}
+				flatSums[a_CodeLocations[static_cast<size_t>(clIndex - 1)].get()] = ios.readVarUInt();
+			}
+			blocks.push_back(pos);
+			snapshots.emplace_back(snapshot, std::move(flatSums));
+			if (a_Progress && !a_Progress(ios.getPosition(), index.size()))
+			{
+				throw ProjectLoadException("Loading has been aborted");
+			}
+		}
+
+		// Attach the trees to the snapshots:
+		auto file = qobject_cast<QFile *>(&a_IODevice);
+		SnapshotPtrs res;
+		if (file != nullptr)
+		{
+			auto source = std::make_shared<FileAllocationsSource>(file->fileName(), a_CodeLocations, blocks, a_IsCompressed, a_Project);
+			size_t idx = 0;
+			for (auto & s: snapshots)
+			{
+				if (blocks[idx].m_Size > 0)
+				{
+					s.first->setLazyAllocations(source, idx, std::move(s.second));
+				}
+				++idx;
+				res.push_back(s.first);
+			}
+		}
+		else
+		{
+			// Not a file, the device may go away after loading, load all the trees now.
+			// The bases always precede the deltas, so they are already loaded when needed:
+			std::vector<AllocationArenaPtr> arenas;
+			arenas.reserve(snapshots.size());
+			size_t idx = 0;
+			for (auto & s: snapshots)
+			{
+				const auto & pos = blocks[idx++];
+				if (pos.m_Size > 0)
+				{
+					if (!a_IODevice.seek(static_cast<qint64>(pos.m_Offset)))
+					{
+						throw ProjectLoadException("Cannot seek to the snapshot's allocations");
+					}
+					QByteArray block;
+					{
+						BinaryIOStream deviceIOS(a_IODevice);
+						block = deviceIOS.readBytes(static_cast<size_t>(pos.m_Size));
+					}
+					if (a_IsCompressed)
+					{
+						block = uncompressBlock(block);
+					}
+					QBuffer blockBuf(&block);
+					blockBuf.open(QIODevice::ReadOnly);
+					BinaryIOStream blockIOS(blockBuf);
+					if (pos.m_Base == NO_BASE)
+					{
+						readAllocation(blockIOS, s.first->createRootAllocation(), a_CodeLocations);
+					}
+					else
+					{
+						const auto & base = arenas[pos.m_Base];
+						readAllocationDelta(blockIOS, Allocation(base.get(), 0), s.first->createRootAllocation(), a_CodeLocations);
+					}
+				}
+				s.first->finishAllocations();
+				s.first->buildChildIndex();
+				arenas.push_back(s.first->getAllocationArena());
+				res.push_back(s.first);
+			}
+		}
+		a_Project->addSnapshots(res);
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProjectLoaderV3:
+
+/** Loads the version 3 of the project format, the append-only journal written by ProjectJournal.
+The file is a sequence of records, each prefixed by its type and size; the string and CodeLocation tables
+are built incrementally from the records, the snapshots are stored the same way as the version 1 blocks.
+An incomplete record at the end of the file (an interrupted write) is ignored. */
+class ProjectLoaderV3:
+	public ProjectLoaderV1
+{
+public:
+	static ProjectPtr loadProject(BinaryIOStream & a_IOS, QIODevice & a_IODevice, ProjectLoader::ProgressCallback a_Progress)
+	{
+		if (a_IODevice.isSequential())
+		{
+			throw ProjectLoadException("Project file version 3 needs a seekable device");
+		}
+		auto res = std::make_shared<Project>();
+		std::vector<QString> strings;
+		std::vector<CodeLocationPtr> codeLocations;
+		SnapshotPtrs snapshots;
+		auto deviceSize = a_IODevice.size();
+		while (a_IOS.getPosition() < deviceSize)
+		{
+			// Read the record, stop at an incomplete one:
+			QByteArray payload;
+			quint64 recordType;
+			try
+			{
+				recordType = a_IOS.readVarUInt();
+				auto size = a_IOS.readVarUInt();
+				if (size > static_cast<quint64>(deviceSize - a_IOS.getPosition()))
+				{
+					break;
+				}
+				payload = a_IOS.readBytes(static_cast<size_t>(size));
+			}
+			catch (const BinaryIOStreamException &)
+			{
+				break;
+			}
+
+			// Process the record:
+			switch (recordType)
+			{
+				case ProjectJournal::rtSettings:
+				{
+					QBuffer buf(&payload);
+					buf.open(QIODevice::ReadOnly);
+					BinaryIOStream ios(buf);
+					res->setCommand(ios.readVarString());
+					res->setTimeUnit(ios.readVarString());
+					break;
+				}
+				case ProjectJournal::rtStrings:
+				{
+					QBuffer buf(&payload);
+					buf.open(QIODevice::ReadOnly);
+					BinaryIOStream ios(buf);
+					readStrings(ios, strings);
+					break;
+				}
+				case ProjectJournal::rtCodeLocations:
+				{
+					QBuffer buf(&payload);
+					buf.open(QIODevice::ReadOnly);
+					BinaryIOStream ios(buf);
+					readCodeLocationEntries(ios, *(res->getCodeLocationFactory()), strings, codeLocations);
+					break;
+				}
+				case ProjectJournal::rtSnapshot:
+				{
+					snapshots.push_back(readSnapshotBlock(payload, codeLocations));
+					break;
+				}
+				default:
+				{
+					// Unknown record type, written by a newer version, skip it
+					break;
+				}
+			}
+			if (a_Progress && !a_Progress(a_IOS.getPosition(), deviceSize))
+			{
+				throw ProjectLoadException("Loading has been aborted");
+			}
+		}
+		res->addSnapshots(snapshots);
+		return res;
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProjectLoaderV4:
+
+/** Loads the version 4 of the project format.
+The layout is the same as in version 2, but each index entry also contains the distance to the snapshot whose
+tree the block is a delta against (0 for the blocks containing the full tree, the keyframes). The lazily loaded
+trees are reconstructed from the nearest keyframe (or an already loaded tree) by applying the deltas. */
+class ProjectLoaderV4:
+	public ProjectLoaderV2
+{
+public:
+	static ProjectPtr loadProject(BinaryIOStream & a_IOS, QIODevice & a_IODevice, ProjectLoader::ProgressCallback a_Progress)
+	{
+		if (a_IODevice.isSequential())
+		{
+			throw ProjectLoadException("Project file version 4 needs a seekable device");
+		}
+		auto res = std::make_shared<Project>();
+		res->setCommand(a_IOS.readVarString());
+		res->setTimeUnit(a_IOS.readVarString());
+		auto codeLocations = readCodeLocations(a_IOS, *(res->getCodeLocationFactory()));
+		auto headerEnd = a_IOS.getPosition();
+		readSnapshotIndex(res, codeLocations, headerEnd, a_IODevice, true, false, a_Progress);
+		return res;
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// ProjectLoaderV5:
+
+/** Loads the version 5 of the project format, the compressed variant of version 4.
+The settings and CodeLocations are stored in a single size-prefixed compressed block. Each tree block and the index
+are compressed independently, the index refers to the compressed blocks, so that a single tree can be located and
+decompressed without touching the rest of the file. */
+class ProjectLoaderV5:
+	public ProjectLoaderV2
+{
+public:
+	static ProjectPtr loadProject(BinaryIOStream & a_IOS, QIODevice & a_IODevice, ProjectLoader::ProgressCallback a_Progress)
+	{
+		if (a_IODevice.isSequential())
+		{
+			throw ProjectLoadException("Project file version 5 needs a seekable device");
+		}
+		auto headerSize = a_IOS.readVarUInt();
+		if (headerSize > static_cast<quint64>(a_IODevice.size() - a_IOS.getPosition()))
+		{
+			throw ProjectLoadException("Project file is truncated");
+		}
+		auto header = uncompressBlock(a_IOS.readBytes(static_cast<size_t>(headerSize)));
+		auto headerEnd = a_IOS.getPosition();
+
+		auto res = std::make_shared<Project>();
+		res->setCompressed(true);
+		QBuffer buf(&header);
+		buf.open(QIODevice::ReadOnly);
+		BinaryIOStream ios(buf);
+		res->setCommand(ios.readVarString());
+		res->setTimeUnit(ios.readVarString());
+		auto codeLocations = readCodeLocations(ios, *(res->getCodeLocationFactory()));
+		readSnapshotIndex(res, codeLocations, headerEnd, a_IODevice, true, true, a_Progress);
+		return res;
 	}
 };
 
@@ -133,7 +977,7 @@ protected:
 ////////////////////////////////////////////////////////////////////////////////
 // ProjectLoader:
 
-ProjectPtr ProjectLoader::loadProject(QIODevice & a_IODevice)
+ProjectPtr ProjectLoader::loadProject(QIODevice & a_IODevice, ProgressCallback a_Progress)
 {
 	// Check if the project file magic string is present at the beginning of the file:
 	char fileMagic[ARRAYCOUNT(g_ProjectFileMagic)];
@@ -153,7 +997,12 @@ ProjectPtr ProjectLoader::loadProject(QIODevice & a_IODevice)
 	// Load the specific version:
 	switch (versionNumber)
 	{
-		case 0: return ProjectLoaderV0::loadProject(a_IODevice);
+		case 0: return ProjectLoaderV0::loadProject(s, a_IODevice, a_Progress);
+		case 1: return ProjectLoaderV1::loadProject(s, a_IODevice, a_Progress);
+		case 2: return ProjectLoaderV2::loadProject(s, a_IODevice, a_Progress);
+		case 3: return ProjectLoaderV3::loadProject(s, a_IODevice, a_Progress);
+		case 4: return ProjectLoaderV4::loadProject(s, a_IODevice, a_Progress);
+		case 5: return ProjectLoaderV5::loadProject(s, a_IODevice, a_Progress);
 	}
 	throw ProjectLoadException("File version is not supported");
 	return nullptr;
@@ -14,7 +14,9 @@
 
 
 #include <memory>
+#include <functional>
 #include <stdexcept>
+#include <QtGlobal>
 
 
 
@@ -47,9 +49,15 @@ public:
 class ProjectLoader
 {
 public:
+	/** The callback called periodically while loading, with the current position within the device and its total size.
+	If it returns false, the loading is aborted. */
+	typedef std::function<bool (qint64 a_Position, qint64 a_Size)> ProgressCallback;
+
+
 	/** Returns the new loaded project.
-	Throws on failure. */
-	static ProjectPtr loadProject(QIODevice & a_Device);
+	If the progress callback is given, it is called after each loaded snapshot.
+	Throws on failure, or when aborted by the callback. */
+	static ProjectPtr loadProject(QIODevice & a_Device, ProgressCallback a_Progress = ProgressCallback());
 
 	/** Returns whether the specified file is a VisualMassifDiff project file. */
 	static bool isProjectFile(QIODevice & a_IODevice);
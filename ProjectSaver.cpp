@@ -9,19 +9,58 @@
 
 #include "Globals.h"
 #include "ProjectSaver.h"
+#include <unordered_map>
+#include <QBuffer>
 #include "Project.h"
 #include "CodeLocationFactory.h"
 #include "Snapshot.h"
 #include "Allocation.h"
+#include "AllocationArena.h"
 #include "BinaryIOStream.h"
 
 
 
 
 
+const size_t ProjectSaver::KEYFRAME_INTERVAL;
+
+
+
+
+
+/** Returns the value representing the allocation type in the file. */
+static quint32 getTypeFileValue(Allocation::Type a_Type)
+{
+	switch (a_Type)
+	{
+		case Allocation::atBelowThreshold: return 1;
+		case Allocation::atRegular:        return 2;
+		case Allocation::atRoot:           return 3;
+		case Allocation::atUnknown:        return 0;
+	}
+	return 0;
+}
+
+
+
+
+
+/** Encodes the signed value so that values close to zero, both positive and negative, make short varints. */
+static quint64 encodeZigZag(qint64 a_Value)
+{
+	return (static_cast<quint64>(a_Value) << 1) ^ static_cast<quint64>(a_Value >> 63);
+}
+
+
+
+
+
 ProjectSaver::ProjectSaver(QIODevice & a_IODevice):
 	m_IODevice(a_IODevice),
-	m_IOS(a_IODevice)
+	m_IOS(a_IODevice),
+	m_ShouldCompress(false),
+	m_NumDeltasSinceKeyframe(0),
+	m_PrevSnapshotToEvict(nullptr)
 {
 }
 
@@ -33,6 +72,7 @@ void ProjectSaver::saveProject(const Project & a_Project, QIODevice & a_IODevice
 {
 	ProjectSaver s(a_IODevice);
 	s.saveProject(a_Project);
+	s.m_IOS.flush();
 }
 
 
@@ -42,39 +82,172 @@ void ProjectSaver::saveProject(const Project & a_Project, QIODevice & a_IODevice
 void ProjectSaver::saveProject(const Project & a_Project)
 {
 	// Write the file header: magic and version:
+	m_ShouldCompress = a_Project.isCompressed();
 	m_IOS.writeConst(g_ProjectFileMagic);
-	m_IOS.writeUInt32(0);
-
-	// Write settings:
-	m_IOS.writeString(a_Project.getCommand());
-	m_IOS.writeString(a_Project.getTimeUnit());
+	m_IOS.writeUInt32(m_ShouldCompress ? 5 : 4);
 
-	// Write code locations:
-	saveCodeLocations(*(a_Project.getCodeLocationFactory()));
+	// Write settings and code locations, in the compressed variant as a single size-prefixed compressed block:
+	QByteArray header;
+	{
+		QBuffer buf(&header);
+		buf.open(QIODevice::WriteOnly);
+		BinaryIOStream ios(buf);
+		ios.writeVarString(a_Project.getCommand());
+		ios.writeVarString(a_Project.getTimeUnit());
+		saveCodeLocations(ios, *(a_Project.getCodeLocationFactory()));
+		ios.flush();
+	}
+	if (m_ShouldCompress)
+	{
+		header = qCompress(header);
+		m_IOS.writeVarUInt(static_cast<quint64>(header.size()));
+	}
+	m_IOS.writeBytes(header.constData(), static_cast<size_t>(header.size()));
 
-	// Write snapshots:
-	m_IOS.writeUInt64(a_Project.getNumSnapshots());
+	// Write the snapshots' allocation trees:
+	m_SnapshotBlocks.clear();
+	m_SnapshotBlocks.reserve(a_Project.getNumSnapshots());
 	for (const auto & s: a_Project.getSnapshots())
 	{
-		saveSnapshot(*s);
+		saveSnapshotAllocations(*s);
 	}  // for s - m_Snapshots[]
+	releasePrevArena();
+
+	// Write the index:
+	saveSnapshotIndex(a_Project);
 }
 
 
 
 
 
-void ProjectSaver::saveCodeLocations(const CodeLocationFactory & a_CodeLocationFactory)
+void ProjectSaver::saveCodeLocations(BinaryIOStream & a_IOS, const CodeLocationFactory & a_CodeLocationFactory)
 {
 	const auto & codeLocations = a_CodeLocationFactory.getAllCodeLocations();
-	m_IOS.writeUInt64(codeLocations.size());
-	for (const auto & l: codeLocations)
+
+	// Build the string table of function and file names, most of the file names repeat a lot:
+	QHash<QString, quint64> stringIndices;
+	std::vector<QString> strings;
+	std::vector<std::pair<quint64, quint64>> clStrings;
+	clStrings.reserve(codeLocations.size());
+	for (const auto & cl: codeLocations)
+	{
+		clStrings.emplace_back(
+			getStringIndex(cl->getFunctionName(), stringIndices, strings),
+			getStringIndex(cl->getFileName(),     stringIndices, strings)
+		);
+	}
+	a_IOS.writeVarUInt(strings.size());
+	for (const auto & str: strings)
+	{
+		a_IOS.writeVarString(str);
+	}
+
+	// Write the code locations, referencing the string table:
+	a_IOS.writeVarUInt(codeLocations.size());
+	m_CodeLocationIndices.clear();
+	auto numCLs = codeLocations.size();
+	for (size_t i = 0; i < numCLs; ++i)
+	{
+		const auto & cl = codeLocations[i];
+		a_IOS.writeVarUInt(cl->getAddress());
+		a_IOS.writeVarUInt(clStrings[i].first);
+		a_IOS.writeVarUInt(clStrings[i].second);
+		a_IOS.writeVarUInt(cl->getFileLineNum());
+		m_CodeLocationIndices[cl.get()] = i + 1;
+	}
+}
+
+
+
+
+
+void ProjectSaver::saveSnapshotAllocations(Snapshot & a_Snapshot)
+{
+	bool wasLoaded = a_Snapshot.areAllocationsLoaded();
+	auto arena = a_Snapshot.getAllocationArena();
+	if ((arena == nullptr) && a_Snapshot.hasAllocations())
+	{
+		// Saving the snapshot without its tree would lose the tree for good:
+		throw ProjectSaveException(
+			QString("Cannot load the allocations of snapshot %1: %2")
+				.arg(a_Snapshot.getTimestamp())
+				.arg(a_Snapshot.getAllocationsLoadError())
+				.toStdString()
+		);
+	}
+
+	// An identical tree is already saved in the previous block, refer to it instead of writing the same data again.
+	// The block is decoded against the same base as for the previous snapshot, which is one more snapshot back:
+	if (
+		(arena != nullptr) &&
+		(m_PrevArena != nullptr) &&
+		!m_SnapshotBlocks.empty() &&
+		arena->isSameSubtree(0, *m_PrevArena, 0)
+	)
+	{
+		auto block = m_SnapshotBlocks.back();
+		if (block.m_BaseDistance > 0)
+		{
+			block.m_BaseDistance += 1;
+		}
+		m_SnapshotBlocks.push_back(block);
+		releasePrevArena();
+		m_PrevArena = std::move(arena);
+		m_PrevSnapshotToEvict = wasLoaded ? nullptr : &a_Snapshot;
+		return;
+	}
+
+	// Serialize the tree into a memory block first, so that the device gets a single large write.
+	// Store it as a delta against the previous tree, unless a keyframe is due:
+	QByteArray block;
+	quint64 baseDistance = 0;
+	if (arena != nullptr)
+	{
+		QBuffer buf(&block);
+		buf.open(QIODevice::WriteOnly);
+		BinaryIOStream ios(buf);
+		if ((m_PrevArena != nullptr) && (m_NumDeltasSinceKeyframe + 1 < KEYFRAME_INTERVAL))
+		{
+			saveAllocationDelta(ios, Allocation(m_PrevArena.get(), 0), Allocation(arena.get(), 0));
+			baseDistance = 1;
+			m_NumDeltasSinceKeyframe += 1;
+		}
+		else
+		{
+			saveAllocation(ios, Allocation(arena.get(), 0), m_CodeLocationIndices);
+			m_NumDeltasSinceKeyframe = 0;
+		}
+		ios.flush();
+	}
+	if (m_ShouldCompress && !block.isEmpty())
+	{
+		// Each block is compressed on its own, so that the loader can decompress just the trees it needs:
+		block = qCompress(block);
+	}
+
+	// Write the block, the index will refer to it by its position:
+	m_SnapshotBlocks.emplace_back(static_cast<quint64>(m_IOS.getPosition()), static_cast<quint64>(block.size()), baseDistance);
+	m_IOS.writeBytes(block.constData(), static_cast<size_t>(block.size()));
+
+	// Keep this tree as the base for the next snapshot; if the tree has been loaded only for saving,
+	// it is evicted once it's not needed as the base anymore:
+	releasePrevArena();
+	m_PrevArena = std::move(arena);
+	m_PrevSnapshotToEvict = wasLoaded ? nullptr : &a_Snapshot;
+}
+
+
+
+
+
+void ProjectSaver::releasePrevArena()
+{
+	m_PrevArena.reset();
+	if (m_PrevSnapshotToEvict != nullptr)
 	{
-		const auto & cl = l.second;
-		m_IOS.writeUInt64(cl->getAddress());
-		m_IOS.writeString(cl->getFunctionName());
-		m_IOS.writeString(cl->getFileName());
-		m_IOS.writeUInt32(cl->getFileLineNum());
+		m_PrevSnapshotToEvict->evictAllocations();
+		m_PrevSnapshotToEvict = nullptr;
 	}
 }
 
@@ -82,43 +255,144 @@ void ProjectSaver::saveCodeLocations(const CodeLocationFactory & a_CodeLocationF
 
 
 
-void ProjectSaver::saveSnapshot(const Snapshot & a_Snapshot)
+void ProjectSaver::saveSnapshotIndex(const Project & a_Project)
 {
-	m_IOS.writeUInt64(a_Snapshot.getTimestamp());
-	m_IOS.writeUInt64(a_Snapshot.getHeapSize());
-	m_IOS.writeUInt64(a_Snapshot.getHeapExtraSize());
-	m_IOS.writeBool(a_Snapshot.hasAllocations());
-	if (a_Snapshot.hasAllocations())
+	// Serialize the index into memory first, so that it can be compressed as a whole:
+	QByteArray index;
+	QBuffer buf(&index);
+	buf.open(QIODevice::WriteOnly);
+	BinaryIOStream ios(buf);
+	ios.writeVarUInt(a_Project.getNumSnapshots());
+	size_t idx = 0;
+	for (const auto & s: a_Project.getSnapshots())
 	{
-		saveAllocation(*(a_Snapshot.getRootAllocation()));
+		const auto & block = m_SnapshotBlocks[idx++];
+		ios.writeVarUInt(block.m_Offset);
+		ios.writeVarUInt(block.m_Size);
+		ios.writeVarUInt(block.m_BaseDistance);
+		ios.writeVarUInt(s->getTimestamp());
+		ios.writeVarUInt(s->getHeapSize());
+		ios.writeVarUInt(s->getHeapExtraSize());
+		ios.writeBool(s->hasAllocations());
+
+		// Write the flat sums, so that the loader doesn't need the tree to provide them:
+		const auto & flatSums = s->getFlatSums();
+		ios.writeVarUInt(flatSums.size());
+		for (const auto & fs: flatSums)
+		{
+			auto itr = m_CodeLocationIndices.find(fs.first);
+			assert(itr != m_CodeLocationIndices.end());  // All CodeLocations must come from the project's factory
+			ios.writeVarUInt(itr->second);
+			ios.writeVarUInt(fs.second);
+		}
+	}  // for s - m_Snapshots[]
+	ios.flush();
+	if (m_ShouldCompress)
+	{
+		index = qCompress(index);
 	}
+	auto indexOffset = static_cast<quint64>(m_IOS.getPosition());
+	m_IOS.writeBytes(index.constData(), static_cast<size_t>(index.size()));
+
+	// Write the footer, a fixed-size pointer to the index, so that it can be found from the end of the file:
+	m_IOS.writeUInt64(indexOffset);
 }
 
 
 
 
 
-void ProjectSaver::saveAllocation(const Allocation & a_Allocation)
+void ProjectSaver::saveAllocation(
+	BinaryIOStream & a_IOS,
+	const Allocation & a_Allocation,
+	const CodeLocationIndices & a_CodeLocationIndices
+)
 {
-	m_IOS.writeUInt64(a_Allocation.getAllocationSize());
-	const auto cl = a_Allocation.getCodeLocation();
-	auto address = (cl == nullptr) ? 0 : cl->getAddress();
-	m_IOS.writeUInt64(address);
-	quint32 type = 0;
-	switch (a_Allocation.getType())
+	a_IOS.writeVarUInt(a_Allocation.getAllocationSize());
+	const auto & cl = a_Allocation.getCodeLocation();
+	quint64 clIndex = 0;
+	if (cl != nullptr)
 	{
-		case Allocation::atBelowThreshold: type = 1; break;
-		case Allocation::atRegular:        type = 2; break;
-		case Allocation::atRoot:           type = 3; break;
-		case Allocation::atUnknown:        type = 0; break;
+		auto itr = a_CodeLocationIndices.find(cl.get());
+		assert(itr != a_CodeLocationIndices.end());  // All CodeLocations must come from the project's factory
+		clIndex = itr->second;
 	}
-	m_IOS.writeUInt32(type);
-	const auto & children = a_Allocation.getChildren();
-	m_IOS.writeUInt64(children.size());
-	for (const auto & ch: children)
+	a_IOS.writeVarUInt(clIndex);
+	a_IOS.writeVarUInt(getTypeFileValue(a_Allocation.getType()));
+	a_IOS.writeVarUInt(a_Allocation.getNumChildren());
+	for (const auto & ch: a_Allocation.getChildren())
+	{
+		saveAllocation(a_IOS, ch, a_CodeLocationIndices);
+	}
+}
+
+
+
+
+
+void ProjectSaver::saveAllocationDelta(
+	BinaryIOStream & a_IOS,
+	const Allocation & a_Base,
+	const Allocation & a_Allocation
+)
+{
+	// An unchanged subtree is only marked as such, the loader shares it from the base tree:
+	if (a_Allocation.getArena()->isSameSubtree(a_Allocation.getIndex(), *a_Base.getArena(), a_Base.getIndex()))
+	{
+		a_IOS.writeVarUInt(0);
+		return;
+	}
+
+	// The node itself has changed, write the size difference and the type:
+	a_IOS.writeVarUInt(1);
+	a_IOS.writeVarUInt(encodeZigZag(
+		static_cast<qint64>(a_Allocation.getAllocationSize()) - static_cast<qint64>(a_Base.getAllocationSize())
+	));
+	a_IOS.writeVarUInt(getTypeFileValue(a_Allocation.getType()));
+
+	// Match the children to the base's children by their CodeLocations, see Allocation::matchChildren().
+	// Each child is written either as a reference to the matching base child (its 1-based position) followed by
+	// the delta against it, or as 0 followed by the full subtree:
+	std::vector<Allocation> baseChildren;
+	auto matches = a_Allocation.matchChildren(a_Base, baseChildren);
+	auto numBaseChildren = baseChildren.size();
+	a_IOS.writeVarUInt(matches.size());
+	size_t idx = 0;
+	for (const auto & ch: a_Allocation.getChildren())
+	{
+		auto match = matches[idx++];
+		if (match == numBaseChildren)
+		{
+			a_IOS.writeVarUInt(0);
+			saveAllocation(a_IOS, ch, m_CodeLocationIndices);
+		}
+		else
+		{
+			a_IOS.writeVarUInt(match + 1);
+			saveAllocationDelta(a_IOS, baseChildren[match], ch);
+		}
+	}
+}
+
+
+
+
+
+quint64 ProjectSaver::getStringIndex(
+	const QString & a_String,
+	QHash<QString, quint64> & a_StringIndices,
+	std::vector<QString> & a_Strings
+)
+{
+	auto itr = a_StringIndices.constFind(a_String);
+	if (itr != a_StringIndices.constEnd())
 	{
-		saveAllocation(*ch);
+		return itr.value();
 	}
+	auto idx = static_cast<quint64>(a_Strings.size());
+	a_Strings.push_back(a_String);
+	a_StringIndices[a_String] = idx;
+	return idx;
 }
 
 
@@ -19,21 +19,86 @@
 
 
 
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <QString>
+#include <QHash>
+
+
+
+
+
 class QIODevice;
 class Project;
 class CodeLocationFactory;
+class CodeLocation;
 class Snapshot;
 class Allocation;
+class AllocationArena;
+typedef std::shared_ptr<AllocationArena> AllocationArenaPtr;
+
 
 
 
 
+class ProjectSaveException:
+	public std::runtime_error
+{
+	typedef std::runtime_error Super;
 
+public:
+	ProjectSaveException(const std::string & a_Reason):
+		Super(a_Reason)
+	{
+	}
+};
+
+
+
+
+
+/** Saves the project in the latest file format version (4), or its compressed variant (version 5) if the project
+is set to be compressed (Project::isCompressed()).
+Version 4 uses LEB128 varints for all numbers, refers to CodeLocations by their index in the file and stores
+the function and file names only once, in a string table. Each snapshot's allocation tree is serialized into
+an in-memory block first and then written to the device in a single operation. The blocks are followed by
+an index of the snapshots - their summaries, flat sums and block positions - and the file ends with the index'
+offset, so that the loader can read just the index and load the individual trees lazily.
+Every KEYFRAME_INTERVAL-th tree is stored in full (a keyframe), the trees in between are stored as deltas against
+the previous snapshot's tree - only the changed sizes, the added subtrees and references to the kept subtrees of
+the previous tree are written. A snapshot whose tree is identical to the previous snapshot's doesn't get its own
+block, its index entry refers to the previous snapshot's block instead, with the base distance one larger, so that
+the block is decoded against the same base tree.
+In the compressed variant, the settings with the CodeLocations, each tree block and the index are compressed
+independently (zlib, via qCompress()), so that the trees can still be located and loaded individually.
+The device must be positioned at its start, since the block offsets are absolute. */
 class ProjectSaver
 {
 public:
+	/** Map of CodeLocation -> its index in the saved file, used for referencing the CodeLocations from the allocations.
+	The indices are 1-based, 0 is used for allocations without a CodeLocation. */
+	typedef std::unordered_map<const CodeLocation *, quint64> CodeLocationIndices;
+
+
 	static void saveProject(const Project & a_Project, QIODevice & a_IODevice);
 
+	/** Writes the allocation and all its descendants, in the tree format shared by the file format versions 1 to 3.
+	All the CodeLocations used in the tree must be present in a_CodeLocationIndices. */
+	static void saveAllocation(
+		BinaryIOStream & a_IOS,
+		const Allocation & a_Allocation,
+		const CodeLocationIndices & a_CodeLocationIndices
+	);
+
+	/** Returns the index of the specified string in the string table, adding it if not present yet. */
+	static quint64 getStringIndex(
+		const QString & a_String,
+		QHash<QString, quint64> & a_StringIndices,
+		std::vector<QString> & a_Strings
+	);
+
 protected:
 	/** The IO device to which all the data is sent. */
 	QIODevice & m_IODevice;
@@ -41,13 +106,73 @@ protected:
 	/** Helper object over m_IODevice that can write binary data in a platform-independent manner. */
 	BinaryIOStream m_IOS;
 
+	/** The indices of the CodeLocations written in the file. */
+	CodeLocationIndices m_CodeLocationIndices;
+
+	/** If true, the blocks are compressed (file format version 5). */
+	bool m_ShouldCompress;
+
+	/** The maximum number of consecutive trees stored as deltas, before a full tree (keyframe) is stored again.
+	Limits the number of blocks the loader needs to read for reconstructing a single tree. */
+	static const size_t KEYFRAME_INTERVAL = 16;
+
+
+	/** The position of a single saved snapshot's allocation block. */
+	struct SnapshotBlock
+	{
+		quint64 m_Offset;
+		quint64 m_Size;
+
+		/** The distance (in snapshots) back to the snapshot whose tree this block is a delta against, 0 for a keyframe. */
+		quint64 m_BaseDistance;
+
+		SnapshotBlock(quint64 a_Offset, quint64 a_Size, quint64 a_BaseDistance):
+			m_Offset(a_Offset),
+			m_Size(a_Size),
+			m_BaseDistance(a_BaseDistance)
+		{
+		}
+	};
+
+
+	/** The position of each saved snapshot's allocation block, in the order of saving. */
+	std::vector<SnapshotBlock> m_SnapshotBlocks;
+
+	/** The tree of the previously saved snapshot, kept for detecting identical consecutive trees. */
+	AllocationArenaPtr m_PrevArena;
+
+	/** The number of trees saved as deltas since the last keyframe. */
+	size_t m_NumDeltasSinceKeyframe;
+
+	/** The previously saved snapshot, if its tree should be evicted once m_PrevArena is released, nullptr otherwise. */
+	Snapshot * m_PrevSnapshotToEvict;
+
 
 	ProjectSaver(QIODevice & a_IODevice);
 
 	void saveProject(const Project & a_Project);
-	void saveCodeLocations(const CodeLocationFactory & a_CodeLocationFactory);
-	void saveSnapshot(const Snapshot & a_Snapshot);
-	void saveAllocation(const Allocation & a_Allocation);
+	void saveCodeLocations(BinaryIOStream & a_IOS, const CodeLocationFactory & a_CodeLocationFactory);
+
+	/** Writes the snapshot's allocation tree block and records its position in m_SnapshotBlocks.
+	Throws a ProjectSaveException if the snapshot has a tree that cannot be loaded, rather than saving it without one.
+	If the tree is the same as the previous snapshot's, records the previous block's position, against the same base,
+	instead of writing.
+	If the tree is lazily loaded, it is evicted again after saving the next snapshot (or in releasePrevArena()). */
+	void saveSnapshotAllocations(Snapshot & a_Snapshot);
+
+	/** Writes the allocation and all its descendants as a delta against a_Base, an allocation of the previous tree
+	with the same CodeLocation. Subtrees that are identical in both trees are written only as a reference. */
+	void saveAllocationDelta(
+		BinaryIOStream & a_IOS,
+		const Allocation & a_Base,
+		const Allocation & a_Allocation
+	);
+
+	/** Releases m_PrevArena and evicts the previous snapshot's tree, if it has been loaded only for saving. */
+	void releasePrevArena();
+
+	/** Writes the index of all the snapshots, followed by the footer pointing to the index. */
+	void saveSnapshotIndex(const Project & a_Project);
 };
 
 
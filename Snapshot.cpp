@@ -8,8 +8,10 @@
 
 #include "Globals.h"
 #include "Snapshot.h"
+#include <vector>
 #include "AllocationPath.h"
 #include "Allocation.h"
+#include "AllocationArena.h"
 
 
 
@@ -18,7 +20,9 @@
 Snapshot::Snapshot():
 	m_Timestamp(0),
 	m_HeapSize(0),
-	m_HeapExtraSize(0)
+	m_HeapExtraSize(0),
+	m_HasAllocations(false),
+	m_AllocationsKey(0)
 {
 }
 
@@ -26,63 +30,295 @@ Snapshot::Snapshot():
 
 
 
-void Snapshot::setRootAllocation(AllocationPtr a_RootAllocation)
+Allocation Snapshot::createRootAllocation()
 {
-	assert(m_RootAllocation == nullptr);  // Only allow a single assignment to the root allocation
+	assert(m_Allocations == nullptr);  // Only allow a single assignment to the root allocation
 
-	m_RootAllocation = a_RootAllocation;
+	m_Allocations = std::make_shared<AllocationArena>();
+	m_HasAllocations = true;
+	return Allocation(m_Allocations.get(), 0);
 }
 
 
 
 
 
-AllocationPtr Snapshot::findAllocation(const AllocationPath & a_Path) const
+void Snapshot::finishAllocations()
 {
-	auto a = m_RootAllocation;
-	const auto & segments = a_Path.getSegments();
-	for (const auto & s: segments)
+	if (m_Allocations != nullptr)
+	{
+		m_Allocations->finishBuilding();
+	}
+	updateFlatSums();
+}
+
+
+
+
+
+void Snapshot::buildChildIndex()
+{
+	if (m_Allocations != nullptr)
+	{
+		m_Allocations->buildChildIndex();
+	}
+}
+
+
+
+
+
+void Snapshot::setLazyAllocations(SnapshotAllocationsSourcePtr a_Source, quint64 a_Key, FlatSums && a_FlatSums)
+{
+	assert(m_Allocations == nullptr);  // Cannot replace allocations that have already been created
+	assert(a_Source != nullptr);
+
+	m_AllocationsSource = a_Source;
+	m_AllocationsKey = a_Key;
+	m_HasAllocations = true;
+	m_FlatSums = std::move(a_FlatSums);
+}
+
+
+
+
+
+bool Snapshot::areAllocationsLoaded() const
+{
+	QMutexLocker lock(&m_AllocationsMutex);
+	return (!m_HasAllocations || (m_Allocations != nullptr));
+}
+
+
+
+
+
+AllocationArenaPtr Snapshot::getAllocationArena() const
+{
+	QMutexLocker lock(&m_AllocationsMutex);
+	if ((m_Allocations == nullptr) && (m_AllocationsSource != nullptr) && m_AllocationsLoadError.isEmpty())
 	{
-		if (a == nullptr)
+		try
 		{
-			return nullptr;
+			m_Allocations = m_AllocationsSource->loadAllocations(m_AllocationsKey);
+		}
+		catch (const std::exception & exc)
+		{
+			// The source is broken (file changed / truncated). Keep the source, so that the snapshot is still known
+			// to have a tree, and remember the error, so that the tree is not silently lost on the next save:
+			m_AllocationsLoadError = QString::fromUtf8(exc.what());
 		}
-		a = a->findCodeLocationChild(s);
 	}
-	return a;
+	return m_Allocations;
 }
 
 
 
 
 
-void Snapshot::updateFlatSums()
+bool Snapshot::evictAllocations()
 {
-	// Calculate the total and child sizes:
-	m_FlatSums.clear();
-	if (m_RootAllocation != nullptr)
+	QMutexLocker lock(&m_AllocationsMutex);
+	if ((m_AllocationsSource == nullptr) || (m_Allocations == nullptr))
+	{
+		return false;
+	}
+	if (m_Allocations.use_count() > 1)
+	{
+		// Someone is still using the tree, such as a later snapshot's tree sharing its subtrees
+		return false;
+	}
+	m_Allocations.reset();
+	return true;
+}
+
+
+
+
+
+bool Snapshot::detachAllocationsSource()
+{
+	// Hold the tree, so that it cannot be evicted (such as by the background trie build) before the source is dropped:
+	auto arena = getAllocationArena();
+	QMutexLocker lock(&m_AllocationsMutex);
+	if (!m_AllocationsLoadError.isEmpty())
+	{
+		return false;
+	}
+	m_AllocationsSource.reset();
+	return true;
+}
+
+
+
+
+
+QString Snapshot::getAllocationsLoadError() const
+{
+	QMutexLocker lock(&m_AllocationsMutex);
+	return m_AllocationsLoadError;
+}
+
+
+
+
+
+/** Copies the subtree of a_Src into a_Dst, sharing the subtrees that are the same as in a_Base instead of copying them.
+a_Base is the allocation matching a_Src in the other tree, invalid if there's none. The subtrees that a_Src already
+shares with some other tree stay shared. Returns true if any subtree of a_Base has been shared. */
+static bool copySharingSubtrees(const Allocation & a_Src, const Allocation & a_Base, const Allocation & a_Dst)
+{
+	a_Dst.setCodeLocation(a_Src.getCodeLocation());
+	if (!a_Src.hasChildren())
+	{
+		// A leaf takes the same space whether shared or not
+		a_Dst.setAllocationSize(a_Src.getAllocationSize());
+		a_Dst.setType(a_Src.getType());
+		return false;
+	}
+	if (a_Src.getArena()->isLinked(a_Src.getIndex()))
+	{
+		a_Dst.shareSubtree(a_Src);
+		return false;
+	}
+	if (a_Base.isValid() && a_Src.getArena()->isSameSubtree(a_Src.getIndex(), *a_Base.getArena(), a_Base.getIndex()))
+	{
+		a_Dst.shareSubtree(a_Base);
+		return true;
+	}
+
+	// The subtree differs, share what can be shared among the children:
+	a_Dst.setAllocationSize(a_Src.getAllocationSize());
+	a_Dst.setType(a_Src.getType());
+	std::vector<Allocation> baseChildren;
+	auto matches = a_Src.matchChildren(a_Base, baseChildren);
+	bool res = false;
+	size_t idx = 0;
+	for (const auto & ch: a_Src.getChildren())
+	{
+		auto match = matches[idx++];
+		auto baseChild = (match < baseChildren.size()) ? baseChildren[match] : Allocation();
+		if (copySharingSubtrees(ch, baseChild, a_Dst.addChild()))
+		{
+			res = true;
+		}
+	}
+	return res;
+}
+
+
+
+
+
+bool Snapshot::shareAllocationsWith(const Snapshot & a_Other)
+{
+	if (&a_Other == this)
+	{
+		return false;
+	}
+
+	// Only use the trees that are already in memory, loading them just for the sharing would cost more than it saves:
+	AllocationArenaPtr other;
+	{
+		QMutexLocker lock(&a_Other.m_AllocationsMutex);
+		other = a_Other.m_Allocations;
+	}
+	if (other == nullptr)
+	{
+		return false;
+	}
+	QMutexLocker lock(&m_AllocationsMutex);
+	if ((m_Allocations == nullptr) || (m_Allocations == other))
+	{
+		return false;
+	}
+
+	// Rebuild the tree, keeping only the parts that differ from the other tree:
+	auto shared = std::make_shared<AllocationArena>();
+	if (!copySharingSubtrees(Allocation(m_Allocations.get(), 0), Allocation(other.get(), 0), Allocation(shared.get(), 0)))
+	{
+		// Nothing in common, keep the original tree
+		return false;
+	}
+	shared->finishBuilding();
+	shared->buildChildIndex();
+	m_Allocations = std::move(shared);
+	return true;
+}
+
+
+
+
+
+SnapshotAllocationsSourcePtr Snapshot::getAllocationsSource() const
+{
+	QMutexLocker lock(&m_AllocationsMutex);
+	return m_AllocationsSource;
+}
+
+
+
+
+
+Allocation Snapshot::getRootAllocation() const
+{
+	auto arena = getAllocationArena();
+	if (arena == nullptr)
 	{
-		addChildrenToFlatSums(m_RootAllocation);
+		return Allocation();
 	}
+	return Allocation(arena.get(), 0);
 }
 
 
 
 
 
-void Snapshot::addChildrenToFlatSums(const AllocationPtr & a_Allocation)
+Allocation Snapshot::findAllocation(const AllocationPath & a_Path) const
 {
-	// Add to m_FlatSums, unless the code location is a nullptr:
-	auto codeLocation = a_Allocation->getCodeLocation().get();
-	if (codeLocation != nullptr)
+	auto a = getRootAllocation();
+	const auto & segments = a_Path.getSegments();
+	for (const auto & s: segments)
 	{
-		m_FlatSums[codeLocation] += a_Allocation->getAllocationSize();
+		if (!a.isValid())
+		{
+			return a;
+		}
+		a = a.findCodeLocationChild(s);
 	}
-	
-	// Recurse the children:
-	for (const auto & ch: a_Allocation->getChildren())
+	return a;
+}
+
+
+
+
+
+void Snapshot::updateFlatSums()
+{
+	m_FlatSums.clear();
+	if (m_Allocations == nullptr)
+	{
+		return;
+	}
+
+	// The flat sums don't depend on the tree structure, but the shared subtrees are stored in other arenas,
+	// so walk the whole tree, using an explicit stack, deep trees would overflow the call stack:
+	std::vector<Allocation> toProcess;
+	toProcess.emplace_back(m_Allocations.get(), 0);
+	while (!toProcess.empty())
 	{
-		addChildrenToFlatSums(ch);
+		auto a = toProcess.back();
+		toProcess.pop_back();
+		// Add to m_FlatSums, unless the code location is a nullptr:
+		auto codeLocation = a.getCodeLocation().get();
+		if (codeLocation != nullptr)
+		{
+			m_FlatSums[codeLocation] += a.getAllocationSize();
+		}
+		for (const auto & ch: a.getChildren())
+		{
+			toProcess.push_back(ch);
+		}
 	}
 }
 
@@ -17,6 +17,8 @@
 #include <unordered_map>
 #include <assert.h>
 #include <Qt>
+#include <QMutex>
+#include <QString>
 
 
 
@@ -24,7 +26,8 @@
 
 // fwd:
 class Allocation;
-typedef std::shared_ptr<Allocation> AllocationPtr;
+class AllocationArena;
+typedef std::shared_ptr<AllocationArena> AllocationArenaPtr;
 class AllocationPath;
 class CodeLocation;
 
@@ -32,6 +35,27 @@ class CodeLocation;
 
 
 
+/** Provides the allocation trees of snapshots that load them lazily, on first access.
+Used by the project loader, so that only the snapshots' summaries need to be read when opening a project. */
+class SnapshotAllocationsSource
+{
+public:
+	virtual ~SnapshotAllocationsSource() {}
+
+	/** Loads and returns the finished allocation tree identified by a_Key (as given to Snapshot::setLazyAllocations()).
+	Can be called from any thread. Throws an exception on error. */
+	virtual AllocationArenaPtr loadAllocations(quint64 a_Key) = 0;
+
+	/** Returns the name of the file from which the allocations are loaded. */
+	virtual QString getFileName() const = 0;
+};
+
+typedef std::shared_ptr<SnapshotAllocationsSource> SnapshotAllocationsSourcePtr;
+
+
+
+
+
 /** Contains the information provided by a single Massif snapshot. */
 class Snapshot
 {
@@ -49,28 +73,68 @@ public:
 	void setHeapSize(quint64 a_HeapSize) { m_HeapSize = a_HeapSize; }
 	void setHeapExtraSize(quint64 a_HeapExtraSize) { m_HeapExtraSize = a_HeapExtraSize; }
 
-	/** Sets the root allocation to the specified one.
-	Cannot replace an allocation that has already been set (write-once).*/
-	void setRootAllocation(AllocationPtr a_RootAllocation);
+	/** Creates the arena for the detailed allocations and returns its (empty) root allocation.
+	Cannot replace allocations that have already been created (write-once). */
+	Allocation createRootAllocation();
+
+	/** Finishes building the allocation tree and updates the flat sums of allocations.
+	Called by the parser / loader after it finishes creating the allocation tree. */
+	void finishAllocations();
+
+	/** Sets the snapshot to load its allocation tree lazily from the specified source, on first access.
+	The flat sums are provided up front, so that they are available without loading the tree. */
+	void setLazyAllocations(SnapshotAllocationsSourcePtr a_Source, quint64 a_Key, FlatSums && a_FlatSums);
+
+	/** Returns true if the allocation tree is currently in memory (or the snapshot has no tree at all). */
+	bool areAllocationsLoaded() const;
+
+	/** Returns the arena containing the allocation tree, loading it first if needed.
+	Holding the returned pointer keeps the tree alive, even when it is evicted from the snapshot,
+	so clients that keep Allocation handles for a longer time should hold it.
+	Returns nullptr if the snapshot has no detailed allocations, or if they failed to load (see getAllocationsLoadError()). */
+	AllocationArenaPtr getAllocationArena() const;
+
+	/** Releases the allocation tree from memory, if it can be loaded again from its source and no one else holds it.
+	Returns true if the tree has been released. */
+	bool evictAllocations();
+
+	/** Loads the allocation tree, if not loaded yet, and stops using the lazy source.
+	Used before the source file is overwritten.
+	Returns false if the tree failed to load; the source is kept then, the file is still the only copy of the tree. */
+	bool detachAllocationsSource();
+
+	/** Returns the reason why the lazy loading of the allocation tree failed, empty if it hasn't failed. */
+	QString getAllocationsLoadError() const;
+
+	/** If both snapshots' allocation trees are in memory, rebuilds this snapshot's tree so that the subtrees that are
+	the same in both trees are shared with the other snapshot's tree instead of being stored twice.
+	The subtrees are matched by their CodeLocations, see Allocation::matchChildren().
+	Returns true if any subtree is shared with the other tree afterwards.
+	The tree is replaced, so this needs to be called before the snapshot is handed over to other threads. */
+	bool shareAllocationsWith(const Snapshot & a_Other);
+
+	/** Returns the source from which the allocations are lazily loaded, nullptr if none. */
+	SnapshotAllocationsSourcePtr getAllocationsSource() const;
+
+	/** Builds the child lookup index in the allocation tree, speeding up findAllocation() and
+	Allocation::findCodeLocationChild() on nodes with many children. */
+	void buildChildIndex();
 
 	quint64 getTimestamp() const { return m_Timestamp; }
 	quint64 getHeapSize() const { return m_HeapSize; }
 	quint64 getHeapExtraSize() const { return m_HeapExtraSize; }
 	quint64 getTotalSize() const { return m_HeapSize + m_HeapExtraSize; }
-	AllocationPtr getRootAllocation() { return m_RootAllocation; }
-	const AllocationPtr getRootAllocation() const { return m_RootAllocation; }
 
-	/** Returns the allocation specified by its full path.
-	Returns nullptr if no such allocation in this snapshot. */
-	AllocationPtr findAllocation(const AllocationPath & a_Path) const;
+	/** Returns the root allocation, or an invalid Allocation if the snapshot has no detailed allocations. */
+	Allocation getRootAllocation() const;
 
-	/** Returns true if the snapshot has detailed allocations attached to it. */
-	bool hasAllocations() const { return (m_RootAllocation != nullptr); }
+	/** Returns the allocation specified by its full path.
+	Returns an invalid Allocation if no such allocation in this snapshot. */
+	Allocation findAllocation(const AllocationPath & a_Path) const;
 
+	/** Returns true if the snapshot has detailed allocations attached to it (whether loaded or not). */
+	bool hasAllocations() const { return m_HasAllocations; }
 
-	/** Updates the flat sums of allocations.
-	Called by the parser after it finishes parsing the allocation tree. */
-	void updateFlatSums();
 	
 	const FlatSums & getFlatSums() const { return m_FlatSums; }
 	
@@ -85,17 +149,34 @@ protected:
 	/** The amount of heap memory allocated but not used (fragmentation etc.) */
 	quint64 m_HeapExtraSize;
 
-	/** The root allocation element, if the snapshot has a detailed report.
+	/** The storage for the allocation tree, if the snapshot has a detailed report and it is loaded.
 	The root element represents all the allocations,
-	its children are individual places on the stack which allocated memory, together with their stacktraces. */
-	AllocationPtr m_RootAllocation;
+	its children are individual places on the stack which allocated memory, together with their stacktraces.
+	Protected by m_AllocationsMutex once the snapshot is finished, since it can be lazily loaded from any thread. */
+	mutable AllocationArenaPtr m_Allocations;
+
+	/** True if the snapshot has a detailed report, even if it is not loaded in m_Allocations. */
+	bool m_HasAllocations;
+
+	/** The source from which m_Allocations can be (re-)loaded, nullptr if the tree is only in memory. */
+	mutable SnapshotAllocationsSourcePtr m_AllocationsSource;
+
+	/** The key identifying this snapshot's tree in m_AllocationsSource. */
+	quint64 m_AllocationsKey;
+
+	/** The reason why loading the tree from m_AllocationsSource failed, empty if it hasn't failed.
+	The loading is not retried once it fails, so that each access to a broken file doesn't read it again. */
+	mutable QString m_AllocationsLoadError;
+
+	/** Protects m_Allocations and m_AllocationsSource against concurrent lazy loading and eviction. */
+	mutable QMutex m_AllocationsMutex;
 	
 	/** The sums of all CodeLocations' allocations within this snapshot. */
 	FlatSums m_FlatSums;
 	
 	
-	/** Recursively adds the specified allocation's children to m_FlatSums. */
-	void addChildrenToFlatSums(const AllocationPtr & a_Allocation);
+	/** Updates the flat sums of allocations from all the nodes in m_Allocations. */
+	void updateFlatSums();
 };
 
 typedef std::shared_ptr<Snapshot> SnapshotPtr;
@@ -8,21 +8,34 @@
 
 #include "Globals.h"
 #include "SnapshotDiff.h"
-#include <unordered_set>
+#include <algorithm>
+#include <functional>
 #include "Allocation.h"
+#include "AllocationArena.h"
 #include "Snapshot.h"
 
 
 
 
 
+/** If the product of the two children counts is at most this, the children are matched by a direct search,
+sorting them would cost more. */
+static const size_t MAX_DIRECTLY_MATCHED_PAIRS = 64;
+
+
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // DiffItem:
 
-DiffItem::DiffItem(DiffItem * a_Parent, AllocationPtr a_First, AllocationPtr a_Second):
+DiffItem::DiffItem(const SnapshotDiff & a_Diff, DiffItem * a_Parent, int a_Row, const Allocation & a_First, const Allocation & a_Second):
+	m_Diff(a_Diff),
 	m_Parent(a_Parent),
+	m_Row(a_Row),
 	m_First(a_First),
-	m_Second(a_Second)
+	m_Second(a_Second),
+	m_AreChildrenCreated(false)
 {
 }
 
@@ -30,11 +43,10 @@ DiffItem::DiffItem(DiffItem * a_Parent, AllocationPtr a_First, AllocationPtr a_S
 
 
 
-DiffItemPtr DiffItem::addChild(AllocationPtr a_First, AllocationPtr a_Second)
+const DiffItemPtrs & DiffItem::getChildren() const
 {
-	auto ch = std::make_shared<DiffItem>(this, a_First, a_Second);
-	m_Children.push_back(ch);
-	return ch;
+	createChildren();
+	return m_Children;
 }
 
 
@@ -43,35 +55,34 @@ DiffItemPtr DiffItem::addChild(AllocationPtr a_First, AllocationPtr a_Second)
 
 CodeLocationPtr DiffItem::getCodeLocation() const
 {
-	if (m_First != nullptr)
+	if (m_First.isValid())
 	{
-		return m_First->getCodeLocation();
+		return m_First.getCodeLocation();
 	}
-	assert(m_Second != nullptr);
-	return m_Second->getCodeLocation();
+	assert(m_Second.isValid());
+	return m_Second.getCodeLocation();
 }
 
 
 
 
 
-qint64 DiffItem::getHeapSizeDiff() const
+qint64 DiffItem::calcHeapSizeDiff(const Allocation & a_First, const Allocation & a_Second)
 {
 	// If allocation is not present in first snapshot, return second allocation's full size:
-	if (m_First == nullptr)
+	if (!a_First.isValid())
 	{
-		assert(m_Second != nullptr);
-		return static_cast<qint64>(m_Second->getAllocationSize());
+		return a_Second.isValid() ? static_cast<qint64>(a_Second.getAllocationSize()) : 0;
 	}
 
 	// If allocation is not present in second snapshot, return negative first allocation's full size:
-	if (m_Second == nullptr)
+	if (!a_Second.isValid())
 	{
-		return -static_cast<qint64>(m_First->getAllocationSize());
+		return -static_cast<qint64>(a_First.getAllocationSize());
 	}
 
 	// Both allocations are present, return the difference between them:
-	auto diff = static_cast<qint64>(m_Second->getAllocationSize()) - static_cast<qint64>(m_First->getAllocationSize());
+	auto diff = static_cast<qint64>(a_Second.getAllocationSize()) - static_cast<qint64>(a_First.getAllocationSize());
 	return diff;
 }
 
@@ -79,57 +90,57 @@ qint64 DiffItem::getHeapSizeDiff() const
 
 
 
-DiffItemPtr DiffItem::child(int a_Index) const
+DiffItem * DiffItem::child(int a_Index) const
 {
-	if ((a_Index < 0) || (static_cast<size_t>(a_Index) > m_Children.size()))
+	createChildren();
+	if ((a_Index < 0) || (static_cast<size_t>(a_Index) >= m_Children.size()))
 	{
 		return nullptr;
 	}
-	return m_Children[a_Index];
+	return m_Children[static_cast<size_t>(a_Index)].get();
 }
 
 
 
 
 
-int DiffItem::indexOfChild(DiffItem * a_Child) const
+int DiffItem::indexOfChild(const DiffItem * a_Child) const
 {
-	int idx = 0;
-	for (auto ch: m_Children)
+	if ((a_Child == nullptr) || (a_Child->m_Parent != this))
 	{
-		if (ch.get() == a_Child)
-		{
-			return idx;
-		}
-		idx += 1;
+		return -1;
 	}
-	return -1;
+	return a_Child->m_Row;
 }
 
 
 
 
 
-void DiffItem::pruneZeroDiffChildren()
+void DiffItem::createChildren() const
 {
-	for (auto itr = m_Children.begin(); itr != m_Children.end(); )
+	if (m_AreChildrenCreated)
 	{
-		auto & ch = *itr;
-		ch->pruneZeroDiffChildren();
-		if (
-			(ch->getHeapSizeDiff() == 0) &&
-			ch->m_Children.empty()
-		)
-		{
-			// Child is empty, remove it
-			itr = m_Children.erase(itr);
-		}
-		else
+		return;
+	}
+	m_AreChildrenCreated = true;
+
+	// An allocation present in only one of the snapshots is shown as a single leaf item with its full size:
+	if (!m_First.isValid() || !m_Second.isValid())
+	{
+		return;
+	}
+
+	// Skip the children that have no difference anywhere in their subtree, they would show only zeroes:
+	auto self = const_cast<DiffItem *>(this);
+	for (const auto & match: m_Diff.matchChildren(m_First, m_Second))
+	{
+		if (m_Diff.hasNonZeroDiff(match.first, match.second))
 		{
-			// Child has children / nonzero diff, keep it
-			++itr;
+			auto row = static_cast<int>(m_Children.size());
+			m_Children.push_back(std::make_shared<DiffItem>(m_Diff, self, row, match.first, match.second));
 		}
-	}  // for itr - m_Children[]
+	}
 }
 
 
@@ -141,57 +152,197 @@ void DiffItem::pruneZeroDiffChildren()
 
 SnapshotDiff::SnapshotDiff(SnapshotPtr a_FirstSnapshot, SnapshotPtr a_SecondSnapshot):
 	m_FirstSnapshot(a_FirstSnapshot),
-	m_SecondSnapshot(a_SecondSnapshot)
+	m_SecondSnapshot(a_SecondSnapshot),
+	m_FirstAllocations(a_FirstSnapshot->getAllocationArena()),
+	m_SecondAllocations(a_SecondSnapshot->getAllocationArena())
 {
 	m_Root = std::make_shared<DiffItem>(
+		*this,
 		nullptr,
-		a_FirstSnapshot->getRootAllocation(),
-		a_SecondSnapshot->getRootAllocation()
+		0,
+		(m_FirstAllocations  == nullptr) ? Allocation() : Allocation(m_FirstAllocations.get(), 0),
+		(m_SecondAllocations == nullptr) ? Allocation() : Allocation(m_SecondAllocations.get(), 0)
 	);
-	matchChildren(m_Root);
-	m_Root->pruneZeroDiffChildren();
 }
 
 
 
 
 
-void SnapshotDiff::matchChildren(DiffItemPtr a_DiffItem)
+std::vector<SnapshotDiff::AllocationPair> SnapshotDiff::matchChildren(const Allocation & a_First, const Allocation & a_Second) const
+{
+	// Collect the children that have a CodeLocation, in their order:
+	std::vector<Allocation> firstChildren, secondChildren;
+	collectMatchableChildren(a_First, firstChildren);
+	collectMatchableChildren(a_Second, secondChildren);
+	auto numFirst = firstChildren.size();
+	auto numSecond = secondChildren.size();
+	std::vector<AllocationPair> res;
+	res.reserve(numFirst + numSecond);
+	std::vector<bool> isSecondMatched(numSecond, false);
+
+	// Few children are matched by searching the second list for each child of the first one, in the same order
+	// as the merge below, each second child at most once:
+	if (numFirst * numSecond <= MAX_DIRECTLY_MATCHED_PAIRS)
+	{
+		for (const auto & ch: firstChildren)
+		{
+			auto cl = ch.getCodeLocation().get();
+			Allocation match;
+			for (size_t i = 0; i < numSecond; ++i)
+			{
+				if (!isSecondMatched[i] && (secondChildren[i].getCodeLocation().get() == cl))
+				{
+					match = secondChildren[i];
+					isSecondMatched[i] = true;
+					break;
+				}
+			}
+			res.emplace_back(ch, match);
+		}
+		addUnmatchedChildren(secondChildren, isSecondMatched, res);
+		return res;
+	}
+
+	// Match the children by merging the two lists sorted by their CodeLocations, rather than searching the second list
+	// for each child of the first one. The sort keeps the order of the children with the same CodeLocation and each
+	// second child is matched at most once, so multiple children sharing a CodeLocation are matched in their order,
+	// the n-th one to the n-th one:
+	auto firstOrder = sortByCodeLocation(firstChildren);
+	auto secondOrder = sortByCodeLocation(secondChildren);
+	for (const auto & ch: firstChildren)
+	{
+		res.emplace_back(ch, Allocation());
+	}
+	size_t idxSecond = 0;
+	for (auto idxFirst: firstOrder)
+	{
+		auto cl = firstChildren[idxFirst].getCodeLocation().get();
+		while (
+			(idxSecond < numSecond) &&
+			std::less<const CodeLocation *>()(secondChildren[secondOrder[idxSecond]].getCodeLocation().get(), cl)
+		)
+		{
+			++idxSecond;
+		}
+		if ((idxSecond < numSecond) && (secondChildren[secondOrder[idxSecond]].getCodeLocation().get() == cl))
+		{
+			res[idxFirst].second = secondChildren[secondOrder[idxSecond]];
+			isSecondMatched[secondOrder[idxSecond]] = true;
+			++idxSecond;
+		}
+	}
+
+	// Add the second children that didn't have a match in the first children:
+	addUnmatchedChildren(secondChildren, isSecondMatched, res);
+	return res;
+}
+
+
+
+
+
+bool SnapshotDiff::hasNonZeroDiff(const Allocation & a_First, const Allocation & a_Second) const
 {
-	auto firstAllocation = a_DiffItem->getFirst();
-	auto secondAllocation = a_DiffItem->getSecond();
+	if (DiffItem::calcHeapSizeDiff(a_First, a_Second) != 0)
+	{
+		return true;
+	}
+
+	// An allocation present in only one of the snapshots is a leaf in the diff, its descendants don't count:
+	if (!a_First.isValid() || !a_Second.isValid())
+	{
+		return false;
+	}
 
-	// Match firstAllocation's children onto secondAllocation's:
-	std::unordered_set<Allocation *> processed;  // set of firstAllocation's children that have been matched
-	for (const auto & ch: firstAllocation->getChildren())
+	// Identical subtrees have no difference anywhere:
+	if (a_First.getArena()->isSameSubtree(a_First.getIndex(), *a_Second.getArena(), a_Second.getIndex()))
 	{
-		if (ch->getCodeLocation() == nullptr)
+		return false;
+	}
+
+	// The subtrees differ, but the changes may still cancel out in this node, check the descendants:
+	for (const auto & match: matchChildren(a_First, a_Second))
+	{
+		if (hasNonZeroDiff(match.first, match.second))
 		{
-			continue;
+			return true;
 		}
-		auto match = secondAllocation->findCodeLocationChild(ch->getCodeLocation().get());
-		auto di = a_DiffItem->addChild(ch, match);
-		if (match != nullptr)
+	}
+	return false;
+}
+
+
+
+
+
+void SnapshotDiff::collectMatchableChildren(const Allocation & a_Allocation, std::vector<Allocation> & a_Children)
+{
+	if (!a_Allocation.isValid())
+	{
+		return;
+	}
+	for (const auto & ch: a_Allocation.getChildren())
+	{
+		if (ch.getCodeLocation() != nullptr)
 		{
-			matchChildren(di);
+			a_Children.push_back(ch);
 		}
-		processed.insert(ch.get());  // Mark the child as processed
 	}
+}
+
+
+
 
-	// Add secondAllocation's children that didn't have a match in firstAllocation's children:
-	for (const auto & ch: secondAllocation->getChildren())
+
+void SnapshotDiff::addUnmatchedChildren(
+	const std::vector<Allocation> & a_SecondChildren,
+	const std::vector<bool> & a_IsSecondMatched,
+	std::vector<AllocationPair> & a_Matches
+)
+{
+	auto num = a_SecondChildren.size();
+	for (size_t i = 0; i < num; ++i)
 	{
-		if (ch->getCodeLocation() == nullptr)
+		if (!a_IsSecondMatched[i])
 		{
-			continue;
+			a_Matches.emplace_back(Allocation(), a_SecondChildren[i]);
 		}
-		if (processed.find(ch.get()) == processed.end())
+	}
+}
+
+
+
+
+
+std::vector<size_t> SnapshotDiff::sortByCodeLocation(const std::vector<Allocation> & a_Children)
+{
+	// Sort the (CodeLocation, index) keys, rather than looking up both children's CodeLocations in each comparison.
+	// The index is a part of the key, so the children with the same CodeLocation keep their relative order:
+	typedef std::pair<const CodeLocation *, size_t> Key;
+	auto num = a_Children.size();
+	std::vector<Key> keys;
+	keys.reserve(num);
+	for (size_t i = 0; i < num; ++i)
+	{
+		keys.emplace_back(a_Children[i].getCodeLocation().get(), i);
+	}
+	std::sort(keys.begin(), keys.end(), [](const Key & a_First, const Key & a_Second)
 		{
-			// Already matched with a firstAllocation's child
-			continue;
+			if (a_First.first != a_Second.first)
+			{
+				return std::less<const CodeLocation *>()(a_First.first, a_Second.first);
+			}
+			return (a_First.second < a_Second.second);
 		}
-		a_DiffItem->addChild(nullptr, ch);
+	);
+	std::vector<size_t> res;
+	res.reserve(num);
+	for (const auto & k: keys)
+	{
+		res.push_back(k.second);
 	}
+	return res;
 }
 
 
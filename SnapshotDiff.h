@@ -15,17 +15,18 @@
 
 #include <memory>
 #include <vector>
+#include <utility>
 #include <Qt>
+#include "Allocation.h"
 
 
 
 
 
 // fwd:
+class SnapshotDiff;
 class Snapshot;
 typedef std::shared_ptr<Snapshot> SnapshotPtr;
-class Allocation;
-typedef std::shared_ptr<Allocation> AllocationPtr;
 class DiffItem;
 typedef std::shared_ptr<DiffItem> DiffItemPtr;
 typedef std::vector<DiffItemPtr> DiffItemPtrs;
@@ -38,52 +39,75 @@ typedef std::shared_ptr<CodeLocation> CodeLocationPtr;
 
 /** Represents a single item of difference between two corresponding allocations in the two snapshots.
 Is arranged into a tree structure with a single DiffItem as the root.
-The tree corresponds to the merged trees of the two snapshots' Allocations. */
+The tree corresponds to the merged trees of the two snapshots' Allocations, without the subtrees that have no
+difference at all. The children are created lazily, on first access, so that only the parts of the tree that are
+actually viewed are ever built. The items are valid only while the SnapshotDiff that created them exists. */
 class DiffItem
 {
 public:
-	/** Creates a new instance representing a diff between the specified allocations. */
-	DiffItem(DiffItem * a_Parent, AllocationPtr a_First, AllocationPtr a_Second);
-
-	/** Adds a new child representing the diff between the specified allocations.
-	Inserts the child to m_Children and sets its parent to self. */
-	DiffItemPtr addChild(AllocationPtr a_First, AllocationPtr a_Second);
+	/** Creates a new instance representing a diff between the specified allocations.
+	a_Row is the index of the new item within its parent's children (0 for the root). */
+	DiffItem(const SnapshotDiff & a_Diff, DiffItem * a_Parent, int a_Row, const Allocation & a_First, const Allocation & a_Second);
 
 	DiffItem * getParent() const { return m_Parent; }
-	AllocationPtr getFirst() const { return m_First; }
-	AllocationPtr getSecond() const { return m_Second; }
-	const DiffItemPtrs & getChildren() const { return m_Children; }
+
+	/** Returns the index of this item within its parent's children, 0 for the root. */
+	int getRow() const { return m_Row; }
+	const Allocation & getFirst() const { return m_First; }
+	const Allocation & getSecond() const { return m_Second; }
+
+	/** Returns all the children, creating them first if not created yet. */
+	const DiffItemPtrs & getChildren() const;
 
 	/** Returns the code location representing this item.
-	The code location is the same for m_First and m_Second, unless one of them is nullptr. */
+	The code location is the same for m_First and m_Second, unless one of them is invalid. */
 	CodeLocationPtr getCodeLocation() const;
 
 	/** Returns the difference in heap size between the first and second allocation.
-	Handles nullptr properly - as a new or expired allocation. */
-	qint64 getHeapSizeDiff() const;
+	Handles invalid allocations properly - as a new or expired allocation. */
+	qint64 getHeapSizeDiff() const { return calcHeapSizeDiff(m_First, m_Second); }
 
-	/** Returns the child at the specifid index, or nullptr if index out of bounds. */
-	DiffItemPtr child(int a_Index) const;
+	/** Returns the child at the specifid index, or nullptr if index out of bounds.
+	Returns a raw pointer, so that the models can call this often without touching the refcount;
+	the child lives as long as this item. */
+	DiffItem * child(int a_Index) const;
 
-	/** Returns the index of the specified child the m_Children, or -1 if not found. */
-	int indexOfChild(DiffItem * a_Child) const;
+	/** Returns the index of the specified child the m_Children, or -1 if it is not a child of this item. */
+	int indexOfChild(const DiffItem * a_Child) const;
 
-	/** Recursively removes children that have zero difference and no children. */
-	void pruneZeroDiffChildren();
+	/** Returns the difference in heap size between the two allocations, either of which may be invalid. */
+	static qint64 calcHeapSizeDiff(const Allocation & a_First, const Allocation & a_Second);
 
 protected:
 
+	/** The diff that created this item, provides the matching of the children. */
+	const SnapshotDiff & m_Diff;
+
 	/** The parent DiffItem of this instance, or nullptr if this is the root. */
 	DiffItem * m_Parent;
 
-	/** The allocation from the first snapshot. */
-	AllocationPtr m_First;
+	/** The index of this item within m_Parent's m_Children, 0 for the root. */
+	int m_Row;
+
+	/** The allocation from the first snapshot.
+	Invalid if the allocation is not present in the first snapshot. */
+	Allocation m_First;
+
+	/** The allocation from the second snapshot.
+	Invalid if the allocation is not present in the second snapshot. */
+	Allocation m_Second;
+
+	/** All DiffItem children of this instance, valid only once m_AreChildrenCreated is true. */
+	mutable DiffItemPtrs m_Children;
+
+	/** Set to true once m_Children have been created. */
+	mutable bool m_AreChildrenCreated;
 
-	/** The allocation from the second snapshot. */
-	AllocationPtr m_Second;
 
-	/** All DiffItem children of this instance. */
-	DiffItemPtrs m_Children;
+	/** Creates the children, if not created yet.
+	Only the children that have a difference in themselves or in any of their descendants are created.
+	The items for the allocations present in only one of the snapshots are leaves, they get no children. */
+	void createChildren() const;
 };
 
 
@@ -93,13 +117,44 @@ protected:
 class SnapshotDiff
 {
 public:
-	/** Creates a diff between the two specified snapshots. */
+	/** A pair of matched allocations, (first, second). Either of them may be invalid if there's no match. */
+	typedef std::pair<Allocation, Allocation> AllocationPair;
+
+
+	/** Creates a diff between the two specified snapshots.
+	Only the root DiffItem is created, its descendants are created on first access. */
 	SnapshotDiff(SnapshotPtr a_FirstSnapshot, SnapshotPtr a_SecondSnapshot);
 
 	SnapshotPtr getFirstSnapshot() const { return m_FirstSnapshot; }
 	SnapshotPtr getSecondSnapshot() const { return m_SecondSnapshot; }
 	DiffItemPtr getRootDiffItem() const { return m_Root; }
 
+	/** Matches the children of the two allocations by their CodeLocations, in O((n + m) log(n + m)).
+	Multiple children with the same CodeLocation are matched in their order: the n-th such child of a_First to the n-th
+	such child of a_Second, the same as Allocation::matchChildren() and MultiSnapshotDiff::matchChildren() do.
+	Returns the first allocation's children with their matches, in their order, followed by the second allocation's
+	children that have no match, in their order. Children without a CodeLocation are not matched nor returned. */
+	std::vector<AllocationPair> matchChildren(const Allocation & a_First, const Allocation & a_Second) const;
+
+	/** Returns true if the two allocations, or any of their descendants, have a non-zero difference.
+	If either allocation is invalid, only the allocation itself counts, since its DiffItem has no children.
+	The unchanged subtrees are recognized by AllocationArena::isSameSubtree(), which compares the subtree hashes first. */
+	bool hasNonZeroDiff(const Allocation & a_First, const Allocation & a_Second) const;
+
+	/** Appends the children of the allocation that have a CodeLocation (and thus can be matched) to a_Children. */
+	static void collectMatchableChildren(const Allocation & a_Allocation, std::vector<Allocation> & a_Children);
+
+	/** Appends the children of a_SecondChildren that are not marked in a_IsSecondMatched to a_Matches, as unmatched. */
+	static void addUnmatchedChildren(
+		const std::vector<Allocation> & a_SecondChildren,
+		const std::vector<bool> & a_IsSecondMatched,
+		std::vector<AllocationPair> & a_Matches
+	);
+
+	/** Returns the indices into a_Children, ordered by the children's CodeLocations.
+	Children with the same CodeLocation keep their relative order. */
+	static std::vector<size_t> sortByCodeLocation(const std::vector<Allocation> & a_Children);
+
 protected:
 	/** The root of the diff tree. */
 	DiffItemPtr m_Root;
@@ -110,9 +165,10 @@ protected:
 	/** The second snapshot to be diff-ed. */
 	SnapshotPtr m_SecondSnapshot;
 
-
-	/** Recursively matches the children Allocations of the specified DiffItem's Allocations. */
-	void matchChildren(DiffItemPtr a_DiffItem);
+	/** The allocation trees of the two snapshots.
+	Held so that the DiffItems' Allocation handles stay valid even if the snapshots evict their lazily loaded trees. */
+	AllocationArenaPtr m_FirstAllocations;
+	AllocationArenaPtr m_SecondAllocations;
 };
 
 
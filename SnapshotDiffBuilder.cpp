@@ -0,0 +1,181 @@
+// SnapshotDiffBuilder.cpp
+
+// Implements the SnapshotDiffBuilder class that builds multiple snapshot diffs in parallel, in the thread pool
+
+
+
+
+
+#include "Globals.h"
+#include "SnapshotDiffBuilder.h"
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include "SnapshotDiff.h"
+#include "MultiSnapshotDiff.h"
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SnapshotDiffBuilder::SharedState:
+
+struct SnapshotDiffBuilder::SharedState
+{
+	/** Protects m_Builder. */
+	QMutex m_Mtx;
+
+	/** The builder to report the diffs to, nullptr once the builder has been destroyed. */
+	SnapshotDiffBuilder * m_Builder;
+
+
+	SharedState(SnapshotDiffBuilder * a_Builder):
+		m_Builder(a_Builder)
+	{
+	}
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SnapshotDiffBuilder::Task:
+
+class SnapshotDiffBuilder::Task:
+	public QRunnable
+{
+public:
+	Task(std::shared_ptr<SharedState> a_State, int a_Index, const SnapshotPair & a_Pair):
+		m_State(a_State),
+		m_Index(a_Index),
+		m_Pair(a_Pair)
+	{
+	}
+
+	virtual void run() override
+	{
+		// Skip the diff if no one is interested in it anymore:
+		{
+			QMutexLocker lock(&m_State->m_Mtx);
+			if (m_State->m_Builder == nullptr)
+			{
+				return;
+			}
+		}
+
+		auto diff = std::make_shared<SnapshotDiff>(m_Pair.first, m_Pair.second);
+
+		// Report the diff while holding the lock, so that the builder cannot be destroyed meanwhile:
+		QMutexLocker lock(&m_State->m_Mtx);
+		if (m_State->m_Builder != nullptr)
+		{
+			emit m_State->m_Builder->diffBuilt(m_Index, diff);
+		}
+	}
+
+protected:
+	std::shared_ptr<SharedState> m_State;
+	int m_Index;
+	SnapshotPair m_Pair;
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SnapshotDiffBuilder::RangeTask:
+
+class SnapshotDiffBuilder::RangeTask:
+	public QRunnable
+{
+public:
+	RangeTask(std::shared_ptr<SharedState> a_State, const std::vector<SnapshotPtr> & a_Snapshots):
+		m_State(a_State),
+		m_Snapshots(a_Snapshots)
+	{
+	}
+
+	virtual void run() override
+	{
+		// Skip the diff if no one is interested in it anymore:
+		{
+			QMutexLocker lock(&m_State->m_Mtx);
+			if (m_State->m_Builder == nullptr)
+			{
+				return;
+			}
+		}
+
+		// Creating the diff loads all the snapshots' trees; also create the top level items here, since matching
+		// them walks the changed parts of the trees. The diff is not touched by this thread after being reported:
+		auto diff = std::make_shared<MultiSnapshotDiff>(m_Snapshots);
+		diff->getRootItem()->getChildren();
+
+		// Report the diff while holding the lock, so that the builder cannot be destroyed meanwhile:
+		QMutexLocker lock(&m_State->m_Mtx);
+		if (m_State->m_Builder != nullptr)
+		{
+			emit m_State->m_Builder->rangeDiffBuilt(diff);
+		}
+	}
+
+protected:
+	std::shared_ptr<SharedState> m_State;
+	std::vector<SnapshotPtr> m_Snapshots;
+};
+
+
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// SnapshotDiffBuilder:
+
+SnapshotDiffBuilder::SnapshotDiffBuilder(QObject * a_Parent):
+	Super(a_Parent),
+	m_State(std::make_shared<SharedState>(this))
+{
+	qRegisterMetaType<SnapshotDiffPtr>("SnapshotDiffPtr");
+	qRegisterMetaType<MultiSnapshotDiffPtr>("MultiSnapshotDiffPtr");
+}
+
+
+
+
+
+SnapshotDiffBuilder::~SnapshotDiffBuilder()
+{
+	QMutexLocker lock(&m_State->m_Mtx);
+	m_State->m_Builder = nullptr;
+}
+
+
+
+
+
+void SnapshotDiffBuilder::start(const SnapshotPairs & a_Pairs)
+{
+	auto threadPool = QThreadPool::globalInstance();
+	int idx = 0;
+	for (const auto & p: a_Pairs)
+	{
+		threadPool->start(new Task(m_State, idx, p));
+		idx += 1;
+	}
+}
+
+
+
+
+
+void SnapshotDiffBuilder::startRange(const std::vector<SnapshotPtr> & a_Snapshots)
+{
+	QThreadPool::globalInstance()->start(new RangeTask(m_State, a_Snapshots));
+}
+
+
+
+
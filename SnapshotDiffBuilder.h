@@ -0,0 +1,102 @@
+// SnapshotDiffBuilder.h
+
+// Declares the SnapshotDiffBuilder class that builds multiple snapshot diffs in parallel, in the thread pool
+
+
+
+
+
+#ifndef SNAPSHOTDIFFBUILDER_H
+#define SNAPSHOTDIFFBUILDER_H
+
+
+
+
+
+#include <memory>
+#include <utility>
+#include <vector>
+#include <QObject>
+
+
+
+
+
+// fwd:
+class Snapshot;
+typedef std::shared_ptr<Snapshot> SnapshotPtr;
+class SnapshotDiff;
+typedef std::shared_ptr<SnapshotDiff> SnapshotDiffPtr;
+class MultiSnapshotDiff;
+typedef std::shared_ptr<MultiSnapshotDiff> MultiSnapshotDiffPtr;
+
+/** A pair of snapshots to be diff-ed, (first, second). */
+typedef std::pair<SnapshotPtr, SnapshotPtr> SnapshotPair;
+typedef std::vector<SnapshotPair> SnapshotPairs;
+
+
+
+
+
+/** Builds the diffs of multiple independent snapshot pairs in the global thread pool.
+Each diff is reported by the diffBuilt() signal as soon as it is finished, so that the UI can show the diffs
+progressively instead of waiting for all of them. The diff across a whole range of snapshots can be built the same
+way, it is reported by the rangeDiffBuilt() signal.
+The builder may be destroyed while the diffs are still being built; the diffs not started yet are skipped
+and the ones being built are discarded once finished. */
+class SnapshotDiffBuilder:
+	public QObject
+{
+	typedef QObject Super;
+	Q_OBJECT
+
+public:
+
+	explicit SnapshotDiffBuilder(QObject * a_Parent = nullptr);
+
+	/** Abandons all the diffs that haven't been reported yet. Doesn't wait for the running ones. */
+	virtual ~SnapshotDiffBuilder();
+
+	/** Queues building the diffs of all the specified pairs, in their order.
+	diffBuilt() is emitted for each pair once its diff is finished. */
+	void start(const SnapshotPairs & a_Pairs);
+
+	/** Queues building the diff across all the specified snapshots, in their order.
+	rangeDiffBuilt() is emitted once the diff is finished. */
+	void startRange(const std::vector<SnapshotPtr> & a_Snapshots);
+
+signals:
+
+	/** Emitted when the diff of the pair at a_Index (in start()'s a_Pairs) has been built.
+	Emitted from the thread pool's threads, the receivers are expected to use queued connections. */
+	void diffBuilt(int a_Index, SnapshotDiffPtr a_Diff);
+
+	/** Emitted when the diff across the range of snapshots given to startRange() has been built.
+	Emitted from the thread pool's threads, the receivers are expected to use queued connections. */
+	void rangeDiffBuilt(MultiSnapshotDiffPtr a_Diff);
+
+protected:
+
+	/** The state shared between the builder and its tasks, so that the tasks can outlive the builder. */
+	struct SharedState;
+
+	/** The QRunnable that builds a single diff. */
+	class Task;
+
+	/** The QRunnable that builds the diff across a range of snapshots. */
+	class RangeTask;
+
+
+	/** The state shared with the tasks. */
+	std::shared_ptr<SharedState> m_State;
+};
+
+
+
+
+
+#endif // SNAPSHOTDIFFBUILDER_H
+
+
+
+
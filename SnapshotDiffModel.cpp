@@ -118,7 +118,7 @@ QModelIndex SnapshotDiffModel::index(int a_Row, int a_Column, const QModelIndex
 		parentItem = static_cast<DiffItem *>(a_Parent.internalPointer());
 	}
 
-	DiffItem * childItem = parentItem->child(a_Row).get();
+	DiffItem * childItem = parentItem->child(a_Row);
 	if (childItem != nullptr)
 	{
 		return createIndex(a_Row, a_Column, childItem);
@@ -148,7 +148,7 @@ QModelIndex SnapshotDiffModel::parent(const QModelIndex & a_Index) const
 		return QModelIndex();
 	}
 
-	return createIndex(parentItem->indexOfChild(childItem), 0, parentItem);
+	return createIndex(parentItem->getRow(), 0, parentItem);
 }
 
 
@@ -33,7 +33,7 @@ SnapshotModel::SnapshotModel(ProjectPtr a_Project):
 	{
 		addSnapshot(s);
 	}
-	connect(m_Project.get(), SIGNAL(addedSnapshot(SnapshotPtr)), this, SLOT(onProjectAddedSnapshot(SnapshotPtr)));
+	connect(m_Project.get(), SIGNAL(addedSnapshots(SnapshotPtrs)), this, SLOT(onProjectAddedSnapshots(SnapshotPtrs)));
 }
 
 
@@ -61,9 +61,12 @@ Qt::ItemFlags SnapshotModel::flags(const QModelIndex & a_Index) const
 
 
 
-void SnapshotModel::onProjectAddedSnapshot(SnapshotPtr a_Snapshot)
+void SnapshotModel::onProjectAddedSnapshots(SnapshotPtrs a_Snapshots)
 {
-	addSnapshot(a_Snapshot);
+	for (const auto & s: a_Snapshots)
+	{
+		addSnapshot(s);
+	}
 }
 
 
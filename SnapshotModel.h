@@ -25,6 +25,7 @@ class Project;
 typedef std::shared_ptr<Project> ProjectPtr;
 class Snapshot;
 typedef std::shared_ptr<Snapshot> SnapshotPtr;
+typedef std::list<SnapshotPtr> SnapshotPtrs;
 
 
 
@@ -73,8 +74,8 @@ signals:
 
 protected slots:
 
-	/** Called from m_Project after a new snapshot has been added to the project. */
-	void onProjectAddedSnapshot(SnapshotPtr a_Snapshot);
+	/** Called from m_Project after a batch of new snapshots has been added to the project. */
+	void onProjectAddedSnapshots(SnapshotPtrs a_Snapshots);
 
 
 protected:
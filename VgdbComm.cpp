@@ -9,6 +9,10 @@
 #include "Globals.h"
 #include "VgdbComm.h"
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QCoreApplication>
+#include <QElapsedTimer>
 #include "ProcessReader.h"
 #include "ParseInteger.h"
 
@@ -16,6 +20,69 @@
 
 
 
+#ifndef _WIN32
+	#include <errno.h>
+	#include <fcntl.h>
+	#include <poll.h>
+	#include <sys/stat.h>
+	#include <sys/types.h>
+	#include <unistd.h>
+#endif
+
+#ifndef _WIN32
+	/** Reads and discards the data from the FIFO until valgrind closes its writing end.
+	Used when a capture is abandoned, closing the reading end while valgrind writes into the FIFO would kill it
+	with a SIGPIPE. a_HasWriterOpened specifies whether the writing end has been seen open already; if not, valgrind is
+	given a short while to open it. Gives up after a while, a writer that doesn't close the FIFO by then is stuck. */
+	static void drainFifo(int a_Fd, bool a_HasWriterOpened)
+	{
+		static const int DRAIN_TIMEOUT_MSEC = 30000;
+		static const int OPEN_GRACE_MSEC = 1000;
+		QElapsedTimer timer;
+		timer.start();
+		char buf[4096];
+		while (timer.elapsed() < DRAIN_TIMEOUT_MSEC)
+		{
+			auto numRead = read(a_Fd, buf, sizeof(buf));
+			if (numRead > 0)
+			{
+				a_HasWriterOpened = true;
+				continue;
+			}
+			if ((numRead < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			if ((numRead < 0) && (errno != EAGAIN))
+			{
+				return;
+			}
+			if (numRead == 0)
+			{
+				// No writer; either it has closed the FIFO, or it hasn't opened it yet:
+				if (a_HasWriterOpened || (timer.elapsed() > OPEN_GRACE_MSEC))
+				{
+					return;
+				}
+				poll(nullptr, 0, 10);
+				continue;
+			}
+
+			// The writing end is open, wait for more data or for the writer closing:
+			a_HasWriterOpened = true;
+			pollfd pfd;
+			pfd.fd = a_Fd;
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			poll(&pfd, 1, 10);
+		}
+	}
+#endif
+
+
+
+
+
 #ifdef _WIN32
 	#define VALGRIND_EXECUTABLE_NAME "valgrind.cmd"
 	#define VGDB_EXECUTABLE_NAME "vgdb.cmd"
@@ -89,17 +156,187 @@ bool VgdbComm::captureSnapshot(
 	quint64 a_InstancePid,
 	const QString & a_FileName,
 	QByteArray & a_StdOut,
-	QByteArray & a_StdErr
+	QByteArray & a_StdErr,
+	bool a_IsDetailed,
+	const std::atomic<bool> * a_ShouldAbort
 )
 {
-	auto exitCode = runVgdbCommand(QStringList()
+	QProcess proc;
+	ProcessReader reader(proc, a_StdOut, a_StdErr);
+	proc.start(VGDB_EXECUTABLE_NAME, QStringList()
 		<< QString::fromUtf8("--pid=%1").arg(a_InstancePid)
-		<< "detailed_snapshot"
-		<< a_FileName,
-		a_StdOut, a_StdErr
+		<< (a_IsDetailed ? "detailed_snapshot" : "snapshot")
+		<< a_FileName
 	);
 
-	return (exitCode == 0);
+	// Wait for vgdb in short steps, so that an abort is noticed quickly:
+	static const int TIMEOUT_MSEC = 30000;
+	QElapsedTimer timer;
+	timer.start();
+	while (!reader.waitForFinished(10) && (proc.state() != QProcess::NotRunning))
+	{
+		if (((a_ShouldAbort != nullptr) && *a_ShouldAbort) || (timer.elapsed() > TIMEOUT_MSEC))
+		{
+			proc.kill();
+			reader.waitForFinished();
+			return false;
+		}
+	}
+	if (reader.hasHadError())
+	{
+		return false;
+	}
+	return ((proc.exitStatus() == QProcess::NormalExit) && (proc.exitCode() == 0));
+}
+
+
+
+
+
+bool VgdbComm::canStreamSnapshots()
+{
+	#ifdef _WIN32
+		return false;
+	#else
+		return true;
+	#endif
+}
+
+
+
+
+
+bool VgdbComm::captureSnapshotStreamed(
+	quint64 a_InstancePid,
+	bool a_IsDetailed,
+	const DataCallback & a_OnData,
+	QByteArray & a_StdOut,
+	QByteArray & a_StdErr,
+	const std::atomic<bool> * a_ShouldAbort
+)
+{
+	#ifdef _WIN32
+		Q_UNUSED(a_InstancePid);
+		Q_UNUSED(a_IsDetailed);
+		Q_UNUSED(a_OnData);
+		Q_UNUSED(a_StdOut);
+		Q_UNUSED(a_ShouldAbort);
+		a_StdErr.append("Streaming snapshots is not supported on this system\n");
+		return false;
+	#else
+		// Create the FIFO for valgrind to write the snapshot into:
+		static std::atomic<int> counter(0);
+		auto fifoName = QString("%1/VisualMassifDiff-%2-stream-pid-%3-%4.fifo")
+			.arg(QDir::tempPath())
+			.arg(QCoreApplication::applicationPid())
+			.arg(a_InstancePid)
+			.arg(++counter);
+		auto fifoNameLocal = QFile::encodeName(fifoName);
+		if (mkfifo(fifoNameLocal.constData(), 0600) != 0)
+		{
+			a_StdErr.append("Cannot create the FIFO for streaming the snapshot\n");
+			return false;
+		}
+
+		// Open the reading end without blocking, valgrind only opens the writing end once vgdb relays the command:
+		int fd = open(fifoNameLocal.constData(), O_RDONLY | O_NONBLOCK);
+		if (fd < 0)
+		{
+			unlink(fifoNameLocal.constData());
+			a_StdErr.append("Cannot open the FIFO for streaming the snapshot\n");
+			return false;
+		}
+
+		QProcess proc;
+		ProcessReader reader(proc, a_StdOut, a_StdErr);
+		proc.start(VGDB_EXECUTABLE_NAME, QStringList()
+			<< QString::fromUtf8("--pid=%1").arg(a_InstancePid)
+			<< (a_IsDetailed ? "detailed_snapshot" : "snapshot")
+			<< fifoName
+		);
+
+		// Read the FIFO while vgdb runs, valgrind blocks when the FIFO is full.
+		// Reading stops at the first end of data after vgdb terminates, by then valgrind has written the whole snapshot:
+		static const int TIMEOUT_MSEC = 30000;
+		QElapsedTimer timer;
+		timer.start();
+		std::vector<char> buf(64 * 1024);
+		bool hasFinished = false;
+		bool hasWriterOpened = false;
+		bool isOk = true;
+		while (true)
+		{
+			auto numRead = read(fd, buf.data(), buf.size());
+			if (numRead > 0)
+			{
+				hasWriterOpened = true;
+				a_OnData(buf.data(), static_cast<size_t>(numRead));
+				continue;
+			}
+			if ((numRead < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			if ((numRead < 0) && (errno != EAGAIN))
+			{
+				isOk = false;
+				break;
+			}
+			if (hasFinished)
+			{
+				break;
+			}
+			if ((a_ShouldAbort != nullptr) && *a_ShouldAbort)
+			{
+				isOk = false;
+				break;
+			}
+			if (timer.elapsed() > TIMEOUT_MSEC)
+			{
+				a_StdErr.append("Timed out while waiting for the snapshot\n");
+				isOk = false;
+				break;
+			}
+			if (numRead == 0)
+			{
+				// The writing end is not open (yet, or anymore), there's nothing to poll, wait for vgdb instead:
+				reader.waitForFinished(10);
+			}
+			else
+			{
+				// The writing end is open, wait for more data:
+				hasWriterOpened = true;
+				pollfd pfd;
+				pfd.fd = fd;
+				pfd.events = POLLIN;
+				pfd.revents = 0;
+				poll(&pfd, 1, 10);
+				reader.waitForFinished(0);
+			}
+			hasFinished = (proc.state() == QProcess::NotRunning);
+		}
+
+		// When abandoning the capture, valgrind may still be writing the snapshot (or about to open the FIFO).
+		// Keep the reading end open and discard the rest of the data, until valgrind closes the writing end:
+		if (!hasFinished)
+		{
+			proc.kill();
+			reader.waitForFinished();
+			drainFifo(fd, hasWriterOpened);
+		}
+		close(fd);
+		unlink(fifoNameLocal.constData());
+
+		if (!hasFinished)
+		{
+			return false;
+		}
+		if (!isOk || reader.hasHadError())
+		{
+			return false;
+		}
+		return ((proc.exitStatus() == QProcess::NormalExit) && (proc.exitCode() == 0));
+	#endif
 }
 
 
@@ -14,6 +14,8 @@
 
 
 #include <vector>
+#include <functional>
+#include <atomic>
 #include <QObject>
 
 
@@ -26,6 +28,9 @@ public:
 	/** Type used to describe a single instance of a process being run under Valgrind's Massif tool. */
 	typedef std::pair<qint64, QString> InstanceDesc;
 
+	/** Type of the callback that receives the snapshot data as it is being streamed. */
+	typedef std::function<void(const char * a_Data, size_t a_Size)> DataCallback;
+
 
 	VgdbComm();
 
@@ -37,12 +42,37 @@ public:
 	Returns a vector of pairs, each pair describes one instance as a pid and command. */
 	static std::vector<InstanceDesc> listRunningInstances();
 
-	/** Captures a snapshot of the instance specified by its Pid, into a file. */
+	/** Captures a snapshot of the instance specified by its Pid, into a file.
+	If a_IsDetailed is false, only the heap totals are captured, without the allocation tree, which is much cheaper.
+	If a_ShouldAbort is given, vgdb is killed and the capture fails as soon as it is set to true; it can be set
+	from any thread. */
 	static bool captureSnapshot(
 		quint64 a_InstancePid,
 		const QString & a_FileName,
 		QByteArray & a_StdOut,
-		QByteArray & a_StdErr
+		QByteArray & a_StdErr,
+		bool a_IsDetailed = true,
+		const std::atomic<bool> * a_ShouldAbort = nullptr
+	);
+
+	/** Returns true if the snapshots can be streamed using captureSnapshotStreamed() on this system. */
+	static bool canStreamSnapshots();
+
+	/** Captures a snapshot of the instance specified by its Pid, without storing it in a file.
+	Valgrind writes the snapshot into a FIFO, from which the data is read while vgdb is running and handed to
+	a_OnData in chunks, as it arrives.
+	If a_IsDetailed is false, only the heap totals are captured, without the allocation tree, which is much cheaper.
+	If a_ShouldAbort is given, the capture is aborted (and vgdb killed) as soon as it is set to true; it can be set
+	from any thread. The data that valgrind still writes after an abort is read and discarded, so that valgrind doesn't
+	get a SIGPIPE; this may delay returning until valgrind finishes writing.
+	Returns true on success. On failure, the data given to a_OnData so far may be incomplete. */
+	static bool captureSnapshotStreamed(
+		quint64 a_InstancePid,
+		bool a_IsDetailed,
+		const DataCallback & a_OnData,
+		QByteArray & a_StdOut,
+		QByteArray & a_StdErr,
+		const std::atomic<bool> * a_ShouldAbort = nullptr
 	);
 
 	/** Launches a new valgrind massif instance for the specified executable, passing the parameters to it.